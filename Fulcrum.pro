@@ -82,6 +82,8 @@ win32-msvc {
 win32 {
     # Windows MSVC & mingw-g++ both have too many warnings due to bitcoin sources, so just disable warnings.
     CONFIG += warn_off
+    # For getpeername() & closesocket() used by ServerBase::earlyRejectDescriptor
+    LIBS += -lws2_32
 }
 linux {
     QMAKE_CXXFLAGS += -std=c++1z
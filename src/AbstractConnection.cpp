@@ -24,9 +24,11 @@
 #include <QSslSocket>
 #include <QHostAddress>
 #include <QNetworkProxy>
+#include <QTimer>
 
 #include <algorithm>
 #include <cassert>
+#include <utility>
 
 AbstractConnection::AbstractConnection(IdMixin::Id id_in, QObject *parent, qint64 maxBuffer_)
     : QObject(parent), IdMixin(id_in)
@@ -127,9 +129,13 @@ void AbstractConnection::setMaxBuffer(qint64 maxBytes)
 
 void AbstractConnection::do_disconnect(bool graceful)
 {
+    if (graceful && socket)
+        flushOutput(); // ensure anything enqueued (such as a final error message) makes it out before we close
     status = status == Bad ? Bad : NotConnected;  // try and keep Bad status around so PeerMgr can decide when to reconnect based on it? TODO: remove this concept from the codebase
     if (socket) {
         if (!graceful) {
+            outQueue.clear(); // discard anything not yet written
+            outQueueBytes = 0;
             DebugM(__func__, " (abort) ", id);
             socket->abort();  // this will set status too because state change, but we set it first above to be paranoid
         } else {
@@ -172,35 +178,100 @@ bool AbstractConnection::do_write(const QByteArray & data)
         Error() << __func__ << " (" << objectName() << ") " << err << " id=" << id;
         return false;
     }
-    if (MAX_BUFFER > 0 && writeBackLog > MAX_BUFFER) {
+    if (MAX_BUFFER > 0 && unsentBytes() > MAX_BUFFER) {
         Warning(Log::Magenta) << __func__ << ": " << prettyName() << " -- MAX_BUFFER reached on write (" << MAX_BUFFER << "), disconnecting client";
         do_disconnect();
         return false;
     }
-    // Note: we temorarily allow the writeBackLog to grow beyond MAX_BUFFER here.  If we run through this function
+    if (data.isEmpty())
+        return true;
+    // Note: we temorarily allow the unsent bytes to grow beyond MAX_BUFFER here.  If we run through this function
     // again in the future before bytes were actually written to the socket and we are over MAX_BUFFER, only then will
     // the above error be triggered.
-    const auto n2write = data.length();
-    writeBackLog += n2write;
-    const qint64 written = socket->write(data);
-    if (UNLIKELY(written < 0)) {
-        Error() << __func__ << ": " << prettyName() << " -- error on write " << socket->error() << " (" << socket->errorString() << ")";
-        do_disconnect();
-        return false;
-    } else if (UNLIKELY(written < n2write)) {
-        // This branch should never happen since QTcpSocket uses an inifinite internal write buffer and always returns
-        // mmediately with the full write request's `byteswritten` as a result.  We still keep this check around,
-        // however, in case some day this predicate is violated by a Qt API change.
-        //
-        // See: https://code.woboq.org/qt5/qtbase/src/network/socket/qabstractsocket.cpp.html#_ZN15QAbstractSocket9writeDataEPKcx
-        Error() << __func__ << ": " << prettyName() << " -- short write count; expected to write " << n2write
-                << " bytes, but wrote " << written << " bytes instead. This should never happen! FIXME!";
-        return false;
+    outQueue.push_back(data);
+    outQueueBytes += data.length();
+    if (!flushScheduled) {
+        // flush once per event loop iteration, coalescing everything enqueued until then
+        flushScheduled = true;
+        QTimer::singleShot(0, this, [this]{
+            flushScheduled = false;
+            flushOutput();
+        });
     }
-    nSent += written;
+    checkOutputBackpressure();
     return true;
 }
 
+bool AbstractConnection::flushOutput()
+{
+    if (outQueue.isEmpty())
+        return true;
+    QByteArrayList q;
+    q.swap(outQueue);
+    const qint64 qBytes = std::exchange(outQueueBytes, 0);
+    if (!socket || status != Connected) {
+        DebugM(__func__, ": ", prettyName(true), " not connected, discarding ", qBytes, " bytes");
+        return false;
+    }
+    const auto writeOne = [this](const QByteArray &data) {
+        const auto n2write = data.length();
+        writeBackLog += n2write;
+        const qint64 written = socket->write(data);
+        ++nWrites;
+        if (UNLIKELY(written < 0)) {
+            Error() << "do_write: " << prettyName() << " -- error on write " << socket->error() << " (" << socket->errorString() << ")";
+            do_disconnect();
+            return false;
+        } else if (UNLIKELY(written < n2write)) {
+            // This branch should never happen since QTcpSocket uses an inifinite internal write buffer and always returns
+            // mmediately with the full write request's `byteswritten` as a result.  We still keep this check around,
+            // however, in case some day this predicate is violated by a Qt API change.
+            //
+            // See: https://code.woboq.org/qt5/qtbase/src/network/socket/qabstractsocket.cpp.html#_ZN15QAbstractSocket9writeDataEPKcx
+            Error() << "do_write: " << prettyName() << " -- short write count; expected to write " << n2write
+                    << " bytes, but wrote " << written << " bytes instead. This should never happen! FIXME!";
+            return false;
+        }
+        nSent += written;
+        return true;
+    };
+    bool ok = true;
+    if (q.size() == 1 || isWebSocket()) {
+        // WebSocket::Wrapper frames each write() as its own message, so we cannot join messages in that case
+        for (const auto & data : qAsConst(q))
+            if (!(ok = writeOne(data)) || !socket)
+                break;
+    } else {
+        QByteArray buf;
+        buf.reserve(qBytes);
+        for (auto & data : q) {
+            buf.append(data);
+            data.clear(); // free memory as we go
+        }
+        ok = writeOne(buf);
+    }
+    if (socket)
+        checkOutputBackpressure();
+    return ok;
+}
+
+void AbstractConnection::checkOutputBackpressure()
+{
+    const qint64 unsent = unsentBytes();
+    if (!outputBackpressured && unsent > OUTPUT_HIGH_WATERMARK) {
+        outputBackpressured = true;
+        ++nOutputBackpressureEvents;
+        DebugM(prettyName(), " unsent bytes: ", unsent, " exceeds high watermark, output backpressure ON");
+        on_outputBackpressure(true);
+    } else if (outputBackpressured && unsent <= OUTPUT_LOW_WATERMARK) {
+        outputBackpressured = false;
+        DebugM(prettyName(), " unsent bytes: ", unsent, ", output backpressure OFF");
+        on_outputBackpressure(false);
+    }
+}
+
+void AbstractConnection::on_outputBackpressure(bool) {}
+
 void AbstractConnection::slot_on_readyRead() { on_readyRead(); }
 
 void AbstractConnection::on_connected()
@@ -238,11 +309,19 @@ void AbstractConnection::on_connected()
         const int period_ms = pingtime_ms/* default: 1 minute */ / 2;
         callOnTimerSoon(period_ms, pingTimer, on_pingTimer, true, Qt::TimerType::CoarseTimer); // method inherited from TimersByNameMixin
     }
+    // The socket may already have data buffered that arrived before we connected to readyRead above (e.g. an SSL socket
+    // coming back from the handshake thread with the client's first request already decrypted). No new readyRead will
+    // be emitted for that data, so process it on the next event loop iteration.
+    if (socket->bytesAvailable() > 0)
+        QTimer::singleShot(0, this, &AbstractConnection::slot_on_readyRead);
 }
 
 void AbstractConnection::on_disconnected()
 {
     writeBackLog = 0;
+    outQueue.clear();
+    outQueueBytes = 0;
+    checkOutputBackpressure(); // will turn off backpressure if it was on
     ++nDisconnects;
 }
 
@@ -272,6 +351,7 @@ void AbstractConnection::on_bytesWritten(qint64 nBytes)
     if (writeBackLog > 0 && status == Connected && socket) {
         DebugM(prettyName(), " writeBackLog size: ", writeBackLog, " (wrote just now: ", nBytes, ")");
     }
+    checkOutputBackpressure();
 }
 
 void AbstractConnection::do_ping()
@@ -300,6 +380,10 @@ auto AbstractConnection::stats() const -> Stats
     m["nDisconnects"] = nDisconnects.load();
     m["nSocketErrors"] = nSocketErrors.load();
     m["writeBackLog"] = writeBackLog;
+    m["outputQueueBytes"] = outQueueBytes;
+    m["nWrites"] = nWrites.load();
+    m["bytesPerWrite"] = nWrites ? QVariant(double(nSent.load()) / double(nWrites.load())) : QVariant();
+    m["nOutputBackpressureEvents"] = nOutputBackpressureEvents;
     m["readBytesAvailable"] = socket ? socket->bytesAvailable() : 0;
     m["activeTimers"] = activeTimerMapForStats();
     m["remote"] = [this]() -> QVariant {
@@ -21,6 +21,7 @@
 #include "Common.h"
 #include "Mixins.h"
 
+#include <QByteArrayList>
 #include <QVariantMap>
 #include <QObject>
 #include <QTcpSocket>
@@ -35,6 +36,10 @@ class AbstractConnection : public QObject, public IdMixin, public TimersByNameMi
 public:
     static constexpr qint64 DEFAULT_MAX_BUFFER = 64*1024*1024; ///< 64MB, may change default in derived classes by setting maxBuffer in c'tor TODO: tune this.
     static constexpr bool DEBUG_PINGS = false; ///< set this to true to debug the "staleness" / "pingtimer" mechanism
+    /// When the bytes we have queued but the kernel has not yet accepted exceed this, on_outputBackpressure(true) is
+    /// called. Once they drop back down to OUTPUT_LOW_WATERMARK, on_outputBackpressure(false) is called.
+    static constexpr qint64 OUTPUT_HIGH_WATERMARK = 2*1024*1024, ///< 2MB
+                            OUTPUT_LOW_WATERMARK = 512*1024; ///< 512KB
 
     explicit AbstractConnection(IdMixin::Id id, QObject *parent = nullptr, qint64 maxBuffer = DEFAULT_MAX_BUFFER);
 
@@ -75,6 +80,7 @@ public:
 signals:
     void lostConnection(AbstractConnection *);
     /// call (emit) this to send data to the other end. connected to do_write() when socket is in the connected state.
+    /// Note that the data is coalesced with other data sent during the same event loop iteration (see do_write()).
     /// This is a low-level function subclasses should create their own high-level protocol-level signals / methods;
     void send(QByteArray);
 
@@ -112,6 +118,8 @@ protected:
     qint64 stale_threshold = default_stale_threshold;
     QTcpSocket *socket = nullptr; ///< this should only ever be touched in our thread (also: socket should live in same thread as this instance)
     qint64 writeBackLog = 0; ///< if this grows beyond a certain size, we should kill the connection
+    std::atomic<qint64> nWrites = 0; ///< number of actual socket->write() calls made by flushOutput()
+    qint64 nOutputBackpressureEvents = 0; ///< number of times the unsent bytes crossed OUTPUT_HIGH_WATERMARK
     QString lastSocketError; ///< the last socket error seen.
     QList<QMetaObject::Connection> connectedConns; /// signal/slot connections for the connected state. this gets populated when the socket connects in on_connected. signal connections will be disconnected on socket disconnect.
 
@@ -122,12 +130,31 @@ protected:
     virtual void on_connected(); ///< overrides should call this base implementation and chain to it. It is required to chain as this method does important setup.
     virtual void on_disconnected(); ///< overrides can chain to this as well
 
-    bool do_write(const QByteArray & = "");
+    /// Enqueues `data` for sending. The data is not written to the socket right away; rather, all the data enqueued
+    /// during the current event loop iteration is coalesced and written with a single socket write in flushOutput()
+    /// (this way a batch of responses completing together ends up as one write and, for SSL, as a few large TLS
+    /// records rather than one small record per message).
+    bool do_write(const QByteArray & data = "");
+    /// Writes everything enqueued by do_write() to the socket right away. Normally this is called for you on the next
+    /// event loop iteration, and also before a graceful disconnect. Returns false on write error.
+    bool flushOutput();
+    /// The number of bytes enqueued via do_write() but not yet accepted by the OS (includes the socket's write buffer).
+    qint64 unsentBytes() const { return writeBackLog + outQueueBytes; }
+    /// Called when unsentBytes() crosses OUTPUT_HIGH_WATERMARK (`on` = true) and when it subsequently drops back down
+    /// to OUTPUT_LOW_WATERMARK (`on` = false). Default implementation does nothing. Subclasses may reimplement this
+    /// to stop producing output (e.g. stop processing requests) while the peer is not reading fast enough.
+    virtual void on_outputBackpressure(bool on);
     /// does a socket->abort, sets status. Chain to this if you want on override. Named this way so as not to clash with QObject::disconnect
     virtual void do_disconnect(bool graceful = false);
 
     static constexpr auto pingTimer = "+Ping Timer";  ///< this is the internal pingTimer which calls do_ping() periodically.
 
+private:
+    QByteArrayList outQueue; ///< data enqueued by do_write(), consumed by flushOutput()
+    qint64 outQueueBytes = 0; ///< total size of the data in outQueue
+    bool flushScheduled = false, outputBackpressured = false;
+    void checkOutputBackpressure();
+
 private slots:
     void on_bytesWritten(qint64);
     void on_error(QAbstractSocket::SocketError);
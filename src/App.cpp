@@ -443,7 +443,9 @@ void App::parseArgs()
     { { "C", "checkdb" },
        QString("If specified, database consistency will be checked thoroughly for sanity & integrity."
                " Note that these checks are somewhat slow to perform and under normal operation are not necessary."
-               " May be specified twice to do even more thorough checks.\n"),
+               " May be specified twice to do even more thorough checks. The checks use all CPU cores, and if"
+               " interrupted they resume where they left off the next time they are run (as long as the blockchain"
+               " tip in the database did not change in the meantime).\n"),
     },
     { { "T", "polltime" },
        QString("The number of seconds for the bitcoind poll interval. Bitcoind is polled once every `polltime`"
@@ -1094,6 +1096,28 @@ void App::parseArgs()
         // log this later in case we are in syslog mode
         Util::AsyncOnObject(this, [p]{ Debug() << "config: bitcoind_throttle = " << QString("(hi: %1, lo: %2, decay: %3)").arg(p.hi).arg(p.lo).arg(p.decay); });
     }
+    if (conf.hasValue("cpu_limit_per_ip")) {
+        const QStringList vals = conf.value("cpu_limit_per_ip").trimmed().simplified().split(QRegularExpression("\\W+"), Compat::SplitBehaviorSkipEmptyParts);
+        constexpr size_t N = 2;
+        std::array<int, N> parsed = {0,0};
+        size_t i = 0;
+        bool ok = false;
+        for (const auto & val : vals) {
+            if (i >= N) { ok = false; break; }
+            parsed[i++] = val.toInt(&ok);
+            if (!ok) break;
+        }
+        Options::CostLimitParams p { parsed[0], parsed[1] };
+        ok = ok && i == N && p.isValid();
+        if (!ok)
+            // failed to parse.. abort...
+            throw BadArgs(QString("Failed to parse \"cpu_limit_per_ip\" -- out of range or invalid format. Please specify 2"
+                                  " non-negative integers: rate (max: %1) and burst (max: %2), where burst >= rate.")
+                          .arg(Options::maxCostLimitRate).arg(Options::maxCostLimitBurst));
+        options->costLimitParams.store(p);
+        // log this later in case we are in syslog mode
+        Util::AsyncOnObject(this, [p]{ Debug() << "config: cpu_limit_per_ip = " << QString("(rate: %1, burst: %2)").arg(p.rate).arg(p.burst); });
+    }
     if (conf.hasValue("max_subs_per_ip")) {
         bool ok;
         const int64_t subs = conf.int64Value("max_subs_per_ip", -1, &ok);
@@ -1114,6 +1138,8 @@ void App::parseArgs()
         // log this later in case we are in syslog mode
         Util::AsyncOnObject(this, [subs]{ Debug() << "config: max_subs = " << subs; });
     }
+    // 'persist_status_cache'
+    options->persistStatusCache = ConfParseBool("persist_status_cache", options->persistStatusCache);
 
     // DB options
     if (conf.hasValue("db_max_open_files")) {
@@ -1157,6 +1183,15 @@ void App::parseArgs()
         // log this later in case we are in syslog mode
         Util::AsyncOnObject(this, [val]{ Debug() << "config: db_use_fsync = " << (val ? "true" : "false"); });
     }
+    if (conf.hasValue("db_history_chunked")) {
+        bool ok;
+        const bool val = conf.boolValue("db_history_chunked", options->db.defaultHistoryChunked, &ok);
+        if (!ok)
+            throw BadArgs("db_history_chunked: bad value. Specify a boolean value such as 0, 1, true, false, yes, no");
+        options->db.historyChunked = val;
+        // log this later in case we are in syslog mode
+        Util::AsyncOnObject(this, [val]{ Debug() << "config: db_history_chunked = " << (val ? "true" : "false"); });
+    }
 
     // warn user that no hostname was specified if they have peerDiscover turned on
     if (!options->hostName.has_value() && options->peerDiscovery && options->peerAnnounceSelf) {
@@ -1316,7 +1351,7 @@ void App::start_httpServer(const Options::Interface &iface)
     std::shared_ptr<SimpleHttpServer> server(new SimpleHttpServer(iface.first, iface.second, 16384));
     httpServers.push_back(server);
     server->tryStart(); // may throw, waits for server to start
-    server->set404Message("Error: Unknown endpoint. /stats & /debug are the only valid endpoint I understand.\r\n");
+    server->set404Message("Error: Unknown endpoint. /stats, /debug & /metrics are the only valid endpoints I understand.\r\n");
     static const auto CRLF = QByteArrayLiteral("\r\n");
     server->addEndpoint("/stats",[this](SimpleHttpServer::Request &req){
         req.response.contentType = "application/json; charset=utf-8";
@@ -1331,6 +1366,11 @@ void App::start_httpServer(const Options::Interface &iface)
         stats = stats.isNull() ? QVariantList{QVariant()} : stats;
         req.response.data = Json::toUtf8(stats, false) + CRLF; // may throw -- caller will handle exception
     });
+    server->addEndpoint("/metrics",[this](SimpleHttpServer::Request &req){
+        // Prometheus text exposition format. Unlike the above, this runs in the http server thread and is lock-free.
+        req.response.contentType = "text/plain; version=0.0.4; charset=utf-8";
+        req.response.data = controller->metrics();
+    });
 }
 
 /* static */ App::QtLogSuppressionList App::qlSuppressions;
@@ -105,6 +105,31 @@ namespace BTC
         return ret;
     }
 
+    std::vector<QByteArray> HashXsFromCScripts(const std::vector<const bitcoin::CScript *> &scripts)
+    {
+        const size_t n = scripts.size();
+        std::vector<const uint8_t *> msgs;
+        std::vector<size_t> lens;
+        msgs.reserve(n);
+        lens.reserve(n);
+        for (const auto *cs : scripts) {
+            msgs.push_back(cs->data());
+            lens.push_back(cs->size());
+        }
+        constexpr size_t hlen = bitcoin::CSHA256::OUTPUT_SIZE;
+        std::vector<uint8_t> digests(n * hlen);
+        bitcoin::SHA256Batch(digests.data(), msgs.data(), lens.data(), n);
+        std::vector<QByteArray> ret;
+        ret.reserve(n);
+        for (size_t i = 0; i < n; ++i) {
+            const uint8_t *d = digests.data() + i * hlen;
+            QByteArray hx(QByteArray::size_type(hlen), Qt::Initialization::Uninitialized);
+            std::reverse_copy(d, d + hlen, reinterpret_cast<uint8_t *>(hx.data())); // hashX is stored reversed
+            ret.push_back(std::move(hx));
+        }
+        return ret;
+    }
+
     // HeaderVerifier helper
     bool HeaderVerifier::operator()(const QByteArray & header, QString *err)
     {
@@ -211,3 +236,65 @@ namespace BTC
     }
 
 } // end namespace BTC
+
+#ifdef ENABLE_TESTS
+#include "App.h"
+
+#include <QFile>
+
+#include <cstdlib>
+
+namespace {
+    void benchHashX() {
+        const char * const fn = std::getenv("BLOCKFILE");
+        if (!fn)
+            throw Exception("Please specify a BLOCKFILE= env var that points to a file containing a serialized block"
+                            " (either raw binary or hex, e.g. the output of `bitcoin-cli getblock <hash> 0`)");
+        QFile f(fn);
+        if (!f.open(QIODevice::ReadOnly))
+            throw Exception(QString("Unable to open %1: %2").arg(QString(fn), f.errorString()));
+        QByteArray raw = f.readAll();
+        if (const auto trimmed = raw.trimmed(); !trimmed.isEmpty() && QByteArray::fromHex(trimmed).toHex() == trimmed.toLower())
+            raw = QByteArray::fromHex(trimmed);
+        const auto block = BTC::Deserialize<bitcoin::CBlock>(raw, 0, true /* segwit */, false, true /* tokens */);
+
+        std::vector<const bitcoin::CScript *> scripts;
+        size_t scriptBytes = 0, nOneBlock = 0;
+        for (const auto & tx : block.vtx) {
+            for (const auto & out : tx->vout) {
+                if (BTC::IsOpReturn(out.scriptPubKey)) continue;
+                scripts.push_back(&out.scriptPubKey);
+                scriptBytes += out.scriptPubKey.size();
+                nOneBlock += out.scriptPubKey.size() <= 55;
+            }
+        }
+        if (scripts.empty())
+            throw Exception("Block has no non-OP_RETURN outputs");
+        Log() << "Read block with " << block.vtx.size() << " txs, " << scripts.size() << " non-OP_RETURN output scripts ("
+              << scriptBytes << " bytes, " << nOneBlock << " fit in 1 sha256 block)";
+
+        constexpr int iters = 100;
+        std::vector<QByteArray> res1, res2;
+        auto t0 = Tic();
+        for (int i = 0; i < iters; ++i) {
+            res1.clear();
+            res1.reserve(scripts.size());
+            for (const auto *cs : scripts)
+                res1.push_back(BTC::HashXFromCScript(*cs));
+        }
+        t0.fin();
+        auto t1 = Tic();
+        for (int i = 0; i < iters; ++i)
+            res2 = BTC::HashXsFromCScripts(scripts);
+        t1.fin();
+        if (res1 != res2)
+            throw Exception("HashXsFromCScripts result differs from HashXFromCScript!");
+        const double n = double(scripts.size()) * iters;
+        Log() << "HashXFromCScript (1 at a time): " << QString::number(t0.nsec() / n, 'f', 1) << " nsec/output";
+        Log() << "HashXsFromCScripts (batched):   " << QString::number(t1.nsec() / n, 'f', 1) << " nsec/output"
+              << " (" << QString::number(double(t0.nsec()) / std::max(double(t1.nsec()), 1.0), 'f', 2) << "x)";
+    }
+
+    const auto b1 = App::registerBench("hashx", &benchHashX);
+} // namespace
+#endif
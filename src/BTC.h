@@ -183,6 +183,11 @@ namespace BTC
         return QByteArray(BTC::HashRev(QByteArray::fromRawData(reinterpret_cast<const char *>(cs.data()), int(cs.size())), true));
     }
 
+    /// Batched version of HashXFromCScript(). Returns the hashX of each of `scripts`, in the same order. The digests are
+    /// computed in one pass via bitcoin::SHA256Batch, which is considerably cheaper per script than calling
+    /// HashXFromCScript() in a loop since most output scripts fit in a single sha256 block.
+    std::vector<QByteArray> HashXsFromCScripts(const std::vector<const bitcoin::CScript *> &scripts);
+
     /// Header Chain Verifier -
     /// To use: Basically keep calling operator() on it with subsequent headers and it will make sure
     /// hashPrevBlock of the current header matches the computed hash of the last header.
@@ -80,6 +80,7 @@ void BitcoinDMgr::startup() {
             }
             const bool wasEmpty = goodSet.empty();
             goodSet.insert(b->id);
+            nGoodSet = unsigned(goodSet.size());
             if (wasEmpty)
                 emit gotFirstGoodConnection(b->id);
         });
@@ -98,6 +99,7 @@ void BitcoinDMgr::startup() {
                 return; // false/stale signal
             }
             goodSet.erase(c->id);
+            nGoodSet = unsigned(goodSet.size());
             auto constexpr chkTimer = "checkNoMoreBitcoinDs";
             // we throttle the spamming of the allConnectionsLost signal via this mechanism
             callOnTimerSoonNoRepeat(miniTimeout, chkTimer, [this]{
@@ -148,6 +150,7 @@ void BitcoinDMgr::cleanup() {
 
     clients.clear(); /// for each client, implicitly calls client->stop() in client d'tor
     goodSet.clear();
+    nGoodSet = 0;
 
     Debug() << "BitcoinDMgr cleaned up";
 }
@@ -166,8 +169,9 @@ auto BitcoinDMgr::stats() const -> Stats
     m["rpc clients"] = l;
     m["extant request contexts"] = BitcoinDMgrHelper::ReqCtxObj::extant.load();
     m["request context table size"] = reqContextTable.size();
-    m["request zombie count"] = requestZombieCtr;
-    m["request timeout count"] = requestTimeoutCtr;
+    m["request count"] = qulonglong(requestCtr.load());
+    m["request zombie count"] = qulonglong(requestZombieCtr.load());
+    m["request timeout count"] = qulonglong(requestTimeoutCtr.load());
     m["activeTimers"] = activeTimerMapForStats();
 
     // "bitcoind info"
@@ -176,6 +180,17 @@ auto BitcoinDMgr::stats() const -> Stats
     return m;
 }
 
+auto BitcoinDMgr::metricCounters() const -> MetricCounters
+{
+    MetricCounters ret;
+    ret.nGoodClients = nGoodSet.load(std::memory_order_relaxed);
+    ret.extantRequestContexts = BitcoinDMgrHelper::ReqCtxObj::extant.load(std::memory_order_relaxed);
+    ret.requests = requestCtr.load(std::memory_order_relaxed);
+    ret.requestZombies = requestZombieCtr.load(std::memory_order_relaxed);
+    ret.requestTimeouts = requestTimeoutCtr.load(std::memory_order_relaxed);
+    return ret;
+}
+
 
 BitcoinD *BitcoinDMgr::getBitcoinD()
 {
@@ -578,6 +593,7 @@ void BitcoinDMgr::submitRequest(QObject *sender, const RPC::Message::Id &rid, co
     // to happen either as a result of a successful request reply, or due to bitcoind failure, or if the sender
     // is deleted.
     timeout = std::max(timeout, 0); /* no negative timeouts allowed */
+    ++requestCtr;
     auto context = std::shared_ptr<ReqCtxObj>(new ReqCtxObj(timeout), [](ReqCtxObj *context){
         // Note: this may run in any thread -- so all we can do here to context is context->deleteLater()
         if constexpr (debugDeletes) {
@@ -134,6 +134,15 @@ public:
     /// Thread-safe.  Convenient method to avoid an extra copy. Returns getBitcoinDInfo().hasDSProofRPC
     bool hasDSProofRPC() const;
 
+    /// Some cheap counters, used by the /metrics endpoint (see Controller::metrics).
+    struct MetricCounters {
+        unsigned nGoodClients = 0; ///< number of connected and authenticated BitcoinD clients
+        int extantRequestContexts = 0;
+        uint64_t requests = 0, requestZombies = 0, requestTimeouts = 0; ///< lifetime totals
+    };
+    /// Thread-safe, lock-free.
+    MetricCounters metricCounters() const;
+
 signals:
     void gotFirstGoodConnection(quint64 bitcoindId); // emitted whenever the first bitcoind after a "down" state (or after startup) gets its first good status (after successful authentication)
     void allConnectionsLost(); // emitted whenever all bitcoind rpc connections are down.
@@ -178,6 +187,7 @@ private:
     std::set<quint64> goodSet; ///< set of bitcoind's (by id) that are `isGood` (connected, authed). This set is updated as we get signaled from BitcoinD objects. May be empty. Has at most N_CLIENTS elements.
 
     std::vector<std::unique_ptr<BitcoinD>> clients;
+    std::atomic_uint nGoodSet = 0; ///< mirrors goodSet.size() so that it may be read from any thread
     unsigned roundRobinCursor = 0; ///< this is incremented each time. use this % N_CLIENTS to dole out bitcoind's in a round-robin fashion
 
     BitcoinD *getBitcoinD(); ///< may return nullptr if none are up. Otherwise does a round-robin of the ones present to grab one. to be called only in this thread.
@@ -214,10 +224,11 @@ private:
     template <typename ReqCtxObjT> // <-- we must template this here because ReqCtxObj is not defined yet. :/
     void handleMessageCommon(const RPC::Message &, void (ReqCtxObjT::*resultsOrErrorFunc)(const RPC::Message &));
 
-    unsigned requestZombieCtr = 0; ///< keep track of how many req responses came in after the sender was deleted
+    std::atomic_uint64_t requestCtr = 0; ///< keep track of how many requests were submitted via submitRequest (lifetime)
+    std::atomic_uint64_t requestZombieCtr = 0; ///< keep track of how many req responses came in after the sender was deleted
     static constexpr auto kRequestTimeoutTimer = "+RequestTimeoutChecker";
     static constexpr auto kRequestTimerPolltimeMS = kDefaultTimeoutMS / 2;
-    unsigned requestTimeoutCtr = 0; ///< keep track of how many requests timed out after kRequestTimeoutMS msecs of no reply from bitcoind
+    std::atomic_uint64_t requestTimeoutCtr = 0; ///< keep track of how many requests timed out after kRequestTimeoutMS msecs of no reply from bitcoind
 
     /// Periodically checks the reqContextTable and expires extant requests that have timed out.
     void requestTimeoutChecker();
@@ -43,6 +43,32 @@ void PreProcessedBlock::fill(BlockHeight blockHeight, size_t blockSize, const bi
     txHashToIndex.max_load_factor(1.0);
     txHashToIndex.reserve(b.vtx.size());
 
+    // compute the hashX for every non-OP_RETURN output in the block in 1 batch up front; outHashX is indexed by
+    // output index (same as `outputs` below), with OP_RETURN outputs left as null QByteArrays
+    std::vector<HashX> outHashX;
+    {
+        std::vector<const bitcoin::CScript *> scripts;
+        std::vector<size_t> scriptOutIdx;
+        size_t nOuts = 0;
+        for (const auto & tx : b.vtx) nOuts += tx->vout.size();
+        scripts.reserve(nOuts);
+        scriptOutIdx.reserve(nOuts);
+        size_t outIdx = 0;
+        for (const auto & tx : b.vtx) {
+            for (const auto & out : tx->vout) {
+                if (!BTC::IsOpReturn(out.scriptPubKey)) {
+                    scripts.push_back(&out.scriptPubKey);
+                    scriptOutIdx.push_back(outIdx);
+                }
+                ++outIdx;
+            }
+        }
+        auto hashXs = BTC::HashXsFromCScripts(scripts);
+        outHashX.resize(nOuts);
+        for (size_t i = 0; i < hashXs.size(); ++i)
+            outHashX[scriptOutIdx[i]] = std::move(hashXs[i]);
+    }
+
     // run through all tx's, build inputs and outputs lists
     size_t txIdx = 0;
     for (const auto & tx : b.vtx) {
@@ -67,10 +93,9 @@ void PreProcessedBlock::fill(BlockHeight blockHeight, size_t blockSize, const bi
             );
             estimatedThisSizeBytes += sizeof(OutPt);
             const size_t outputIdx = outputs.size()-1;
-            if (const auto cscript = out.scriptPubKey;
-                    !BTC::IsOpReturn(cscript))  ///< skip OP_RETURN
+            if (const HashX & hashX = outHashX[outputIdx];
+                    !hashX.isNull())  ///< skip OP_RETURN
             {
-                const HashX hashX = BTC::HashXFromCScript(cscript);
                 // add this output to the hashX -> outputs association for later
                 auto & ag = hashXAggregated[ hashX ];
                 ag.outs.emplace_back( outputIdx );
@@ -150,13 +175,11 @@ void PreProcessedBlock::fill(BlockHeight blockHeight, size_t blockSize, const bi
                                     .arg(QString(prevInfo.hash.toHex())).arg(height));
             auto & outp = outputs[ inp.parentTxOutIdx.value() ];
             outp.spentInInputIndex.emplace( inIdx ); // mark the output as spent by this index
-            const auto & prevTx = b.vtx[prevTxIdx];
-            assert(inp.prevoutN < prevTx->vout.size());
-            if (const auto cscript = prevTx->vout[inp.prevoutN].scriptPubKey;  // grab prevOut address
-                    !BTC::IsOpReturn(cscript))
+            assert(inp.prevoutN < b.vtx[prevTxIdx]->vout.size());
+            if (const HashX & hashX = outHashX[inp.parentTxOutIdx.value()];  // grab prevOut address
+                    !hashX.isNull())  ///< skip OP_RETURN
             {
                 // mark this input as involving this hashX
-                const HashX hashX = BTC::HashXFromCScript(cscript);
                 auto & ag = hashXAggregated[ hashX ];
                 ag.ins.emplace_back(inIdx);
                 if (auto & vec = ag.txNumsInvolvingHashX; vec.empty() || vec.back() != inp.txIdx)
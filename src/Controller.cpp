@@ -48,7 +48,8 @@
 
 
 Controller::Controller(const std::shared_ptr<const Options> &o, const SSLCertMonitor *certMon)
-    : Mgr(nullptr), polltimeMS(int(o->pollTimeSecs * 1e3)), options(o), sslCertMonitor(certMon)
+    : Mgr(nullptr), polltimeMS(int(o->pollTimeSecs * 1e3)), options(o), sslCertMonitor(certMon),
+      dspSyncState(std::make_shared<SynchDSPsState>())
 {
     setObjectName("Controller");
     _thread.setObjectName(objectName());
@@ -189,6 +190,7 @@ void Controller::startup()
                     Fatal() << e.what();
                 }
             }); // wait for srvmgr's thread (usually the main thread)
+            srvmgrForMetrics = srvmgr.get();
 
             // connect the header subscribe signal
             conns += connect(this, &Controller::newHeader, srvmgr.get(), &SrvMgr::newHeader);
@@ -337,6 +339,7 @@ void Controller::cleanup()
     stop();
     tasks.clear(); // deletes all tasks asap
     if (zmqHashBlockNotifier) { Log("Stopping ZMQ notifier ..."); zmqHashBlockNotifier.reset(); }
+    srvmgrForMetrics = nullptr;
     if (srvmgr) { Log("Stopping SrvMgr ... "); srvmgr->cleanup(); srvmgr.reset(); }
     if (bitcoindmgr) { Log("Stopping BitcoinDMgr ... "); bitcoindmgr->cleanup(); bitcoindmgr.reset(); }
     if (storage) { Log("Closing storage ..."); storage->cleanup(); storage.reset(); }
@@ -1524,7 +1527,7 @@ void Controller::process(bool beSilentIfUpToDate)
         });
         sm->state = State::SynchingMempool;
     } else if (sm->state == State::SynchDSPs) {
-        auto task = newTask<SynchDSPsTask>(false, this, storage, masterNotifySubsFlag);
+        auto task = newTask<SynchDSPsTask>(false, this, storage, masterNotifySubsFlag, dspSyncState);
         task->threadObjectDebugLifecycle = Trace::isEnabled(); // suppress verbose lifecycle prints unless trace mode
         connect(task, &CtlTask::success, this, [this, task]{
             if (UNLIKELY(!sm || isTaskDeleted(task) || sm->state != State::SynchingDSPs))
@@ -1850,6 +1853,8 @@ auto Controller::stats() const -> Stats
         }
         m["ZMQ Notifiers (active)"] = m2;
     }
+    if (bitcoindmgr->hasDSProofRPC())
+        m["DSProof sync"] = dspSyncState->stats();
     st["Controller"] = m;
     st["Storage"] = storage->statsSafe();
     QVariantMap misc;
@@ -1939,6 +1944,131 @@ auto Controller::debug(const StatsParams &p) const -> Stats // from StatsMixin
     return ret;
 }
 
+namespace {
+    /// Minimal builder for the Prometheus text exposition format (version 0.0.4). See:
+    /// https://prometheus.io/docs/instrumenting/exposition_formats/
+    class MetricsText {
+        QByteArray buf, curName;
+    public:
+        enum Type { Counter, Gauge };
+
+        MetricsText() { buf.reserve(8192); }
+
+        /// Begins a new metric family. Subsequent calls to sample() append samples to this family.
+        MetricsText & family(const char *name, Type type, const char *help) {
+            curName = QByteArrayLiteral("fulcrum_") + name;
+            buf += QByteArrayLiteral("# HELP ") + curName + ' ' + help + '\n';
+            buf += QByteArrayLiteral("# TYPE ") + curName + (type == Counter ? " counter\n" : " gauge\n");
+            return *this;
+        }
+
+        /// `labels`, if specified, should be of the form: `name="value",name2="value2"`
+        template <typename T, typename = std::enable_if_t<std::is_arithmetic_v<T>>>
+        MetricsText & sample(T val, const char *labels = nullptr) {
+            buf += curName;
+            if (labels) buf += QByteArrayLiteral("{") + labels + '}';
+            buf += ' ';
+            if constexpr (std::is_floating_point_v<T>) buf += QByteArray::number(double(val), 'g', 17);
+            else if constexpr (std::is_signed_v<T>) buf += QByteArray::number(qlonglong(val));
+            else buf += QByteArray::number(qulonglong(val));
+            buf += '\n';
+            return *this;
+        }
+
+        QByteArray take() { return std::move(buf); }
+    };
+} // namespace
+
+QByteArray Controller::metrics() const
+{
+    MetricsText mt;
+
+    // Storage
+    if (storage) {
+        const auto sc = storage->metricCounters();
+        mt.family("headers", MetricsText::Gauge, "Number of block headers in the database (latest height + 1).")
+          .sample(sc.headerCount);
+        mt.family("txs", MetricsText::Gauge, "Number of confirmed transactions in the database.")
+          .sample(sc.txNum);
+        mt.family("utxo_set_size", MetricsText::Gauge, "Number of entries in the UTXO set.")
+          .sample(sc.utxoSetSize);
+        mt.family("storage_merge_calls_total", MetricsText::Counter, "RocksDB merge operator invocations.")
+          .sample(sc.merges, R"(db="scripthash_history")")
+          .sample(sc.mergesTxHash2TxNum, R"(db="txhash2txnum")");
+        mt.family("storage_cache_hits_total", MetricsText::Counter, "Storage LRU cache hits (approximate).")
+          .sample(sc.num2HashHits, R"(cache="txnum2txhash")")
+          .sample(sc.height2HashesHits, R"(cache="height2txhashes")");
+        mt.family("storage_cache_misses_total", MetricsText::Counter, "Storage LRU cache misses (approximate).")
+          .sample(sc.num2HashMisses, R"(cache="txnum2txhash")")
+          .sample(sc.height2HashesMisses, R"(cache="height2txhashes")");
+
+        // SubsMgr
+        const std::tuple<const SubsMgr *, const char *> subsMgrs[] = {
+            { storage->subs(), R"(type="scripthash")" },
+            { storage->dspSubs(), R"(type="dsproof")" },
+            { storage->txSubs(), R"(type="tx")" },
+        };
+        mt.family("subscriptions_active", MetricsText::Gauge, "Number of active (non-zombie) client subscriptions.");
+        for (const auto & [mgr, labels] : subsMgrs)
+            if (mgr) mt.sample(mgr->numActiveClientSubscriptions(), labels);
+        mt.family("subscriptions_global", MetricsText::Gauge, "Number of unique subscriptions app-wide, including zombies.")
+          .sample(SubsMgr::numGlobalSubscriptions());
+        mt.family("subscriptions_cache_hits_total", MetricsText::Counter, "Subscription status cache hits.");
+        for (const auto & [mgr, labels] : subsMgrs)
+            if (mgr) mt.sample(mgr->cacheHitsAndMisses().first, labels);
+        mt.family("subscriptions_cache_misses_total", MetricsText::Counter, "Subscription status cache misses.");
+        for (const auto & [mgr, labels] : subsMgrs)
+            if (mgr) mt.sample(mgr->cacheHitsAndMisses().second, labels);
+    }
+
+    // BitcoinDMgr
+    if (bitcoindmgr) {
+        const auto bc = bitcoindmgr->metricCounters();
+        mt.family("bitcoind_clients_up", MetricsText::Gauge, "Number of connected and authenticated bitcoind RPC clients.")
+          .sample(bc.nGoodClients);
+        mt.family("bitcoind_requests_extant", MetricsText::Gauge, "Number of bitcoind requests awaiting a reply.")
+          .sample(bc.extantRequestContexts);
+        mt.family("bitcoind_requests_total", MetricsText::Counter, "Requests submitted to bitcoind.")
+          .sample(bc.requests);
+        mt.family("bitcoind_request_timeouts_total", MetricsText::Counter, "Requests to bitcoind that timed out.")
+          .sample(bc.requestTimeouts);
+        mt.family("bitcoind_request_zombies_total", MetricsText::Counter, "Replies from bitcoind that arrived after the requestor was gone.")
+          .sample(bc.requestZombies);
+    }
+
+    // ThreadPool
+    if (const auto *tp = ::AppThreadPool()) {
+        mt.family("threadpool_jobs_extant", MetricsText::Gauge, "Number of jobs queued or running in the app-wide thread pool.")
+          .sample(tp->extantJobs());
+        mt.family("threadpool_jobs_extant_max", MetricsText::Gauge, "Maximum number of extant jobs seen (lifetime).")
+          .sample(tp->extantJobsMaxSeen());
+        mt.family("threadpool_jobs_extant_limit", MetricsText::Gauge, "Extant job limit, beyond which new jobs are rejected.")
+          .sample(tp->extantJobLimit());
+        mt.family("threadpool_threads_max", MetricsText::Gauge, "Maximum number of threads in the app-wide thread pool.")
+          .sample(tp->maxThreadCount());
+        mt.family("threadpool_jobs_total", MetricsText::Counter, "Jobs submitted to the app-wide thread pool.")
+          .sample(tp->numJobsSubmitted());
+        mt.family("threadpool_overflows_total", MetricsText::Counter, "Jobs rejected because the job queue was full.")
+          .sample(tp->overflows());
+    }
+
+    // Servers
+    mt.family("clients", MetricsText::Gauge, "Number of connected clients.")
+      .sample(Client::numClients.load(std::memory_order_relaxed));
+    mt.family("clients_max", MetricsText::Gauge, "Maximum number of simultaneously connected clients (lifetime).")
+      .sample(Client::numClientsMax.load(std::memory_order_relaxed));
+    mt.family("client_connections_total", MetricsText::Counter, "Client connections accepted.")
+      .sample(Client::numClientsCtr.load(std::memory_order_relaxed));
+    if (const auto *sm = srvmgrForMetrics.load()) {
+        mt.family("tx_broadcasts_total", MetricsText::Counter, "Transactions successfully broadcast on behalf of clients.")
+          .sample(sm->txBroadcasts());
+        mt.family("tx_broadcast_bytes_total", MetricsText::Counter, "Bytes of transactions successfully broadcast on behalf of clients.")
+          .sample(sm->txBroadcastBytes());
+    }
+
+    return mt.take();
+}
+
 size_t Controller::nBlocksDownloadedSoFar() const
 {
     size_t ret = 0;
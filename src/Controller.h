@@ -38,6 +38,7 @@
 
 class CtlTask;
 class SSLCertMonitor;
+class SynchDSPsState;
 class ZmqSubNotifier;
 
 class Controller : public Mgr, public ThreadObjectMixin, public TimersByNameMixin, public ProcessAgainMixin
@@ -63,6 +64,12 @@ public:
 
     QVariantMap statsDebug(const QMap<QString, QString> & params) const;
 
+    /// Thread-safe, lock-free. Returns a snapshot of various counters and gauges from Storage, the SubsMgrs,
+    /// BitcoinDMgr, the app-wide ThreadPool and the servers, in the Prometheus text exposition format (v0.0.4). Unlike
+    /// stats(), this is built from atomics only (no big locks are taken), so it's cheap enough to be scraped often.
+    /// Used by the /metrics endpoint of the stats HTTP server.
+    QByteArray metrics() const;
+
     /// Helper for log printing mempool status. Called this instance (from a timer), also called from the SynchMempoolTask
     /// for debug printing when it receives new mempool tx's.
     static void printMempoolStatusToLog(size_t newSize, size_t numAddresses, double msec, bool useDebugLogger, bool force = false);
@@ -165,6 +172,9 @@ private:
     std::shared_ptr<Storage> storage; ///< shared with srvmgr, but we control its lifecycle
     std::shared_ptr<BitcoinDMgr> bitcoindmgr; ///< shared with srvmgr, but we control its lifecycle
     std::unique_ptr<SrvMgr> srvmgr; ///< NB: this may be nullptr if we haven't yet synched up and started listening.  Additionally, this should be destructed before storage or bitcoindmgr.
+    /// Points to the above srvmgr once it is started, and is cleared before it is destroyed. This allows metrics() to
+    /// be called from any thread (the unique_ptr above may only be accessed from this object's thread).
+    std::atomic<const SrvMgr *> srvmgrForMetrics = nullptr;
 
     struct StateMachine;
     std::unique_ptr<StateMachine> sm;
@@ -218,6 +228,9 @@ private:
     /// for that block, until a new block arrives, then is cleared again.
     std::unordered_set<TxHash, HashHasher> mempoolIgnoreTxns;
 
+    /// Shared with each SynchDSPsTask; remembers proofs across runs so we don't re-download them (and keeps stats).
+    const std::shared_ptr<SynchDSPsState> dspSyncState;
+
 private slots:
     /// Stops the zmqHashBlockNotifier; called if we received an empty hashblock endpoint address from BitcoinDMgr or
     /// when all connections to bitcoind are lost
@@ -20,10 +20,38 @@
 #include "SubsMgr.h"
 #include "Util.h"
 
+#include <algorithm>
 #include <utility>
 
-SynchDSPsTask::SynchDSPsTask(Controller *ctl_, std::shared_ptr<Storage> storage, const std::atomic_bool & notifyFlag)
-    : CtlTask(ctl_, "SynchDSPs"), storage(storage), notifyFlag(notifyFlag)
+void SynchDSPsState::recordCycle(double msec, std::size_t nDls, std::size_t nSkip)
+{
+    std::unique_lock g(mut);
+    ++nCycles;
+    nDownloads += nDls;
+    nSkipped += nSkip;
+    lastCycleMsec = msec;
+    maxCycleMsec = std::max(maxCycleMsec, msec);
+    totalCycleMsec += msec;
+}
+
+QVariantMap SynchDSPsState::stats() const
+{
+    std::unique_lock g(mut);
+    QVariantMap m;
+    m["cycles"] = qulonglong(nCycles);
+    m["lastCycleMsec"] = QString::number(lastCycleMsec, 'f', 3);
+    m["avgCycleMsec"] = nCycles ? QString::number(totalCycleMsec / double(nCycles), 'f', 3) : QVariant();
+    m["maxCycleMsec"] = QString::number(maxCycleMsec, 'f', 3);
+    m["downloads"] = qulonglong(nDownloads);
+    m["downloadsSkipped"] = qulonglong(nSkipped);
+    m["pendingProofs"] = qulonglong(pending.size());
+    m["badProofs"] = qulonglong(bad.size());
+    return m;
+}
+
+SynchDSPsTask::SynchDSPsTask(Controller *ctl_, std::shared_ptr<Storage> storage, const std::atomic_bool & notifyFlag,
+                             std::shared_ptr<SynchDSPsState> syncState_)
+    : CtlTask(ctl_, "SynchDSPs"), storage(storage), notifyFlag(notifyFlag), syncState(std::move(syncState_))
 {
     // force emit of success or errored to lead to immediate state=End assignment as a side-effect
     connect(this, &CtlTask::success, this, [this]{state = End;});
@@ -33,6 +61,8 @@ SynchDSPsTask::SynchDSPsTask(Controller *ctl_, std::shared_ptr<Storage> storage,
 SynchDSPsTask::~SynchDSPsTask() {
     stop();
 
+    syncState->recordCycle(elapsed.msec<double>(), dspsDownloaded.size() + downloadsFailed.size(), dlsSkipped);
+
     if (!dspsDownloaded.empty() || !downloadsFailed.empty() || !txsAffected.empty()) {
         DebugM(objectName(), ": downloaded: ", dspsDownloaded.size(),", failed: ", downloadsFailed.size(),
                ", txsAffecteed: ", txsAffected.size(), ", dsp count now: ", storage->mempool().first.dsps.size(),
@@ -69,8 +99,7 @@ void SynchDSPsTask::doGetDSPList()
             Error() << "FIXME: Spurious getdsprooflist reply, ignoring... ";
             return;
         }
-        const auto knownDSPs = Util::keySet<DSPs::DspHashSet>(storage->mempool().first.dsps.getAll()); // this is guarded access, lock held until statement end (C++ temporary lifetime rules)
-        // scan thru all downloaded dsp hashes and figure out what's new and what needs refresh
+        DSPs::DspHashSet listed;
         for (const auto & var : resp.result().toList()) {
             const DspHash hash = DspHash::fromHex(var.toString());
             if (!hash.isValid()) {
@@ -78,21 +107,44 @@ void SynchDSPsTask::doGetDSPList()
                 Warning() << "Got an invalid dsp hash from bitcoind: \"" << var.toString() << "\"";
                 continue;
             }
-            if (!knownDSPs.count(hash)) {
-                auto [it, inserted] = dspsNeedingDownload.emplace(std::piecewise_construct, std::forward_as_tuple(hash), std::forward_as_tuple());
-                if (!inserted) {
-                    // should never happen
-                    Warning() << "Got dupe dsp hash in results from bitcoin for dsp: " << hash.toHex();
+            if (!listed.insert(hash).second)
+                // should never happen
+                Warning() << "Got dupe dsp hash in results from bitcoin for dsp: " << hash.toHex();
+        }
+        {
+            auto [mempool, lock] = storage->mempool(); // shared lock, held until end of this scope
+            const auto & knownDSPs = mempool.dsps.getAll();
+            std::unique_lock g(syncState->mut);
+            // forget persisted state for proofs bitcoind no longer knows about
+            for (auto it = syncState->pending.begin(); it != syncState->pending.end(); )
+                it = listed.count(it->first) ? std::next(it) : syncState->pending.erase(it);
+            for (auto it = syncState->bad.begin(); it != syncState->bad.end(); )
+                it = listed.count(*it) ? std::next(it) : syncState->bad.erase(it);
+            // scan thru all downloaded dsp hashes and figure out what's new and what needs refresh
+            for (const auto & hash : listed) {
+                if (knownDSPs.count(hash))
+                    continue; // already have it
+                if (syncState->bad.count(hash)) {
+                    ++dlsSkipped; // failed sanity checks before, don't bother again
+                    continue;
+                }
+                if (const auto it = syncState->pending.find(hash); it != syncState->pending.end()) {
+                    // we already have the proof data; only its descendants need a refresh, and only if we can add it now
+                    if (mempool.txs.count(it->second.txHash))
+                        dspsNeedingRefresh.insert(*it);
+                    else
+                        ++dlsSkipped;
                     continue;
                 }
+                const auto it = dspsNeedingDownload.emplace(std::piecewise_construct, std::forward_as_tuple(hash), std::forward_as_tuple()).first;
                 DSProof & dspNew = it->second;
                 dspNew.hash = it->first; // re-use same QByteArray memory (copy-on-write)
             }
         }
         // if we have any new dsps needing download, proceed to download state
-        if (!dspsNeedingDownload.empty()) {
-            //DebugM("new dsps: ", dspsNeedingDownload.size());
-            dspDlsExpected = dspsNeedingDownload.size();
+        if (!dspsNeedingDownload.empty() || !dspsNeedingRefresh.empty()) {
+            //DebugM("new dsps: ", dspsNeedingDownload.size(), " refresh: ", dspsNeedingRefresh.size());
+            dspDlsExpected = dspsNeedingDownload.size() + dspsNeedingRefresh.size();
             state = DownloadingNewDSPs;
             AGAIN();
         } else {
@@ -135,7 +187,8 @@ void SynchDSPsTask::dlNext(bool phase2, std::shared_ptr<DSPs::DspMap::node_type>
                                             "txidChk: %5, txoTxHash: %6, descs: %7")
                                     .arg(int(ok)).arg(QString(chk.toHex())).arg(QString(hash.toHex())).arg(QString(proof.txHash.toHex()))
                                     .arg(QString(txidChk.toHex())).arg(QString(proof.txo.txHash.toHex())).arg(descs.size()));
-                // build descendants set
+                // build descendants set (from scratch, since this may be a refresh of a proof we downloaded before)
+                proof.descendants.clear();
                 for (const auto &desc : descs) {
                     const auto txid = Util::ParseHexFast(desc.toUtf8());
                     if (txid.length() != HashLen)
@@ -146,27 +199,43 @@ void SynchDSPsTask::dlNext(bool phase2, std::shared_ptr<DSPs::DspMap::node_type>
                     throw Exception(QString("missing proof's associated txid \"%1\" in the descendants set").arg(QString(proof.txHash.toHex())));
                 DebugM("dsp ", hash.toHex(), " downloaded ok, descendants: ", proof.descendants.size());
                 dspsDownloaded.insert(std::move(*node)); // success! phase2 complete...
+                --dlsInFlight;
                 AGAIN();
             }
         } catch (const std::exception &e) {
             Warning() << "bad dsp " << hash.toHex() << ", (exc: " << e.what() << "), ignoring dsp ...";
             downloadsFailed.insert(hash);
+            {
+                std::unique_lock g(syncState->mut);
+                syncState->bad.insert(hash);
+                syncState->pending.erase(hash);
+            }
+            --dlsInFlight;
             AGAIN();
         }
     },
     [this, hash, phase2](const RPC::Message &){
-        // ignore errors, keep going
+        // ignore errors, keep going (we will try again next time)
         DebugM("failed to download dsp ", hash.toHex(), " phase ", 1+int(phase2), ", ignoring dsp ...");
         downloadsFailed.insert(hash);
+        --dlsInFlight;
         AGAIN();
     });
 }
 
 void SynchDSPsTask::doDownloadNewDSPs()
 {
-    if (!dspsNeedingDownload.empty())
-        dlNext(false, dspsNeedingDownload.extract(dspsNeedingDownload.begin()));
-    else if (const auto sum = dspsDownloaded.size() + downloadsFailed.size(); sum == dspDlsExpected) {
+    // keep up to kMaxConcurrentDownloads requests in flight; each one that completes calls AGAIN() to get us here again
+    while (dlsInFlight < kMaxConcurrentDownloads && !(dspsNeedingRefresh.empty() && dspsNeedingDownload.empty())) {
+        ++dlsInFlight;
+        if (!dspsNeedingRefresh.empty())
+            dlNext(true, dspsNeedingRefresh.extract(dspsNeedingRefresh.begin())); // already have the proof, phase 2 only
+        else
+            dlNext(false, dspsNeedingDownload.extract(dspsNeedingDownload.begin()));
+    }
+    if (dlsInFlight)
+        return; // still waiting on some downloads
+    if (const auto sum = dspsDownloaded.size() + downloadsFailed.size(); sum == dspDlsExpected) {
         // end this state, move on to next
         state = ProcessDownloads;
         AGAIN();
@@ -182,14 +251,17 @@ void SynchDSPsTask::doProcessDownloads()
     unsigned ctr = 0, notAdded = 0;
     {
         auto [mempool, lock] = storage->mutableMempool();
+        std::unique_lock g(syncState->mut);
         for (auto & [hash, proof] : dspsDownloaded) {
             if (!mempool.txs.count(proof.txHash)) {
                 // unknown txid (it's new and we haven't seen it in SynchMempoolTask yet!)
                 DebugM("skipping dsp ", hash.toHex(), " because its associated txid ", proof.txHash.toHex(),
                        " is not yet known to us");
                 ++notAdded;
+                syncState->pending.insert_or_assign(hash, proof); // remember it so we needn't download it again
                 continue;
             }
+            syncState->pending.erase(hash);
 
             decltype(proof.descendants) skipped;
             for (const auto & txid : proof.descendants) {
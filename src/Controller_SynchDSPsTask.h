@@ -23,16 +23,42 @@
 #include "Mempool.h"
 #include "Storage.h"
 
+#include <QVariantMap>
+
 #include <atomic>
 #include <memory>
+#include <mutex>
 #include <utility>
 
+/// State that persists across SynchDSPsTask runs. There is 1 of these owned by the Controller and shared with each task.
+/// Thread-safe.
+class SynchDSPsState {
+public:
+    /// Called at the end of each SynchDSPsTask run to record its latency and counts.
+    void recordCycle(double msec, std::size_t nDownloads, std::size_t nSkipped);
+    /// Controller stats
+    QVariantMap stats() const;
+
+private:
+    friend class SynchDSPsTask;
+    mutable std::mutex mut;
+    /// Proofs we downloaded but could not yet add since their tx is not yet in our mempool. The proof data (phase 1)
+    /// is immutable, so we never download it again. We only re-query the descendants (phase 2) once the tx shows up.
+    DSPs::DspMap pending;
+    /// Proofs that failed sanity checks. We don't retry these for as long as bitcoind keeps listing them.
+    DSPs::DspHashSet bad;
+    // stats
+    quint64 nCycles = 0, nDownloads = 0, nSkipped = 0;
+    double lastCycleMsec = 0., maxCycleMsec = 0., totalCycleMsec = 0.;
+};
+
 /// This runs after the SynchMempoolTask to download new DSProofs and also update existing proofs
 /// with new descendant info. This task is only run if the bitcoind we are connected to supports
 /// the `getdsprooflist` and `getdsproof` RPC methods.
 class SynchDSPsTask : public CtlTask {
 public:
-    SynchDSPsTask(Controller *ctl_, std::shared_ptr<Storage> storage, const std::atomic_bool & notifyFlag);
+    SynchDSPsTask(Controller *ctl_, std::shared_ptr<Storage> storage, const std::atomic_bool & notifyFlag,
+                  std::shared_ptr<SynchDSPsState> syncState);
     ~SynchDSPsTask() override;
 
 protected:
@@ -41,6 +67,10 @@ protected:
 private:
     const std::shared_ptr<Storage> storage;
     const std::atomic_bool & notifyFlag;
+    const std::shared_ptr<SynchDSPsState> syncState;
+
+    /// Max. number of getdsproof requests we keep in flight at once (spread across the bitcoind connections).
+    static constexpr unsigned kMaxConcurrentDownloads = 8;
 
     enum State {
         GetDSPList, WaitingForDSPList,
@@ -52,8 +82,8 @@ private:
     State state = GetDSPList;
 
     Mempool::TxHashSet txsAffected;
-    DSPs::DspMap dspsNeedingDownload, dspsDownloaded;
-    unsigned dspDlsExpected = 0;
+    DSPs::DspMap dspsNeedingDownload, dspsNeedingRefresh, dspsDownloaded; ///< "refresh" = phase 2 only (see SynchDSPsState::pending)
+    unsigned dspDlsExpected = 0, dlsInFlight = 0, dlsSkipped = 0;
     DSPs::DspHashSet downloadsFailed;
 
     void doGetDSPList();
@@ -29,6 +29,7 @@
 #include <mutex> // for lock_guard
 #include <optional>
 #include <shared_mutex> // for shared_lock, shared_mutex
+#include <type_traits>
 #include <utility> // for move
 
 /// A cost-based cache, allowing for memory-bounded caching.
@@ -140,6 +141,24 @@ public:
         ExclusiveLockGuard g(lock);
         return Base::remove(k);
     }
+    /// Removes all items whose keys are in the range [first, last). Only available for integral Key types. Takes the
+    /// lock once, and iterates over whichever is smaller: the range or the cache. Returns the number of items removed.
+    template <typename K = Key, std::enable_if_t<std::is_integral_v<K>, int> = 0>
+    unsigned removeRange(const K first, const K last) {
+        unsigned ct = 0;
+        if (last <= first)
+            return ct;
+        ExclusiveLockGuard g(lock);
+        if (static_cast<unsigned long long>(last - first) <= static_cast<unsigned long long>(Base::size())) {
+            for (K k = first; k < last; ++k)
+                ct += Base::remove(k);
+        } else {
+            for (const auto & k : Base::keys())
+                if (k >= first && k < last)
+                    ct += Base::remove(k);
+        }
+        return ct;
+    }
     /// May throw if maxCost is 0 or >= INT_MAX
     void setMaxCost(unsigned maxCost) {
         chkMaxCost(maxCost);
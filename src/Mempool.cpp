@@ -28,31 +28,118 @@
 void Mempool::clear() {
     txs.clear();
     hashXTxs.clear();
+    feeBuckets.clear();
+    descIndex.clear();
     dsps.clear(); // <-- this always frees capacity
     txs.rehash(0); // this should free previous capacity
     hashXTxs.rehash(0);
 }
 
+auto Mempool::DescendantIndex::intern(const TxHash &txid) -> Id
+{
+    auto [it, inserted] = ids.try_emplace(txid, Id{});
+    if (!inserted)
+        return it->second;
+    Id id;
+    if (!freeIds.empty()) {
+        id = freeIds.back();
+        freeIds.pop_back();
+    } else {
+        id = Id(nodes.size());
+        nodes.emplace_back();
+    }
+    nodes[id].txid = it->first; // shallow copy
+    return it->second = id;
+}
+
+void Mempool::DescendantIndex::releaseIfIsolated(Id id)
+{
+    Node & n = nodes[id];
+    if (!n.parents.empty() || !n.children.empty())
+        return;
+    ids.erase(n.txid);
+    n = Node{}; // frees memory
+    freeIds.push_back(id);
+}
+
+void Mempool::DescendantIndex::addEdge(const TxHash &parent, const TxHash &child)
+{
+    const Id pid = intern(parent), cid = intern(child);
+    auto & children = nodes[pid].children;
+    if (std::find(children.begin(), children.end(), cid) != children.end())
+        return; // already have this edge (child spends more than 1 output of parent)
+    children.push_back(cid);
+    nodes[cid].parents.push_back(pid);
+}
+
+void Mempool::DescendantIndex::rmTx(const TxHash &txid)
+{
+    const auto it = ids.find(txid);
+    if (it == ids.end())
+        return;
+    const Id id = it->second;
+    const auto unlink = [this, id](std::vector<Id> &others, auto otherSide) {
+        for (const Id oid : others) {
+            auto & vec = nodes[oid].*otherSide;
+            vec.erase(std::find(vec.begin(), vec.end(), id));
+            releaseIfIsolated(oid);
+        }
+        others.clear();
+    };
+    unlink(nodes[id].parents, &Node::children);
+    unlink(nodes[id].children, &Node::parents);
+    releaseIfIsolated(id);
+}
+
+void Mempool::DescendantIndex::clear()
+{
+    ids.clear();
+    ids.rehash(0);
+    nodes = {};
+    freeIds = {};
+}
+
+std::size_t Mempool::DescendantIndex::growToIncludeDescendants(TxHashSet &txids) const
+{
+    std::size_t added = 0;
+    std::vector<Id> todo;
+    for (const auto & txid : txids)
+        if (const auto it = ids.find(txid); it != ids.end())
+            todo.push_back(it->second);
+    while (!todo.empty()) {
+        const Id id = todo.back();
+        todo.pop_back();
+        for (const Id cid : nodes[id].children) {
+            if (txids.insert(nodes[cid].txid).second) {
+                ++added;
+                todo.push_back(cid);
+            }
+        }
+    }
+    return added;
+}
+
+std::size_t Mempool::DescendantIndex::numEdges() const
+{
+    std::size_t ret = 0;
+    for (const auto & n : nodes)
+        ret += n.children.size();
+    return ret;
+}
+
 auto Mempool::calcCompactFeeHistogram(double binSize) const -> FeeHistogramVec
 {
     // this algorithm is taken from:
     // https://github.com/Electron-Cash/electrumx/blob/fbd00416d804c286eb7de856e9399efb07a2ceaf/electrumx/server/mempool.py#L139
     FeeHistogramVec ret;
-    std::map<unsigned, unsigned, std::greater<unsigned>> histogram; // sorted map, descending order by key
-
-    for (const auto & [txid, tx] : txs) {
-        const auto feeRate = unsigned(tx->fee / bitcoin::Amount::satoshi()) // sats
-                             /  std::max(tx->sizeBytes, 1u); // per byte
-        histogram[feeRate] += tx->sizeBytes; // accumulate size by feeRate
-    }
 
-    // now, compact the bins
+    // compact the bins (feeBuckets is already sorted in descending order by feeRate)
     ret.reserve(8);
     unsigned cumSize = 0;
     double r = 0.;
 
-    for (const auto & [feeRate, size] : histogram) {
-        cumSize += size;
+    for (const auto & [feeRate, bucket] : feeBuckets) {
+        cumSize += bucket.sizeBytes;
         if (cumSize + r > binSize) {
             ret.push_back(FeeHistogramItem{feeRate, cumSize});
             r += double(cumSize) - binSize;
@@ -64,6 +151,26 @@ auto Mempool::calcCompactFeeHistogram(double binSize) const -> FeeHistogramVec
     return ret;
 }
 
+void Mempool::feeBucketsAdd(const Tx &tx)
+{
+    auto & bucket = feeBuckets[feeRateOf(tx)];
+    bucket.sizeBytes += tx.sizeBytes;
+    ++bucket.nTxs;
+}
+
+void Mempool::feeBucketsRemove(const Tx &tx)
+{
+    const auto it = feeBuckets.find(feeRateOf(tx));
+    if (UNLIKELY(it == feeBuckets.end() || !it->second.nTxs)) {
+        Error() << __func__ << ": no fee rate bucket for tx " << tx.hash.toHex() << "! FIXME!";
+        return;
+    }
+    auto & bucket = it->second;
+    bucket.sizeBytes -= std::min(bucket.sizeBytes, tx.sizeBytes);
+    if (!--bucket.nTxs)
+        feeBuckets.erase(it);
+}
+
 auto Mempool::addNewTxs(ScriptHashesAffectedSet & scriptHashesAffected,
                         const NewTxsMap & txsNew,
                         const GetTXOInfoFromDBFunc & getTXOInfo,
@@ -73,6 +180,24 @@ auto Mempool::addNewTxs(ScriptHashesAffectedSet & scriptHashesAffected,
     Stats ret;
     ret.oldSize = this->txs.size();
     ret.oldNumAddresses = this->hashXTxs.size();
+    // Once we are done (or if we throw part-way through), account for every new tx that made it into `txs` in the fee
+    // rate buckets. We must wait until the end since a tx's fee is only known after all of its inputs are processed.
+    Defer feeBucketsAdder([this, &txsNew] {
+        for (const auto & [hash, pair] : txsNew)
+            if (txs.count(hash))
+                feeBucketsAdd(*pair.first);
+    });
+    // compute the hashXs of all the new non-OP_RETURN outputs in 1 batch; they are consumed in the same order below
+    std::vector<HashX> newHashXs;
+    {
+        std::vector<const bitcoin::CScript *> scripts;
+        for (const auto & [hash, pair] : txsNew)
+            for (const auto & out : pair.second->vout)
+                if (!BTC::IsOpReturn(out.scriptPubKey))
+                    scripts.push_back(&out.scriptPubKey);
+        newHashXs = BTC::HashXsFromCScripts(scripts);
+    }
+    auto nextHashX = newHashXs.begin();
     // first, do new outputs for all tx's, and put the new tx's in the mempool struct
     for (auto & [hash, pair] : txsNew) {
         auto & [tx, ctx] = pair;
@@ -89,7 +214,8 @@ auto Mempool::addNewTxs(ScriptHashesAffectedSet & scriptHashesAffected,
             const auto & script = out.scriptPubKey;
             if (!BTC::IsOpReturn(script)) {
                 // UTXO only if it's not OP_RETURN -- can't do 'continue' here as that would throw off the 'n' counter
-                HashX sh = BTC::HashXFromCScript(out.scriptPubKey);
+                assert(nextHashX != newHashXs.end());
+                HashX sh = std::move(*nextHashX++);
                 // the below is a hack to save memory by re-using the same shallow copy of 'sh' each time
                 auto hxit = this->hashXTxs.find(sh);
                 if (hxit != this->hashXTxs.end()) {
@@ -117,8 +243,6 @@ auto Mempool::addNewTxs(ScriptHashesAffectedSet & scriptHashesAffected,
         // . <-- at this point the .txos vec is built, with everything isValid() except for the OP_RETURN outs, which are all !isValid()
     }
 
-    std::unordered_map<TxHash, TxHashSet, HashHasher> newTxsNewParents; // only used if !dsps.empty(). Contains all in-mempool parents of txs from txsNew that are themselves in txsNew
-
     // next, do new inputs for all tx's, debiting/crediting either a mempool tx or querying db for the relevant utxo
     for (auto & [hash, pair] : txsNew) {
         auto & [tx, ctx] = pair;
@@ -148,6 +272,7 @@ auto Mempool::addNewTxs(ScriptHashesAffectedSet & scriptHashesAffected,
                     throw InternalError(QString("PREV OUT %1 IS MISSING ITS HASHX ENTRY FOR HASHX %2 (txid: %3)")
                                         .arg(prevTXO.toString(), QString(sh.toHex()), QString(tx->hash.toHex())));
                 prevHashXIt->second.utxo.erase(prevN); // remove this spend from utxo set for prevTx in mempool
+                descIndex.addEdge(prevTxRef->hash, tx->hash);
                 if (TRACE) Debug() << hash.toHex() << " unconfirmed spend: " << prevTXO.toString() << " " << prevInfo.amount.ToString().c_str();
 
                 // DSP handling (BCH only)
@@ -176,11 +301,8 @@ auto Mempool::addNewTxs(ScriptHashesAffectedSet & scriptHashesAffected,
                                 }
                             }
                         }
-                    } else {
-                        // parent was a tx in the new set, so we must process further at end of function to figure
-                        // out if this childtx has associated dsps...
-                        newTxsNewParents[hash].insert(prevTxId);
                     }
+                    // else: parent was a tx in the new set, we propagate its dsps (if any) at the end of this function
                     seenParents.insert(prevTxId);
                 }
                 // /DSP handling
@@ -235,38 +357,34 @@ auto Mempool::addNewTxs(ScriptHashesAffectedSet & scriptHashesAffected,
     }
 
     // DSP handling (BCH only)
-    if (!dsps.empty() && !newTxsNewParents.empty() && !ret.dspTxsAffected.empty()) {
+    if (!dsps.empty() && !ret.dspTxsAffected.empty()) {
+        // The new txs in dspTxsAffected got linked to the dsps of their old (already in mempool) parents above. Now
+        // link all of their descendants (which are necessarily also new txs) to those same dsps, by walking the
+        // descendant index.
         Tic t0;
-        unsigned addCt, iters = 0, innerIters = 0, addsTotal = 0;
-        do {
-            // Keep looping and adding dsp<->txid associations (this keeps expanding the dsp->descendant sets for each
-            // dsp) until nothing new is added, in which case we are done.
-            //
-            // This loop is guaranteed to terminate but only if DSPs::addTx returns an accurate bool about whether an
-            // insertion took place or not (it currently does). That invariant needs to be maintained.  A note was also
-            // added to DSPs::addTx to warn of this.
-            addCt = 0;
-            for (const auto & [hash, parentSet] : newTxsNewParents) {
-                ++innerIters;
-                for (const auto & prevTxId : parentSet) {
-                    ++innerIters;
-                    if (const auto *dspHashes = dsps.dspHashesForTx(prevTxId)) {
-                        for (const auto &dspHash : *dspHashes) {
-                            ++innerIters;
-                            if (dsps.addTx(dspHash, hash)) {
-                                ++addCt;
-                                ++addsTotal;
-                                ret.dspTxsAffected.insert(hash);
-                                DebugM(__func__, ": added tx ", hash.toHex(), " to descendants for dsp ", dspHash.toHex());
-                            }
-                        }
+        unsigned addsTotal = 0;
+        const TxHashSet roots = ret.dspTxsAffected;
+        for (const auto & root : roots) {
+            const auto *rootDsps = dsps.dspHashesForTx(root);
+            if (!rootDsps) continue; // should never happen
+            const auto dspHashes = *rootDsps; // copy since addTx below may modify the set it points to
+            TxHashSet descendants{root};
+            if (!descIndex.growToIncludeDescendants(descendants))
+                continue; // no children
+            for (const auto & txid : descendants) {
+                for (const auto & dspHash : dspHashes) {
+                    // Note: DSPs::addTx returns false if already linked (e.g. via another root in a diamond pattern)
+                    if (dsps.addTx(dspHash, txid)) {
+                        ++addsTotal;
+                        ret.dspTxsAffected.insert(txid);
+                        DebugM(__func__, ": added tx ", txid.toHex(), " to descendants for dsp ", dspHash.toHex());
                     }
                 }
             }
-            ++iters;
-        } while (addCt);
-        DebugM(__func__, ": (unconf. parent chain) dspTx adds: ", addsTotal, ", iters: ", iters, ", innerIters: ",
-               innerIters, ", elapsed: ", t0.msecStr(), " msec");
+        }
+        if (addsTotal)
+            DebugM(__func__, ": (unconf. parent chain) dspTx adds: ", addsTotal, ", roots: ", roots.size(),
+                   ", elapsed: ", t0.msecStr(), " msec");
     }
     if (!ret.dspTxsAffected.empty())
         // this grows the set to encompass all txids now linked by common dsproofs
@@ -284,40 +402,20 @@ std::size_t Mempool::growTxHashSetToIncludeDescendants(const char *const logpfx,
     if (txids.empty())
         return 0;
 
-    std::size_t added = 0, iterct = 0;
-    bool found;
-
-    // "recursively" find txids spending from a source set. Implicitly keeps adding
-    // to the resulting set until all dependant txs in mempool are covered.
     const auto t0 = Tic();
-    do {
-        ++iterct;
-        found = false;
-        for (const auto & [txid, tx] : txs) {
-            if (!tx->hasUnconfirmedParentTx || txids.count(txid))
-                continue; // no unconf. parents or already added
-            for (const auto & [sh, ioinfo] : tx->hashXs) {
-                for (const auto & [txo, txoinfo] : ioinfo.unconfirmedSpends) {
-                    if (txids.count(txo.txHash)) {
-                        // this spends one of the ones in our set! add it since it's a child of something we want to remove.
-                        txids.insert(txid);
-                        ++added;
-                        if (TRACE)
-                            DebugM(logpfx, ": additonal tx ", Util::ToHexFast(txid), " added to set because it spends ",
-                                   txo.toString(), " which is already in our removal set");
-                        found = true;
-                        goto next_txid;
-                    }
-                }
-            }
-        next_txid:
-            continue;
-        }
-    } while (found);
+    std::size_t added;
+    if (TRACE) {
+        const auto before = txids;
+        added = descIndex.growToIncludeDescendants(txids);
+        for (const auto & txid : txids)
+            if (!before.count(txid))
+                DebugM(logpfx, ": additonal tx ", Util::ToHexFast(txid), " added to set because it spends from a tx"
+                       " already in our set");
+    } else
+        added = descIndex.growToIncludeDescendants(txids);
 
     using Util::Pluralize;
-    DebugM(logpfx, ": iterated ", iterct, Pluralize(" time", iterct), " to add ", added, Pluralize(" additional child tx", added),
-           " in ", t0.msecStr(2), " msec");
+    DebugM(logpfx, ": added ", added, Pluralize(" additional child tx", added), " in ", t0.msecStr(2), " msec");
     return added;
 }
 
@@ -408,6 +506,8 @@ auto Mempool::dropTxs(ScriptHashesAffectedSet & scriptHashesAffectedOut, TxHashS
 
         // and finally remove this tx from `txs` now, while we have its iterator .. this is faster
         // than doing the remove later, since we already have the iterator now!
+        feeBucketsRemove(*tx);
+        descIndex.rmTx(txid);
         txs.erase(it);
     }
 
@@ -566,6 +666,8 @@ auto Mempool::confirmedInBlock(ScriptHashesAffectedSet & scriptHashesAffectedOut
                 dspTxids.insert(txid);
             }
             // and erase NOW!
+            feeBucketsRemove(*tx);
+            descIndex.rmTx(txid);
             itTxs = txs.erase(itTxs); // in this branch: removed, take next it and continue
             continue;
         } else if (tx->hasUnconfirmedParentTx) {
@@ -834,10 +936,82 @@ bool Mempool::deepCompareEqual(const Mempool &o, QString *estr) const
         if (estr) *estr = "DSPs members differ";
         return false;
     }
+    if (feeBuckets != o.feeBuckets) {
+        if (estr) *estr = "Fee rate buckets differ";
+        return false;
+    }
     // couldn't find an inequality, return true
     return true;
 }
 
+auto Mempool::calcFeeRateBucketsSlow() const -> FeeRateBuckets
+{
+    FeeRateBuckets ret;
+    for (const auto & [txid, tx] : txs) {
+        auto & bucket = ret[feeRateOf(*tx)];
+        bucket.sizeBytes += tx->sizeBytes;
+        ++bucket.nTxs;
+    }
+    return ret;
+}
+
+std::size_t Mempool::growTxHashSetToIncludeDescendantsSlow(TxHashSet &txids) const
+{
+    if (txids.empty())
+        return 0;
+
+    std::size_t added = 0;
+    bool found;
+
+    // "recursively" find txids spending from a source set. Implicitly keeps adding
+    // to the resulting set until all dependant txs in mempool are covered.
+    do {
+        found = false;
+        for (const auto & [txid, tx] : txs) {
+            if (!tx->hasUnconfirmedParentTx || txids.count(txid))
+                continue; // no unconf. parents or already added
+            for (const auto & [sh, ioinfo] : tx->hashXs) {
+                for (const auto & [txo, txoinfo] : ioinfo.unconfirmedSpends) {
+                    if (txids.count(txo.txHash)) {
+                        // this spends one of the ones in our set! add it since it's a child of something we want to remove.
+                        txids.insert(txid);
+                        ++added;
+                        found = true;
+                        goto next_txid;
+                    }
+                }
+            }
+        next_txid:
+            continue;
+        }
+    } while (found);
+
+    return added;
+}
+
+bool Mempool::checkDescendantIndex(QString *errMsg) const
+{
+    const auto fail = [errMsg](const QString &msg) {
+        if (errMsg) *errMsg = msg;
+        return false;
+    };
+    std::size_t nEdges = 0;
+    for (const auto & [txid, tx] : txs) {
+        TxHashSet expected, actual;
+        for (const auto & [sh, ioinfo] : tx->hashXs)
+            for (const auto & [txo, txoinfo] : ioinfo.unconfirmedSpends)
+                expected.insert(txo.txHash);
+        descIndex.forEachParent(txid, [&actual](const TxHash &p){ actual.insert(p); });
+        if (expected != actual)
+            return fail(QString("tx %1 has %2 parents in the index, expected %3").arg(QString(txid.toHex()))
+                        .arg(actual.size()).arg(expected.size()));
+        nEdges += expected.size();
+    }
+    if (nEdges != descIndex.numEdges())
+        return fail(QString("index has %1 edges, expected %2").arg(descIndex.numEdges()).arg(nEdges));
+    return true;
+}
+
 namespace {
     using MPData = Mempool::NewTxsMap;
 
@@ -1022,6 +1196,37 @@ namespace {
                 Log() << "Added to mempool in " << t0.msecStr() << " msec."
                       << " Scripthashes: " << shset.size() << ", size: " << stats.newSize << ", addresses " << stats.newNumAddresses;
                 shset.clear();
+                // fee histogram: the incrementally-maintained buckets must match a from-scratch scan of all txs
+                t0 = Tic();
+                const auto slowBuckets = mempool.calcFeeRateBucketsSlow();
+                t0.fin();
+                auto t1 = Tic();
+                const auto hist = mempool.calcCompactFeeHistogram();
+                t1.fin();
+                if (slowBuckets != mempool.feeRateBuckets())
+                    throw Exception("Fee rate buckets differ from a full recompute!");
+                Log() << "Fee histogram: " << hist.size() << " bins from " << slowBuckets.size() << " fee rates in "
+                      << t1.usec() << " usec (a full scan of all txs takes " << t0.usec() << " usec)";
+                // descendant index: must agree with the old full-scan graph walk
+                if (QString err; !mempool.checkDescendantIndex(&err))
+                    throw Exception("Descendant index check failed: " + err);
+                Mempool::TxHashSet fromIndex, fromScan;
+                for (const auto & [txid, tx] : mempool.txs)
+                    if (!tx->hasUnconfirmedParentTx) fromIndex.insert(txid);
+                fromScan = fromIndex;
+                const auto nRoots = fromIndex.size();
+                t0 = Tic();
+                mempool.growTxHashSetToIncludeDescendantsSlow(fromScan);
+                t0.fin();
+                t1 = Tic();
+                mempool.descendantIndex().growToIncludeDescendants(fromIndex);
+                t1.fin();
+                if (fromIndex != fromScan)
+                    throw Exception("Descendant index yielded a different descendant set than a full scan!");
+                Log() << "Descendant index: " << mempool.descendantIndex().size() << " interned txs, "
+                      << mempool.descendantIndex().numEdges() << " edges; descendants of " << nRoots << " roots ("
+                      << fromIndex.size() << " txs) found in " << t1.msecStr() << " msec (full scan: " << t0.msecStr()
+                      << " msec)";
                 const auto mem = Util::getProcessMemoryUsage();
                 Log() << "Mem usage: physical " << QString::number(mem.phys / 1024.0, 'f', 1)
                       << " KiB, virtual " << QString::number(mem.virt / 1024.0, 'f', 1) << " KiB";
@@ -1318,6 +1523,10 @@ namespace {
                         }
                         if (Util::keySet(mempool.txs) != setInVecs)
                             throw Exception("Some txs in mempool.txs are not in txvecs!");
+                        if (mempool.feeRateBuckets() != mempool.calcFeeRateBucketsSlow())
+                            throw Exception("Fee rate buckets are inconsistent with mempool.txs!");
+                        if (QString err; !mempool.checkDescendantIndex(&err))
+                            throw Exception("Descendant index is inconsistent with mempool.txs: " + err);
                     }
                     if (iterMode == DropOnlyLeaves || isConfirmMode) {
                         if (stats.oldSize - stats.newSize != txids.size())
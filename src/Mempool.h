@@ -26,6 +26,9 @@
 
 #include <QVariantMap>
 
+#include <algorithm>
+#include <cstdint>
+#include <functional>
 #include <map>
 #include <memory>
 #include <optional>
@@ -204,6 +207,53 @@ struct Mempool
                            const TxHashNumMap & txidMap, BlockHeight confirmedHeight,
                            bool TRACE = false, std::optional<float> rehashMaxLoadFactor = {});
 
+    // -- Descendant index --
+
+    /// Adjacency lists for the in-mempool spend graph (parent -> children, and child -> parents), with the txids
+    /// interned to compact 32-bit ids. Only txs that have at least 1 in-mempool parent or child are interned, so for
+    /// a typical mempool this is a small fraction of `txs`. Maintained by addNewTxs(), dropTxs(), confirmedInBlock()
+    /// and clear(). This lets dropTxs() and the dsproof linking code find descendants by walking just the affected
+    /// part of the graph, rather than repeatedly scanning all of `txs`.
+    class DescendantIndex {
+    public:
+        using Id = uint32_t;
+
+        /// Records that `child` spends an output of `parent`. Duplicate edges are ignored.
+        void addEdge(const TxHash &parent, const TxHash &child);
+        /// Removes `txid` and all of its edges (if any).
+        void rmTx(const TxHash &txid);
+        void clear();
+
+        /// Adds all of the in-mempool descendants of the txs in `txids` to `txids`. Returns the number of txs added.
+        std::size_t growToIncludeDescendants(TxHashSet &txids) const;
+        /// Calls func(const TxHash &) for each of the direct in-mempool parents of `txid`
+        template <typename Func>
+        void forEachParent(const TxHash &txid, Func && func) const {
+            if (const auto it = ids.find(txid); it != ids.end())
+                for (const Id pid : nodes[it->second].parents)
+                    func(nodes[pid].txid);
+        }
+
+        /// The number of interned txs
+        std::size_t size() const { return ids.size(); }
+        /// The number of parent -> child edges
+        std::size_t numEdges() const;
+
+    private:
+        struct Node {
+            TxHash txid; ///< null for free slots
+            std::vector<Id> parents, children;
+        };
+        std::unordered_map<TxHash, Id, HashHasher> ids;
+        std::vector<Node> nodes; ///< indexed by Id
+        std::vector<Id> freeIds; ///< free slots in `nodes`
+
+        Id intern(const TxHash &txid);
+        /// Frees the slot for `id` if it has no more edges
+        void releaseIfIsolated(Id id);
+    };
+    const DescendantIndex & descendantIndex() const { return descIndex; }
+
     // -- Fee histogram support (used by mempool.get_fee_histogram RPC) --
 
     struct FeeHistogramItem {
@@ -211,11 +261,21 @@ struct Mempool
         unsigned cumulativeSize = 0; // bin size, cumulative bytes
     };
     using FeeHistogramVec = std::vector<FeeHistogramItem>;
-    /// This function is potentially going to take a couple of ms at worst on very large mempools.  Even a 1.5k tx
-    /// mempool takes under 1 ms on average hardware, so it's very fast. Storage calls this in refreshMempoolHistogram
-    /// from a periodic background task kicked off in Controller.
+    /// This is O(number of distinct fee rates) since it works off of the feeRateBuckets, which are kept up-to-date
+    /// incrementally as txs enter and leave the mempool. Storage calls this in refreshMempoolHistogram from a periodic
+    /// background task kicked off in Controller.
     FeeHistogramVec calcCompactFeeHistogram(double binSize = 1e5 /* binSize in bytes */) const;
 
+    struct FeeRateBucket {
+        unsigned sizeBytes = 0; ///< total size of all the txs at this fee rate
+        unsigned nTxs = 0; ///< number of txs at this fee rate
+        bool operator==(const FeeRateBucket &o) const { return sizeBytes == o.sizeBytes && nTxs == o.nTxs; }
+        bool operator!=(const FeeRateBucket &o) const { return !(*this == o); }
+    };
+    /// feeRate (sats/B, truncated) -> bucket, sorted in descending order by feeRate
+    using FeeRateBuckets = std::map<unsigned, FeeRateBucket, std::greater<unsigned>>;
+    const FeeRateBuckets & feeRateBuckets() const { return feeBuckets; }
+
     // -- Dump (for JSONesque debug support)
 
     /// Dump to QVariantMap (used by Controller::debug(), see Controller.cpp)
@@ -229,9 +289,22 @@ struct Mempool
     void clear();
 
 private:
+    /// Maintained by addNewTxs(), dropTxs(), confirmedInBlock() & clear(); there is 1 entry per distinct fee rate.
+    FeeRateBuckets feeBuckets;
+    /// Maintained by addNewTxs(), dropTxs(), confirmedInBlock() & clear(); see DescendantIndex.
+    DescendantIndex descIndex;
+
+    /// Returns the fee rate of `tx` in sats/B (truncated), which is the key into `feeBuckets`.
+    static unsigned feeRateOf(const Tx &tx) {
+        return unsigned(tx.fee / bitcoin::Amount::satoshi()) / std::max(tx.sizeBytes, 1u);
+    }
+    /// Accounts for `tx` in feeBuckets. Call this only after tx->fee is final.
+    void feeBucketsAdd(const Tx &tx);
+    /// Removes `tx` from feeBuckets. Call this when removing a tx from `txs`.
+    void feeBucketsRemove(const Tx &tx);
+
     /// Given a set of txids in this Mempool, grow the set to encompass all descendant tx's that spend
-    /// from the initial set.  Will keep iterating until it cannot grow the set any longer.
-    /// dropTxs() implicitly calls this.
+    /// from the initial set (using descIndex). dropTxs() implicitly calls this.
     std::size_t growTxHashSetToIncludeDescendants(TxHashSet &txids, bool TRACE = false) const;
 
     /// Actual implementation of same-named function
@@ -261,5 +334,16 @@ public:
     ///
     /// This is very slow -- used only in the mempool bench.
     bool deepCompareEqual(const Mempool &other, QString *differenceExplanation = nullptr) const;
+
+    /// Recomputes the fee rate buckets from scratch by scanning all of `txs`. Used by the mempool bench to check
+    /// feeRateBuckets().
+    FeeRateBuckets calcFeeRateBucketsSlow() const;
+
+    /// Like growTxHashSetToIncludeDescendants(), but does it the old, slow way: by repeatedly scanning all of `txs`
+    /// rather than using the descendant index. Used by the mempool bench for timing comparisons and to check the index.
+    std::size_t growTxHashSetToIncludeDescendantsSlow(TxHashSet &txids) const;
+
+    /// Returns true if the descendant index has exactly the edges implied by the unconfirmedSpends of all the txs.
+    bool checkDescendantIndex(QString *errMsg = nullptr) const;
 #endif
 };
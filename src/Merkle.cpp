@@ -19,6 +19,7 @@
 #include "Merkle.h"
 #include "Util.h"
 
+#include "bitcoin/crypto/sha256.h"
 #include "bitcoin/hash.h"
 #include "bitcoin/uint256.h"
 
@@ -28,6 +29,40 @@
 
 namespace Merkle {
 
+    namespace {
+        using uint256 = bitcoin::uint256;
+        using UHashVec = std::vector<uint256>;
+        static_assert(sizeof(uint256) == HashLen, "Assumption is that a vector of uint256 is a contiguous hash buffer");
+
+        /// Appends [begin, end) to `out` (a contiguous buffer of 32-byte hashes).
+        void appendHashes(UHashVec &out, HashVec::const_iterator begin, HashVec::const_iterator end) {
+            for (auto it = begin; it != end; ++it) {
+                const auto & h = *it;
+                if (static_cast<size_t>(h.size()) == uint256::size()) {
+                    auto & back = out.emplace_back(uint256::Uninitialized);
+                    std::memcpy(back.data(), h.data(), back.size());
+                } else {
+                    // this should never happen -- indicates bad hash which is not of the right size.
+                    Warning() << "Merkle: encountered a hash that is not of size " << uint256::size()
+                              << " (size: " << h.size() << ", hash: " << QString::fromUtf8(h.toHex()) << ")";
+                    out.emplace_back();
+                }
+            }
+        }
+
+        /// Replaces `hashes` with the next level up of the merkle tree (duplicating the last hash first if the count
+        /// is odd). All of the pairs are hashed in place with a single SHA256D64 call, so that the multi-way kernels
+        /// (SHA-NI, SSE4.1, AVX2) get used when available.
+        void hashLevel(UHashVec &hashes) {
+            if (hashes.size() & 0x1u)
+                hashes.emplace_back(hashes.back());
+            const size_t n = hashes.size() / 2u;
+            if (n)
+                bitcoin::SHA256D64(hashes.front().data(), hashes.front().data(), n);
+            hashes.resize(n);
+        }
+    } // namespace
+
     BranchAndRootPair branchAndRoot(const HashVec &hashVec, unsigned index, const std::optional<unsigned> & optLen)
     {
         BranchAndRootPair ret;
@@ -44,34 +79,11 @@ namespace Merkle {
         }
         HashVec branch;
         branch.reserve(length);
-        using uint256 = bitcoin::uint256;
-        using UHashVec = std::vector<uint256>;
         UHashVec hashes;
         hashes.reserve(hvsz+1u);
 
-        // Copy all hashVec to our working vector, to start. This vector mutates as we iterate below.
-        for (const auto & h : hashVec) {
-            if (static_cast<size_t>(h.size()) == uint256::size()) {
-                auto & back = hashes.emplace_back(uint256::Uninitialized);
-                std::memcpy(back.data(), h.data(), std::min<size_t>(h.size(), back.size()));
-            } else {
-                // this should never happen -- indicates bad hash which is not of the right size.
-                Warning() << "Merkle::branchAndRoot encountered a hash that is not of size " << uint256::size()
-                          << " (size: " << h.size() << ", hash: " << QString::fromUtf8(h.toHex()) << ")";
-                hashes.emplace_back();
-            }
-        }
-
-        constexpr auto recomputeHashes = [](UHashVec & hashes) {
-            UHashVec hv;
-            const unsigned sz = unsigned(hashes.size());
-            hv.reserve( (sz / 2u) + 1u );
-            for (unsigned i = 0; i < sz; i+=2u) {
-                const auto &a = hashes[i], &b = hashes[i+1u];
-                hv.emplace_back(bitcoin::Hash(a.begin(), a.end(), b.begin(), b.end()));
-            }
-            hashes.swap(hv);
-        };
+        // Copy all hashVec to our working buffer, to start. Each level is computed in place in this buffer below.
+        appendHashes(hashes, hashVec.begin(), hashVec.end());
 
         for (unsigned i = 0; i < length; ++i) {
             if (hashes.size() & 0x1u) // is odd, add the end twice
@@ -80,7 +92,7 @@ namespace Merkle {
             const auto &h = hashes[index ^ 1u];
             branch.emplace_back(reinterpret_cast<const char *>(h.data()), QByteArray::size_type(h.size()));
             index >>= 1u;
-            recomputeHashes(hashes); // makes hashes be 1/2 the size each time
+            hashLevel(hashes); // makes hashes be 1/2 the size each time
         }
         if (UNLIKELY(hashes.empty())) {
             Error() << __PRETTY_FUNCTION__ << ": INTERNAL ERROR. Output vector is empty! FIXME!";
@@ -106,10 +118,16 @@ namespace Merkle {
         const unsigned hsz = unsigned(hashes.size());
         const unsigned size = 1u << depthHigher;
         ret.reserve(hsz/size + 1u);
+        UHashVec seg; // working buffer, re-used for each segment
+        seg.reserve(std::min(size, hsz) + 1u);
         for (unsigned i = 0; i < hsz; i += size) {
             const auto endIndex = std::min(i+size, hsz); // ensure we don't go past end of array
-            ret.emplace_back(
-                root(HashVec(hashes.begin()+i, hashes.begin()+endIndex), depthHigher) );
+            // equivalent to: root(HashVec(hashes.begin()+i, hashes.begin()+endIndex), depthHigher)
+            seg.clear();
+            appendHashes(seg, hashes.begin()+i, hashes.begin()+endIndex);
+            for (unsigned d = 0; d < depthHigher; ++d)
+                hashLevel(seg);
+            ret.emplace_back(reinterpret_cast<const char *>(seg.front().data()), QByteArray::size_type(HashLen));
         }
         return ret;
     }
@@ -1558,6 +1576,58 @@ namespace {
         const Tic t0;
         auto pair2 = Merkle::branchAndRoot(txs, 0);
         Log() << "Merkle took: " << t0.msecStr(4) << " msec";
+
+        // merkle root check against a naive 1-pair-at-a-time calculation
+        {
+            Merkle::HashVec hv = txs;
+            while (hv.size() > 1) {
+                if (hv.size() & 0x1u) hv.push_back(hv.back());
+                Merkle::HashVec next;
+                for (size_t i = 0; i < hv.size(); i += 2)
+                    next.push_back(BTC::HashTwo(hv[i], hv[i+1]));
+                hv.swap(next);
+            }
+            if (hv.front() != pair2.second)
+                throw Exception("Merkle root does not match the naive calculation!");
+            Log() << "Merkle root matches naive calculation";
+        }
+
+        // header-chain sized merkle cache level (this is what Merkle::Cache::initialize does at startup)
+        {
+            constexpr size_t nHeaders = 800'000;
+            Merkle::HashVec hdrs;
+            hdrs.reserve(nHeaders);
+            for (size_t i = 0; i < nHeaders; ++i)
+                hdrs.push_back(txs[i % txs.size()]);
+            const unsigned depthHigher = Merkle::treeDepth(unsigned(nHeaders)) / 2;
+            const Tic t1;
+            const auto lvl = Merkle::level(hdrs, depthHigher);
+            const double secs = t1.secs<double>();
+            Log() << "Merkle::level for " << nHeaders << " hashes (depthHigher: " << depthHigher << ", " << lvl.size()
+                  << " level hashes) took: " << t1.msecStr(4) << " msec, "
+                  << QString::number(nHeaders / std::max(secs, 1e-9) / 1e6, 'f', 3) << " M hashes/sec";
+        }
+
+        // per-kernel throughput of the batched double-sha256 of 64-byte blobs, as used for every level above
+        Log() << "Using sha256: " << QString::fromStdString(bitcoin::SHA256AutoDetect());
+        constexpr size_t nBlocks = 1'000'000;
+        QByteArray in(int(nBlocks * 64), Qt::Uninitialized);
+        QRandomGenerator::securelySeeded().fillRange(reinterpret_cast<uint32_t *>(in.data()), in.size() / int(sizeof(uint32_t)));
+        QByteArray expected(int(nBlocks * 32), Qt::Uninitialized), out(int(nBlocks * 32), Qt::Uninitialized);
+        const auto inPtr = reinterpret_cast<const uint8_t *>(in.constData());
+        bitcoin::SHA256D64Kernel(1, reinterpret_cast<uint8_t *>(expected.data()), inPtr, nBlocks);
+        for (const unsigned ways : {1u, 2u, 4u, 8u}) {
+            const Tic t2;
+            if (!bitcoin::SHA256D64Kernel(ways, reinterpret_cast<uint8_t *>(out.data()), inPtr, nBlocks)) {
+                Log() << "SHA256D64 " << ways << "-way: not available";
+                continue;
+            }
+            const double secs = t2.secs<double>();
+            if (out != expected)
+                throw Exception(QString("SHA256D64 %1-way output differs from the 1-way output!").arg(ways));
+            Log() << "SHA256D64 " << ways << "-way: " << nBlocks << " hashes in " << t2.msecStr(2) << " msec, "
+                  << QString::number(nBlocks / std::max(secs, 1e-9) / 1e6, 'f', 3) << " M hashes/sec";
+        }
     }
     static const auto test_ = App::registerTest("merkle", &test);
     static const auto bench_ = App::registerBench("merkle", &bench);
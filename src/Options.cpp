@@ -150,14 +150,19 @@ QVariantMap Options::toMap() const
     // bitcoind_throttle params
     const auto [hi, lo, decay] = bdReqThrottleParams.load();
     m["bitcoind_throttle"] = QVariantList{ hi, lo, decay };
+    // cpu_limit_per_ip params
+    const auto [costRate, costBurst] = costLimitParams.load();
+    m["cpu_limit_per_ip"] = QVariantList{ costRate, costBurst };
     // max_subs_per_ip & max_subs
     m["max_subs_per_ip"] = qlonglong(maxSubsPerIP);
     m["max_subs"] = qlonglong(maxSubsGlobally);
+    m["persist_status_cache"] = persistStatusCache;
     // db advanced options
     m["db_max_open_files"] = qlonglong(db.maxOpenFiles);
     m["db_keep_log_file_num"] = qlonglong(db.keepLogFileNum);
     m["db_mem"] = double(db.maxMem / 1024.0 / 1024.0);
     m["db_use_fsync"] = db.useFsync;
+    m["db_history_chunked"] = db.historyChunked;
     // ts-format
     m["ts-format"] = logTimestampModeString();
     // tls-disallow-deprecated
@@ -195,6 +200,11 @@ bool Options::BdReqThrottleParams::isValid() const noexcept
             && decay >= minBDReqDecayPerSec && decay <= maxBDReqDecayPerSec;
 }
 
+bool Options::CostLimitParams::isValid() const noexcept
+{
+    return rate >= 0 && rate <= maxCostLimitRate && burst >= 0 && burst <= maxCostLimitBurst && (rate == 0 || burst >= rate);
+}
+
 /* static */
 bool Options::isSimdJson() { return RPC::isFastJson(); }
 /* static */
@@ -174,6 +174,19 @@ public:
     /// Comes from a triplet in config, if specified e.g.: "bitcoind_throttle = 50, 20, 10"
     AtomicStruct<BdReqThrottleParams> bdReqThrottleParams;
 
+    static constexpr int defaultCostLimitRate = 500, defaultCostLimitBurst = 10'000;
+    static constexpr int maxCostLimitRate = 1'000'000, maxCostLimitBurst = 3'600'000;
+    /// Per-IP CPU cost limit params. Each IP address has a token bucket denominated in msec of thread pool work time.
+    /// See ServerBase::onMessage for how these are used.
+    struct CostLimitParams {
+        int rate = defaultCostLimitRate,   ///< msec of work credited to each IP per second. 0 = disabled
+            burst = defaultCostLimitBurst; ///< the maximum credit (in msec) an IP may accumulate
+        bool isValid() const noexcept;
+        bool isEnabled() const noexcept { return rate > 0; }
+    };
+    /// Comes from a pair in config, if specified e.g.: "cpu_limit_per_ip = 500, 10000"
+    AtomicStruct<CostLimitParams> costLimitParams;
+
     static constexpr int64_t defaultMaxSubsPerIP = 75'000, maxSubsPerIPMin = 500, maxSubsPerIPMax = std::numeric_limits<int>::max()/2; // 75k, 500, 10^30 (~1bln) respectively
     static constexpr int64_t defaultMaxSubsGlobally = 10'000'000, maxSubsGloballyMin = 5000, maxSubsGloballyMax = std::numeric_limits<int>::max(); // 10 mln, 5k, 10^31 (~2bln) respectively
     int64_t maxSubsPerIP = defaultMaxSubsPerIP; // 75k subs per IP ought to be plenty. User can set this in `max_subs_per_ip` in conf.
@@ -181,6 +194,10 @@ public:
     static constexpr bool isMaxSubsPerIPSettingInBounds(int64_t m) { return m >= maxSubsPerIPMin && m <= maxSubsPerIPMax; }
     static constexpr bool isMaxSubsGloballySettingInBounds(int64_t m) { return m >= maxSubsGloballyMin && m <= maxSubsGloballyMax; }
 
+    /// comes from config 'persist_status_cache'. If true, the scripthash status cache is saved to the datadir on
+    /// shutdown and loaded again on startup.
+    bool persistStatusCache = false;
+
     QString dumpScriptHashes;  ///< if specified, a file path to which to dump all scripthashes as JSON, corresponds to --dump-sh CLI arg
 
     struct DBOpts {
@@ -202,6 +219,12 @@ public:
         /// db_use_fsync in conf file -- default false
         static constexpr bool defaultUseFsync = false;
         bool useFsync = defaultUseFsync;
+
+        /// db_history_chunked in conf file -- default false. If true, the scripthash_history table stores each
+        /// scripthash's history as several rows, one per range of TxNums (see Storage.h). Changing this setting on an
+        /// existing datadir converts the table on the next startup.
+        static constexpr bool defaultHistoryChunked = false;
+        bool historyChunked = defaultHistoryChunked;
     };
     DBOpts db;
 
@@ -25,6 +25,7 @@
 
 #include <atomic>
 #include <memory>
+#include <mutex>
 #include <type_traits>
 #include <utility>
 
@@ -263,6 +264,31 @@ namespace RPC {
         return ret;
     }
 
+    struct SharedNotification::Data {
+        const QString method;
+        const QVariantList params;
+        std::once_flag once[2]; ///< index 0 = v2, 1 = v1
+        QByteArray json[2];
+
+        Data(const QString &m, const QVariantList &pl) : method(m), params(pl) {}
+    };
+
+    SharedNotification::SharedNotification(const QString &method, const QVariantList &params)
+        : p(std::make_shared<Data>(method, params))
+    {}
+
+    QString SharedNotification::method() const { return p ? p->method : QString{}; }
+
+    QByteArray SharedNotification::json(bool v1) const
+    {
+        if (!p) return {};
+        const unsigned idx = v1 ? 1 : 0;
+        std::call_once(p->once[idx], [this, v1, idx]{
+            p->json[idx] = Message::makeNotification(p->method, p->params, v1).toJsonUtf8();
+        });
+        return p->json[idx];
+    }
+
     ConnectionBase::ConnectionBase(const MethodMap * methods_, IdMixin::Id id_in, QObject *parent, qint64 maxBuffer_)
         : AbstractConnection(id_in, parent, maxBuffer_), methods(methods_ ? *methods_ : EmptyMethodMap)
     {
@@ -278,6 +304,8 @@ namespace RPC {
         // connection will be auto-disconnected on socket disconnect
         connectedConns.push_back(connect(this, &ConnectionBase::sendNotification, this, &ConnectionBase::_sendNotification));
         // connection will be auto-disconnected on socket disconnect
+        connectedConns.push_back(connect(this, &ConnectionBase::sendSharedNotification, this, &ConnectionBase::_sendSharedNotification));
+        // connection will be auto-disconnected on socket disconnect
         connectedConns.push_back(connect(this, &ConnectionBase::sendError, this, &ConnectionBase::_sendError));
         // connection will be auto-disconnected on socket disconnect
         connectedConns.push_back(connect(this, &ConnectionBase::sendResult, this, &ConnectionBase::_sendResult));
@@ -336,7 +364,7 @@ namespace RPC {
 
         TraceM("Sending json: ", Util::Ellipsify(jsonData));
         ++nRequestsSent;
-        // below send() ends up calling do_write immediately (which is connected to send)
+        // below send() ends up calling do_write immediately (which is connected to send), which enqueues the data for flushing
         emit send( wrapForSend(std::move(jsonData)) );
     }
     void ConnectionBase::_sendNotification(const QString &method, const QVariant & params)
@@ -362,7 +390,25 @@ namespace RPC {
         }
         TraceM("Sending json: ", Util::Ellipsify(json));
         ++nNotificationsSent;
-        // below send() ends up calling do_write immediately (which is connected to send)
+        // below send() ends up calling do_write immediately (which is connected to send), which enqueues the data for flushing
+        emit send( wrapForSend(std::move(json)) );
+    }
+    void ConnectionBase::_sendSharedNotification(const SharedNotification &notif)
+    {
+        if (status != Connected || !socket) {
+            DebugM(__func__, " method: ", notif.method(), "; Not connected! ", "(id: ", this->id, "), forcing on_disconnect ...");
+            // the below ensures socket cleanup code runs.  This guarantees a disconnect & cleanup on bad socket state.
+            do_disconnect();
+            return;
+        }
+        QByteArray json = notif.json(v1); // shallow copy of the bytes shared by all recipients
+        if (json.isEmpty()) {
+            Error() << __func__ << " method: " << notif.method() << "; Unable to generate notification JSON! FIXME!";
+            return;
+        }
+        TraceM("Sending shared json: ", Util::Ellipsify(json));
+        ++nNotificationsSent;
+        // below send() ends up calling do_write immediately (which is connected to send), which enqueues the data for flushing
         emit send( wrapForSend(std::move(json)) );
     }
     void ConnectionBase::_sendError(bool disc, int code, const QString &msg, BatchId batchId, const Message::Id & reqId)
@@ -389,7 +435,7 @@ namespace RPC {
         }
         TraceM("Sending json: ", Util::Ellipsify(json));
         ++nErrorsSent;
-        // below send() ends up calling do_write immediately (which is connected to send)
+        // below send() ends up calling do_write immediately (which is connected to send), which enqueues the data for flushing
         emit send( wrapForSend(std::move(json)) );
         if (disc) {
             do_disconnect(true); // graceful disconnect
@@ -422,7 +468,7 @@ namespace RPC {
         }
         TraceM("Sending result json: ", Util::Ellipsify(json));
         ++nResultsSent;
-        // below send() ends up calling do_write immediately (which is connected to send)
+        // below send() ends up calling do_write immediately (which is connected to send), which enqueues the data for flushing
         emit send( wrapForSend(std::move(json)) );
     }
 
@@ -719,7 +765,7 @@ namespace RPC {
         // is available.
         while (!isBad() && socket && (ws ? ws->messagesAvailable() > 0 : socket->canReadLine())) {
             // check if paused -- we may get paused inside processJson below
-            if (readPaused) {
+            if (isReadPaused()) {
                 skippedOnReadyRead = true;
                 DebugM(prettyName(), " reads paused, skipping on_readyRead",
                        " (bufsz: ", QString::number(socket->bytesAvailable()/1024.0, 'f', 1), " KB) ...");
@@ -765,13 +811,29 @@ namespace RPC {
 #endif
         if (!!b == !!readPaused)
             return; // already set
+        const bool wasPaused = isReadPaused();
+        readPaused = b;
+        readPausedMaybeChanged(wasPaused);
+    }
+
+    void ElectrumConnection::on_outputBackpressure(bool on)
+    {
+        const bool wasPaused = isReadPaused();
+        outputPaused = on;
+        readPausedMaybeChanged(wasPaused);
+    }
+
+    void ElectrumConnection::readPausedMaybeChanged(bool wasPaused)
+    {
+        const bool paused = isReadPaused();
+        if (paused == wasPaused)
+            return; // effective state unchanged
         const bool hadSkips = skippedOnReadyRead;
         skippedOnReadyRead = false;
-        readPaused = b;
-        if (!readPaused && hadSkips)
+        if (!paused && hadSkips)
             // we had some skipped on_readyReads() -- resume
             QTimer::singleShot(0, this, [this]{on_readyRead();} );
-        emit readPausedStateChanged(readPaused);
+        emit readPausedStateChanged(paused);
     }
 
     void ElectrumConnection::memoryWasteDoSProtection()
@@ -1261,7 +1323,7 @@ namespace RPC {
                 auto json = Json::toUtf8(l, true);
                 l.clear(); // clear memory right away
                 TraceM("Sending result json: ", Util::Ellipsify(json));
-                // below send() ends up calling do_write immediately (which is connected to send)
+                // below send() ends up calling do_write immediately (which is connected to send), which enqueues the data for flushing
                 emit conn.send( conn.wrapForSend(std::move(json)) );
             }
             if (batch.errCt && (conn.errorPolicy & conn.ErrorPolicyDisconnect)) {
@@ -191,6 +191,30 @@ namespace RPC {
 
     using MethodMap = QHash<QString, Method>;
 
+    /// An immutable, implicitly-shared notification message. Its JSON is generated lazily, at most once per JSON-RPC
+    /// flavor (v1 or v2), no matter how many connections it is sent to. The resulting QByteArray is itself implicitly
+    /// shared, so all recipients reference the same serialized bytes. Used for notifications that fan out to many
+    /// clients at once (header and scripthash status notifications).
+    ///
+    /// Copies are cheap (a shared_ptr copy). All methods are thread-safe.
+    class SharedNotification
+    {
+        struct Data;
+        std::shared_ptr<Data> p;
+    public:
+        SharedNotification() noexcept = default;
+        SharedNotification(const QString &method, const QVariantList &params);
+
+        bool isNull() const noexcept { return !p; }
+        /// Returns the method name, or an empty string if isNull()
+        QString method() const;
+        /// Returns the serialized JSON for this notification. Returns an empty QByteArray if isNull() or on error.
+        /// The first call (per `v1` flavor) does the serialization; subsequent calls return the cached bytes.
+        QByteArray json(bool v1) const;
+        /// The number of SharedNotification instances referencing the same underlying message.
+        long useCount() const noexcept { return p.use_count(); }
+    };
+
     // forward declarations because these are used in ConnectionBase
     class BatchProcessor;
 
@@ -360,6 +384,9 @@ namespace RPC {
         void sendRequest(const RPC::Message::Id & reqid, const QString &method, const QVariantList & params = {});
         /// Call (emit) this to send a notification to the peer
         void sendNotification(const QString &method, const QVariant & params);
+        /// Like sendNotification, but the JSON is shared with (and generated at most once for) all other connections
+        /// the same SharedNotification is sent to.
+        void sendSharedNotification(const RPC::SharedNotification &notif);
         /// Call (emit) this to send an error message to the peer.
         /// @param `batchId` is the batch this error pertains to, if it is in response to a request from a batch,
         /// otherwise may be .isNull() (response will be sent immediately, and not collated to any batch in that case)
@@ -391,6 +418,7 @@ namespace RPC {
         void _sendRequest(const RPC::Message::Id & reqid, const QString &method, const QVariantList & params = {});
         // ditto for notifications
         void _sendNotification(const QString &method, const QVariant & params);
+        void _sendSharedNotification(const RPC::SharedNotification &notif);
         /// Actual implementation of sendError, runs in our thread context.
         void _sendError(bool disconnect, int errorCode, const QString &message, RPC::BatchId batchId, const RPC::Message::Id &reqid = {});
         /// Actual implementation of sendResult, runs in our thread context.
@@ -556,9 +584,13 @@ namespace RPC {
         using ConnectionBase::ConnectionBase;
         ~ElectrumConnection() override; ///< for vtable
 
-        // the below two can/should only be called from the same thread as this object's thread
+        // the below three can/should only be called from the same thread as this object's thread
         void setReadPaused(bool);
-        bool isReadPaused() const override { return readPaused; }
+        /// Returns true if reading (and thus request processing) is paused, either because setReadPaused(true) was
+        /// called, or because the peer is not reading our output fast enough (see on_outputBackpressure()).
+        bool isReadPaused() const override { return readPaused || outputPaused; }
+        /// Returns true only if setReadPaused(true) was called (ignores the output backpressure state).
+        bool isReadPauseRequested() const { return readPaused; }
 
         /// Reimplemented from AbstractConnection.
         /// Returns true if the socket is wrapped by a WebSocket::Wrapper, false otherwise.
@@ -572,6 +604,11 @@ namespace RPC {
         /// implements pure virtual from super to handle linefeed-based JSON. When a full line arrives, calls ConnectionBase::processJson
         void on_readyRead() override;
         QByteArray wrapForSend(QByteArray &&) override;
+        /// Reimplemented from AbstractConnection. Pauses reads while our unsent output is above the high watermark.
+        void on_outputBackpressure(bool on) override;
+        /// Subclasses that add their own pause conditions to isReadPaused() must call this after modifying them,
+        /// passing the previous value of isReadPaused().
+        void readPausedMaybeChanged(bool wasPaused);
 
     private:
         qint64 memoryWasteThreshold = -1; ///< gets lazy-initialized in memoryWasteDoSProtection below
@@ -579,6 +616,7 @@ namespace RPC {
         void memoryWasteDoSProtection(); ///< must be called from on_readyRead only.
 
         bool readPaused = false;
+        bool outputPaused = false; ///< set by on_outputBackpressure()
         bool skippedOnReadyRead = false;
         std::optional<WebSocket::Wrapper *> webSocket; ///< set once the first time on_readyRead() or wrapForSend() is called. If set and valid, affects the framing behavior of this class.
         WebSocket::Wrapper *checkSetGetWebSocket();
@@ -634,3 +672,4 @@ namespace RPC {
 Q_DECLARE_METATYPE(RPC::Message);
 Q_DECLARE_METATYPE(RPC::Message::Id);
 Q_DECLARE_METATYPE(RPC::BatchId);
+Q_DECLARE_METATYPE(RPC::SharedNotification);
@@ -204,6 +204,30 @@ std::vector<QByteArray> RecordFile::readRecords(uint64_t recNumStart, size_t cou
     return ret;
 }
 
+QByteArray RecordFile::readRecordsContiguous(uint64_t recNumStart, size_t count, QString *errStr) const
+{
+    std::shared_lock g(rwlock);
+    QByteArray ret;
+    if (!count || recNumStart >= nrecs || count > nrecs - recNumStart) {
+        if (errStr) *errStr = "readRecordsContiguous specification is out of range";
+        return ret;
+    }
+    QFile f(fileName());
+    if (!f.open(QIODevice::ReadOnly|QIODevice::ExistingOnly) || !f.seek(offsetOfRec(recNumStart))) {
+        if (errStr) *errStr = QString("Unable to open or seek in file %1 (error was: '%2')").arg(fileName(), f.errorString());
+        return ret;
+    }
+    const qint64 nBytes = qint64(count * recsz);
+    ret = f.read(nBytes);
+    if (ret.size() != nBytes) {
+        if (errStr)
+            *errStr = QString("Short read of %1 records starting at %2 from file %3 (error was: '%4')")
+                             .arg(count).arg(recNumStart).arg(f.fileName(), f.errorString());
+        ret.clear();
+    }
+    return ret;
+}
+
 uint64_t RecordFile::truncate(uint64_t newNRecs, QString *errStr)
 {
     if (newNRecs >= nrecs) {
@@ -460,6 +484,22 @@ namespace {
             Log() << "Truncated file to size " << f.numRecords() << " and verified in "<< t0.msecStr() << " msec";
             ++nChecksOK;
         }
+        {
+            t0 = Tic();
+            // read everything in 1 go and verify
+            RecordFile f(fileName, HashLen);
+            QString fail;
+            const auto blob = f.readRecordsContiguous(0, f.numRecords(), &fail);
+            if (!fail.isEmpty() || size_t(blob.size()) != f.numRecords() * HashLen)
+                throw Exception(QString("Failed to read all records contiguously: %1").arg(fail));
+            for (size_t i = 0; i < f.numRecords(); ++i)
+                if (blob.mid(int(i * HashLen), int(HashLen)) != hashes[i])
+                    throw Exception(QString("Contiguous read: record %1 does not compare equal!").arg(i));
+            if (!f.readRecordsContiguous(1, f.numRecords()).isEmpty())
+                throw Exception("Contiguous read past the end of the file should have failed!");
+            Log() << "Read " << f.numRecords() << " records contiguously and verified in " << t0.msecStr() << " msec";
+            ++nChecksOK;
+        }
         {
             t0 = Tic();
             // truncate the file to 0, then write N / 10 records using single-append calls and verify
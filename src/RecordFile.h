@@ -64,6 +64,11 @@ public:
     /// (and *errStr will contain the error message).
     std::vector<QByteArray> readRecords(uint64_t recNumStart, size_t count, QString *errStr = nullptr) const;
 
+    /// Thread-safe. Like the above but reads all `count` records using a single read() call, returning them
+    /// back-to-back in one QByteArray of size count * recordSize(). Useful for loading a whole file of small records
+    /// in one go. Returns an empty QByteArray on error (or if the specification is out of range) and sets *errStr.
+    QByteArray readRecordsContiguous(uint64_t recNumStart, size_t count, QString *errStr = nullptr) const;
+
     /// Thread-safe.  Implicitly opens a private copy of the file and reads recNums from the file. Under non-error
     /// circumstances, the returned array will be of the same size as the recNums array, with corresponding indices
     /// containing the data obtained per recNum.  On error the returned array will be shorter than anticipated
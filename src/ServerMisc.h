@@ -40,6 +40,9 @@ namespace ServerMisc
     inline constexpr double kMaxSubsPerIPWarningsRateLimitSecs = 1.0;
     /// The rate limit for suppression of dupe per-IP "connection limit exceeded" warnings to log.
     inline constexpr double kMaxClientsPerIPWarningRateLimitSecs = 5.0;
+    /// The maximum number of scripthashes a client may pass to blockchain.scripthash.subscribe_many and
+    /// blockchain.scripthash.get_status_many (advertised in server.features as "scripthash_bulk_max").
+    inline constexpr int kMaxScriptHashesPerBulkRequest = 1000;
     /// This key is used in the stats() map for each Server instance to save bloom filter info
     inline constexpr auto kBloomFiltersKey = "bloom filters";
 }
@@ -36,6 +36,7 @@
 #include <QCoreApplication>
 #include <QFile>
 #include <QFileInfo>
+#include <QPointer>
 #include <QtNetwork>
 #include <QSslCertificate>
 #include <QSslKey>
@@ -45,17 +46,30 @@
 #include <QTimer>
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cmath>
 #include <cstdlib>
+#include <deque>
 #include <iostream>
 #include <limits>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <shared_mutex>
 #include <type_traits>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
+#if defined(Q_OS_WIN)
+#  include <winsock2.h>        // for getpeername(), closesocket()
+#  include <ws2tcpip.h>        // for sockaddr_storage
+#elif defined(Q_OS_UNIX)
+#  include <sys/socket.h>      // for getpeername(), sockaddr_storage
+#  include <unistd.h>          // for close()
+#endif
+
 TcpServerError::~TcpServerError() {} // for vtable
 
 AbstractTcpServer::AbstractTcpServer(const QHostAddress &a, quint16 p)
@@ -355,11 +369,30 @@ namespace {
     }
 } // namespace
 
+/// Per-ServerBase cache of bitcoind RPC results. See generic_async_to_bitcoind_cached().
+struct ServerBase::BitcoinDCache
+{
+    struct Waiter {
+        IdMixin::Id clientId;
+        RPC::BatchId batchId;
+        RPC::Message::Id reqId;
+    };
+    struct Hasher {
+        std::size_t operator()(const QByteArray &k) const { return Util::hashForStd(k); }
+    };
+    static constexpr std::size_t kMaxEntries = 1000; ///< we stop caching new results past this many (per epoch)
+    QByteArray epoch; ///< tip height + tip hash + mempool histogram generation; `results` is cleared when this changes
+    std::unordered_map<QByteArray, QVariant, Hasher> results; ///< keyed on epoch + method + params
+    std::unordered_map<QByteArray, std::vector<Waiter>, Hasher> pending; ///< requests currently out to bitcoind
+    quint64 nHits = 0, nMisses = 0, nCoalesced = 0;
+};
+
 ServerBase::ServerBase(SrvMgr *sm,
                        const RPC::MethodMap & methods, const DispatchTable & dispatchTable,
                        const QHostAddress & a, quint16 p, const std::shared_ptr<const Options> & opts,
                        const std::shared_ptr<Storage> & st, const std::shared_ptr<BitcoinDMgr> & bdm)
-    : AbstractTcpServer(a, p), srvmgr(sm), methods(methods), dispatchTable(dispatchTable), options(opts), storage(st), bitcoindmgr(bdm)
+    : AbstractTcpServer(a, p), srvmgr(sm), methods(methods), dispatchTable(dispatchTable),
+      bdCache(std::make_unique<BitcoinDCache>()), options(opts), storage(st), bitcoindmgr(bdm)
 {
     if (!options || !storage || !bitcoindmgr)
         // defensive programming
@@ -390,6 +423,7 @@ QVariant ServerBase::stats() const
         map["nTxSent"] = client->info.nTxSent;
         map["nTxBytesSent"] = client->info.nTxBytesSent;
         map["nTxBroadcastErrors"] = client->info.nTxBroadcastErrors;
+        map["nCostDelayedMessages"] = qulonglong(client->costDelayedMessages.size());
         // data from the per-ip structure
         map["perIPData"] = [client]{
             QVariantMap m;
@@ -399,6 +433,9 @@ QVariant ServerBase::stats() const
             m["isWhiteListed"] = client->perIPData->isWhitelisted();
             m["nExtantBatchRequests"] = qlonglong(client->perIPData->nExtantBatchRequests.load());
             m["extantBatchRequestCosts"] = qlonglong(client->perIPData->extantBatchRequestCosts.load());
+            m["cpuMsec"] = qulonglong(client->perIPData->costUsec_cum.load() / 1000u);
+            m["cpuCreditMsec"] = std::round(client->perIPData->costCreditNoRefill() * 10.0) / 10.0;
+            m["nCostDelays"] = qulonglong(client->perIPData->nCostDelays.load());
             return m;
         }();
         // the below don't really make much sense for this class (they are always 0 or empty)
@@ -410,6 +447,25 @@ QVariant ServerBase::stats() const
         clientList.append(QVariantMap({{name, map}}));
     }
     m["clients"] = clientList;
+    {
+        const auto & bc = *bdCache;
+        const quint64 nReqs = bc.nHits + bc.nCoalesced + bc.nMisses;
+        m["bitcoindCache"] = QVariantMap{
+            { "hits", qulonglong(bc.nHits) },
+            { "coalesced", qulonglong(bc.nCoalesced) },
+            { "misses", qulonglong(bc.nMisses) },
+            { "hitRate", nReqs ? QString::number(double(bc.nHits + bc.nCoalesced) / double(nReqs), 'f', 3) : QVariant() },
+            { "bitcoindCallsAvoided", qulonglong(bc.nHits + bc.nCoalesced) },
+            { "entries", qulonglong(bc.results.size()) },
+            { "inFlight", qulonglong(bc.pending.size()) },
+        };
+    }
+    m["rejectedConnections"] = QVariantMap{
+        { "banned", qulonglong(rejectCounts.banned) },
+        { "connLimitEarly", qulonglong(rejectCounts.connLimitEarly) },
+        { "connLimitLate", qulonglong(rejectCounts.connLimitLate) },
+        { "noPeerAddress", qulonglong(rejectCounts.noPeerAddress) },
+    };
     return QVariantMap{{prettyName(), m}};
 }
 
@@ -449,26 +505,110 @@ std::shared_ptr<Client::PerIPData> Client::PerIPDataHolder_Temp::take(QTcpSocket
 }
 // -- /Client :: PerIPDataHolder_Temp
 
+// -- Client :: PerIPData
+void Client::PerIPData::chargeCost(qint64 usec)
+{
+    if (usec <= 0) return;
+    costUsec_cum += uint64_t(usec);
+    std::lock_guard g(costMut);
+    costTokens -= double(usec) / 1e3;
+}
+double Client::PerIPData::costCredit(const Options::CostLimitParams &params)
+{
+    const qint64 now = Util::getTime();
+    std::lock_guard g(costMut);
+    if (!costLastRefill)
+        costTokens = params.burst; // first time through: start out with a full bucket
+    else if (now > costLastRefill)
+        costTokens = std::min(costTokens + double(now - costLastRefill) * params.rate / 1e3, double(params.burst));
+    costLastRefill = now;
+    return costTokens;
+}
+double Client::PerIPData::costCreditNoRefill() const
+{
+    std::lock_guard g(costMut);
+    return costTokens;
+}
+// -- /Client :: PerIPData
+
+namespace {
+    void logConnectionLimitReached(Client::PerIPData &perIPData, const QHostAddress &addr, int maxPerIP)
+    {
+        if (const qint64 now = Util::getTime(), last = perIPData.lastConnectionLimitReachedWarning.load();
+                !last || (now - last)/1e3 >= ServerMisc::kMaxClientsPerIPWarningRateLimitSecs) {
+            // Rate-limit the spam of this log message to once every 5 seconds, per IP.  We must do this rate-
+            // limiting of the log message because some port scanners (or abusers) ended up filling our logs with
+            // this message. (Note there is a potential race here in that 2 threads may enter here at once and
+            // update this timestamp simultaneously. This is acceptable for this code here which doesn't need to be
+            // 100% precise, just "good enough" to rate limit log messages most of the time).
+            perIPData.lastConnectionLimitReachedWarning.store(now);
+            Log() << "Connection limit (" << maxPerIP << ") exceeded for " << addr.toString() << ", connection refused";
+        }
+    }
+} // namespace
+
+bool ServerBase::earlyRejectDescriptor(qintptr socketDescriptor)
+{
+#if defined(Q_OS_WIN) || defined(Q_OS_UNIX)
+    sockaddr_storage ss{};
+#  ifdef Q_OS_WIN
+    const auto fd = static_cast<SOCKET>(socketDescriptor);
+    int len = sizeof(ss);
+#  else
+    const auto fd = static_cast<int>(socketDescriptor);
+    socklen_t len = sizeof(ss);
+#  endif
+    if (::getpeername(fd, reinterpret_cast<sockaddr *>(&ss), &len) != 0)
+        // Peer may have already gone away. Let the normal path deal with this fd.
+        return false;
+    const QHostAddress addr(reinterpret_cast<const sockaddr *>(&ss));
+    if (UNLIKELY(addr.isNull()))
+        return false;
+
+    bool reject = false;
+    if (srvmgr->isIPBanned(addr, true)) {
+        // Not logged at the normal level since a banned host that keeps reconnecting would otherwise spam the log.
+        DebugM("Rejecting connection from ", addr.toString(), " (banned)");
+        ++rejectCounts.banned;
+        reject = true;
+    } else if (const auto maxPerIP = options->maxClientsPerIP; maxPerIP > 0) {
+        // Note: we only look up existing per-IP data here; a new IP cannot be over the limit, and we don't want a
+        // flood of connections from many distinct IPs to grow the per-IP table before any real checks are done.
+        if (const auto perIPData = srvmgr->findExistingPerIPData(addr);
+                perIPData && !perIPData->isWhitelisted() && perIPData->nClients >= maxPerIP) {
+            logConnectionLimitReached(*perIPData, addr, maxPerIP);
+            ++rejectCounts.connLimitEarly;
+            reject = true;
+        }
+    }
+    if (reject) {
+#  ifdef Q_OS_WIN
+        ::closesocket(fd);
+#  else
+        ::close(fd);
+#  endif
+    }
+    return reject;
+#else
+    // Unknown platform: we don't know how to query or close the raw descriptor, so rely on the later checks.
+    Q_UNUSED(socketDescriptor);
+    return false;
+#endif
+}
+
 bool ServerBase::attachPerIPDataAndCheckLimits(QTcpSocket *socket)
 {
     bool ok = true;
     if (const auto addr = socket->peerAddress(); LIKELY(!addr.isNull())) {
         auto holder = new Client::PerIPDataHolder_Temp(srvmgr->getOrCreatePerIPData(addr), socket); // `new` ok; owned by `socket` (parent QObject)
         const auto maxPerIP = options->maxClientsPerIP;
-        // check connection limit immediately
+        // check connection limit immediately (this catches races that earlyRejectDescriptor() could not see, such as
+        // connections from the same IP arriving on other server threads at the same time)
         if (const auto & perIPData = holder->perIPData;
                 maxPerIP > 0 && !perIPData->isWhitelisted() && perIPData->nClients > maxPerIP) {
             // limit reached -- reject connection here
-            if (const qint64 now = Util::getTime(), last = perIPData->lastConnectionLimitReachedWarning.load();
-                    !last || (now - last)/1e3 >= ServerMisc::kMaxClientsPerIPWarningRateLimitSecs) {
-                // Rate-limit the spam of this log message to once every 5 seconds, per IP.  We must do this rate-
-                // limiting of the log message because some port scanners (or abusers) ended up filling our logs with
-                // this message. (Note there is a potential race here in that 2 threads may enter here at once and
-                // update this timestamp simultaneously. This is acceptable for this code here which doesn't need to be
-                // 100% precise, just "good enough" to rate limit log messages most of the time).
-                perIPData->lastConnectionLimitReachedWarning.store(now);
-                Log() << "Connection limit (" << maxPerIP << ") exceeded for " << addr.toString() << ", connection refused";
-            }
+            logConnectionLimitReached(*perIPData, addr, maxPerIP);
+            ++rejectCounts.connLimitLate;
             ok = false;
         }
     } else {
@@ -476,6 +616,7 @@ bool ServerBase::attachPerIPDataAndCheckLimits(QTcpSocket *socket)
         // begin processing, so socket->peerAddress() returns a null address since it cannot get any address
         // from the kernel.
         Warning() << "Could not create per-IP data in " << __func__ << " -- client may have already disconnected!";
+        ++rejectCounts.noPeerAddress;
         ok = false;
     }
     if (!ok) {
@@ -490,6 +631,9 @@ bool ServerBase::attachPerIPDataAndCheckLimits(QTcpSocket *socket)
 template <typename SockType, typename /* enable if .. */>
 SockType *ServerBase::createSocketFromDescriptorAndCheckLimits(qintptr socketDescriptor)
 {
+    // cheap checks on the raw fd first, so that banned or over-limit peers cost us no Qt socket objects or handshakes
+    if (earlyRejectDescriptor(socketDescriptor))
+        return nullptr;
     auto socket = new SockType(this);
     if (!socket->setSocketDescriptor(socketDescriptor)) {
         /// This branch won't ever be taken unless somehow this class or a derived class ends up being radically
@@ -659,32 +803,72 @@ void ServerBase::onMessage(IdMixin::Id clientId, RPC::BatchId batchId, const RPC
 {
     TraceM("onMessage: ", clientId, ", ", batchId.get(), " json: ", m.toJsonUtf8());
     if (Client *c = getClient(clientId); c) {
-        const auto member = dispatchTable.value(m.method);
-        if (!member)
-            Error() << "Unknown method: \"" << m.method << "\". This shouldn't happen. FIXME! Json: " << m.toJsonUtf8();
-        else {
-            // indicate a good request, accepted request
-            ++c->info.nRequestsRcv;
-            try {
-                // call ptr to member -- note member is free to throw if it wants to send an error immediately
-                (this->*member)(c, batchId, m);
-            } catch (const RPCError & e) {
-                emit c->sendError(e.disconnect, e.code, e.what(), batchId, m.id);
-            } catch (const std::exception & e) {
-                // log this unexpected exception, so we get bug reports hopefully if this ever happens
-                Warning() << "Unexpected exception thrown while processing RPC request \"" << m.method
-                          << "\" for client " << c->id << ", exception: " << e.what();
-                emit c->sendError(false, RPC::ErrorCodes::Code_InternalError,
-                                  QString("internal error: %1").arg(e.what()),  batchId, m.id);
-            } catch (...) {
-                Warning() << "Unknown exception thrown while processing RPC request \"" << m.method << "\" for client " << c->id;
-                emit c->sendError(false, RPC::ErrorCodes::Code_InternalError, "internal error: unknown", batchId, m.id);
-            }
-        }
+        if (UNLIKELY(!c->costDelayedMessages.empty() || isOverCostBudget(c)))
+            // This client's IP has used up its CPU budget; delay the request until the budget refills. Note that if
+            // requests are already delayed, we must also delay this one so as to preserve request ordering.
+            delayMessage(c, batchId, m);
+        else
+            dispatchMessage(c, batchId, m);
     } else {
         DebugM("Unknown client: ", clientId);
     }
 }
+void ServerBase::dispatchMessage(Client *c, RPC::BatchId batchId, const RPC::Message &m)
+{
+    const auto member = dispatchTable.value(m.method);
+    if (!member)
+        Error() << "Unknown method: \"" << m.method << "\". This shouldn't happen. FIXME! Json: " << m.toJsonUtf8();
+    else {
+        // indicate a good request, accepted request
+        ++c->info.nRequestsRcv;
+        try {
+            // call ptr to member -- note member is free to throw if it wants to send an error immediately
+            (this->*member)(c, batchId, m);
+        } catch (const RPCError & e) {
+            emit c->sendError(e.disconnect, e.code, e.what(), batchId, m.id);
+        } catch (const std::exception & e) {
+            // log this unexpected exception, so we get bug reports hopefully if this ever happens
+            Warning() << "Unexpected exception thrown while processing RPC request \"" << m.method
+                      << "\" for client " << c->id << ", exception: " << e.what();
+            emit c->sendError(false, RPC::ErrorCodes::Code_InternalError,
+                              QString("internal error: %1").arg(e.what()),  batchId, m.id);
+        } catch (...) {
+            Warning() << "Unknown exception thrown while processing RPC request \"" << m.method << "\" for client " << c->id;
+            emit c->sendError(false, RPC::ErrorCodes::Code_InternalError, "internal error: unknown", batchId, m.id);
+        }
+    }
+}
+bool ServerBase::isOverCostBudget(Client *c) const
+{
+    const auto params = options->costLimitParams.load();
+    return params.isEnabled() && !c->perIPData->isWhitelisted() && c->perIPData->costCredit(params) < 0.;
+}
+void ServerBase::delayMessage(Client *c, RPC::BatchId batchId, const RPC::Message &m)
+{
+    ++c->perIPData->nCostDelays;
+    c->costDelayedMessages.emplace_back(batchId, m);
+    if (c->costDelayedMessages.size() == 1)
+        DebugM(c->prettyName(), " is over its per-IP CPU budget (credit: ",
+               QString::number(c->perIPData->costCreditNoRefill(), 'f', 1), " msec), delaying requests");
+    c->setCostPaused(true); // stop reading more requests from this client while its requests are delayed
+    constexpr auto kTimerName = "+CostDelayTimer";
+    constexpr int kPollMs = 100;
+    c->callOnTimerSoon(kPollMs, kTimerName, [this, c] {
+        const auto clientId = c->id;
+        while (!c->costDelayedMessages.empty() && !isOverCostBudget(c)) {
+            auto [delayedBatchId, delayedMsg] = std::move(c->costDelayedMessages.front());
+            c->costDelayedMessages.pop_front();
+            dispatchMessage(c, delayedBatchId, delayedMsg);
+            if (!getClient(clientId))
+                return false; // client was killed as a result of the message, stop the timer
+        }
+        if (!c->costDelayedMessages.empty())
+            return true; // still over budget, keep timer alive
+        DebugM(c->prettyName(), " is back under its per-IP CPU budget, resuming");
+        c->setCostPaused(false);
+        return false; // done, stop the timer
+    });
+}
 void ServerBase::onErrorMessage(IdMixin::Id clientId, const RPC::Message &m)
 {
     TraceM("onErrorMessage: ", clientId, " json: ", m.toJsonUtf8());
@@ -737,7 +921,7 @@ ServerBase::RPCError::~RPCError() {}
 ServerBase::RPCErrorWithDisconnect::~RPCErrorWithDisconnect() {}
 
 void ServerBase::generic_do_async(Client *c, RPC::BatchId batchId, const RPC::Message::Id &reqId,
-                                  const std::function<QVariant ()> &work, int priority)
+                                  const std::function<QVariant ()> &work, ThreadPool::JobClass cls)
 {
     if (LIKELY(work)) {
         struct ResErr {
@@ -749,10 +933,13 @@ void ServerBase::generic_do_async(Client *c, RPC::BatchId batchId, const RPC::Me
 
         auto reserr = std::make_shared<ResErr>(); ///< shared with lambda for both work and completion. this is how they communicate.
 
-        (asyncThreadPool ? asyncThreadPool : ::AppThreadPool())->submitWork(
+        (asyncThreadPool ? asyncThreadPool : ::AppThreadPool())->submitFairWork(
+            c->perIPData.get(), // <--- fairness key: all clients from the same IP share a queue
+            cls,
             c, // <--- all work done in client context, so if client is deleted, completion not called
-            // runs in worker thread, must not access anything other than reserr and work
-            [reserr,work]{
+            // runs in worker thread, must not access anything other than reserr, work, and perIP
+            [reserr, work, perIP = c->perIPData]{
+                const Tic t0;
                 try {
                     QVariant result = work();
                     reserr->results.swap( result ); // constant-time copy
@@ -762,6 +949,7 @@ void ServerBase::generic_do_async(Client *c, RPC::BatchId batchId, const RPC::Me
                     reserr->errMsg = e.what();
                     reserr->errCode = e.code;
                 }
+                perIP->chargeCost(t0.usec()); // charge the time taken to this client's IP (see isOverCostBudget)
             },
             // completion: runs in client thread (only called if client not already deleted)
             [c, batchId, reqId, reserr] {
@@ -773,9 +961,7 @@ void ServerBase::generic_do_async(Client *c, RPC::BatchId batchId, const RPC::Me
                 emit c->sendResult(batchId, reqId, reserr->results);
             },
             // default fail function just sends json rpc error "internal error: <message>"
-            defaultTPFailFunc(c, batchId, reqId),
-            // lower is sooner, higher is later. Default 0.
-            priority
+            defaultTPFailFunc(c, batchId, reqId)
         );
     } else
         Error() << "INTERNAL ERROR: work must be valid! FIXME!";
@@ -792,33 +978,7 @@ void ServerBase::generic_async_to_bitcoind(Client *c, const RPC::BatchId batchId
         Warning() << __func__ << " is meant to be called from the Client thread only. The current thread is not the"
                   << " Client thread. This may cause problems if the Client is deleted while submitting the request. FIXME!";
     }
-    // Throttling support
-    {
-        const int bdReqHi = options->bdReqThrottleParams.load().hi;
-        ++c->perIPData->bdReqCtr; // increase bitcoind request counter (per-IP, owned by multiple threads)
-        ++c->perIPData->bdReqCtr_cum; // increase cumulative bitcoind request counter (per-IP, owned by multiple threads)
-        if (++c->bdReqCtr/*<- incr. per-client counter*/ >= bdReqHi && !c->isReadPaused()) {
-            DebugM(c->prettyName(), " has bitcoinD req ctr: ", c->bdReqCtr, " (PerIP ctr: ",
-                   c->perIPData->bdReqCtr, "), PAUSING reads from socket");
-            c->setReadPaused(true); // pause reading from this client -- they exceeded threshold.
-            // if timer not already active, start timer to decay ctr over time --
-            constexpr auto kTimerName = "+BDR_DecayTimer";
-            static constexpr int kPollFreqHz = 5; //<-- we "poll" 5 times per second so as to detect situations where bitcoind is faster than our heuristics estimate it to be, and then wake up clients faster in that case
-            static_assert (kPollFreqHz > 0 && kPollFreqHz <= 100); // for sanity
-            c->callOnTimerSoon(1000/kPollFreqHz /*=200ms*/, kTimerName, [c, this, iCtr=unsigned(0)]() mutable {
-                const auto [bdReqHi, bdReqLo, decayPerSec] = options->bdReqThrottleParams.load();
-                if ((++iCtr % kPollFreqHz) == 0) // every kPollFreqHz iterations = every 1 second, decay the counter by decayPerSec amount
-                    c->bdReqCtr -= std::min(qint64(decayPerSec), c->bdReqCtr);
-                if (c->isReadPaused() && c->bdReqCtr <= bdReqLo) {
-                    DebugM(c->prettyName(), " has bitcoinD req ctr: ", c->bdReqCtr, " (PerIP ctr: ",
-                           c->perIPData->bdReqCtr, "), RESUMING reads from socket");
-                    c->setReadPaused(false);
-                }
-                return c->bdReqCtr > 0; // return false when ctr reaches 0, which stops the recurring decay timer
-            });
-        }
-    }
-    // /Throttling support
+    chargeBitcoinDThrottle(c);
     bitcoindmgr->submitRequest(c, newId(), method, params,
         // success
         [c, batchId, reqId, successFunc](const RPC::Message & reply) {
@@ -853,9 +1013,165 @@ void ServerBase::generic_async_to_bitcoind(Client *c, const RPC::BatchId batchId
     );
 }
 
+void ServerBase::generic_async_to_bitcoind_cached(Client *c, const RPC::BatchId batchId, const RPC::Message::Id & reqId,
+                                                  const QString &method, const QVariantList & params,
+                                                  const BitcoinDSuccessFunc & successFunc)
+{
+    auto & bc = *bdCache;
+    QByteArray epoch;
+    {
+        const auto [tipHeight, tipHash] = storage->latestTip();
+        const quint64 mpGen = storage->mempoolHistogramGeneration();
+        epoch.reserve(int(sizeof(tipHeight) + sizeof(mpGen)) + tipHash.size());
+        epoch.append(reinterpret_cast<const char *>(&tipHeight), int(sizeof(tipHeight)))
+             .append(reinterpret_cast<const char *>(&mpGen), int(sizeof(mpGen)))
+             .append(tipHash);
+    }
+    if (epoch != bc.epoch) {
+        // new block or mempool refresh since the last call, forget everything we cached
+        bc.results.clear();
+        bc.epoch = epoch;
+    }
+    const QByteArray key = epoch + method.toUtf8() + Json::toUtf8(params, true);
+    if (const auto it = bc.results.find(key); it != bc.results.end()) {
+        ++bc.nHits;
+        emit c->sendResult(batchId, reqId, it->second);
+        return;
+    }
+    auto & waiters = bc.pending[key];
+    waiters.push_back({c->id, batchId, reqId});
+    if (waiters.size() > 1) {
+        // identical request already out to bitcoind, we will get its result when it comes back
+        ++bc.nCoalesced;
+        return;
+    }
+    ++bc.nMisses;
+
+    // The request is charged to the client that initiated it. It may be gone by the time bitcoind answers, so we
+    // keep the per-IP data alive and look the client itself up again by id.
+    chargeBitcoinDThrottle(c);
+    const auto uncharge = [this, clientId = c->id, perIP = c->perIPData] {
+        --perIP->bdReqCtr;
+        if (Client *ic = getClient(clientId))
+            ic->bdReqCtr -= std::min(ic->bdReqCtr, 1LL);
+    };
+    // takes all of the waiters for this key and calls `send` for each of them that is still connected
+    const auto forEachWaiter = [this, key](const auto & send) {
+        auto node = bdCache->pending.extract(key);
+        if (node.empty()) return;
+        for (const auto & w : node.mapped())
+            if (Client *wc = getClient(w.clientId))
+                send(wc, w);
+    };
+    const auto sendErrorToAll = [forEachWaiter](bool disconnect, int code, const QString &msg) {
+        forEachWaiter([&](Client *wc, const BitcoinDCache::Waiter &w) {
+            emit wc->sendError(disconnect, code, msg, w.batchId, w.reqId);
+        });
+    };
+    bitcoindmgr->submitRequest(this, newId(), method, params,
+        // success
+        [this, key, epoch, successFunc, uncharge, forEachWaiter, sendErrorToAll](const RPC::Message & reply) {
+            uncharge();
+            QVariant result;
+            try {
+                result = successFunc ? successFunc(reply) : reply.result();
+            } catch (const RPCError &e) {
+                sendErrorToAll(e.disconnect, e.code, e.what());
+                return;
+            } catch (const std::exception &e) {
+                sendErrorToAll(false, RPC::ErrorCodes::Code_InternalError, e.what());
+                return;
+            }
+            if (auto & bc = *bdCache; bc.epoch == epoch && bc.results.size() < bc.kMaxEntries)
+                bc.results.emplace(key, result);
+            forEachWaiter([&result](Client *wc, const BitcoinDCache::Waiter &w) {
+                emit wc->sendResult(w.batchId, w.reqId, result);
+            });
+        },
+        // error -- not cached
+        [uncharge, sendErrorToAll](const RPC::Message & errorReply) {
+            uncharge();
+            sendErrorToAll(false, RPC::Code_App_DaemonError, errorReply.errorMessage());
+        },
+        // failure, sends json rpc error "internal error: <message>" (like defaultBDFailFunc)
+        [uncharge, sendErrorToAll](const RPC::Message::Id &, const QString &what) {
+            uncharge();
+            sendErrorToAll(false, RPC::Code_InternalError, QString("internal error: %1").arg(what));
+        }
+    );
+}
+
+void ServerBase::chargeBitcoinDThrottle(Client *c)
+{
+    // Throttling support
+    {
+        const int bdReqHi = options->bdReqThrottleParams.load().hi;
+        ++c->perIPData->bdReqCtr; // increase bitcoind request counter (per-IP, owned by multiple threads)
+        ++c->perIPData->bdReqCtr_cum; // increase cumulative bitcoind request counter (per-IP, owned by multiple threads)
+        if (++c->bdReqCtr/*<- incr. per-client counter*/ >= bdReqHi && !c->isReadPauseRequested()) {
+            DebugM(c->prettyName(), " has bitcoinD req ctr: ", c->bdReqCtr, " (PerIP ctr: ",
+                   c->perIPData->bdReqCtr, "), PAUSING reads from socket");
+            c->setReadPaused(true); // pause reading from this client -- they exceeded threshold.
+            // if timer not already active, start timer to decay ctr over time --
+            constexpr auto kTimerName = "+BDR_DecayTimer";
+            static constexpr int kPollFreqHz = 5; //<-- we "poll" 5 times per second so as to detect situations where bitcoind is faster than our heuristics estimate it to be, and then wake up clients faster in that case
+            static_assert (kPollFreqHz > 0 && kPollFreqHz <= 100); // for sanity
+            c->callOnTimerSoon(1000/kPollFreqHz /*=200ms*/, kTimerName, [c, this, iCtr=unsigned(0)]() mutable {
+                const auto [bdReqHi, bdReqLo, decayPerSec] = options->bdReqThrottleParams.load();
+                if ((++iCtr % kPollFreqHz) == 0) // every kPollFreqHz iterations = every 1 second, decay the counter by decayPerSec amount
+                    c->bdReqCtr -= std::min(qint64(decayPerSec), c->bdReqCtr);
+                if (c->isReadPauseRequested() && c->bdReqCtr <= bdReqLo) {
+                    DebugM(c->prettyName(), " has bitcoinD req ctr: ", c->bdReqCtr, " (PerIP ctr: ",
+                           c->perIPData->bdReqCtr, "), RESUMING reads from socket");
+                    c->setReadPaused(false);
+                }
+                return c->bdReqCtr > 0; // return false when ctr reaches 0, which stops the recurring decay timer
+            });
+        }
+    }
+    // /Throttling support
+}
+
+/// Per-Server cache of notifications built during the current event loop iteration. See getSharedNotification().
+struct Server::NotificationCache
+{
+    struct Key {
+        QString method;
+        QByteArray key; ///< scripthash, txid, alias, or raw header
+        SubStatus status;
+        bool operator==(const Key &o) const { return key == o.key && status == o.status && method == o.method; }
+    };
+    struct Hasher {
+        std::size_t operator()(const Key &k) const {
+            std::size_t h = Util::hashForStd(k.key);
+            h ^= std::hash<SubStatus>{}(k.status) + 0x9e3779b9u + (h << 6) + (h >> 2);
+            return h;
+        }
+    };
+    std::unordered_map<Key, RPC::SharedNotification, Hasher> map;
+    bool clearScheduled = false;
+    quint64 nBuilt = 0, nReused = 0;
+};
+
+/// Per-Server table of the queries currently being computed in the thread pool. See generic_do_async_coalesced().
+struct Server::InFlightQueries
+{
+    struct Waiter {
+        IdMixin::Id clientId;
+        RPC::BatchId batchId;
+        RPC::Message::Id reqId;
+    };
+    struct Hasher {
+        std::size_t operator()(const QByteArray &k) const { return Util::hashForStd(k); }
+    };
+    std::unordered_map<QByteArray, std::vector<Waiter>, Hasher> map; ///< coalesce key -> the requests waiting on it
+    quint64 nComputed = 0, nCoalesced = 0;
+};
+
 Server::Server(SrvMgr *sm, const QHostAddress &a, quint16 p, const std::shared_ptr<const Options> & opts,
                const std::shared_ptr<Storage> &s, const std::shared_ptr<BitcoinDMgr> &bdm)
-    : ServerBase(sm, StaticData::methodMap, StaticData::dispatchTable, a, p, opts, s, bdm)
+    : ServerBase(sm, StaticData::methodMap, StaticData::dispatchTable, a, p, opts, s, bdm),
+      notifCache(std::make_unique<NotificationCache>()), inFlight(std::make_unique<InFlightQueries>())
 {
     StaticData::init(); // only does something first time it's called, otherwise a no-op
     logFilter = weakLogFilter.lock();
@@ -887,6 +1203,15 @@ QVariant Server::stats() const
     if (auto mm = m.value(myKey).toMap(); !mm.isEmpty()) {
         // unite whatever base class created as a map with the bloom filter info map
         mm.insert(ServerMisc::kBloomFiltersKey, logFilter->broadcast.stats());
+        mm.insert("sharedNotifications", QVariantMap{
+            { "built", qulonglong(notifCache->nBuilt) },
+            { "reused", qulonglong(notifCache->nReused) },
+        });
+        mm.insert("coalescedQueries", QVariantMap{
+            { "computed", qulonglong(inFlight->nComputed) },
+            { "coalesced", qulonglong(inFlight->nCoalesced) },
+            { "inFlight", qulonglong(inFlight->map.size()) },
+        });
         m[myKey] = mm;
         v = m;
     } else {
@@ -897,6 +1222,109 @@ QVariant Server::stats() const
     return v;
 }
 
+RPC::SharedNotification Server::getSharedNotification(const QString &method, const QByteArray &key,
+                                                      const SubStatus &status, const std::function<QVariantList()> &mkParams)
+{
+    auto & nc = *notifCache;
+    NotificationCache::Key k{method, key, status};
+    if (auto it = nc.map.find(k); it != nc.map.end()) {
+        ++nc.nReused;
+        return it->second;
+    }
+    RPC::SharedNotification ret(method, mkParams());
+    ++nc.nBuilt;
+    nc.map.emplace(std::move(k), ret);
+    if (!nc.clearScheduled) {
+        // Forget everything once we return to the event loop. All of the (queued) deliveries of a notification to our
+        // clients are already in our event queue ahead of this, so they all get to share the same instance.
+        nc.clearScheduled = true;
+        QTimer::singleShot(0, this, [this]{
+            notifCache->map.clear();
+            notifCache->clearScheduled = false;
+        });
+    }
+    return ret;
+}
+
+QByteArray Server::makeCoalesceKey(const QByteArray &tag, const HashX &hashX) const
+{
+    const BlockHeight tip = storage->latestHeight().value_or(0);
+    QByteArray ret;
+    ret.reserve(tag.size() + 1 + hashX.size() + int(sizeof(tip)));
+    ret.append(tag).append(':').append(hashX).append(reinterpret_cast<const char *>(&tip), int(sizeof(tip)));
+    return ret;
+}
+
+void Server::generic_do_async_coalesced(Client *c, RPC::BatchId batchId, const RPC::Message::Id &reqId,
+                                        const QByteArray &coalesceKey, const AsyncWorkFunc &work, ThreadPool::JobClass cls)
+{
+    if (UNLIKELY(!work)) {
+        Error() << "INTERNAL ERROR: work must be valid! FIXME!";
+        return;
+    }
+    auto & waiters = inFlight->map[coalesceKey];
+    waiters.push_back({c->id, batchId, reqId});
+    if (waiters.size() > 1) {
+        // identical query already in flight, we will get its result when it completes
+        ++inFlight->nCoalesced;
+        return;
+    }
+    ++inFlight->nComputed;
+
+    struct ResErr {
+        QVariant results;
+        bool error = false, doDisconnect = false;
+        QString errMsg;
+        int errCode = 0;
+    };
+    auto reserr = std::make_shared<ResErr>(); ///< shared with lambda for both work and completion
+    // takes all of the waiters for this query and calls `send` for each of them that is still connected
+    const auto forEachWaiter = [this, coalesceKey](const auto & send) {
+        auto node = inFlight->map.extract(coalesceKey);
+        if (node.empty()) return;
+        for (const auto & w : node.mapped())
+            if (Client *wc = getClient(w.clientId))
+                send(wc, w);
+    };
+
+    (asyncThreadPool ? asyncThreadPool : ::AppThreadPool())->submitFairWork(
+        c->perIPData.get(), // <--- fairness key: charged to the IP of the client that initiated the query
+        cls,
+        this, // <--- the completion is for all waiters, so it must run even if the initiating client is gone
+        // runs in worker thread, must not access anything other than reserr, work, and perIP
+        [reserr, work, perIP = c->perIPData]{
+            const Tic t0;
+            try {
+                QVariant result = work();
+                reserr->results.swap( result ); // constant-time copy
+            } catch (const RPCError & e) {
+                reserr->error = true;
+                reserr->doDisconnect = e.disconnect;
+                reserr->errMsg = e.what();
+                reserr->errCode = e.code;
+            }
+            perIP->chargeCost(t0.usec()); // charged to the initiating client's IP only
+        },
+        // completion: runs in our thread, sends results (or the error) to all waiters
+        [reserr, forEachWaiter] {
+            forEachWaiter([&reserr](Client *wc, const InFlightQueries::Waiter &w) {
+                if (reserr->error)
+                    emit wc->sendError(reserr->doDisconnect, reserr->errCode, reserr->errMsg, w.batchId, w.reqId);
+                else
+                    emit wc->sendResult(w.batchId, w.reqId, reserr->results);
+            });
+        },
+        // fail: sends json rpc error "internal error: <message>" to all waiters (like defaultTPFailFunc)
+        [forEachWaiter](const QString &what) {
+            Warning() << "ThreadPool job for coalesced query failed: " << what;
+            const QString msg = QString("internal error: %1").arg(what);
+            forEachWaiter([&msg](Client *wc, const InFlightQueries::Waiter &w) {
+                emit wc->sendError(false, RPC::Code_InternalError, msg, w.batchId, w.reqId);
+            });
+        }
+    );
+}
+
 void Server::rpc_server_add_peer(Client *c, const RPC::BatchId batchId, const RPC::Message &m)
 {
     const auto map = m.paramsList().constFirst().toMap();
@@ -1019,7 +1447,7 @@ void Server::rpc_server_banner(Client *c, const RPC::BatchId batchId, const RPC:
                 }
                 // send result to client (either the fallback or the real deal)
                 return ret;
-        });
+        }, ThreadPool::JobClass::Cheap);
     }
 }
 void Server::rpc_server_donation_address(Client *c, const RPC::BatchId batchId, const RPC::Message &m)
@@ -1042,6 +1470,9 @@ QVariantMap Server::makeFeaturesDictForConnection(AbstractConnection *c, const Q
     r["protocol_max"] = ServerMisc::MaxProtocolVersion.toString();
     r["hash_function"] = ServerMisc::HashFunction;
     r["dsproof"] = dsproof;
+    // Fulcrum extension: blockchain.scripthash.subscribe_many & blockchain.scripthash.get_status_many are available,
+    // taking at most this many scripthashes per call
+    r["scripthash_bulk_max"] = ServerMisc::kMaxScriptHashesPerBulkRequest;
 
     QVariantMap hmap, hmapTor;
     if (opts.publicTcp.has_value())
@@ -1213,7 +1644,7 @@ void Server::rpc_blockchain_block_header(Client *c, const RPC::BatchId batchId,
             return ret;
         } else
             throw RPCError(err.isEmpty() ? "Unknown error" : err);
-    });
+    }, cp_height ? ThreadPool::JobClass::Normal : ThreadPool::JobClass::Cheap);
 }
 
 void Server::rpc_blockchain_block_headers(Client *c, const RPC::BatchId batchId, const RPC::Message &m)
@@ -1290,7 +1721,7 @@ void Server::rpc_blockchain_estimatefee(Client *c, const RPC::BatchId batchId, c
     if ((bitcoindmgr->isCoreLike())
             && bitcoindmgr->getBitcoinDVersion() >= Version{0,17,0}) {
         // Bitcoin Core removed the "estimatefee" RPC method entirely in version 0.17.0, in favor of "estimatesmartfee"
-        generic_async_to_bitcoind(c, batchId, m.id, "estimatesmartfee", params, [](const RPC::Message &response){
+        generic_async_to_bitcoind_cached(c, batchId, m.id, "estimatesmartfee", params, [](const RPC::Message &response){
             // We don't validate what bitcoind returns. Sometimes if it has not enough information, it may
             // return no "feerate" but instead return an "errors" entry in the dict. This is fine.
             // ElectrumX just returns -1 in that case here, so we do the same.
@@ -1300,7 +1731,7 @@ void Server::rpc_blockchain_estimatefee(Client *c, const RPC::BatchId batchId, c
     }
 
     // regular Bitcoin Cash daemons
-    generic_async_to_bitcoind(c, batchId, m.id, "estimatefee", params, [](const RPC::Message &response){
+    generic_async_to_bitcoind_cached(c, batchId, m.id, "estimatefee", params, [](const RPC::Message &response){
         return response.result();
     });
 }
@@ -1319,9 +1750,12 @@ void Server::rpc_blockchain_headers_subscribe(Client *c, const RPC::BatchId batc
     if (!c->isSubscribedToHeaders) {
         c->isSubscribedToHeaders = true;
         // connect to signal. Will be emitted directly to object until it dies.
-        connect(this, &Server::newHeader, c, [c, meth=m.method](unsigned height, const QByteArray &header){
+        connect(this, &Server::newHeader, c, [this, c, meth=m.method](unsigned height, const QByteArray &header){
             // the notification is a list of size 1, with a dict in it. :/
-            emit c->sendNotification(meth, QVariantList({mkResp(height, header)}));
+            const auto notif = getSharedNotification(meth, header, std::optional<BlockHeight>(height), [&]{
+                return QVariantList({mkResp(height, header)});
+            });
+            emit c->sendSharedNotification(notif);
         });
         DebugM(c->prettyName(false, false), " is now subscribed to headers");
     } else {
@@ -1392,7 +1826,7 @@ void Server::impl_get_balance(Client *c, const RPC::BatchId batchId, const RPC::
           { "unconfirmed" , qlonglong(uamt / uamt.satoshi()) },
         };
         return resp;
-    });
+    }, ThreadPool::JobClass::Heavy);
 }
 
 /// called from get_mempool and get_history to retrieve the mempool for a hashx synchronously.  Returns the
@@ -1425,9 +1859,9 @@ void Server::rpc_blockchain_address_get_history(Client *c, const RPC::BatchId ba
 }
 void Server::impl_get_history(Client *c, const RPC::BatchId batchId, const RPC::Message &m, const HashX &sh)
 {
-    generic_do_async(c, batchId, m.id, [sh, this] {
+    generic_do_async_coalesced(c, batchId, m.id, makeCoalesceKey(QByteArrayLiteral("history"), sh), [sh, this] {
         return getHistoryCommon(sh, false);
-    });
+    }, ThreadPool::JobClass::Heavy);
 }
 
 void Server::rpc_blockchain_scripthash_get_mempool(Client *c, const RPC::BatchId batchId, const RPC::Message &m)
@@ -1463,7 +1897,7 @@ void Server::rpc_blockchain_address_listunspent(Client *c, const RPC::BatchId ba
 }
 void Server::impl_listunspent(Client *c, const RPC::BatchId batchId, const RPC::Message &m, const HashX &sh)
 {
-    generic_do_async(c, batchId, m.id, [sh, this] {
+    generic_do_async_coalesced(c, batchId, m.id, makeCoalesceKey(QByteArrayLiteral("listunspent"), sh), [sh, this] {
         QVariantList resp;
         const auto items = storage->listUnspent(sh); // these are already sorted
         for (const auto & item : items) {
@@ -1475,7 +1909,7 @@ void Server::impl_listunspent(Client *c, const RPC::BatchId batchId, const RPC::
             });
         }
         return resp;
-    });
+    }, ThreadPool::JobClass::Heavy);
 }
 void Server::rpc_blockchain_scripthash_subscribe(Client *c, const RPC::BatchId batchId, const RPC::Message &m)
 {
@@ -1493,31 +1927,19 @@ void Server::impl_generic_subscribe(SubsMgr *subs, Client *c, const RPC::BatchId
                                     const HashX &key, const std::optional<QString> &optAlias)
 {
     const auto CheckSubsLimit = [c, &key, this, subs](int64_t nShSubs, bool doUnsub) {
-        if (UNLIKELY(nShSubs > options->maxSubsPerIP)) {
-            if (c->perIPData->isWhitelisted()) {
-                // White-listed, let it go, but print to debug log
-                DebugM( c->prettyName(false, false), " exceeded the per-IP subscribe limit with ", nShSubs,
-                        " subs, but it is whitelisted (subnet: ", c->perIPData->whiteListedSubnet().toString(), ")");
-            } else {
-                // Not white-listed .. unsubscribe and throw an error.
-                if (const auto now = Util::getTimeSecs(); now - c->lastWarnedAboutSubsLimit > ServerMisc::kMaxSubsPerIPWarningsRateLimitSecs /* 1.0 secs */) {
-                    // message spam throttled to once per second
-                    Warning() << c->prettyName(false, false) << " exceeded per-IP subscribe limit with " << nShSubs
-                              << " subs, denying subscribe request";
-                    c->lastWarnedAboutSubsLimit = now;
-                }
-                if (doUnsub) {
-                    // unsubscribe client right away
-                    if (LIKELY(subs->unsubscribe(c, key))) {
-                        // decrement counters
-                        --c->nShSubs;
-                        --c->perIPData->nShSubs;
-                    } else
-                        // This should never happen but we'll print debug/warning info if it does.
-                        Warning() << c->prettyName(false, false) << " failed to unsubscribe client from a subscribable we just subscribed him to! FIXME!";
-                }
-                throw RPCError("Subscription limit reached", RPC::Code_App_LimitExceeded); // send error to client
+        if (UNLIKELY(isPerIPSubsLimitExceeded(c, nShSubs))) {
+            // Not white-listed .. unsubscribe and throw an error.
+            if (doUnsub) {
+                // unsubscribe client right away
+                if (LIKELY(subs->unsubscribe(c, key))) {
+                    // decrement counters
+                    --c->nShSubs;
+                    --c->perIPData->nShSubs;
+                } else
+                    // This should never happen but we'll print debug/warning info if it does.
+                    Warning() << c->prettyName(false, false) << " failed to unsubscribe client from a subscribable we just subscribed him to! FIXME!";
             }
+            throw RPCError("Subscription limit reached", RPC::Code_App_LimitExceeded); // send error to client
         }
     };
     // First, check the Per-IP subs limit right away before we do anything. This has a potential race condition
@@ -1528,38 +1950,25 @@ void Server::impl_generic_subscribe(SubsMgr *subs, Client *c, const RPC::BatchId
 
     SubsMgr::SubscribeResult result;
     try {
-        const auto MkNotifierLambda = [c, &m, &optAlias]() -> StatusCallback {
-            // We return two different lambdas, based on whether there is an opAddr alias specified or not.
-            // The reason for doing it this way is that were we to capture the 'alias' as an empty value in the lambda
-            // always, then in the blockchain.scripthash.subscribe case we would be wasting minimally ~16 bytes of
-            // memory for the empty QByteArray *for each subscription*.
-            //
-            // Since we only use this data for the blockchain.address.subscribe case, we will capture it only in
-            // that special case, hence the existence of two different lambdas here.
+        const auto MkNotifierLambda = [this, c, &m, &optAlias]() -> StatusCallbackPtr {
+            // We use two different lambdas, based on whether there is an opAddr alias specified or not.
+            // In the common (no alias) case the callback is identical for all of this client's subs made via this
+            // method, so we create it once per client and re-use it, and the SubsMgr stores it only once.
             //
-            // This optimization optimizes memory consumption for the common case, since we don't expect many
-            // blockchain.address.subscribe calls to the server.  (EC doesn't issue these calls, and that is our
-            // primary client that we serve).
-            StatusCallback ret;
-            if (!optAlias.has_value()) { // common case
-                // regular blockchain.scripthash.subscribe callback does no aliasing/rewriting and simply echoes the sh back to client as hex.
-                ret =
-                    [c, method=m.method](const HashX &key, const SubStatus &status) {
+            // Since we only use the alias for the blockchain.address.subscribe case, that special case gets its own
+            // callback per subscription (capturing the alias). We don't expect many blockchain.address.subscribe
+            // calls to the server.  (EC doesn't issue these calls, and that is our primary client that we serve).
+            if (!optAlias.has_value()) // common case
+                return getClientStatusCallback(c, m.method);
+            // When notifying, blockchain.address.subscribe callback must rewrite the sh arg -> the original address argument given by the client.
+            return std::make_shared<const StatusCallback>(
+                [this, c, method=m.method, alias=optAlias->toUtf8()](const HashX &, const SubStatus &status) {
+                    const auto notif = getSharedNotification(method, alias, status, [&]{
                         // if empty we simply notify as 'null' (this is unlikely in practice but may happen on reorg)
-                        const QVariant statusMaybeNull = status.toVariant();
-                        const QByteArray keyHex = Util::ToHexFast(key);
-                        emit c->sendNotification(method, QVariantList{keyHex, statusMaybeNull});
-                    };
-            } else {
-                // When notifying, blockchain.address.subscribe callback must rewrite the sh arg -> the original address argument given by the client.
-                ret =
-                    [c, method=m.method, alias=optAlias->toUtf8()](const HashX &, const SubStatus &status) {
-                        // if empty we simply notify as 'null' (this is unlikely in practice but may happen on reorg)
-                        const QVariant statusMaybeNull = status.toVariant();
-                        emit c->sendNotification(method, QVariantList{alias, statusMaybeNull});
-                    };
-            }
-            return ret;
+                        return QVariantList{alias, status.toVariant()};
+                    });
+                    emit c->sendSharedNotification(notif);
+                });
         };
         /// Note: potential race condition here whereby notification can arrive BEFORE the status result. In practice this
         /// is fine since clients will cope with the situation, but... ideally, fixme.
@@ -1584,19 +1993,162 @@ void Server::impl_generic_subscribe(SubsMgr *subs, Client *c, const RPC::BatchId
         CheckSubsLimit( ++c->perIPData->nShSubs, true ); // may throw RPCError
     }
     if (!status.has_value()) {
-        // no known/cached status -- do the work ourselves asynch in the thread pool.
-        generic_do_async(c, batchId, m.id, [key, subs] {
+        // no known/cached status -- do the work ourselves asynch in the thread pool (sharing it with any identical
+        // in-flight requests, e.g. many clients subscribing to the same popular scripthash at once).
+        generic_do_async_coalesced(c, batchId, m.id, makeCoalesceKey(subs->objectName().toUtf8(), key), [key, subs] {
             const auto status = subs->getFullStatus(key);
             subs->maybeCacheStatusResult(key, status);
             // if empty we return `null`, otherwise we return hex encoded bytes, json object, or numeric as the immediate status.
             return status.toVariant();
-        });
+        }, ThreadPool::JobClass::Heavy);
     } else {
         // SubsMgr reported a cached status -- immediately return that as the result!
         const QVariant result = status.toVariant();
         emit c->sendResult(batchId, m.id, result); ///<  may be 'null' if status was empty (indicates no history for scripthash or no proof for txid)
     }
 }
+bool Server::isPerIPSubsLimitExceeded(Client *c, int64_t nShSubs)
+{
+    if (LIKELY(nShSubs <= options->maxSubsPerIP))
+        return false;
+    if (c->perIPData->isWhitelisted()) {
+        // White-listed, let it go, but print to debug log
+        DebugM( c->prettyName(false, false), " exceeded the per-IP subscribe limit with ", nShSubs,
+                " subs, but it is whitelisted (subnet: ", c->perIPData->whiteListedSubnet().toString(), ")");
+        return false;
+    }
+    if (const auto now = Util::getTimeSecs(); now - c->lastWarnedAboutSubsLimit > ServerMisc::kMaxSubsPerIPWarningsRateLimitSecs /* 1.0 secs */) {
+        // message spam throttled to once per second
+        Warning() << c->prettyName(false, false) << " exceeded per-IP subscribe limit with " << nShSubs
+                  << " subs, denying subscribe request";
+        c->lastWarnedAboutSubsLimit = now;
+    }
+    return true;
+}
+StatusCallbackPtr Server::getClientStatusCallback(Client *c, const QString &method)
+{
+    auto & ret = c->subsNotifiers[method];
+    if (!ret) {
+        // regular blockchain.scripthash.subscribe callback does no aliasing/rewriting and simply echoes the sh back to client as hex.
+        ret = std::make_shared<const StatusCallback>(
+            [this, c, method](const HashX &key, const SubStatus &status) {
+                const auto notif = getSharedNotification(method, key, status, [&]{
+                    // if empty we simply notify as 'null' (this is unlikely in practice but may happen on reorg)
+                    return QVariantList{Util::ToHexFast(key), status.toVariant()};
+                });
+                emit c->sendSharedNotification(notif);
+            });
+    }
+    return ret;
+}
+std::vector<HashX> Server::parseFirstHashListParamCommon(const RPC::Message &m) const
+{
+    const QVariantList l(m.paramsList());
+    assert(!l.isEmpty());
+    if (!l.front().canConvert<QVariantList>())
+        throw RPCError("Expected a list of scripthashes");
+    const QVariantList hexes = l.front().toList();
+    if (hexes.isEmpty())
+        throw RPCError("Expected a non-empty list of scripthashes");
+    if (hexes.size() > ServerMisc::kMaxScriptHashesPerBulkRequest)
+        throw RPCError(QString("Too many scripthashes (max: %1)").arg(ServerMisc::kMaxScriptHashesPerBulkRequest),
+                       RPC::Code_App_LimitExceeded);
+    std::vector<HashX> ret;
+    ret.reserve(size_t(hexes.size()));
+    for (const auto & var : hexes) {
+        HashX sh = validateHashHex( var.toString() );
+        if (sh.length() != HashLen)
+            throw RPCError(QString("Invalid scripthash at position %1").arg(ret.size()));
+        ret.push_back(std::move(sh));
+    }
+    return ret;
+}
+void Server::rpc_blockchain_scripthash_subscribe_many(Client *c, const RPC::BatchId batchId, const RPC::Message &m)
+{
+    const auto shs = parseFirstHashListParamCommon(m);
+    ScriptHashSubsMgr * const subs = storage->subs();
+    // Pre-check the limit as impl_generic_subscribe does, to avoid creating zombie subs if we are already at the limit
+    if (UNLIKELY(isPerIPSubsLimitExceeded(c, c->perIPData->nShSubs + 1)))
+        throw RPCError("Subscription limit reached", RPC::Code_App_LimitExceeded);
+    // Notifications for these subs are identical to those for subs made via blockchain.scripthash.subscribe, so that
+    // clients need not handle a new notification method.
+    const auto notifier = getClientStatusCallback(c, QStringLiteral("blockchain.scripthash.subscribe"));
+    std::vector<HashX> newSubs; // subs that were newly created by this call, so that we may undo them on error
+    const auto undoNewSubs = [&newSubs, subs, c] {
+        for (const auto & key : newSubs) {
+            if (subs->unsubscribe(c, key)) {
+                --c->nShSubs;
+                --c->perIPData->nShSubs;
+            }
+        }
+    };
+    auto statuses = std::make_shared<std::vector<SubStatus>>(shs.size());
+    std::vector<size_t> uncached; // indices into `shs` for which SubsMgr had no cached status
+    try {
+        for (size_t i = 0; i < shs.size(); ++i) {
+            auto [wasNew, status] = subs->subscribe(c, shs[i], notifier);
+            if (wasNew) {
+                newSubs.push_back(shs[i]);
+                if (++c->nShSubs == 1)
+                    DebugM(c->prettyName(false, false), " is now subscribed to at least one subscribable");
+                if (UNLIKELY(isPerIPSubsLimitExceeded(c, ++c->perIPData->nShSubs))) {
+                    // all-or-nothing: undo the subs we made so far
+                    undoNewSubs();
+                    throw RPCError("Subscription limit reached", RPC::Code_App_LimitExceeded);
+                }
+            }
+            if (status.has_value())
+                (*statuses)[i] = std::move(status);
+            else
+                uncached.push_back(i);
+        }
+    } catch (const SubsMgr::LimitReached &e) {
+        undoNewSubs();
+        if (Util::getTimeSecs() - lastSubsWarningPrintTime > ServerMisc::kMaxSubsWarningsRateLimitSecs /* ~250 ms */) {
+            // rate limit printing
+            Warning() << "Exception from SubsMgr: " << e.what() << " (while serving subscribe_many request for " << c->prettyName(false, false) << ")";
+            lastSubsWarningPrintTime = Util::getTimeSecs();
+        }
+        emit globalSubsLimitReached(); // connected to the SrvMgr, which will loop through all IPs and kick all clients for the most-subscribed IP
+        throw RPCError("Subscription limit reached", RPC::Code_App_LimitExceeded); // send error to client
+    }
+    const auto toResult = [](const std::vector<SubStatus> &sts) {
+        // compact result: a list parallel to the request's list, of hex status (or null if no history)
+        QVariantList ret;
+        ret.reserve(int(sts.size()));
+        for (const auto & st : sts)
+            ret.push_back(st.toVariant());
+        return ret;
+    };
+    if (uncached.empty()) {
+        emit c->sendResult(batchId, m.id, toResult(*statuses));
+        return;
+    }
+    // Compute the missing statuses in 1 thread pool job, reading all of the histories in 1 pass
+    generic_do_async(c, batchId, m.id, [subs, shs, statuses, uncached = std::move(uncached), toResult] {
+        std::vector<HashX> keys;
+        keys.reserve(uncached.size());
+        for (const auto i : uncached)
+            keys.push_back(shs[i]);
+        auto full = subs->getFullStatuses(keys);
+        for (size_t j = 0; j < uncached.size(); ++j) {
+            subs->maybeCacheStatusResult(keys[j], full[j]);
+            (*statuses)[uncached[j]] = std::move(full[j]);
+        }
+        return toResult(*statuses);
+    }, ThreadPool::JobClass::Heavy);
+}
+void Server::rpc_blockchain_scripthash_get_status_many(Client *c, const RPC::BatchId batchId, const RPC::Message &m)
+{
+    const auto shs = parseFirstHashListParamCommon(m);
+    generic_do_async(c, batchId, m.id, [shs, subs = storage->subs()] {
+        QVariantList ret;
+        ret.reserve(int(shs.size()));
+        for (const auto & st : subs->getFullStatuses(shs))
+            ret.push_back(st.toVariant()); // hex status, or null if no history
+        return ret;
+    }, ThreadPool::JobClass::Heavy);
+}
 void Server::rpc_blockchain_scripthash_unsubscribe(Client *c, const RPC::BatchId batchId, const RPC::Message &m)
 {
     const auto sh = parseFirstHashParamCommon(m);
@@ -1820,7 +2372,7 @@ void Server::rpc_blockchain_transaction_get_height(Client *c, const RPC::BatchId
         if (!optHeight)
             throw RPCError("No transaction matching the requested hash was found");
         return qlonglong(*optHeight);
-    });
+    }, ThreadPool::JobClass::Cheap);
 }
 
 void Server::rpc_blockchain_transaction_get_merkle(Client *c, const RPC::BatchId batchId, const RPC::Message &m)
@@ -1942,7 +2494,7 @@ void Server::rpc_blockchain_transaction_dsproof_get(Client *c, const RPC::BatchI
         if (dsp && !dsp->isEmpty())
             ret = dsp->toVarMap();
         return ret;
-    });
+    }, ThreadPool::JobClass::Cheap);
 }
 void Server::rpc_blockchain_transaction_dsproof_list(Client *c, const RPC::BatchId batchId, const RPC::Message &m)
 {
@@ -2007,7 +2559,7 @@ void Server::rpc_blockchain_utxo_get_info(Client *c, const RPC::BatchId batchId,
         }
         // NB: if not fond  or invalid, `null` will be returned
         return ret;
-    });
+    }, ThreadPool::JobClass::Cheap);
 }
 void Server::rpc_mempool_get_fee_histogram(Client *c, const RPC::BatchId batchId, const RPC::Message &m)
 {
@@ -2055,6 +2607,8 @@ HEY_COMPILER_PUT_STATIC_HERE(Server::StaticData::registry){
     { {"blockchain.scripthash.listunspent", true,               false,    PR{1,1},                    },          MP(rpc_blockchain_scripthash_listunspent) },
     { {"blockchain.scripthash.subscribe",   true,               false,    PR{1,1},                    },          MP(rpc_blockchain_scripthash_subscribe) },
     { {"blockchain.scripthash.unsubscribe", true,               false,    PR{1,1},                    },          MP(rpc_blockchain_scripthash_unsubscribe) },
+    { {"blockchain.scripthash.subscribe_many",   true,          false,    PR{1,1},                    },          MP(rpc_blockchain_scripthash_subscribe_many) },
+    { {"blockchain.scripthash.get_status_many",  true,          false,    PR{1,1},                    },          MP(rpc_blockchain_scripthash_get_status_many) },
 
     { {"blockchain.transaction.broadcast",  true,               false,    PR{1,1},                    },          MP(rpc_blockchain_transaction_broadcast) },
     { {"blockchain.transaction.get",        true,               false,    PR{1,2},                    },          MP(rpc_blockchain_transaction_get) },
@@ -2111,9 +2665,109 @@ void Server::StaticData::init() { InitStaticDataCommon(dispatchTable, methodMap,
 // --- /RPC METHODS ---
 
 // --- SSL Server support ---
+
+/// A few threads, shared by all ServerSSL instances, on which the TLS handshakes are done. This way the RSA/ECDHE work
+/// of a burst of (re)connecting clients (e.g. after a restart or a network blip) doesn't stall the servers' own
+/// threads. Each thread has a "parking" QObject that owns the sockets while they are mid-handshake, so that they get
+/// cleaned up should the pool be destroyed while handshakes are still in progress.
+class ServerSSL::HandshakePool
+{
+public:
+    explicit HandshakePool(int nThreads) {
+        for (int i = 0; i < nThreads; ++i) {
+            auto & w = workers.emplace_back(std::make_unique<Worker>());
+            w->thread.setObjectName(QStringLiteral("TLS Handshake %1").arg(i + 1));
+            w->parking = new QObject; // deleted in our d'tor
+            w->parking->moveToThread(&w->thread);
+            w->thread.start();
+        }
+        DebugM("TLS handshake pool started with ", nThreads, Util::Pluralize(" thread", nThreads));
+    }
+    ~HandshakePool() {
+        for (auto & w : workers)
+            w->thread.quit();
+        for (auto & w : workers) {
+            w->thread.wait();
+            delete w->parking; // safe now that its thread is no longer running; deletes any still-parked sockets too
+        }
+    }
+
+    /// Returns the parking object of the next thread to use, round-robin. Thread-safe.
+    QObject *nextParking() { return workers[next++ % workers.size()]->parking; }
+    int numThreads() const { return int(workers.size()); }
+
+    /// Returns the app-wide instance, creating it if it does not already exist. Thread-safe.
+    static std::shared_ptr<HandshakePool> get() {
+        static std::mutex mut;
+        static std::weak_ptr<HandshakePool> weak;
+        std::unique_lock g(mut);
+        auto ret = weak.lock();
+        if (!ret) {
+            ret = std::make_shared<HandshakePool>(std::clamp(QThread::idealThreadCount() / 2, 1, 4));
+            weak = ret;
+        }
+        return ret;
+    }
+
+private:
+    struct Worker {
+        QThread thread;
+        QObject *parking = nullptr;
+    };
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic_uint next{0};
+};
+
+struct ServerSSL::HandshakeStats
+{
+    static constexpr qint64 kRecentWindowMSec = 60'000; ///< the window for the "recent" rate and average below
+
+    std::atomic_uint64_t completed{0}, failed{0}, timedOut{0};
+    std::atomic_int inProgress{0};
+
+    void recordCompleted(double msec) {
+        ++completed;
+        const auto now = Util::getTime();
+        std::unique_lock g(mut);
+        totalMSec += msec;
+        recent.emplace_back(now, msec);
+        trimRecent(now);
+    }
+
+    QVariantMap toMap(int nThreads) const {
+        QVariantMap m;
+        const auto nCompleted = completed.load();
+        m["completed"] = qulonglong(nCompleted);
+        m["failed"] = qulonglong(failed.load());
+        m["timed out"] = qulonglong(timedOut.load());
+        m["in progress"] = inProgress.load();
+        m["threads"] = nThreads;
+        std::unique_lock g(mut);
+        trimRecent(Util::getTime());
+        double recentMSec = 0.;
+        for (const auto & [ts, msec] : recent)
+            recentMSec += msec;
+        m["handshakes/sec (last 60s)"] = double(recent.size()) / (kRecentWindowMSec / 1e3);
+        m["avg msec (last 60s)"] = recent.empty() ? QVariant() : QVariant(recentMSec / recent.size());
+        m["avg msec"] = nCompleted ? QVariant(totalMSec / nCompleted) : QVariant();
+        return m;
+    }
+
+private:
+    mutable std::mutex mut; ///< guards below
+    double totalMSec = 0.;
+    mutable std::deque<std::pair<qint64, double>> recent; ///< (completion timestamp, handshake msec)
+
+    void trimRecent(qint64 now) const {
+        while (!recent.empty() && now - recent.front().first > kRecentWindowMSec)
+            recent.pop_front();
+    }
+};
+
 ServerSSL::ServerSSL(SrvMgr *sm, const QHostAddress & address_, quint16 port_, const std::shared_ptr<const Options> & opts,
                      const std::shared_ptr<Storage> & storage_, const std::shared_ptr<BitcoinDMgr> & bitcoindmgr_)
-    : Server(sm, address_, port_, opts, storage_, bitcoindmgr_)
+    : Server(sm, address_, port_, opts, storage_, bitcoindmgr_), handshakePool(HandshakePool::get()),
+      handshakeStats(std::make_shared<HandshakeStats>())
 {
     setupSslConfiguration();
     resetName();
@@ -2169,6 +2823,7 @@ QVariant ServerSSL::stats() const
 #else
             sslConfiguration.localCertificate().subjectInfo(QSslCertificate::Organization).join(", ");
 #endif
+        mm["TLS handshakes"] = handshakeStats->toMap(handshakePool->numThreads());
         m[myKey] = mm;
         v = m;
     }
@@ -2187,52 +2842,103 @@ void ServerSSL::incomingConnection(qintptr socketDescriptor)
         delete socket;
         return;
     }
-    QTimer *timer = new QTimer(socket);
-    timer->setObjectName(QStringLiteral("TLS handshake timer"));
-    timer->setSingleShot(true);
-    static const auto kTimedOutPropertyName = "ServerSSL_Handshake_Timed_Out";
-    connect(timer, &QTimer::timeout, this, [socket, timer, peerName]{
-        Warning() << peerName << " SSL handshake timed out after " << QString::number(timer->interval()/1e3, 'f', 1) << " secs, deleting socket";
-        socket->setProperty(kTimedOutPropertyName, true);
+    // Hand the socket off to a handshake thread. A QObject that has a parent cannot be moved to another thread, so we
+    // detach it from `this` here, and the handshake thread's parking object adopts it once it gets there.
+    QObject * const parking = handshakePool->nextParking();
+    socket->setParent(nullptr);
+    socket->moveToThread(parking->thread());
+    ++handshakeStats->inProgress;
+    const Tic t0;
+    QMetaObject::invokeMethod(parking, [socket, parking, peerName, t0, stats = handshakeStats, srv = QPointer<ServerSSL>(this),
+                                        srvThread = thread()] {
+        // -- in the handshake thread
+        socket->setParent(parking);
+        auto done = std::make_shared<bool>(false); // set once the handshake has succeeded or failed, to only count it once
+        const auto finish = [done, stats](std::atomic_uint64_t *failCounter) {
+            if (*done) return false;
+            *done = true;
+            --stats->inProgress;
+            if (failCounter) ++*failCounter;
+            return true;
+        };
+        QTimer *timer = new QTimer(socket);
+        timer->setObjectName(QStringLiteral("TLS handshake timer"));
+        timer->setSingleShot(true);
+        connect(timer, &QTimer::timeout, socket, [socket, timer, peerName, finish, stats]{
+            if (!finish(&stats->timedOut)) return;
+            Warning() << peerName << " SSL handshake timed out after " << QString::number(timer->interval()/1e3, 'f', 1) << " secs, deleting socket";
+            socket->abort();
+            socket->deleteLater();
+        });
+        auto tmpConnections = std::make_shared<QList<QMetaObject::Connection>>();
+        *tmpConnections += connect(socket, &QSslSocket::disconnected, socket, [socket, peerName, finish, stats]{
+            if (finish(&stats->failed))
+                DebugM(peerName, " SSL handshake failed due to disconnect before completion, deleting socket");
+            socket->deleteLater();
+        });
+        *tmpConnections += connect(socket, &QSslSocket::encrypted, socket, [timer, tmpConnections, socket, peerName, t0, stats,
+                                                                          finish, srv, srvThread] {
+            if (!finish(nullptr)) return;
+            stats->recordCompleted(t0.msec<double>());
+            TraceM(peerName, " SSL ready");
+            delete timer; // we are in its thread so this is safe, and it must not be running when the socket changes threads
+            if (tmpConnections) {
+                // tmpConnections will get auto-deleted after this lambda returns because the QObject connection holding
+                // it alive will be disconnected.
+                for (const auto & conn : qAsConst(*tmpConnections))
+                    disconnect(conn);
+            }
+            // Send the socket back to the server's thread. We can't do that from within this signal emission since
+            // QSslSocket may still touch its internals after we return, so we defer it to the next event loop pass.
+            QMetaObject::invokeMethod(socket, [socket, srv, srvThread] {
+                socket->setParent(nullptr);
+                socket->moveToThread(srvThread);
+                // The context object for the below is the socket itself (which by then lives in the server's thread),
+                // so that if the server is gone by the time this is processed, we don't leak the socket.
+                QMetaObject::invokeMethod(socket, [socket, srv] {
+                    if (!srv) {
+                        socket->abort();
+                        socket->deleteLater();
+                        return;
+                    }
+                    srv->on_handshakeComplete(socket);
+                }, Qt::QueuedConnection);
+            }, Qt::QueuedConnection);
+        });
+        *tmpConnections +=
+        connect(socket, qOverload<const QList<QSslError> &>(&QSslSocket::sslErrors), socket, [socket, peerName, finish, stats](const QList<QSslError> & errors) {
+            finish(&stats->failed);
+            for (const auto & e : errors)
+                Warning() << peerName << " SSL error: " << e.errorString();
+            DebugM(peerName, " Aborting connection due to SSL errors");
+            socket->deleteLater();
+        });
+        timer->start(10'000); // give the TLS handshake 10 seconds to complete
+        socket->startServerEncryption();
+    }, Qt::QueuedConnection);
+}
+void ServerSSL::on_handshakeComplete(QSslSocket *socket)
+{
+    socket->setParent(this);
+    if (socket->state() != QAbstractSocket::SocketState::ConnectedState) {
+        // The peer went away while the socket was being handed back to us from the handshake thread. Nothing was
+        // connected to `disconnected` during that window, so we must catch it here, otherwise the Client would end up
+        // occupying a per-IP slot on a dead socket until the idle timeout.
+        DebugM(socket->peerAddress().toString(), ":", socket->peerPort(), " disconnected after SSL handshake, deleting socket");
         socket->abort();
         socket->deleteLater();
-    });
-    auto tmpConnections = std::make_shared<QList<QMetaObject::Connection>>();
-    *tmpConnections += connect(socket, &QSslSocket::disconnected, this, [socket, peerName]{
-        if (!socket->property(kTimedOutPropertyName).toBool())
-            DebugM(peerName, " SSL handshake failed due to disconnect before completion, deleting socket");
-        socket->deleteLater();
-    });
-    *tmpConnections += connect(socket, &QSslSocket::encrypted, this, [this, timer, tmpConnections, socket, peerName] {
-        TraceM(peerName, " SSL ready");
-        timer->stop();
-        timer->deleteLater();
-        if (tmpConnections) {
-            // tmpConnections will get auto-deleted after this lambda returns because the QObject connection holding
-            // it alive will be disconnected.
-            for (const auto & conn : qAsConst(*tmpConnections))
-                disconnect(conn);
-        }
-        if (!usesWS) {
-            // Classic non-WebSocket mode.  We are done; enqueue the connection and emit the signal.
-            addPendingConnection(socket);
-            emit newConnection();
-            return;
-        }
+        return;
+    }
+    if (!usesWS) {
+        // Classic non-WebSocket mode.  We are done; enqueue the connection and emit the signal.
+        addPendingConnection(socket);
+        emit newConnection();
+        return;
+    }
 
-        // WebSocket mode -- create the wrapper object and further negotiate the handshake.  Later on newConnection()
-        // will be emitted again on success, or the socket will be auto-deleted on failure.
-        startWebSocketHandshake(socket);
-    });
-    *tmpConnections +=
-    connect(socket, qOverload<const QList<QSslError> &>(&QSslSocket::sslErrors), this, [socket, peerName](const QList<QSslError> & errors) {
-        for (const auto & e : errors)
-            Warning() << peerName << " SSL error: " << e.errorString();
-        DebugM(peerName, " Aborting connection due to SSL errors");
-        socket->deleteLater();
-    });
-    timer->start(10'000); // give the TLS handshake 10 seconds to complete
-    socket->startServerEncryption();
+    // WebSocket mode -- create the wrapper object and further negotiate the handshake.  Later on newConnection()
+    // will be emitted again on success, or the socket will be auto-deleted on failure.
+    startWebSocketHandshake(socket);
 }
 // --- /SSL Server support ---
 
@@ -2691,6 +3397,15 @@ void Client::do_disconnect(bool graceful)
     ignoreNewIncomingMessages = true;
 }
 
+void Client::setCostPaused(bool b)
+{
+    if (b == costPaused)
+        return;
+    const bool wasPaused = isReadPaused();
+    costPaused = b;
+    readPausedMaybeChanged(wasPaused);
+}
+
 void Client::do_ping()
 {
     // Don't send clients pings.
@@ -24,6 +24,7 @@
 #include "PeerMgr.h"
 #include "RollingBloomFilter.h"
 #include "RPC.h"
+#include "ThreadPool.h"
 #include "Util.h"
 #include "Version.h"
 
@@ -33,11 +34,13 @@
 #include <QThread>
 #include <QVector>
 
+#include <functional>
 #include <memory> // for shared_ptr
 #include <mutex>
 #include <optional>
 #include <shared_mutex>
 #include <type_traits>
+#include <vector>
 
 struct TcpServerError : public Exception
 {
@@ -132,10 +135,10 @@ protected:
 
 class BitcoinDMgr;
 class Client;
+class SubStatus;
 class QSslSocket;
 class Storage;
 class SubsMgr;
-class ThreadPool;
 
 /// Base class for the Electrum-server-style linefeed-based JSON-RPC service.
 ///
@@ -230,6 +233,12 @@ protected:
     ///
     /// Note: On false return, socket->abort() and then socket->deleteLater() are called by this function.
     bool attachPerIPDataAndCheckLimits(QTcpSocket *);
+    /// Called by createSocketFromDescriptorAndCheckLimits on the raw socket descriptor, before any Qt socket object is
+    /// created (and thus before any SSL or WebSocket handshake work is done). Looks up the peer address via
+    /// getpeername() and, if the address is banned or already has the maximum number of connections allowed per IP,
+    /// closes the descriptor and returns true. Returns false if the connection should proceed normally (this includes
+    /// the case where the peer address cannot be determined -- attachPerIPDataAndCheckLimits deals with that later).
+    bool earlyRejectDescriptor(qintptr socketDescriptor);
     /// Used internally by both this incomingConnection implementation and ServerSSL's implementation.
     /// SockType must be QTcpSocket or QSslSocket.
     template <typename SockType,
@@ -275,7 +284,11 @@ protected:
     /// the work for later and handles sending the response (returned from work) to the client as well as sending
     /// any errors to the client. The `work` functor may throw RPCError, in which case code and message will be
     /// sent instead.  Note that all other exceptions also end up sent to the client as "internal error: MESSAGE".
-    void generic_do_async(Client *client, RPC::BatchId, const RPC::Message::Id &reqId,  const AsyncWorkFunc & work, int priority = 0);
+    ///
+    /// Work is scheduled fairly across client IP addresses (see ThreadPool::submitFairWork), with `cls` being a hint
+    /// as to how expensive `work` is expected to be (cheaper work gets dequeued more often).
+    void generic_do_async(Client *client, RPC::BatchId, const RPC::Message::Id &reqId,  const AsyncWorkFunc & work,
+                          ThreadPool::JobClass cls = ThreadPool::JobClass::Normal);
     void generic_async_to_bitcoind(Client *client,
                                    RPC::BatchId batchId, ///< if running in batch context, will be !batchId.isNull()
                                    const RPC::Message::Id & reqId,  ///< the original client request id
@@ -283,6 +296,28 @@ protected:
                                    const QVariantList &params, ///< params for bitcoind method
                                    const BitcoinDSuccessFunc & successFunc,
                                    const BitcoinDErrorFunc & errorFunc = BitcoinDErrorFunc());
+    /// Like generic_async_to_bitcoind(), but for RPCs whose answer only changes when the chain tip changes or the
+    /// mempool is refreshed (such as estimatefee). Results are cached keyed on (method, params) and the cache is
+    /// dropped whenever the tip or the mempool fee histogram generation changes. Concurrent misses for the same key
+    /// are "single-flight": only 1 request is sent to bitcoind and its result (or error) goes to all of the waiters.
+    /// Call this only from this object's thread.
+    void generic_async_to_bitcoind_cached(Client *client, RPC::BatchId batchId, const RPC::Message::Id & reqId,
+                                          const QString &method, const QVariantList &params,
+                                          const BitcoinDSuccessFunc & successFunc);
+    struct BitcoinDCache;
+    const std::unique_ptr<BitcoinDCache> bdCache;
+    /// Increments the bitcoind request throttle counters for client `c`, pausing its reads if it is over the limit.
+    /// Used by the above 2 functions. The counters are decremented again when the bitcoind request completes.
+    void chargeBitcoinDThrottle(Client *c);
+
+    /// Returns true if the IP address of client `c` has spent its CPU cost budget (see Options::CostLimitParams), in
+    /// which case its requests should be delayed.
+    bool isOverCostBudget(Client *c) const;
+    /// Appends `m` to the client's queue of delayed messages, pauses the client, and starts its timer which
+    /// processes the queue as the IP's budget refills. Used by onMessage().
+    void delayMessage(Client *c, RPC::BatchId batchId, const RPC::Message &m);
+    /// Actually dispatches message `m` to its rpc_* method. Used by onMessage() and by the above.
+    void dispatchMessage(Client *c, RPC::BatchId batchId, const RPC::Message &m);
 
     /// Subclasses may set this pointer if they wish the generic_do_async function above to use a private/custom
     /// threadpool. Otherwise the app-global ::AppThreadPool()  will be used for generic_do_async().
@@ -302,6 +337,15 @@ protected:
     /// "ws" & "wss" config file options and/or the --ws/--wss (-w/-W) CLI args.
     bool usesWS = false;
 
+    /// Counters for connections refused in incomingConnection, by reason. Reported in stats(). Only ever accessed from
+    /// this object's thread.
+    struct RejectCounts {
+        quint64 banned = 0; ///< refused early (before socket creation) because the IP address is banned
+        quint64 connLimitEarly = 0; ///< refused early because the IP address was already at the per-IP connection limit
+        quint64 connLimitLate = 0; ///< refused by attachPerIPDataAndCheckLimits due to the per-IP connection limit
+        quint64 noPeerAddress = 0; ///< refused by attachPerIPDataAndCheckLimits because the peer address was null
+    } rejectCounts;
+
     /// This is set on construction by querying Storage. Subclasses may use this information at runtime to present
     /// RPC behavior differences between BTC vs BCH vs LTC (e.g. in the address_* RPCs).
     BTC::Coin coin = BTC::Coin::Unknown;
@@ -375,6 +419,8 @@ private:
     void rpc_blockchain_scripthash_listunspent(Client *, RPC::BatchId, const RPC::Message &); // fully implemented
     void rpc_blockchain_scripthash_subscribe(Client *, RPC::BatchId, const RPC::Message &); // fully implemented
     void rpc_blockchain_scripthash_unsubscribe(Client *, RPC::BatchId, const RPC::Message &); // fully implemented
+    void rpc_blockchain_scripthash_subscribe_many(Client *, RPC::BatchId, const RPC::Message &); // Fulcrum extension
+    void rpc_blockchain_scripthash_get_status_many(Client *, RPC::BatchId, const RPC::Message &); // Fulcrum extension
     // transaction
     void rpc_blockchain_transaction_broadcast(Client *, RPC::BatchId, const RPC::Message &); // fully implemented
     void rpc_blockchain_transaction_get(Client *, RPC::BatchId, const RPC::Message &); // fully implemented
@@ -416,6 +462,17 @@ private:
     /// does normally if the params spec is correctly written).  Validation is done on the argument, however, and
     /// it will throw RPCError in all parse/failure cases and only ever returns a valid hash on success.
     HashX parseFirstHashParamCommon(const RPC::Message &m, const char *const errMsg = nullptr) const;
+    /// Used by the *_many methods above. Takes the first argument in m.paramsList(), which must be a list of at most
+    /// ServerMisc::kMaxScriptHashesPerBulkRequest hex scripthashes, and returns them decoded (in the same order).
+    /// Will throw RPCError on invalid argument.
+    std::vector<HashX> parseFirstHashListParamCommon(const RPC::Message &m) const;
+    /// Returns true if `nShSubs` subscriptions for the IP of client `c` would exceed Options::maxSubsPerIP, and the IP
+    /// is not whitelisted. Logs a (rate-limited) warning in that case.
+    bool isPerIPSubsLimitExceeded(Client *c, int64_t nShSubs);
+    /// Returns the status notification callback for client `c`'s subs made via `method`, creating it if needed. The
+    /// callback echoes the key back to the client as hex. See Client::subsNotifiers.
+    std::shared_ptr<const std::function<void(const HashX &, const SubStatus &)>>
+    getClientStatusCallback(Client *c, const QString &method);
 
 
     /// Basically a namespace for our rpc dispatch tables, etc
@@ -444,6 +501,29 @@ private:
 
     double lastSubsWarningPrintTime = 0.; ///< used internally to rate-limit "max subs exceeded" message spam to log
 
+    /// Returns the notification for (method, key, status), building it by calling `mkParams` only if no identical
+    /// notification was already built during the current event loop iteration. Since a status change (or a new
+    /// header) is delivered to all of this server's subscribed clients back-to-back, this means the notification
+    /// JSON is serialized once and then shared by all of them. Call this only from this object's thread.
+    RPC::SharedNotification getSharedNotification(const QString &method, const QByteArray &key, const SubStatus &status,
+                                                  const std::function<QVariantList()> &mkParams);
+    struct NotificationCache;
+    const std::unique_ptr<NotificationCache> notifCache;
+
+    /// Like generic_do_async(), but "single-flight": if an identical query (same `coalesceKey`) is already in flight
+    /// on this server, no new work is submitted and this request simply shares the result (or error) of the in-flight
+    /// one once it completes. `coalesceKey` must uniquely identify the result (see makeCoalesceKey()). Note that a
+    /// request may thus get a result computed slightly before it arrived (e.g. missing a mempool tx that just came in);
+    /// this is no different than the request having been processed a moment earlier, and the client's subscription
+    /// notifications will rectify the situation. Call this only from this object's thread.
+    void generic_do_async_coalesced(Client *c, RPC::BatchId batchId, const RPC::Message::Id &reqId,
+                                    const QByteArray &coalesceKey, const AsyncWorkFunc &work,
+                                    ThreadPool::JobClass cls = ThreadPool::JobClass::Normal);
+    /// Returns the key to use with generic_do_async_coalesced() for query `tag` on `hashX` at the current chain tip.
+    QByteArray makeCoalesceKey(const QByteArray &tag, const HashX &hashX) const;
+    struct InFlightQueries;
+    const std::unique_ptr<InFlightQueries> inFlight;
+
 protected:
     /// Rolling bloom filters used by blockchain.transaction.broadcast to suppress repetitive messages to the log.
     /// There is 1 of these shared amongst all intances of this class, however access to it is thread-safe.
@@ -477,7 +557,7 @@ public:
 
     QString prettyName() const override; ///< overrides super to indicate SSL in server name
 
-    /// override from Server -- we add custom stats for our TLS certificate
+    /// override from Server -- we add custom stats for our TLS certificate and for the TLS handshakes
     QVariant stats() const override;
 
     /// Overides ServerBase -- re-sets the SSL config (sometimes WSS uses a different config from regular SSL ports).
@@ -490,11 +570,21 @@ public slots:
     void setupSslConfiguration();
 
 protected:
-    /// overrides ServerBase to create a QSslSocket wrapping the passed-in file descriptor, and then initiate the TLS
-    /// server-side handshake.
+    /// overrides ServerBase to create a QSslSocket wrapping the passed-in file descriptor, and then hand it off to one
+    /// of the HandshakePool threads to do the TLS server-side handshake. Once the handshake completes, the socket is
+    /// moved back to our thread and handed to on_handshakeComplete().
     void incomingConnection(qintptr) override;
 private:
     QSslConfiguration sslConfiguration;
+
+    class HandshakePool; ///< defined in Servers.cpp; a single instance is shared by all ServerSSL instances
+    struct HandshakeStats; ///< defined in Servers.cpp
+    std::shared_ptr<HandshakePool> handshakePool;
+    /// Shared with the in-flight handshakes (which may outlive this instance), hence the shared_ptr.
+    const std::shared_ptr<HandshakeStats> handshakeStats;
+
+    /// Called in our thread after the TLS handshake succeeded and `socket` was moved back to our thread.
+    void on_handshakeComplete(QSslSocket *socket);
 };
 
 class SrvMgr;
@@ -612,16 +702,43 @@ public:
         std::atomic_uint64_t nExtantBatchRequests{0};
         /// The total estimated memory footprint of all extant batch requests for this IP
         std::atomic_int64_t extantBatchRequestCosts{0};
+
+        /// CPU cost accounting: a token bucket denominated in msec of thread pool work time. Each job run on behalf
+        /// of a client from this IP is charged the time it took. See Options::CostLimitParams.
+        std::atomic_uint64_t costUsec_cum{0}; ///< cumulative work time charged to this IP, in usec
+        std::atomic_uint64_t nCostDelays{0}; ///< the number of requests from this IP that were delayed due to cost
+        /// Thread-safe. Deducts `usec` of work time from this IP's bucket.
+        void chargeCost(qint64 usec);
+        /// Thread-safe. Refills the bucket according to `params` and returns the remaining credit in msec. A negative
+        /// value means this IP is over budget.
+        double costCredit(const Options::CostLimitParams &params);
+        /// Thread-safe. Returns the remaining credit in msec as of the last refill (does not refill).
+        double costCreditNoRefill() const;
+    private:
+        mutable std::mutex costMut; ///< guards the below 2
+        double costTokens = 0.; ///< remaining credit in msec, may go negative
+        qint64 costLastRefill = 0; ///< Util::getTime() timestamp of the last refill, or 0 if never refilled
     };
 
     std::shared_ptr<PerIPData> perIPData;
 
     bool isSubscribedToHeaders = false;
     std::atomic_int nShSubs{0};  ///< the number of unique scripthash subscriptions for this client.
+    /// Status notification callbacks handed to the SubsMgrs, one per subscribe method (e.g. "blockchain.scripthash.subscribe").
+    /// All of this client's subs made via a given method share the same callback, so the SubsMgr stores it just once.
+    /// (blockchain.address.subscribe is the exception since it needs a per-sub alias; see Server::impl_generic_subscribe).
+    QHash<QString, std::shared_ptr<const std::function<void(const QByteArray &, const SubStatus &)>>> subsNotifiers;
 
     //bitcoind_throttle counter, per client
     qint64 bdReqCtr = 0;
 
+    /// Messages delayed because this client's IP is over its CPU cost budget, in arrival order. See
+    /// ServerBase::delayMessage.
+    std::deque<std::pair<RPC::BatchId, RPC::Message>> costDelayedMessages;
+    /// Pauses/unpauses reading and batch processing while costDelayedMessages is not empty
+    void setCostPaused(bool b);
+    bool isReadPaused() const override { return ElectrumConnection::isReadPaused() || costPaused; }
+
     double lastWarnedAboutSubsLimit = 0.; ///< used to throttle log messages when client hits subs limit
 
     static std::atomic_size_t numClients, numClientsMax, numClientsCtr; // number of connected clients: current, max lifetime, accumulated counter
@@ -661,4 +778,5 @@ protected:
     [[nodiscard]] bool canAcceptBatch(RPC::BatchProcessor *) override;
 private:
     const Options & options;
+    bool costPaused = false;
 };
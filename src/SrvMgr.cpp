@@ -29,8 +29,11 @@
 #include "SubsMgr.h"
 #include "Util.h"
 
+#include <algorithm>
+#include <cmath>
 #include <mutex>
 #include <utility>
+#include <vector>
 
 namespace {
     constexpr size_t tableSqueezeThreshold = 64; ///< used by perIPData and addrIdMap to determing when to auto-squeeze.
@@ -455,10 +458,44 @@ QVariantList SrvMgr::adminRPC_getClients_blocking(int timeout_ms) const
         QVariantList ret;
         for (const auto & server : servers)
             ret.push_back( server->statsSafe(timeoutPerServer) );
+        ret.push_back( QVariantMap{{"topCpuConsumersPerIP", topCostConsumers(10)}} );
         return ret;
     }, timeout_ms);
 }
 
+QVariantList SrvMgr::topCostConsumers(int n) const
+{
+    std::vector<std::pair<QHostAddress, std::shared_ptr<Client::PerIPData>>> datas;
+    {
+        const auto [table, lock] = perIPData.getTable();
+        datas.reserve(size_t(table.size()));
+        for (auto it = table.cbegin(); it != table.cend(); ++it)
+            if (auto data = it.value().lock(); data && data->costUsec_cum.load() > 0)
+                datas.emplace_back(it.key(), std::move(data));
+        // lock released at scope end
+    }
+    const auto byCost = [](const auto &a, const auto &b) {
+        return a.second->costUsec_cum.load() > b.second->costUsec_cum.load();
+    };
+    if (n >= 0 && size_t(n) < datas.size()) {
+        std::partial_sort(datas.begin(), datas.begin() + n, datas.end(), byCost);
+        datas.resize(size_t(n));
+    } else
+        std::sort(datas.begin(), datas.end(), byCost);
+    QVariantList ret;
+    for (const auto & [addr, data] : datas) {
+        ret.push_back(QVariantMap{
+            { "ip", addr.toString() },
+            { "cpuMsec", qulonglong(data->costUsec_cum.load() / 1000u) },
+            { "cpuCreditMsec", std::round(data->costCreditNoRefill() * 10.0) / 10.0 },
+            { "nCostDelays", qulonglong(data->nCostDelays.load()) },
+            { "nClients", data->nClients.load() },
+            { "isWhiteListed", data->isWhitelisted() },
+        });
+    }
+    return ret;
+}
+
 std::shared_ptr<Client::PerIPData> SrvMgr::getOrCreatePerIPData(const QHostAddress &address)
 {
     auto ret = perIPData.getOrCreate(address, true);
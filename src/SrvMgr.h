@@ -63,7 +63,11 @@ public:
     /// (timeout_ms, specify timeout_ms <= 0 to block forever), and prepares the QVariantList RPC response appropriate
     /// to send back to the FulcrumAdmin script.  May throw Utils::TimeoutException, or Util::ThreadNotRunning if called
     /// with the servers stopped.
+    /// (The last item in the list is a map containing the top CPU consumers per IP, see topCostConsumers()).
     QVariantList adminRPC_getClients_blocking(int timeout_ms) const;
+    /// Thread-safe. Returns up to `n` IP addresses sorted by most cumulative CPU time charged (see
+    /// Client::PerIPData::chargeCost), as a list of maps suitable for the admin RPC.
+    QVariantList topCostConsumers(int n) const;
     /// Called by the admin server (and also the ::stats method). This is thread-safe as it takes a lock.
     /// Returns a map suitable for serializing to JSON or printing ot the /stats port.
     QVariantMap adminRPC_banInfo_threadSafe() const;
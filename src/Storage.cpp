@@ -44,11 +44,16 @@
 #include <QByteArray>
 #include <QDir>
 #include <QFileInfo>
+#include <QtEndian>
 #include <QVector> // we use this for the Height2Hash cache to save on memcopies since it's implicitly shared.
 
 #include <algorithm>
+#include <array>
 #include <atomic>
+#include <bitset>
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
 #include <cstddef> // for std::byte
 #include <cstdlib>
 #include <cstring> // for memcpy
@@ -56,6 +61,7 @@
 #include <limits>
 #include <list>
 #include <map>
+#include <mutex>
 #include <optional>
 #include <set>
 #include <shared_mutex>
@@ -92,7 +98,7 @@ namespace {
 
     // some database keys we use -- todo: if this grows large, move it elsewhere
     static const bool falseMem = false, trueMem = true;
-    static const rocksdb::Slice kMeta{"meta"}, kDirty{"dirty"}, kUtxoCount{"utxo_count"},
+    static const rocksdb::Slice kMeta{"meta"}, kDirty{"dirty"}, kUtxoCount{"utxo_count"}, kShistLayout{"shist_layout"},
                                 kTrue(reinterpret_cast<const char *>(&trueMem), sizeof(trueMem)),
                                 kFalse(reinterpret_cast<const char *>(&falseMem), sizeof(falseMem));
 
@@ -484,6 +490,207 @@ namespace {
     struct UserInterrupted : public Exception { using Exception::Exception; ~UserInterrupted() override; };
     UserInterrupted::~UserInterrupted() {} // weak vtable warning suppression
 
+    /// Scans every row of a db table using multiple threads. Used by the slow CheckDB (-C) startup checks.
+    ///
+    /// The keyspace is partitioned into NShards key ranges by the first byte of the key. All of the tables we scan
+    /// this way are keyed by a hash (or a fragment of one), so the shards end up roughly equal in size. Each thread
+    /// repeatedly takes the next unscanned shard until none are left. Progress is logged periodically from the calling
+    /// thread, which also watches for Ctrl-C.
+    ///
+    /// If a Checkpoint is specified, the per-shard results are saved to the meta db each time a shard completes, so
+    /// that an interrupted scan resumes where it left off on the next startup (provided the db tip did not change in
+    /// the meantime). The checkpoint is deleted once the whole table has been scanned.
+    class ShardedTableScan {
+    public:
+        static constexpr unsigned NShards = 256;
+
+        /// Per-shard accumulator that the row function writes to. Summed across all shards at the end of the scan.
+        struct Result {
+            uint64_t count = 0; ///< number of rows (or items) verified
+            uint32_t flags = 0; ///< caller-defined bits (e.g. which known exceptions were seen), OR'd across shards
+            unsigned shard = 0; ///< the shard this result is for (not summed, and not saved in the checkpoint)
+            Result &operator+=(const Result &o) { count += o.count; flags |= o.flags; return *this; }
+        };
+
+        struct Checkpoint {
+            rocksdb::DB *db = nullptr; ///< the meta db; if nullptr, no checkpoints are saved or loaded
+            QByteArray key; ///< the key in `db` under which the checkpoint is saved
+            int tipHeight = -1;
+            Storage::HeaderHash tipHash; ///< a saved checkpoint is only used if the tip still matches
+        };
+
+        ShardedTableScan(rocksdb::DB *db_, const rocksdb::ReadOptions &ropts_, const QString &name_, Checkpoint cp_ = {})
+            : db(db_), ropts(ropts_), name(name_), cp(std::move(cp_))
+        {
+            // don't evict hot data from the block cache with a one-off full table scan
+            ropts.fill_cache = false;
+        }
+
+        /// Calls `rowFunc(const rocksdb::Slice &key, const rocksdb::Slice &value, Result &shardResult)` for every row,
+        /// and then `shardEndFunc(Result &shardResult)` from the same thread once all the rows of a shard were visited
+        /// (useful for callers that batch up work per shard). Both are called concurrently from multiple threads and may
+        /// throw. The first exception thrown aborts the scan and is rethrown here. Throws UserInterrupted if the app
+        /// caught a signal during the scan.
+        template <typename RowFunc, typename ShardEndFunc = void(*)(Result &)>
+        Result run(const RowFunc &rowFunc, const ShardEndFunc &shardEndFunc = [](Result &){}) {
+            loadCheckpoint();
+            std::vector<unsigned> todo;
+            for (unsigned i = 0; i < NShards; ++i)
+                if (!done[i]) todo.push_back(i);
+            const unsigned nThreads = std::clamp(Util::getNVirtualProcessors(), 1u, std::max(unsigned(todo.size()), 1u));
+            if (todo.size() < NShards)
+                Log() << "CheckDB: " << name << ": resuming from checkpoint, " << (NShards - todo.size()) << "/"
+                      << NShards << " key ranges already verified";
+            Debug() << "CheckDB: " << name << ": scanning " << todo.size() << " key ranges using " << nThreads
+                    << Util::Pluralize(" thread", nThreads);
+
+            const Tic t0;
+            std::atomic_size_t nextTodo{0};
+            std::atomic_bool abort{false};
+            unsigned nRunning = nThreads; // guarded by mut
+            std::exception_ptr exc; // guarded by mut
+            std::vector<std::thread> threads;
+            threads.reserve(nThreads);
+            for (unsigned t = 0; t < nThreads; ++t) {
+                threads.emplace_back([&]{
+                    try {
+                        for (size_t k; !abort && (k = nextTodo++) < todo.size(); ) {
+                            Result res;
+                            res.shard = todo[k];
+                            if (!scanShard(todo[k], rowFunc, res, abort))
+                                break; // aborted mid-shard; this shard's partial result is discarded
+                            shardEndFunc(res);
+                            markDone(todo[k], res);
+                        }
+                    } catch (...) {
+                        std::unique_lock g(mut);
+                        if (!exc) exc = std::current_exception();
+                        abort = true;
+                    }
+                    {
+                        std::unique_lock g(mut);
+                        --nRunning;
+                    }
+                    cond.notify_all();
+                });
+            }
+            bool interrupted = false;
+            {
+                App *ourApp = app();
+                Tic tLog;
+                std::unique_lock g(mut);
+                while (nRunning) {
+                    cond.wait_for(g, std::chrono::milliseconds(100));
+                    if (!abort && ourApp && ourApp->signalsCaught())
+                        abort = interrupted = true;
+                    if (nRunning && !abort && tLog.secs() >= 10.) {
+                        tLog = Tic();
+                        Log() << "CheckDB: " << name << ": " << QString::number(nDone * 100.0 / NShards, 'f', 1)
+                              << "% (" << nRows.load() << " rows verified, " << t0.secsStr(0) << " sec elapsed) ...";
+                    }
+                }
+            }
+            for (auto & thr : threads) thr.join();
+            if (exc) std::rethrow_exception(exc);
+            if (interrupted) throw UserInterrupted("User interrupted, aborting check");
+
+            if (cp.db)
+                GenericDBDelete(cp.db, cp.key, "Failed to delete the CheckDB checkpoint from the meta db");
+            Result total;
+            for (const auto & r : results) total += r;
+            Debug() << "CheckDB: " << name << ": scanned " << nRows.load() << " rows in " << t0.secsStr() << " sec";
+            return total;
+        }
+
+    private:
+        static constexpr uint32_t kCheckpointMagic = 0x5ca4c4ec;
+
+        rocksdb::DB * const db;
+        rocksdb::ReadOptions ropts;
+        const QString name;
+        const Checkpoint cp;
+
+        std::mutex mut;
+        std::condition_variable cond;
+        // the below are guarded by mut
+        std::array<bool, NShards> done{};
+        std::array<Result, NShards> results{};
+        unsigned nDone = 0;
+
+        std::atomic_uint64_t nRows{0}; ///< for progress reporting only
+
+        template <typename RowFunc>
+        bool scanShard(const unsigned shard, const RowFunc &rowFunc, Result &res, const std::atomic_bool &abort) {
+            const char lo = char(shard), hi = char(shard + 1);
+            const rocksdb::Slice lower(&lo, 1), upper(&hi, 1);
+            rocksdb::ReadOptions opts(ropts);
+            opts.iterate_lower_bound = &lower;
+            if (shard + 1 < NShards) opts.iterate_upper_bound = &upper;
+            std::unique_ptr<rocksdb::Iterator> iter(db->NewIterator(opts));
+            if (!iter) throw DatabaseError(QString("Unable to obtain an iterator to the %1 db").arg(name));
+            unsigned ctr = 0;
+            for (iter->Seek(lower); iter->Valid(); iter->Next()) {
+                rowFunc(iter->key(), iter->value(), res);
+                if (UNLIKELY(0 == ++ctr % 1000)) {
+                    nRows += 1000;
+                    if (abort) return false;
+                }
+            }
+            nRows += ctr % 1000;
+            if (const auto st = iter->status(); !st.ok())
+                throw DatabaseError(QString("Error iterating over the %1 db: %2").arg(name, StatusString(st)));
+            return true;
+        }
+
+        void markDone(unsigned shard, const Result &res) {
+            std::unique_lock g(mut);
+            done[shard] = true;
+            results[shard] = res;
+            ++nDone;
+            if (!cp.db) return;
+            QByteArray ba;
+            {
+                QDataStream ds(&ba, QIODevice::WriteOnly|QIODevice::Truncate);
+                ds << kCheckpointMagic << qint32(cp.tipHeight) << cp.tipHash;
+                for (unsigned i = 0; i < NShards; ++i)
+                    ds << done[i] << quint64(results[i].count) << quint32(results[i].flags);
+            }
+            GenericDBPut(cp.db, cp.key, ba, "Failed to save the CheckDB checkpoint to the meta db");
+        }
+
+        void loadCheckpoint() {
+            if (!cp.db) return;
+            const auto opt = GenericDBGet<QByteArray>(cp.db, cp.key, true, "Failed to read the CheckDB checkpoint from the meta db");
+            if (!opt) return;
+            QDataStream ds(*opt);
+            uint32_t magic{};
+            qint32 height{};
+            Storage::HeaderHash hash;
+            ds >> magic >> height >> hash;
+            if (ds.status() != QDataStream::Ok || magic != kCheckpointMagic || height != cp.tipHeight || hash != cp.tipHash) {
+                Debug() << "CheckDB: " << name << ": ignoring stale or invalid checkpoint";
+                return;
+            }
+            std::array<bool, NShards> d{};
+            std::array<Result, NShards> r{};
+            for (unsigned i = 0; i < NShards; ++i) {
+                quint64 count{};
+                quint32 flags{};
+                ds >> d[i] >> count >> flags;
+                r[i] = {count, flags, i};
+            }
+            if (ds.status() != QDataStream::Ok) {
+                Debug() << "CheckDB: " << name << ": ignoring truncated checkpoint";
+                return;
+            }
+            std::unique_lock g(mut);
+            done = d;
+            results = r;
+            nDone = unsigned(std::count(done.begin(), done.end(), true));
+            for (const auto & res : results) nRows += res.count;
+        }
+    };
+
     /// Manages the txhash2txnum rocksdb table.  The schema is:
     /// Key: N bytes from POS position from the big-endian ordered (JSON ordered) txhash (default 6 from the End)
     /// Value: One or more serialized VarInts. Each VarInt represents a "TxNum" (which tells us where the actual hash
@@ -809,71 +1016,63 @@ namespace {
     public:
         // -- Utility / consistency check, etc ..
 
-        void consistencyCheck() { // this throws if the checks fail
+        /// Scans the whole table in parallel (see ShardedTableScan), resuming from `cp` if a valid one exists.
+        void consistencyCheck(const ShardedTableScan::Checkpoint &cp = {}) { // this throws if the checks fail
             const Tic t0;
             Log() << "CheckDB: Verifying txhash index (this may take some time) ...";
-            std::unique_ptr<rocksdb::Iterator> iter(db->NewIterator(rdOpts));
-            size_t i = 0, verified = 0;
-            QString err;
             constexpr size_t batchSize = 50'000;
-            std::vector<std::pair<std::string, uint64_t>> batch;
-            std::vector<uint64_t> batchNums;
-            batch.reserve(batchSize + 500);
-            batchNums.reserve(batchSize + 500);
-            auto ProcBatch = [this, &batch, &batchNums, &err, &verified]{
-                std::sort(batch.begin(), batch.end(), [](const auto & a, const auto & b){
+            struct Batch {
+                std::vector<std::pair<std::string, uint64_t>> items;
+                std::vector<uint64_t> nums;
+            };
+            // Each shard is only ever visited by 1 thread at a time, so each thread only touches its own shard's batch
+            std::array<Batch, ShardedTableScan::NShards> batches;
+            auto ProcBatch = [this](Batch &batch, ShardedTableScan::Result &res) {
+                auto & [items, nums] = batch;
+                std::sort(items.begin(), items.end(), [](const auto & a, const auto & b){
                     return a.second < b.second;
                 });
-                std::sort(batchNums.begin(), batchNums.end());
-                const auto recs = rf->readRandomRecords(batchNums, &err);
-                if (recs.size() != batchNums.size()) throw InternalError(QString("short read of records: ") + err);
+                std::sort(nums.begin(), nums.end());
+                QString err;
+                const auto recs = rf->readRandomRecords(nums, &err);
+                if (recs.size() != nums.size()) throw InternalError(QString("short read of records: ") + err);
                 for (size_t i = 0; i < recs.size(); ++i) {
                     const auto &hash = recs[i];
-                    const auto txNum = batchNums[i];
-                    if (batch[i].second != txNum) throw DatabaseError("txNum mismatch");
+                    const auto txNum = nums[i];
+                    if (items[i].second != txNum) throw DatabaseError("txNum mismatch");
                     if (hash.length() != HashLen) throw DatabaseFormatError("bad record");
                     const auto expect = makeKeyFromHash(hash).toByteArray();
-                    const auto &keyStr = batch[i].first;
+                    const auto &keyStr = items[i].first;
                     const auto key = QByteArray::fromRawData(keyStr.data(), keyStr.size());
                     if (key != expect)
                         throw DatabaseError(QString("record %1 does not match key. expected: %2, got: %3")
                                             .arg(txNum).arg(QString(expect.toHex())).arg(QString(key.toHex())));
-                    ++verified;
+                    ++res.count;
                 }
-                batch.resize(0);
-                batchNums.resize(0);
+                batch = Batch{}; // release memory
             };
-            App *ourApp = app();
-            const auto nrec = rf->numRecords();
-            for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
-                if (UNLIKELY(0 == i % 100 && ourApp && ourApp->signalsCaught()))
-                    throw UserInterrupted("User interrupted, aborting check"); // if the user hits Ctrl-C, stop the operation
-                if (i && 0 == i % 1'000'000) {
-                    *(0 == i % 5'000'000 ? std::make_unique<Log>() : std::make_unique<Debug>())
-                    << "Verified " << verified << "/" << nrec << ", merge ops so far: " << mergeCount() << " ...";
-                }
-                const auto keySlice = iter->key();
-                const auto valSlice = iter->value();
+            ShardedTableScan scan(db, rdOpts, DBName(db), cp);
+            const auto result = scan.run([&](const rocksdb::Slice &keySlice, const rocksdb::Slice &valSlice, ShardedTableScan::Result &res) {
                 const auto key = FromSlice(keySlice);
                 if (key.startsWith(kLargestTxNumSeenKeyPrefix))
-                    continue; // skip this meta entry
+                    return; // skip this meta entry
+                auto & batch = batches[res.shard];
                 const auto val = FromSlice(valSlice);
                 Span<const std::byte> bytes(reinterpret_cast<const std::byte *>(val.constData()), val.size());
                 if (bytes.empty()) throw DatabaseFormatError("Empty db data!");
                 while (!bytes.empty()) {
                     auto vint = VarInt::deserialize(bytes);
                     auto txNum = vint.value<uint64_t>();
-                    batch.emplace_back(keySlice.ToString(), txNum);
-                    batchNums.push_back(txNum);
-                    ++i;
-                }
-                if (batch.size() >= batchSize) {
-                    ProcBatch();
+                    batch.items.emplace_back(keySlice.ToString(), txNum);
+                    batch.nums.push_back(txNum);
                 }
-            }
-            if (!batch.empty()) ProcBatch();
-            iter->Reset();
-            Log() << "CheckDB: txhash index verified " << verified << " entries in " << t0.secsStr(1) << " secs";
+                if (batch.items.size() >= batchSize)
+                    ProcBatch(batch, res);
+            }, [&](ShardedTableScan::Result &res) {
+                if (auto & batch = batches[res.shard]; !batch.items.empty())
+                    ProcBatch(batch, res);
+            });
+            Log() << "CheckDB: txhash index verified " << result.count << " entries in " << t0.secsStr(1) << " secs";
         }
 
         void rebuildDB() {
@@ -953,6 +1152,68 @@ namespace {
 
     /* static */ const QByteArray TxHash2TxNumMgr::kLargestTxNumSeenKeyPrefix = "+largestTxNumSeen";
 
+    /// The on-disk layout of the scripthash_history table (persisted in the meta db under kShistLayout).
+    enum class ShistLayout : uint8_t {
+        Legacy = 0,  ///< 1 row per hashX: key = hashX, value = the hashX's entire TxNumVec
+        Chunked = 1, ///< 1 row per (hashX, chunk): key = hashX + big-endian uint32 chunk number, value = TxNumVec
+        Converting = 2, ///< a conversion between the above two was interrupted; rows of both kinds may be present
+    };
+
+    /// In the chunked layout, each chunk covers 2^kShistChunkBits TxNums (~1M txs, or a few hundred blocks on BTC).
+    /// Since TxNums are at most 48 bits, chunk numbers always fit in a uint32.
+    constexpr unsigned kShistChunkBits = 20;
+    constexpr int kShistChunkKeyLen = HashLen + int(sizeof(uint32_t));
+#ifdef ENABLE_TESTS
+    /// The "shist" test lowers this so that a small synthetic chain spans many chunks. It must never change while
+    /// a Storage instance is open.
+    unsigned shistChunkBits = kShistChunkBits;
+#else
+    constexpr unsigned shistChunkBits = kShistChunkBits;
+#endif
+
+    inline uint32_t shistChunkForTxNum(TxNum n) { return uint32_t(n >> shistChunkBits); }
+
+    /// The chunk number is appended big-endian so that a hashX's rows sort in TxNum order.
+    QByteArray mkShistChunkKey(const QByteArray &hashX, uint32_t chunk) {
+        QByteArray ret(kShistChunkKeyLen, Qt::Uninitialized);
+        std::memcpy(ret.data(), hashX.constData(), size_t(std::min(hashX.size(), HashLen)));
+        qToBigEndian(chunk, ret.data() + HashLen);
+        return ret;
+    }
+
+    /// Calls f(chunk, nums) for each run of TxNums in `sorted` that fall into the same chunk.
+    template <typename Func>
+    void forEachShistChunk(const TxNumVec &sorted, Func && f) {
+        for (auto it = sorted.begin(); it != sorted.end(); ) {
+            const uint32_t chunk = shistChunkForTxNum(*it);
+            const auto end = std::find_if(it, sorted.end(), [chunk](TxNum n){ return shistChunkForTxNum(n) != chunk; });
+            f(chunk, TxNumVec(it, end));
+            it = end;
+        }
+    }
+
+    /// The phases of Storage::addBlock that we time. The first kNumCommitPhases of these are the independent table
+    /// writes, each of which gets its own co-task so that they may proceed concurrently. The rest run in the calling
+    /// thread.
+    enum class AddBlockPhase : unsigned {
+        TxNums = 0, TxHash2TxNum, UTXOSet, ShUnspent, ShHistory, BlkInfo, Undo, Headers, // <-- table writes
+        Prepare,      ///< mempool cleanup & header verification
+        UTXOResolve,  ///< building the utxo batch, which includes looking up the spent inputs
+        HistoryBuild, ///< building the scripthash_history batch
+        Join,         ///< time spent waiting for the table writes to complete
+        Total,        ///< wall-clock time spent with the locks held
+    };
+    constexpr size_t kNumCommitPhases = size_t(AddBlockPhase::Prepare), kNumAddBlockPhases = size_t(AddBlockPhase::Total) + 1;
+    constexpr std::array<const char *, kNumAddBlockPhases> kAddBlockPhaseNames = {
+        "txnum2txhash", "txhash2txnum", "utxoset", "scripthash_unspent", "scripthash_history", "blkinfo", "undo",
+        "headers", "prepare", "utxo_resolve", "history_build", "join", "total",
+    };
+    using AddBlockTimes = std::array<double, kNumAddBlockPhases>; ///< msec, indexed by AddBlockPhase
+
+    /// Blocks with fewer txs than this commit their tables serially in the calling thread, since for them the thread
+    /// hand-off overhead would eat up any gains.
+    constexpr size_t kMinTxsForParallelCommit = 1000;
+
 } // namespace
 
 struct Storage::Pvt
@@ -1001,6 +1262,7 @@ struct Storage::Pvt
 
     std::unique_ptr<RecordFile> txNumsFile;
     std::unique_ptr<RecordFile> headersFile;
+    std::unique_ptr<RecordFile> blkInfoFile; ///< flat copy of the blkinfo table, kept in lockstep with it; loaded at startup
 
     /// Big lock used for block/history updates. Public methods that read the history such as getHistory and listUnspent
     /// take this as read-only (shared), and addBlock and undoLatestBlock take this as read/write (exclusively).
@@ -1014,9 +1276,10 @@ struct Storage::Pvt
 
     std::atomic<TxNum> txNumNext{0};
 
-    std::vector<BlkInfo> blkInfos;
-    std::map<TxNum, unsigned> blkInfosByTxNum; ///< ordered map of TxNum0 for a block -> index into above blkInfo array
-    RWLock blkInfoLock; ///< locks blkInfos and blkInfosByTxNum
+    ShistLayout shistLayout = ShistLayout::Legacy; ///< set once at startup by loadCheckShistLayout()
+
+    std::vector<BlkInfo> blkInfos; ///< indexed by height. Sorted by txNum0, so heightForTxNum() binary-searches it.
+    RWLock blkInfoLock; ///< locks blkInfos
 
     std::atomic<int64_t> utxoCt = 0;
 
@@ -1059,11 +1322,21 @@ struct Storage::Pvt
 
     Mempool mempool; ///< app-wide mempool data -- does not get saved to db. Controller.cpp writes to this
     Mempool::FeeHistogramVec mempoolFeeHistogram; ///< refreshed periodically by refreshMempoolHistogram()
+    std::atomic<quint64> mempoolFeeHistogramGen = 0; ///< incremented by refreshMempoolHistogram()
     RWLock mempoolLock;
 
     Tic lastWarned; ///< to rate-limit potentially spammy warning messages (guarded by blocksLock)
 
-    std::unique_ptr<CoTask> blocksWorker; ///< work to be done in parallel can be submitted to this co-task in addBlock and undoLatestBlock
+    std::unique_ptr<CoTask> blocksWorker; ///< work to be done in parallel can be submitted to this co-task in undoLatestBlock
+    /// addBlock writes each of its tables on its own co-task (indexed by AddBlockPhase), see kMinTxsForParallelCommit
+    std::array<std::unique_ptr<CoTask>, kNumCommitPhases> commitWorkers;
+
+    struct AddBlockStats {
+        mutable std::mutex mut; ///< guards the below
+        AddBlockTimes last{}, total{};
+        BlockHeight lastHeight = 0;
+        uint64_t nBlocks = 0, nParallel = 0;
+    } addBlockStats;
 };
 
 namespace {
@@ -1453,9 +1726,12 @@ class Storage::UTXOCache
                     throw InternalError("Tried overwriting existing TXO in cache but failed! THIS SHOULD NEVER HAPPEN!");
             }
         }
-        // NOTE: Assumption is that this txo was not in `rms`.  On mainnet the dupe txos are unspent
-        //       between the 2 times they appear, so this assumption holds, and since BIP34 has been
-        //       activated, it will always hold, since only 1 of them can ever be spent in the future.
+        // NOTE: This txo may also be in `rms`. This happens when undoLatestBlock() re-adds a txo that was spent by
+        //       the block being undone, while that spend's delete is still queued. (On mainnet it can't happen
+        //       otherwise: the dupe pre-BIP34 txos are unspent between the 2 times they appear.) We don't remove
+        //       it from `rms`. Instead, correctness relies on the flush applying all of `rms` *before* any of
+        //       `adds` (see do_parallel_flush), so that the add wins. The early-abort checks preserve this too: if
+        //       the rms loop stops early, the adds loop stops at once. Do not reorder those loops!
 
         if (isNotInDBYet) {
             adds.insert(it);
@@ -1485,8 +1761,10 @@ class Storage::UTXOCache
                       << it->second << " amt2: " << amt << "], overwriting existing with amt2.";
             it->second = amt; // overwrite existing to preserve behavior of pre-UTXOCache code.
         }
-        // NOTE: Assumption is that an add will never add a shunspent key that is in the shunspentRms vector.
-        // (this is not checked for performance.)
+        // NOTE: The key may also be in `shunspentRms`, e.g. when undoLatestBlock() re-adds an output whose delete
+        // is still queued. This is not checked for performance. Instead, do_shunspent_flush() must apply all of
+        // `shunspentRms` *before* any of `shunspentAdds`, so that the add wins. Its early-abort checks keep this
+        // order. Do not reorder those loops!
     }
 
     bool rm(const TXO &txo) {
@@ -1884,15 +2162,25 @@ void Storage::startup()
     loadCheckShunspentInDB();
     // load check earliest undo to populate earliestUndoHeight
     loadCheckEarliestUndo();
+    // check the scripthash_history layout matches db_history_chunked, converting the table if it does not
+    loadCheckShistLayout();
     // if user specified --compact-dbs on CLI, run the compaction now before returning
     compactAllDBs();
+    // load the scripthash statuses saved on last shutdown (if any), so that clients re-subscribing after a restart
+    // don't all trigger a full status computation at once
+    if (options->persistStatusCache)
+        subsmgr->loadPersistedStatuses(statusCacheFileName());
 
-    // start up the co-task we use in addBlock and undoLatestBlock
+    // start up the co-tasks we use in addBlock and undoLatestBlock
     p->blocksWorker = std::make_unique<CoTask>("Storage Worker");
+    for (size_t i = 0; i < kNumCommitPhases; ++i)
+        p->commitWorkers[i] = std::make_unique<CoTask>(QString("Storage Commit: %1").arg(kAddBlockPhaseNames[i]));
 
     start(); // starts our thread
 }
 
+QString Storage::statusCacheFileName() const { return options->datadir + QDir::separator() + "status_cache"; }
+
 void Storage::compactAllDBs()
 {
     if (!options->compactDBs)
@@ -1950,10 +2238,16 @@ void Storage::gentlyCloseAllDBs()
 void Storage::cleanup()
 {
     stop(); // joins our thread
+    const bool wasStarted = bool(p->blocksWorker); // startup() creates this as the last thing it does
     if (p->blocksWorker) p->blocksWorker.reset(); // stop the co-task
+    for (auto & w : p->commitWorkers) w.reset(); // stop the commit co-tasks
     if (txsubsmgr) txsubsmgr->cleanup();
     if (dspsubsmgr) dspsubsmgr->cleanup();
     if (subsmgr) subsmgr->cleanup();
+    // Note: this must come after subsmgr->cleanup() above (which joins its thread), so that a notification pass that
+    // is in-flight cannot leave us saving a pre-block status tagged with the post-block tip.
+    if (wasStarted && subsmgr && options->persistStatusCache)
+        subsmgr->savePersistedStatuses(statusCacheFileName());
     gentlyCloseAllDBs();
     // TODO: unsaved/"dirty state" detection here -- and forced save, if needed.
 }
@@ -1995,6 +2289,23 @@ auto Storage::stats() const -> Stats
         caches["merkleHeaders_SizeBytes"] = qulonglong(bytes);
     }
     ret["caches"] = caches;
+    {
+        // addBlock per-phase timings (the table write phases run concurrently for large blocks, so they need not
+        // add up to "total")
+        QVariantMap m, last, avg;
+        const auto & s = p->addBlockStats;
+        std::unique_lock g(s.mut);
+        for (size_t i = 0; i < kNumAddBlockPhases; ++i) {
+            last[kAddBlockPhaseNames[i]] = s.last[i];
+            avg[kAddBlockPhaseNames[i]] = s.nBlocks ? s.total[i] / double(s.nBlocks) : 0.;
+        }
+        m["blocks"] = qulonglong(s.nBlocks);
+        m["blocks (parallel commit)"] = qulonglong(s.nParallel);
+        m["last height"] = s.nBlocks ? QVariant(s.lastHeight) : QVariant();
+        m["last block (msec)"] = last;
+        m["avg per block (msec)"] = avg;
+        ret["addBlock timings"] = m;
+    }
     {
         // db stats
         QVariantMap m;
@@ -2289,23 +2600,116 @@ void Storage::loadCheckTxNumsFileAndBlkInfo()
     p->txNumsFile = std::make_unique<RecordFile>(options->datadir + QDir::separator() + "txnum2txhash", HashLen, 0x000012e2);
     p->txNumNext = p->txNumsFile->numRecords();
     Debug() << "Read TxNumNext from file: " << p->txNumNext.load();
+    // may throw. This is a flat array of BlkInfo (one record per height) that mirrors the blkinfo table, so that we
+    // may load it in 1 read on startup rather than scanning the table.
+    p->blkInfoFile = std::make_unique<RecordFile>(options->datadir + QDir::separator() + "blkinfo_snapshot", sizeof(BlkInfo), 0x00b1c1f0);
     TxNum ct = 0;
     if (const int height = latestTip().first; height >= 0)
     {
-        p->blkInfos.reserve(std::min(size_t(height+1), MAX_HEADERS));
+        const size_t nBlks = size_t(height) + 1;
         Log() << "Checking tx counts ...";
-        for (int i = 0; i <= height; ++i) {
-            static const QString errMsg("Failed to read a blkInfo from db, the database may be corrupted");
-            const auto blkInfo = GenericDBGetFailIfMissing<BlkInfo>(p->db.blkinfo.get(), uint32_t(i), errMsg, false, p->db.defReadOpts);
-            if (blkInfo.txNum0 != ct)
+        const Tic t0;
+        // Returns the index of the first BlkInfo whose txNum0 does not follow from the ones before it, or -1 if all ok
+        const auto firstBadBlkInfo = [](const std::vector<BlkInfo> &v) -> int {
+            TxNum expected = 0;
+            for (size_t i = 0; i < v.size(); ++i) {
+                if (v[i].txNum0 != expected)
+                    return int(i);
+                expected += v[i].nTx;
+            }
+            return -1;
+        };
+        const auto loadFromSnapshot = [&]() -> std::vector<BlkInfo> {
+            std::vector<BlkInfo> ret;
+            if (const auto nrecs = p->blkInfoFile->numRecords(); nrecs != nBlks) {
+                Debug() << "blkinfo snapshot has " << nrecs << " records, expected " << nBlks << ", ignoring";
+                return ret;
+            }
+            QString err;
+            const QByteArray blob = p->blkInfoFile->readRecordsContiguous(0, nBlks, &err);
+            if (blob.isEmpty()) {
+                Warning() << "Failed to read the blkinfo snapshot: " << err;
+                return ret;
+            }
+            ret.resize(nBlks);
+            std::memcpy(reinterpret_cast<char *>(ret.data()), blob.constData(), nBlks * sizeof(BlkInfo));
+            // validate against the db: the entry for the tip must match what the blkinfo table has
+            const auto dbTip = GenericDBGet<BlkInfo>(p->db.blkinfo.get(), uint32_t(height), true, QString(), false, p->db.defReadOpts);
+            if (!dbTip || *dbTip != ret.back()) {
+                Debug() << "blkinfo snapshot does not match the db at height " << height << ", ignoring";
+                ret.clear();
+            } else if (const int bad = firstBadBlkInfo(ret); bad > -1) {
+                Warning() << "blkinfo snapshot failed verification at height " << bad << ", ignoring";
+                ret.clear();
+            }
+            return ret;
+        };
+        const auto loadFromDB = [&] {
+            // Read the whole table with a single iterator rather than doing nBlks point lookups. Note that the keys are
+            // host byte order uint32's, so the rows don't come back in height order -- hence the temporary vector.
+            std::vector<BlkInfo> ret(nBlks);
+            std::vector<bool> present(nBlks, false);
+            rocksdb::ReadOptions ropts(p->db.defReadOpts);
+            ropts.fill_cache = false;
+            std::unique_ptr<rocksdb::Iterator> iter(p->db.blkinfo->NewIterator(ropts));
+            if (!iter) throw DatabaseError("Unable to obtain an iterator to the blkinfo db");
+            for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+                if (iter->key().size() != sizeof(uint32_t))
+                    throw DatabaseFormatError("Unexpected key in blkinfo database. We expect only 32-bit unsigned ints!");
+                const auto h = DeserializeScalar<uint32_t>(FromSlice(iter->key()));
+                if (h >= nBlks)
+                    continue; // beyond the tip; never read by us
+                bool ok;
+                ret[h] = Deserialize<BlkInfo>(FromSlice(iter->value()), &ok);
+                if (!ok)
+                    throw DatabaseSerializationError(QString("Failed to deserialize the blkInfo for height %1, the"
+                                                             " database may be corrupted").arg(h));
+                present[h] = true;
+            }
+            if (const auto st = iter->status(); !st.ok())
+                throw DatabaseError("Error iterating over the blkinfo db: " + StatusString(st));
+            if (const auto it = std::find(present.begin(), present.end(), false); it != present.end())
+                throw DatabaseFormatError(QString("BlkInfo for height %1 is missing from the db, the database may be"
+                                                  " corrupted").arg(it - present.begin()));
+            if (const int bad = firstBadBlkInfo(ret); bad > -1) {
+                const TxNum expected = bad ? ret[size_t(bad) - 1].txNum0 + ret[size_t(bad) - 1].nTx : 0;
                 throw DatabaseFormatError(QString("BlkInfo for height %1 does not match computed txNum of %2."
                                                   "\n\nThe database may be corrupted. Delete the datadir and resynch it.\n")
-                                          .arg(i).arg(ct));
-            ct += blkInfo.nTx;
-            p->blkInfos.emplace_back(blkInfo);
-            p->blkInfosByTxNum[blkInfo.txNum0] = unsigned(p->blkInfos.size()-1);
+                                          .arg(bad).arg(expected));
+            }
+            return ret;
+        };
+        const auto saveSnapshot = [&](const std::vector<BlkInfo> &v) {
+            try {
+                if (QString err; p->blkInfoFile->truncate(0, &err) != 0)
+                    throw DatabaseError(err);
+                auto batch = p->blkInfoFile->beginBatchAppend(); // may throw
+                for (const auto & bi : v)
+                    if (QString err; !batch.append(Serialize(bi), &err))
+                        throw DatabaseError(err);
+            } catch (const std::exception &e) {
+                // not fatal; we will just end up reading the db table again next time
+                Warning() << "Failed to write the blkinfo snapshot: " << e.what();
+            }
+        };
+
+        // With -C we always go to the db, which also refreshes the snapshot
+        std::vector<BlkInfo> blkInfos = options->doSlowDbChecks ? std::vector<BlkInfo>{} : loadFromSnapshot();
+        const bool fromSnapshot = !blkInfos.empty();
+        if (!fromSnapshot) {
+            blkInfos = loadFromDB();
+            saveSnapshot(blkInfos);
+        }
+        ct = blkInfos.back().txNum0 + blkInfos.back().nTx;
+        {
+            ExclusiveLockGuard g(p->blkInfoLock);
+            p->blkInfos = std::move(blkInfos);
         }
+        Debug() << "Loaded " << nBlks << " blkinfos from " << (fromSnapshot ? "snapshot" : "db") << " in "
+                << t0.msecStr() << " msec";
         Log() << ct << " total transactions";
+    } else if (p->blkInfoFile->numRecords()) {
+        p->blkInfoFile->truncate(0);
     }
     if (ct != p->txNumNext) {
         throw DatabaseFormatError(QString("BlkInfo txNums do not add up to expected value of %1 != %2."
@@ -2341,8 +2745,10 @@ void Storage::loadCheckTxHash2TxNumMgr()
         if (p->db.txhash2txnumMgr->maxTxNumSeenInDB()+1 != int64_t(nrecs))
             throw DatabaseFormatError(QString("Failed invariant: txNumCount != nrecs; ") + errMsg);
 
-        if (options->doSlowDbChecks) // require the slow check for this one
-            p->db.txhash2txnumMgr->consistencyCheck();
+        if (options->doSlowDbChecks) { // require the slow check for this one
+            const auto tip = latestTip();
+            p->db.txhash2txnumMgr->consistencyCheck({p->db.meta.get(), "checkdb_txhash2txnum", tip.first, tip.second});
+        }
         if (options->doSlowDbChecks >= 3) // the below check is very slow so we require -C -C -C
             p->db.txhash2txnumMgr->consistencyCheckSlowRev();
     } catch (const DatabaseError &e) {
@@ -2355,6 +2761,8 @@ void Storage::loadCheckTxHash2TxNumMgr()
             Debug() << e.what();
             Log() << "Upgrading database, this may take from 1-10 minutes, please wait ...";
         }
+        // any saved partial consistency check progress no longer applies to the rebuilt index
+        GenericDBDelete(p->db.meta.get(), QByteArray("checkdb_txhash2txnum"));
         p->db.txhash2txnumMgr->rebuildDB();
     }
 }
@@ -2381,10 +2789,15 @@ void Storage::loadCheckUTXOsInDB()
             {TXO{Util::ParseHexFast("d5d27987d2a3dfc724e359870c6644b40e497bdc0589a033220fe15429d88599"), 0},
              { Util::ParseHexFast("76d95f02197b7c685b972104f6d7688a78bdcbb6a757fd5a139a195e59505fab"), {91842, 91812} } },
         };
-        std::set<TXO> seenExceptions;
+        // Bit N of a ShardedTableScan::Result::flags value corresponds to the Nth entry in the above map
+        const auto fudgeBit = [&fudgeDueToBitcoinBugs](auto it) {
+            return uint32_t(1) << unsigned(std::distance(fudgeDueToBitcoinBugs.begin(), it));
+        };
+        uint32_t seenExceptions = 0;
         // scan shunspent to see if our counts may be off
         // (this scan guards against these coins being spent in future throwing off our counts yet again!)
-        for (const auto & [txo, pair] : fudgeDueToBitcoinBugs) {
+        for (auto it = fudgeDueToBitcoinBugs.begin(); it != fudgeDueToBitcoinBugs.end(); ++it) {
+            const auto & [txo, pair] = *it;
             const auto & [hashx, heights] = pair;
             for (const auto & height : heights) {
                 if (height >= p->blkInfos.size())
@@ -2393,28 +2806,29 @@ void Storage::loadCheckUTXOsInDB()
                 const CompactTXO ctxo(txNum, txo.outN);
                 auto opt = GenericDBGet<QByteArray>(p->db.shunspent.get(), mkShunspentKey(hashx, ctxo), true, "", false, p->db.defReadOpts);
                 if (opt.has_value()) {
-                    if (seenExceptions.insert(txo).second)
+                    if (!(seenExceptions & fudgeBit(it)))
                         Debug() << "Seen exception: " << txo.toString() << ", height: " << height;
+                    seenExceptions |= fudgeBit(it);
                 }
             }
         }
 
         const Tic t0;
         {
-            const int currentHeight = latestTip().first;
-
-            std::unique_ptr<rocksdb::Iterator> iter(p->db.utxoset->NewIterator(p->db.defReadOpts));
-            if (!iter) throw DatabaseError("Unable to obtain an iterator to the utxo set db");
-            p->utxoCt = 0;
-            for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+            const auto tip = latestTip();
+            const int currentHeight = tip.first;
+            const TxNum txNumNext = p->txNumNext;
+            ShardedTableScan scan(p->db.utxoset.get(), p->db.defReadOpts, "utxoset",
+                                  {p->db.meta.get(), "checkdb_utxoset", currentHeight, tip.second});
+            const auto result = scan.run([&](const rocksdb::Slice &key, const rocksdb::Slice &val, ShardedTableScan::Result &res) {
                 // TODO: the below checks may be too slow. See about removing them and just counting the iter.
-                const auto txo = Deserialize<TXO>(FromSlice(iter->key()));
+                const auto txo = Deserialize<TXO>(FromSlice(key));
                 if (!txo.isValid()) {
                     throw DatabaseSerializationError("Read an invalid txo from the utxo set database."
                                                      " This may be due to a database format mismatch."
                                                      "\n\nDelete the datadir and resynch to bitcoind.\n");
                 }
-                auto info = Deserialize<TXOInfo>(FromSlice(iter->value()));
+                auto info = Deserialize<TXOInfo>(FromSlice(val));
                 if (!info.isValid())
                     throw DatabaseSerializationError(QString("Txo %1 has invalid metadata in the db."
                                                             " This may be due to a database format mismatch."
@@ -2426,8 +2840,8 @@ void Storage::loadCheckUTXOsInDB()
                 // we must tolerate counts being off if we see this utxo.
                 if (auto it = fudgeDueToBitcoinBugs.find(txo);
                         it != fudgeDueToBitcoinBugs.end() && it->second.second.count(info.confirmedHeight.value_or(0))) {
-                    if (seenExceptions.insert(txo).second)
-                        Debug() << "Seen exception: " << txo.toString();
+                    Debug() << "Seen exception: " << txo.toString();
+                    res.flags |= fudgeBit(it);
                 }
 
                 // this is a deep test: only happens if -C / --checkdb is specified on CLI or in conf.
@@ -2437,7 +2851,7 @@ void Storage::loadCheckUTXOsInDB()
                 QByteArray tmpBa;
                 if (bool fail1 = false, fail2 = false, fail3 = false, fail4 = false;
                         (fail1 = (info.confirmedHeight.has_value() && int(*info.confirmedHeight) > currentHeight))
-                        || (fail2 = info.txNum >= p->txNumNext)
+                        || (fail2 = info.txNum >= txNumNext)
                         || (fail3 = (tmpBa = GenericDBGet<QByteArray>(p->db.shunspent.get(), shuKey, true, errPrefix, false, p->db.defReadOpts).value_or("")).isEmpty())
                         || (fail4 = (info.amount != Deserialize<bitcoin::Amount>(tmpBa)))) {
                     // TODO: reorg? Inconsisent db?  FIXME
@@ -2449,7 +2863,7 @@ void Storage::loadCheckUTXOsInDB()
                         if (fail1) {
                             ts << " > current height: " << currentHeight << ".";
                         } else if (fail2) {
-                            ts << ". TxNum: " << info.txNum << " >= " << p->txNumNext << ".";
+                            ts << ". TxNum: " << info.txNum << " >= " << txNumNext << ".";
                         } else if (fail3) {
                             ts << ". Failed to find ctxo " << ctxo.toString() << " in the scripthash_unspent db.";
                         } else if (fail4) {
@@ -2459,19 +2873,17 @@ void Storage::loadCheckUTXOsInDB()
                     }
                     throw DatabaseError(msg);
                 }
-                if (0 == ++p->utxoCt % 100'000) {
-                    *(0 == p->utxoCt % 2'500'000 ? std::make_unique<Log>() : std::make_unique<Debug>())
-                            << "CheckDB: Verified " << p->utxoCt << " utxos ...";
-                } else if (0 == p->utxoCt % 1'000 && app() && app()->signalsCaught()) {
-                    throw UserInterrupted("User interrupted, aborting check");
-                }
-            }
+                ++res.count;
+            });
+            p->utxoCt = int64_t(result.count);
+            seenExceptions |= result.flags;
+            const long nSeenExceptions = long(std::bitset<32>(seenExceptions).count());
 
             if (const auto metact = readUtxoCtFromDB();
                     // counts may be slightly off due to the dupe tx's outlined above -- after this is run
                     // the utxoset will have the right count (although shunspent will disagree with this,
                     // which we also tolerate). So we tolerate being off due to the "exceptions" above.
-                    std::abs(long(p->utxoCt) - long(metact)) > long(seenExceptions.size()))
+                    std::abs(long(p->utxoCt) - long(metact)) > nSeenExceptions)
                     throw DatabaseError(QString("UTXO count in meta table (%1) does not match the actual number of UTXOs in the utxoset (%2)."
                                                 "\n\nThe database has been corrupted. Please delete the datadir and resynch to bitcoind.\n")
                                         .arg(metact).arg(p->utxoCt.load()));
@@ -2499,9 +2911,6 @@ void Storage::loadCheckShunspentInDB()
 
     const Tic t0;
 
-    std::unique_ptr<rocksdb::Iterator> iter(p->db.shunspent->NewIterator(p->db.defReadOpts));
-    if (!iter) throw DatabaseError("Unable to obtain an iterator to the scripthash unspent db");
-
     // Note: Before the BIP that imposed uniqueness on coinbase tx's,
     // Bitcoin coinbase tx's for heights 91842 and 91812 both have outpoint:
     //      d5d27987d2a3dfc724e359870c6644b40e497bdc0589a033220fe15429d88599:0
@@ -2514,16 +2923,23 @@ void Storage::loadCheckShunspentInDB()
         TXO{Util::ParseHexFast("e3bf3d07d4b0375638d5f1db5255fe07ba2c4cb067cd81b84ee974b6585fb468"), 0},
         TXO{Util::ParseHexFast("d5d27987d2a3dfc724e359870c6644b40e497bdc0589a033220fe15429d88599"), 0},
     };
-    std::set<TXO> seenExceptions;
+    // Bit N of a ShardedTableScan::Result::flags value corresponds to the Nth entry in the above set
+    const auto exceptionBit = [&exceptionsDueToBitcoinBugs](const TXO &txo) -> uint32_t {
+        const auto it = exceptionsDueToBitcoinBugs.find(txo);
+        if (it == exceptionsDueToBitcoinBugs.end()) return 0;
+        return uint32_t(1) << unsigned(std::distance(exceptionsDueToBitcoinBugs.begin(), it));
+    };
 
     constexpr auto errMsg = "This may be due to either a database format mismatch or data corruption."
                             "\n\nDelete the datadir and resynch to bitcoind.\n";
-    size_t ctr = 0;
-    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
-        const auto &[hashx, ctxo] = extractShunspentKey(iter->key());
+    const auto tip = latestTip();
+    ShardedTableScan scan(p->db.shunspent.get(), p->db.defReadOpts, "scripthash_unspent",
+                          {p->db.meta.get(), "checkdb_shunspent", tip.first, tip.second});
+    const auto result = scan.run([&](const rocksdb::Slice &key, const rocksdb::Slice &val, ShardedTableScan::Result &res) {
+        const auto &[hashx, ctxo] = extractShunspentKey(key);
         if (!ctxo.isValid())
             throw DatabaseError(QString("Read an invalid compact txo from the scripthash_unspent database. %1").arg(errMsg));
-        const bitcoin::Amount amount = Deserialize<bitcoin::Amount>(FromSlice(iter->value()));
+        const bitcoin::Amount amount = Deserialize<bitcoin::Amount>(FromSlice(val));
         if (UNLIKELY(!bitcoin::MoneyRange(amount)))
             throw DatabaseError(QString("Read an invalid amount from the scripthash_unspent database for scripthash: %1. %2")
                                 .arg(QString(hashx.toHex()), errMsg));
@@ -2538,34 +2954,33 @@ void Storage::loadCheckShunspentInDB()
         const auto optInfo = GenericDBGet<TXOInfo>(p->db.utxoset.get(), ToSlice(Serialize(txo)), true, "", false, p->db.defReadOpts);
         if (!optInfo) {
             // we permit the buggy utxos above to be off -- those are due to collisions in historical blockchain
-            if (!exceptionsDueToBitcoinBugs.count(txo))
+            if (const auto bit = exceptionBit(txo); !bit)
                 throw DatabaseError(QString("The scripthash_unspent table is missing a corresponding entry in the UTXO table for TXO \"%1\". %2")
                                     .arg(txo.toString(), errMsg));
             else {
-                seenExceptions.insert(txo);
+                res.flags |= bit;
                 Debug() << "Seen exception: " << txo.toString() << ", height: " << info.confirmedHeight.value_or(0);
             }
         }
 
         if (!info.isValid() || !optInfo->isValid() || *optInfo != info) {
             // we permit the buggy utxos above to be off -- those are due to collisions in historical blockchain
-            if (!exceptionsDueToBitcoinBugs.count(txo))
+            if (const auto bit = exceptionBit(txo); !bit)
                 throw DatabaseError(QString("TXO \"%1\" mismatch between scripthash_unspent and the UTXO table. %2")
                                     .arg(txo.toString(), errMsg));
             else {
-                seenExceptions.insert(txo);
+                res.flags |= bit;
                 Debug() << "Seen exception: " << txo.toString() << ", height: " << info.confirmedHeight.value_or(0);
             }
         }
-        if (0 == ++ctr % 10000) {
-            *(0 == ctr % 200000 ? std::make_unique<Log>() : std::make_unique<Debug>())
-                    << "CheckDB: Verified " << ctr << " scripthash_unspent entries ...";
-        }
-    }
+        ++res.count;
+    });
+    const auto ctr = result.count;
+    const long nSeenExceptions = long(std::bitset<32>(result.flags).count());
 
     if (const auto metact = readUtxoCtFromDB();
             // tolerate being off by as much as 2 in case the exceptional utxos get spent!
-            std::abs(long(ctr) - long(metact)) > long(seenExceptions.size()))
+            std::abs(long(ctr) - long(metact)) > nSeenExceptions)
             throw DatabaseError(QString("UTXO count in meta table (%1) does not match the actual number of UTXOs in shunspent (%2). %3")
                                 .arg(metact).arg(ctr).arg(errMsg));
 
@@ -2573,6 +2988,106 @@ void Storage::loadCheckShunspentInDB()
           << " in " << t0.secsStr() << " sec";
  }
 
+void Storage::loadCheckShistLayout()
+{
+    FatalAssert(!!p->db.shist && !!p->db.meta,  __func__, ": scripthash_history and/or meta db are not open");
+
+    static const QString errPrefix("Error reading/writing the scripthash_history layout in the meta db");
+    const auto layoutName = [](ShistLayout l) { return l == ShistLayout::Chunked ? "chunked" : "legacy"; };
+    const auto stored = GenericDBGet<uint8_t>(p->db.meta.get(), kShistLayout, true, errPrefix, false, p->db.defReadOpts)
+                            .value_or(uint8_t(ShistLayout::Legacy));
+    if (stored > uint8_t(ShistLayout::Converting))
+        throw DatabaseFormatError(QString("Unknown scripthash_history layout: %1").arg(unsigned(stored)));
+    const auto wanted = options->db.historyChunked ? ShistLayout::Chunked : ShistLayout::Legacy;
+    p->shistLayout = wanted;
+    if (ShistLayout(stored) == wanted) {
+        Debug() << "scripthash_history layout: " << layoutName(wanted);
+        return;
+    }
+
+    rocksdb::ReadOptions ropts = p->db.defReadOpts;
+    ropts.fill_cache = false;
+    std::unique_ptr<rocksdb::Iterator> iter(p->db.shist->NewIterator(ropts));
+    if (!iter) throw DatabaseError("Unable to obtain an iterator to the scripthash_history db");
+    if (iter->SeekToFirst(); !iter->Valid() && iter->status().ok()) {
+        // empty table (new datadir), nothing to convert
+        GenericDBPut(p->db.meta.get(), kShistLayout, uint8_t(wanted), errPrefix, p->db.defWriteOpts);
+        Debug() << "scripthash_history layout: " << layoutName(wanted);
+        return;
+    }
+
+    // Convert. Each scripthash's rows are rewritten atomically in the same WriteBatch, and the two kinds of rows are
+    // told apart by key length, so an interrupted conversion (flagged as "Converting") can always be resumed -- in
+    // either direction.
+    GenericDBPut(p->db.meta.get(), kShistLayout, uint8_t(ShistLayout::Converting), errPrefix, p->db.defWriteOpts);
+    Log() << "Converting scripthash_history to the " << layoutName(wanted) << " layout, this may take a while ...";
+    const Tic t0;
+    App *ourApp = app();
+    rocksdb::WriteBatch batch;
+    size_t ctr = 0;
+    const auto writeBatch = [&] {
+        if (auto st = p->db.shist->Write(p->db.defWriteOpts, &batch); !st.ok())
+            throw DatabaseError("Failed to write to the scripthash_history db: " + StatusString(st));
+        batch.Clear();
+    };
+    // called after each scripthash is fully added to `batch` -- writes the batch periodically, and checks for Ctrl-C
+    const auto finishedScriptHash = [&] {
+        if (++ctr % 1'000'000 == 0)
+            Log() << "Converted " << ctr << " scripthashes, elapsed: " << t0.secsStr(1) << " sec ...";
+        if (batch.Count() >= 100'000) {
+            writeBatch();
+            if (ourApp && ourApp->signalsCaught())
+                throw UserInterrupted("User interrupted, aborting scripthash_history conversion (it will resume on next startup)");
+        }
+    };
+    const auto readRow = [&] {
+        bool ok;
+        auto vec = Deserialize<TxNumVec>(FromSlice(iter->value()), &ok);
+        if (!ok) throw DatabaseSerializationError("Bad TxNumVec in scripthash_history db");
+        return vec;
+    };
+    // Note: the iterator reads from an implicit snapshot, so it's safe to rewrite rows as we go.
+    if (wanted == ShistLayout::Chunked) {
+        for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+            const auto key = iter->key();
+            if (key.size() != HashLen) continue; // already chunked
+            const QByteArray hashX(key.data(), HashLen);
+            forEachShistChunk(readRow(), [&](uint32_t chunk, const TxNumVec &nums) {
+                batch.Put(ToSlice(mkShistChunkKey(hashX, chunk)), ToSlice(Serialize(nums)));
+            });
+            batch.Delete(key);
+            finishedScriptHash();
+        }
+    } else {
+        // a scripthash's chunk rows are adjacent and sorted in TxNum order, so we just concatenate them
+        QByteArray hashX;
+        TxNumVec nums;
+        const auto flushScriptHash = [&] {
+            if (hashX.isEmpty()) return;
+            batch.Put(ToSlice(hashX), ToSlice(Serialize(nums)));
+            nums.clear();
+            finishedScriptHash();
+        };
+        for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+            const auto key = iter->key();
+            if (key.size() != size_t(kShistChunkKeyLen)) continue; // already legacy
+            if (const rocksdb::Slice sh(key.data(), HashLen); sh != ToSlice(hashX)) {
+                flushScriptHash();
+                hashX = QByteArray(sh.data(), HashLen);
+            }
+            const auto row = readRow();
+            nums.insert(nums.end(), row.begin(), row.end());
+            batch.Delete(key);
+        }
+        flushScriptHash();
+    }
+    if (const auto st = iter->status(); !st.ok())
+        throw DatabaseError("Error iterating over the scripthash_history db: " + StatusString(st));
+    if (batch.Count()) writeBatch();
+    GenericDBPut(p->db.meta.get(), kShistLayout, uint8_t(wanted), errPrefix, p->db.defWriteOpts);
+    Log() << "Converted " << ctr << " scripthashes to the " << layoutName(wanted) << " layout in " << t0.secsStr(1) << " sec";
+}
+
 void Storage::loadCheckEarliestUndo()
 {
     FatalAssert(!!p->db.undo,  __func__, ": Undo db is not open");
@@ -2756,6 +3271,23 @@ std::optional<TXOInfo> Storage::utxoGetFromDB(const TXO &txo, bool throwIfMissin
 }
 
 int64_t Storage::utxoSetSize() const { return p->utxoCt; }
+
+auto Storage::metricCounters() const -> MetricCounters
+{
+    MetricCounters ret;
+    if (p->headersFile) ret.headerCount = p->headersFile->numRecords();
+    ret.txNum = p->txNumNext.load(std::memory_order_relaxed);
+    ret.utxoSetSize = p->utxoCt.load(std::memory_order_relaxed);
+    if (auto & c = p->db.concatOperator; c) ret.merges = c->merges.load(std::memory_order_relaxed);
+    if (auto & c = p->db.concatOperatorTxHash2TxNum; c) ret.mergesTxHash2TxNum = c->merges.load(std::memory_order_relaxed);
+    const auto & lcs = p->lruCacheStats;
+    ret.num2HashHits = lcs.num2HashHits.load(std::memory_order_relaxed);
+    ret.num2HashMisses = lcs.num2HashMisses.load(std::memory_order_relaxed);
+    ret.height2HashesHits = lcs.height2HashesHits.load(std::memory_order_relaxed);
+    ret.height2HashesMisses = lcs.height2HashesMisses.load(std::memory_order_relaxed);
+    return ret;
+}
+
 double Storage::utxoSetSizeMB() const {
     constexpr int64_t elemSize = TXOInfo::serSize() + TXO::minSize() /*<-- assumption is most utxos use 16-bit IONums */;
     return (utxoSetSize()*elemSize) / 1e6;
@@ -2850,6 +3382,8 @@ void Storage::addBlock(PreProcessedBlockPtr ppb, bool saveUndo, unsigned nReserv
     {
         // take all locks now.. since this is a Big Deal. TODO: add more locks here?
         std::scoped_lock guard(p->blocksLock, p->headerVerifierLock, p->blkInfoLock, p->mempoolLock);
+        const Tic tAll;
+        AddBlockTimes tm{}; // per-phase timings for this block, saved to p->addBlockStats at the end
 
         if (p->db.utxoCache && p->db.utxoCache->cacheMisses) {
             p->db.utxoCache->prefetch(ppb); // will prefetch inputs in a thread
@@ -2907,10 +3441,36 @@ void Storage::addBlock(PreProcessedBlockPtr ppb, bool saveUndo, unsigned nReserv
                 // after everything completes successfully.
                 rawHeader = p->headerVerifier.lastHeaderProcessed().second;
             }
+            tm[size_t(AddBlockPhase::Prepare)] = tAll.msec<double>();
+
+            // The writes to each of the tables below are independent of one another, so for large enough blocks they
+            // are submitted to the commit co-tasks and proceed concurrently while we do the rest of the work here.
+            // NOTE: Everything the submitted lambdas reference must be declared *before* `futs`, since the futures
+            // auto-wait on scope end (even if we throw), and everything they write to must not be touched by this
+            // thread until they are joined below. The first tasks only read ppb->txInfos, which nothing mutates;
+            // the later ones are submitted after we are done mutating ppb->hashXAggregated. If that changes, please
+            // re-examine this code.
+            UTXOBatch utxoBatch{p->db.utxoCache.get()}; // utxo batch (updates utxoset & scripthash_unspent tables)
+            rocksdb::WriteBatch shistBatch;
+            const bool parallel = ppb->txInfos.size() >= kMinTxsForParallelCommit;
+            std::array<CoTask::Future, kNumCommitPhases> futs;
+            // Runs `func` on the co-task for phase `ph` (or right here if !parallel), timing it.
+            const auto commit = [&](const AddBlockPhase ph, auto && func) {
+                auto timed = [&tm, ph, func = std::forward<decltype(func)>(func)] {
+                    const Tic t0;
+                    func();
+                    tm[size_t(ph)] = t0.msec<double>();
+                };
+                if (parallel)
+                    futs[size_t(ph)] = p->commitWorkers[size_t(ph)]->submitWork(std::move(timed));
+                else
+                    timed();
+            };
 
             setDirty(true); // <--  no turning back. if the app crashes unexpectedly while this is set, on next restart it will refuse to run and insist on a clean resynch.
 
-            {  // add txnum -> txhash association to the TxNumsFile...
+            commit(AddBlockPhase::TxNums, [&] {
+                // add txnum -> txhash association to the TxNumsFile...
                 auto batch = p->txNumsFile->beginBatchAppend(); // may throw if io error in c'tor here.
                 QString errStr;
                 for (const auto & txInfo : ppb->txInfos) {
@@ -2919,38 +3479,23 @@ void Storage::addBlock(PreProcessedBlockPtr ppb, bool saveUndo, unsigned nReserv
                 }
                 // <-- The batch d'tor may close the app on error here with Fatal() if a low-level file error occurs now
                 //     on header update (see: RecordFile.cpp, ~BatchAppendContext()).
-            }
-
-            p->txNumNext += ppb->txInfos.size(); // update internal counter
+            });
 
-            if (p->txNumNext != p->txNumsFile->numRecords())
-                throw InternalError("TxNum file and internal txNumNext counter disagree! FIXME!");
+            p->txNumNext += ppb->txInfos.size(); // update internal counter (checked against the TxNumsFile below)
 
-            // Asynch task -- the future will automatically be awaited on scope end (even if we throw here!)
-            // NOTE: The assumption here is that ppb->txInfos is ok to share amongst threads -- that is, the assumption
-            // is that nothing mutates it.  If that changes, please re-examine this code.
-            CoTask::Future fut; // if valid, will auto-wait for us on scope end
-            if (ppb->txInfos.size() > 1000) {
-                // submit this to the co-task for blocks with enough txs
-                fut = p->blocksWorker->submitWork([&]{
-                    p->db.txhash2txnumMgr->insertForBlock(blockTxNum0, ppb->txInfos);
-                });
-            } else {
-                // otherwise just do the work ourselves immediately here since this is likely faster (less overhead)
+            commit(AddBlockPhase::TxHash2TxNum, [&] {
                 p->db.txhash2txnumMgr->insertForBlock(blockTxNum0, ppb->txInfos);
-            }
+            });
 
             constexpr bool debugPrt = false;
 
             // update utxoSet & scritphash history
             {
+                const Tic t0;
                 std::unordered_set<HashX, HashHasher> newHashXInputsResolved;
                 newHashXInputsResolved.reserve(1024); ///< todo: tune this magic number?
 
                 {
-                    // utxo batch block (updtes utxoset & scripthash_unspent tables)
-                    UTXOBatch utxoBatch{p->db.utxoCache.get()};
-
                     // reserve space in undo, if in saveUndo mode
                     if (undo) {
                         undo->addUndos.reserve(ppb->outputs.size());
@@ -3038,9 +3583,21 @@ void Storage::addBlock(PreProcessedBlockPtr ppb, bool saveUndo, unsigned nReserv
                         ++inum;
                     }
 
-                    // commit the utxoset updates now.. this issues the writes to the db and also updates
-                    // p->utxoCt. This may throw.
-                    issueUpdates(utxoBatch);
+                    // commit the utxoset updates now. This is what issueUpdates() does, except that the utxoset and
+                    // scripthash_unspent writes are issued as 2 separate commit phases. If there is a UTXOCache, it
+                    // has already taken the writes and there is nothing to issue here.
+                    if (!utxoBatch.p->cache) {
+                        static const QString errMsg1("Error issuing batch write to utxoset db for a utxo update"),
+                                             errMsg2("Error issuing batch write to scripthash_unspent db for a utxo update");
+                        commit(AddBlockPhase::UTXOSet, [&] {
+                            GenericBatchWrite(p->db.utxoset.get(), utxoBatch.p->utxosetBatch, errMsg1, p->db.defWriteOpts); // may throw
+                        });
+                        commit(AddBlockPhase::ShUnspent, [&] {
+                            GenericBatchWrite(p->db.shunspent.get(), utxoBatch.p->shunspentBatch, errMsg2, p->db.defWriteOpts); // may throw
+                        });
+                    }
+                    p->utxoCt += utxoBatch.p->addCt - utxoBatch.p->rmCt; // tally up adds and deletes
+                    utxoBatch.p->defunct = true;
                 }
 
                 // sort and shrink_to_fit new hashX inputs added
@@ -3056,15 +3613,21 @@ void Storage::addBlock(PreProcessedBlockPtr ppb, bool saveUndo, unsigned nReserv
 
                 if constexpr (debugPrt)
                     Debug() << "utxoset size: " << utxoSetSize() << " block: " << ppb->height;
+                tm[size_t(AddBlockPhase::UTXOResolve)] = t0.msec<double>();
             }
 
             {
+                const Tic t0;
                 // now.. update the txNumsInvolvingHashX to be offset from txNum0 for this block, and save history to db table
                 // history is hashX -> TxNumVec (serialized) as a serities of 6-bytes txNums in blockchain order as they appeared.
                 if (notify)
                     // first, reserve space for notifications
                     notify->scriptHashesAffected.reserve(notify->scriptHashesAffected.size() + ppb->hashXAggregated.size());
-                rocksdb::WriteBatch batch;
+                const auto merge = [&](const HashX &hashX, const QByteArray &key, const TxNumVec &nums) {
+                    if (auto st = shistBatch.Merge(ToSlice(key), ToSlice(Serialize(nums))); !st.ok())
+                        throw DatabaseError(QString("batch merge fail for hashX %1, block height %2: %3")
+                                            .arg(QString(hashX.toHex())).arg(ppb->height).arg(StatusString(st)));
+                };
                 for (auto & [hashX, ag] : ppb->hashXAggregated) {
                     if (notify) notify->scriptHashesAffected.insert(hashX); // fast O(1) insertion because we reserved the right size above.
                     for (auto & txNum : ag.txNumsInvolvingHashX) {
@@ -3072,13 +3635,20 @@ void Storage::addBlock(PreProcessedBlockPtr ppb, bool saveUndo, unsigned nReserv
                     }
                     // save scripthash history for this hashX, by appending to existing history. Note that this uses
                     // the 'ConcatOperator' class we defined in this file, which requires rocksdb be compiled with RTTI.
-                    if (auto st = batch.Merge(ToSlice(hashX), ToSlice(Serialize(ag.txNumsInvolvingHashX))); !st.ok())
-                        throw DatabaseError(QString("batch merge fail for hashX %1, block height %2: %3")
-                                            .arg(QString(hashX.toHex())).arg(ppb->height).arg(StatusString(st)));
+                    if (p->shistLayout == ShistLayout::Chunked) {
+                        // a block's txNums usually all land in 1 chunk, but may straddle a chunk boundary
+                        forEachShistChunk(ag.txNumsInvolvingHashX, [&merge, &hashX = hashX](uint32_t chunk, const TxNumVec &nums) {
+                            merge(hashX, mkShistChunkKey(hashX, chunk), nums);
+                        });
+                    } else
+                        merge(hashX, hashX, ag.txNumsInvolvingHashX);
                 }
-                if (auto st = p->db.shist->Write(p->db.defWriteOpts, &batch) ; !st.ok())
-                    throw DatabaseError(QString("batch merge fail for block height %1: %2")
-                                        .arg(ppb->height).arg(StatusString(st)));
+                tm[size_t(AddBlockPhase::HistoryBuild)] = t0.msec<double>();
+                commit(AddBlockPhase::ShHistory, [&] {
+                    if (auto st = p->db.shist->Write(p->db.defWriteOpts, &shistBatch) ; !st.ok())
+                        throw DatabaseError(QString("batch merge fail for block height %1: %2")
+                                            .arg(ppb->height).arg(StatusString(st)));
+                });
             }
 
 
@@ -3094,13 +3664,15 @@ void Storage::addBlock(PreProcessedBlockPtr ppb, bool saveUndo, unsigned nReserv
                     unsigned(ppb->txInfos.size())
                 );
 
-                const auto & blkInfo = p->blkInfos.back();
-
-                p->blkInfosByTxNum[blkInfo.txNum0] = unsigned(p->blkInfos.size()-1);
-
-                // save BlkInfo to db
-                static const QString blkInfoErrMsg("Error writing BlkInfo to db");
-                GenericDBPut(p->db.blkinfo.get(), uint32_t(ppb->height), blkInfo, blkInfoErrMsg, p->db.defWriteOpts);
+                // save BlkInfo to db (we give the task a copy since p->blkInfos may be reallocated by other code)
+                commit(AddBlockPhase::BlkInfo, [this, height = uint32_t(ppb->height), blkInfo = p->blkInfos.back()] {
+                    static const QString blkInfoErrMsg("Error writing BlkInfo to db");
+                    GenericDBPut(p->db.blkinfo.get(), height, blkInfo, blkInfoErrMsg, p->db.defWriteOpts);
+                    // ... and to the flat snapshot. A failure here is not fatal since the snapshot gets validated (and
+                    // rebuilt if need be) on startup.
+                    if (QString err; !p->blkInfoFile->appendRecord(Serialize(blkInfo), true, &err))
+                        Warning() << "Failed to append to the blkinfo snapshot: " << err;
+                });
 
                 if (undo) {
                     // save blkInfo to undo information, if in saveUndo mode
@@ -3108,62 +3680,68 @@ void Storage::addBlock(PreProcessedBlockPtr ppb, bool saveUndo, unsigned nReserv
                 }
             }
 
-            // save the last of the undo info, if in saveUndo mode
-            if (undo) {
-                const auto t0 = Util::getTimeNS();
-                undo->hash = BTC::HashRev(rawHeader);
-                undo->scriptHashes = Util::keySet<decltype (undo->scriptHashes)>(ppb->hashXAggregated);
-                static const QString errPrefix("Error saving undo info to undo db");
-
-                GenericDBPut(p->db.undo.get(), uint32_t(ppb->height), *undo, errPrefix, p->db.defWriteOpts); // save undo to db
-                if (ppb->height < p->earliestUndoHeight) {
-                    // remember earliest for delete clause below...
-                    p->earliestUndoHeight = ppb->height;
-                }
+            // save the last of the undo info (if in saveUndo mode) and expire old undos
+            commit(AddBlockPhase::Undo, [&] {
+                if (undo) {
+                    undo->hash = BTC::HashRev(rawHeader);
+                    undo->scriptHashes = Util::keySet<decltype (undo->scriptHashes)>(ppb->hashXAggregated);
+                    static const QString errPrefix("Error saving undo info to undo db");
+
+                    GenericDBPut(p->db.undo.get(), uint32_t(ppb->height), *undo, errPrefix, p->db.defWriteOpts); // save undo to db
+                    if (ppb->height < p->earliestUndoHeight) {
+                        // remember earliest for delete clause below...
+                        p->earliestUndoHeight = ppb->height;
+                    }
 
-                if constexpr (debugPrt) {
-                    // testing undo ser/deser
-                    Debug() << "Undo info 1: " << undo->toDebugString();
-                    QByteArray ba = Serialize(*undo);
-                    Debug() << "Undo info 1 serSize: " << ba.length();
-                    bool ok;
-                    auto undo2 = Deserialize<UndoInfo>(ba, &ok);
-                    ba.fill('z'); // ensure no shallow copies of buffer exist in deserialized object. if they do below tests will fail
-                    FatalAssert(ok && undo2.isValid(), "Deser of undo info failed!");
-                    Debug() << "Undo info 2: " << undo2.toDebugString();
-                    Debug() << "Undo info 1 == undo info 2: " << (*undo == undo2);
-                } else {
-                    const auto elapsedms = (Util::getTimeNS() - t0)/1e6;
-                    const size_t nTx = undo->blkInfo.nTx, nSH = undo->scriptHashes.size();
-                    Debug() << "Saved V2 undo for block " << undo->height << ", "
-                            << nTx << " " << Util::Pluralize("transaction", nTx)
-                            << " involving " << nSH << " " << Util::Pluralize("scripthash", nSH)
-                            << ", in " << QString::number(elapsedms, 'f', 2) << " msec.";
+                    if constexpr (debugPrt) {
+                        // testing undo ser/deser
+                        Debug() << "Undo info 1: " << undo->toDebugString();
+                        QByteArray ba = Serialize(*undo);
+                        Debug() << "Undo info 1 serSize: " << ba.length();
+                        bool ok;
+                        auto undo2 = Deserialize<UndoInfo>(ba, &ok);
+                        ba.fill('z'); // ensure no shallow copies of buffer exist in deserialized object. if they do below tests will fail
+                        FatalAssert(ok && undo2.isValid(), "Deser of undo info failed!");
+                        Debug() << "Undo info 2: " << undo2.toDebugString();
+                        Debug() << "Undo info 1 == undo info 2: " << (*undo == undo2);
+                    }
+                    // (the "Saved undo" debug line is printed at the end of this function, once all timings are known)
                 }
-            }
-            // Expire old undos >configuredUndoDepth() blocks ago to keep the db tidy.
-            // We only do this if we know there is an old undo for said height in db.
-            // Note that the assumption here is that no holes exist, and that we always walk
-            // forward with addBlock() 1 block at a time (which is a valid assumption in this codebase).
-            if (const auto expireUndoHeight = int(ppb->height) - int(configuredUndoDepth());
-                    expireUndoHeight >= 0 && unsigned(expireUndoHeight) >= p->earliestUndoHeight) {
-                // FIXME -- this runs for every block in between the last undo save and current tip.
-                // If the node was off for a while then restarted this just hits the db with useless deletes for non-existant
-                // keys as we catch up.  It's not the end of the world, as each call here is on the order of microseconds..
-                // but perhaps we need to see about fixing this to not do that.
-                static const QString errPrefix("Error deleting old/stale undo info from undo db");
-                GenericDBDelete(p->db.undo.get(), uint32_t(expireUndoHeight), errPrefix, p->db.defWriteOpts);
-                p->earliestUndoHeight = unsigned(expireUndoHeight + 1);
-                if constexpr (debugPrt) DebugM("Deleted undo for block ", expireUndoHeight, ", earliest now ", p->earliestUndoHeight.load());
-            }
+                // Expire old undos >configuredUndoDepth() blocks ago to keep the db tidy.
+                // We only do this if we know there is an old undo for said height in db.
+                // Note that the assumption here is that no holes exist, and that we always walk
+                // forward with addBlock() 1 block at a time (which is a valid assumption in this codebase).
+                if (const auto expireUndoHeight = int(ppb->height) - int(configuredUndoDepth());
+                        expireUndoHeight >= 0 && unsigned(expireUndoHeight) >= p->earliestUndoHeight) {
+                    // FIXME -- this runs for every block in between the last undo save and current tip.
+                    // If the node was off for a while then restarted this just hits the db with useless deletes for non-existant
+                    // keys as we catch up.  It's not the end of the world, as each call here is on the order of microseconds..
+                    // but perhaps we need to see about fixing this to not do that.
+                    static const QString errPrefix("Error deleting old/stale undo info from undo db");
+                    GenericDBDelete(p->db.undo.get(), uint32_t(expireUndoHeight), errPrefix, p->db.defWriteOpts);
+                    p->earliestUndoHeight = unsigned(expireUndoHeight + 1);
+                    if constexpr (debugPrt) DebugM("Deleted undo for block ", expireUndoHeight, ", earliest now ", p->earliestUndoHeight.load());
+                }
+            });
 
-            appendHeader(rawHeader, ppb->height);
+            commit(AddBlockPhase::Headers, [&] { appendHeader(rawHeader, ppb->height); });
 
             if (UNLIKELY(ppb->height == 0)) {
                 // update genesis hash now if block 0 -- this info is used by rpc method server.features
                 p->genesisHash = BTC::HashRev(rawHeader); // this variable is guarded by p->headerVerifierLock
             }
 
+            {
+                // join the table writes -- this rethrows the first exception any of them may have thrown
+                const Tic t0;
+                for (auto & fut : futs)
+                    if (fut.future.valid()) fut.future.get();
+                tm[size_t(AddBlockPhase::Join)] = t0.msec<double>();
+            }
+
+            if (p->txNumNext != p->txNumsFile->numRecords())
+                throw InternalError("TxNum file and internal txNumNext counter disagree! FIXME!");
+
             if (size_t limit; p->db.utxoCache && (limit = options->utxoCache) && p->db.utxoCache->memUsage() > limit)
                 p->db.utxoCache->limitSize(static_cast<size_t>(limit * 0.75) /* chop down to 3/4 size */);
 
@@ -3171,6 +3749,29 @@ void Storage::addBlock(PreProcessedBlockPtr ppb, bool saveUndo, unsigned nReserv
             setDirty(false);
 
             undoVerifierOnScopeEnd.disable(); // indicate to the "Defer" object declared at the top of this function that it shouldn't undo anything anymore as we are happy now with the db state now.
+
+            tm[size_t(AddBlockPhase::Total)] = tAll.msec<double>();
+            {
+                auto & s = p->addBlockStats;
+                std::unique_lock g(s.mut);
+                s.last = tm;
+                s.lastHeight = ppb->height;
+                ++s.nBlocks;
+                s.nParallel += parallel;
+                for (size_t i = 0; i < kNumAddBlockPhases; ++i)
+                    s.total[i] += tm[i];
+            }
+            if (undo && Debug::isEnabled()) {
+                const size_t nTx = undo->blkInfo.nTx, nSH = undo->scriptHashes.size();
+                Debug d;
+                d << "Saved undo for block " << undo->height << ", "
+                  << nTx << " " << Util::Pluralize("transaction", nTx)
+                  << " involving " << nSH << " " << Util::Pluralize("scripthash", nSH)
+                  << ", in " << QString::number(tm[size_t(AddBlockPhase::Undo)], 'f', 2) << " msec."
+                  << (parallel ? " Parallel commit," : "") << " Phases (msec):";
+                for (size_t i = 0; i < kNumAddBlockPhases; ++i)
+                    d << " " << kAddBlockPhaseNames[i] << "=" << QString::number(tm[i], 'f', 2);
+            }
         }
     } /// release locks
 
@@ -3182,6 +3783,9 @@ void Storage::addBlock(PreProcessedBlockPtr ppb, bool saveUndo, unsigned nReserv
             dspsubsmgr->enqueueNotifications(std::move(notify->dspTxsAffected));
         if (txsubsmgr && !notify->txidsAffected.empty())
             txsubsmgr->enqueueNotifications(std::move(notify->txidsAffected));
+    } else if (subsmgr && subsmgr->hasPersistedStatuses()) {
+        // notifications are off (initial synch), but the statuses loaded from disk for this block's scripthashes are stale now
+        subsmgr->dropPersistedStatuses(Util::keySet<NotifyData::NotifySet>(ppb->hashXAggregated));
     }
 }
 
@@ -3195,6 +3799,7 @@ BlockHeight Storage::undoLatestBlock(bool notifySubs)
         NotifySet scriptHashesAffected, dspTxsAffected, txidsAffected;
     };
     std::unique_ptr<NotifyData> notify;
+    NotifySet persistedStale; ///< only used if !notifySubs
 
     if (notifySubs) {
         notify = std::make_unique<NotifyData>(); // note we don't reserve here -- we will reserve at the end when we run through the hashXAggregated set one final time...
@@ -3206,10 +3811,9 @@ BlockHeight Storage::undoLatestBlock(bool notifySubs)
 
         const auto t0 = Util::getTimeNS();
 
-        // First, disable the UTXO Cache, if it happened to be enabled (implicitly causes it to flush to DB).
-        // We must do this because the way the UTXO Cache works is fundamentally at odds with assumption we have
-        // while we undo.
-        p->db.utxoCache.reset(); // if valid, delete causes implicit flush to DB
+        // Note: if the UTXO Cache is enabled, we leave it enabled and route the UTXO updates below through it. This is
+        // safe because the cache always flushes queued deletions before queued additions, so a UTXO re-added by
+        // undo after its deletion was queued (but not yet flushed) correctly ends up in the DB.
 
         // NOTE: For very full mempools, this clear has the potential to stall the app after the reorg
         // completes since the app will have to re-download the whole mempool state again.
@@ -3267,10 +3871,10 @@ BlockHeight Storage::undoLatestBlock(bool notifySubs)
 
             // undo the blkInfo from the back
             p->blkInfos.pop_back();
-            p->blkInfosByTxNum.erase(undo.blkInfo.txNum0);
             GenericDBDelete(p->db.blkinfo.get(), uint32_t(undo.height), "Failed to delete blkInfo in undoLatestBlock");
-            // clear num2hash cache
-            p->lruNum2Hash.clear();
+            p->blkInfoFile->truncate(p->blkInfos.size());
+            // remove this block's txNums from the num2hash cache (these txNums will be recycled by the next block)
+            p->lruNum2Hash.removeRange(undo.blkInfo.txNum0, undo.blkInfo.txNum0 + undo.blkInfo.nTx);
             // remove block from txHashes cache
             p->lruHeight2Hashes_BitcoindMemOrder.remove(undo.height);
 
@@ -3281,40 +3885,66 @@ BlockHeight Storage::undoLatestBlock(bool notifySubs)
             // here is that the txNumsFile has all the hashes we want to delete until the below operation is done).
             CoTask::Future fut = p->blocksWorker->submitWork([&]{ p->db.txhash2txnumMgr->truncateForUndo(txNum0);});
 
-            // undo the scripthash histories
-            for (const auto & sh : undo.scriptHashes) {
-                const QString shHex = Util::ToHexFast(sh);
-                const auto vec = GenericDBGetFailIfMissing<TxNumVec>(p->db.shist.get(), sh, QStringLiteral("Undo failed because we failed to retrieve the scripthash history for %1").arg(shHex), false, p->db.defReadOpts);
-                TxNumVec newVec;
-                newVec.reserve(vec.size());
-                for (const auto txNum : vec) {
-                    if (txNum < txNum0) {
-                        // accept only stuff in history that's before txNum0 for this block, filter out everything else
-                        newVec.push_back(txNum);
+            // undo the scripthash histories -- all rewrites are accumulated in 1 batch and committed together
+            {
+                rocksdb::WriteBatch batch;
+                // rewrites the history row at `key` to keep only the entries in `vec` that precede this block
+                const auto filterRow = [&](const rocksdb::Slice &key, const TxNumVec &vec) {
+                    // The txnums are sorted and unique in the db data, and this invariant is very important, so the
+                    // entries to keep are exactly those before the first one that is >= txNum0.
+                    const auto keepEnd = std::lower_bound(vec.begin(), vec.end(), txNum0);
+                    if (keepEnd == vec.end())
+                        return; // row unaffected by this block (can happen in the chunked layout), leave it alone
+                    rocksdb::Status st;
+                    if (keepEnd != vec.begin()) {
+                        // the sh still has some history, write it to db
+                        st = batch.Put(key, ToSlice(Serialize(TxNumVec(vec.begin(), keepEnd))));
+                    } else {
+                        // the sh in question lost all its history (in this row) as a result of undo, just delete it from db to save space
+                        st = batch.Delete(key);
                     }
+                    if (!st.ok())
+                        throw DatabaseError(QStringLiteral("Undo failed because we failed to write the new scripthash history for %1: %2")
+                                            .arg(QString(Util::ToHexFast(FromSlice(key).left(HashLen))), StatusString(st)));
+                };
+                // Visit the scripthashes in key order with a single iterator, so the seeks below move forward only.
+                std::vector<std::reference_wrapper<const HashX>> shs(undo.scriptHashes.begin(), undo.scriptHashes.end());
+                std::sort(shs.begin(), shs.end(), [](const HashX &a, const HashX &b){ return a < b; });
+                std::unique_ptr<rocksdb::Iterator> iter(p->db.shist->NewIterator(p->db.defReadOpts));
+                if (!iter) throw DatabaseError("Unable to obtain an iterator to the scripthash_history db");
+                const bool chunked = p->shistLayout == ShistLayout::Chunked;
+                for (const HashX & sh : shs) {
+                    const auto readErr = [&sh](const QString &extra = {}) {
+                        return DatabaseError(QStringLiteral("Undo failed because we failed to retrieve the scripthash history for %1%2")
+                                             .arg(QString(Util::ToHexFast(sh)), extra));
+                    };
+                    // In the chunked layout, only the row for the chunk containing txNum0, and any later rows, can
+                    // contain history from this block.
+                    const QByteArray firstKey = chunked ? mkShistChunkKey(sh, shistChunkForTxNum(txNum0)) : sh;
+                    size_t nRows = 0;
+                    for (iter->Seek(ToSlice(firstKey)); iter->Valid() && iter->key().starts_with(ToSlice(sh)); iter->Next()) {
+                        if (!chunked && iter->key().size() != size_t(HashLen))
+                            break;
+                        bool ok;
+                        const auto vec = Deserialize<TxNumVec>(FromSlice(iter->value()), &ok);
+                        if (!ok) throw readErr(": bad TxNumVec");
+                        filterRow(iter->key(), vec);
+                        ++nRows;
+                        if (!chunked)
+                            break;
+                    }
+                    if (const auto st = iter->status(); !st.ok())
+                        throw readErr(": " + StatusString(st));
+                    if (!nRows)
+                        throw readErr();
                 }
-                const QString errMsg = QStringLiteral("Undo failed because we failed to write the new scripthash history for %1").arg(shHex);
-                if (!newVec.empty()) {
-                    // The below is entirely unnecessary as the txnums should be already sorted and unique in the db data.
-                    // We are doing this here to illustrate that this invariant in the data is very important.
-                    // Block undo is intended to be an infrequent process (and thus not especially performance-critical),
-                    // so this does no harm.
-                    std::sort(newVec.begin(), newVec.end());
-                    auto last = std::unique(newVec.begin(), newVec.end());
-                    newVec.erase(last, newVec.end());
-                }
-                if (!newVec.empty()) {
-                    // the sh still has some history, write it to db
-                    GenericDBPut(p->db.shist.get(), sh, newVec, errMsg, p->db.defWriteOpts);
-                } else {
-                    // the sh in question lost all its history as a result of undo, just delete it from db to save space
-                    GenericDBDelete(p->db.shist.get(), sh, errMsg, p->db.defWriteOpts);
-                }
+                iter.reset();
+                GenericBatchWrite(p->db.shist.get(), batch, "Undo failed because we failed to write the new scripthash histories", p->db.defWriteOpts);
             }
 
             {
                 // UTXO set update
-                UTXOBatch utxoBatch;
+                UTXOBatch utxoBatch{p->db.utxoCache.get()};
 
                 // now, undo the utxo deletions by re-adding them
                 for (const auto & [txo, info] : undo.delUndos) {
@@ -3364,7 +3994,9 @@ BlockHeight Storage::undoLatestBlock(bool notifySubs)
                     notify->scriptHashesAffected.swap(undo.scriptHashes);
                 else
                     notify->scriptHashesAffected.merge(std::move(undo.scriptHashes));
-            }
+            } else if (subsmgr && subsmgr->hasPersistedStatuses())
+                persistedStale.swap(undo.scriptHashes); // see below
+
         }
 
         const size_t nTx = undo.blkInfo.nTx;
@@ -3383,6 +4015,9 @@ BlockHeight Storage::undoLatestBlock(bool notifySubs)
             dspsubsmgr->enqueueNotifications(std::move(notify->dspTxsAffected));
         if (txsubsmgr && !notify->txidsAffected.empty())
             txsubsmgr->enqueueNotifications(std::move(notify->txidsAffected));
+    } else if (!persistedStale.empty()) {
+        // notifications are off, but the statuses loaded from disk for the undone scripthashes are stale now
+        subsmgr->dropPersistedStatuses(persistedStale);
     }
 
     return prevHeight;
@@ -3453,12 +4088,14 @@ std::optional<unsigned> Storage::heightForTxNum(TxNum n) const
 std::optional<unsigned> Storage::heightForTxNum_nolock(TxNum n) const
 {
     std::optional<unsigned> ret;
-    auto it = p->blkInfosByTxNum.upper_bound(n);  // O(logN) search; find the block *AFTER* n, then go backw on to find the block in range
-    if (it != p->blkInfosByTxNum.begin()) {
+    // O(logN) binary search over the contiguous blkInfos array (sorted by txNum0); find the block *AFTER* n, then go
+    // back one to find the block in range
+    const auto begin = p->blkInfos.cbegin();
+    auto it = std::upper_bound(begin, p->blkInfos.cend(), n, [](TxNum txNum, const BlkInfo &bi) { return txNum < bi.txNum0; });
+    if (it != begin) {
         --it;
-        const auto & bi = p->blkInfos[it->second];
-        if (n >= bi.txNum0 && n < bi.txNum0+bi.nTx)
-            ret = it->second;
+        if (n >= it->txNum0 && n < it->txNum0 + it->nTx)
+            ret = unsigned(it - begin);
     }
     return ret;
 }
@@ -3539,27 +4176,13 @@ auto Storage::getHistory(const HashX & hashX, bool conf, bool unconf) const -> H
     try {
         SharedLockGuard g(p->blocksLock);  // makes sure history doesn't mutate from underneath our feet
         if (conf) {
-            static const QString err("Error retrieving history for a script hash");
-            auto nums_opt = GenericDBGet<TxNumVec>(p->db.shist.get(), hashX, true, err, false, p->db.defReadOpts);
-            if (nums_opt.has_value()) {
-                auto & nums = *nums_opt;
-                if (UNLIKELY(nums.size() > maxHistory)) {
-                    throw HistoryTooLarge(QString("History for scripthash %1 exceeds MaxHistory %2 with %3 items!")
-                                          .arg(QString(hashX.toHex())).arg(maxHistory).arg(nums.size()));
-                }
-                ret.reserve(nums.size());
-                // TODO: The below could use some optimization.  A batched version of both hashForTxNum and
-                // heightForTxNum are low-hanging fruit for optimization.  Each call to the below takes a shared lock
-                // then releases it, for each item.  I imagine batched versions would have significantly less overhead
-                // per item, which could add up to huge performance savings on large histories.  This is a very
-                // low hanging fruit for optimization -- thus I am leaving this comment here so I can remember to come
-                // back and optmize the below.  /TODO
-                for (auto num : nums) {
-                    auto hash = hashForTxNum(num).value(); // may throw, but that indicates some database inconsistency. we catch below
-                    auto height = heightForTxNum(num).value(); // may throw, same deal
-                    ret.emplace_back(HistoryItem{hash, int(height), {}});
-                }
+            // read at most 1 past the limit, so that huge histories in the chunked layout are rejected early
+            const auto nums = readHistoryTxNums_nolock(hashX, 0, p->txNumNext.load(), maxHistory + 1, false);
+            if (UNLIKELY(nums.size() > maxHistory)) {
+                throw HistoryTooLarge(QString("History for scripthash %1 exceeds MaxHistory %2 with %3 or more items!")
+                                      .arg(QString(hashX.toHex())).arg(maxHistory).arg(nums.size()));
             }
+            ret = historyItemsForTxNums(nums);
         }
         if (unconf) {
             auto [mempool, lock] = this->mempool();
@@ -3581,6 +4204,207 @@ auto Storage::getHistory(const HashX & hashX, bool conf, bool unconf) const -> H
     return ret;
 }
 
+auto Storage::getHistories(const std::vector<HashX> & hashXs, bool conf, bool unconf) const -> std::vector<History>
+{
+    std::vector<History> ret(hashXs.size());
+    const size_t maxHistory = size_t(options->maxHistory);
+    std::vector<bool> skip(hashXs.size()); // invalid hashXs, and those whose confirmed history was too large
+    for (size_t i = 0; i < hashXs.size(); ++i)
+        skip[i] = hashXs[i].length() != HashLen;
+    try {
+        SharedLockGuard g(p->blocksLock);  // makes sure history doesn't mutate from underneath our feet
+        if (conf) {
+            for (size_t i = 0; i < hashXs.size(); ++i) {
+                if (skip[i]) continue;
+                const auto & hashX = hashXs[i];
+                try {
+                    // read at most 1 past the limit, so that huge histories in the chunked layout are rejected early
+                    const auto nums = readHistoryTxNums_nolock(hashX, 0, p->txNumNext.load(), maxHistory + 1, false);
+                    if (UNLIKELY(nums.size() > maxHistory)) {
+                        throw HistoryTooLarge(QString("History for scripthash %1 exceeds MaxHistory %2 with %3 or more items!")
+                                              .arg(QString(hashX.toHex())).arg(maxHistory).arg(nums.size()));
+                    }
+                    ret[i] = historyItemsForTxNums(nums);
+                } catch (const std::exception &e) {
+                    // same as getHistory(): this scripthash gets an empty history, but we carry on with the rest
+                    Warning(Log::Magenta) << __func__ << ": " << e.what();
+                    skip[i] = true;
+                }
+            }
+        }
+        if (unconf) {
+            auto [mempool, lock] = this->mempool();
+            for (size_t i = 0; i < hashXs.size(); ++i) {
+                if (skip[i]) continue;
+                const auto & hashX = hashXs[i];
+                if (auto it = mempool.hashXTxs.find(hashX); it != mempool.hashXTxs.end()) {
+                    auto & hist = ret[i];
+                    const auto & txvec = it->second;
+                    const size_t total = hist.size() + txvec.size();
+                    if (UNLIKELY(total > maxHistory)) {
+                        // same as getHistory(): the result is truncated to just the confirmed history
+                        Warning(Log::Magenta) << __func__ << ": " << QString("History for scripthash %1 exceeds MaxHistory %2 with %3 items!")
+                                                                     .arg(QString(hashX.toHex())).arg(maxHistory).arg(total);
+                        continue;
+                    }
+                    hist.reserve(total);
+                    for (const auto & tx : txvec)
+                        hist.emplace_back(HistoryItem{tx->hash, tx->hasUnconfirmedParentTx ? -1 : 0, tx->fee});
+                }
+            }
+        }
+    } catch (const std::exception &e) {
+        Warning(Log::Magenta) << __func__ << ": " << e.what();
+    }
+    return ret;
+}
+
+auto Storage::getHistoryRange(const HashX & hashX, int fromHeight, int toHeight, size_t maxItems, int *nextFromHeight) const -> History
+{
+    History ret;
+    int next = -1;
+    if (hashX.length() == HashLen && maxItems) {
+        try {
+            SharedLockGuard g(p->blocksLock);  // makes sure history doesn't mutate from underneath our feet
+            const auto txNumRangeForHeights = [this](unsigned h0, unsigned h1) {
+                SharedLockGuard g2(p->blkInfoLock);
+                const auto & bi = p->blkInfos[h1];
+                return std::pair<TxNum, TxNum>{p->blkInfos[h0].txNum0, bi.txNum0 + bi.nTx};
+            };
+            const int tip = [this]{ SharedLockGuard g2(p->blkInfoLock); return int(p->blkInfos.size()) - 1; }();
+            fromHeight = std::max(fromHeight, 0);
+            if (toHeight < 0 || toHeight > tip)
+                toHeight = tip;
+            if (fromHeight <= toHeight) {
+                const auto [begin, end] = txNumRangeForHeights(unsigned(fromHeight), unsigned(toHeight));
+                // read 1 past the limit so we know whether there is more, and at which height it starts
+                maxItems = std::min(maxItems, std::numeric_limits<size_t>::max() - 1);
+                auto nums = readHistoryTxNums_nolock(hashX, begin, end, maxItems + 1, false);
+                if (nums.size() > maxItems) {
+                    const unsigned cutHeight = heightForTxNum(nums[maxItems]).value();
+                    nums.resize(maxItems);
+                    // drop the partial block at the end
+                    while (!nums.empty() && heightForTxNum(nums.back()).value() == cutHeight)
+                        nums.pop_back();
+                    if (!nums.empty())
+                        next = int(cutHeight);
+                    else {
+                        // the first block alone has more than maxItems items for this scripthash, return all of it
+                        const auto [b0, b1] = txNumRangeForHeights(cutHeight, cutHeight);
+                        nums = readHistoryTxNums_nolock(hashX, b0, b1, std::numeric_limits<size_t>::max(), false);
+                        if (int(cutHeight) < toHeight)
+                            next = int(cutHeight) + 1;
+                    }
+                }
+                ret = historyItemsForTxNums(nums);
+            }
+        } catch (const std::exception &e) {
+            Warning(Log::Magenta) << __func__ << ": " << e.what();
+            ret.clear();
+            next = -1;
+        }
+    }
+    if (nextFromHeight)
+        *nextFromHeight = next;
+    return ret;
+}
+
+auto Storage::getHistoryTail(const HashX & hashX, size_t n) const -> History
+{
+    History ret;
+    if (hashX.length() != HashLen || !n)
+        return ret;
+    try {
+        SharedLockGuard g(p->blocksLock);  // makes sure history doesn't mutate from underneath our feet
+        ret = historyItemsForTxNums(readHistoryTxNums_nolock(hashX, 0, p->txNumNext.load(), n, true));
+    } catch (const std::exception &e) {
+        Warning(Log::Magenta) << __func__ << ": " << e.what();
+        ret.clear();
+    }
+    return ret;
+}
+
+auto Storage::historyItemsForTxNums(const std::vector<TxNum> & nums) const -> History
+{
+    History ret;
+    ret.reserve(nums.size());
+    // TODO: The below could use some optimization.  A batched version of both hashForTxNum and
+    // heightForTxNum are low-hanging fruit for optimization.  Each call to the below takes a shared lock
+    // then releases it, for each item.  I imagine batched versions would have significantly less overhead
+    // per item, which could add up to huge performance savings on large histories.  This is a very
+    // low hanging fruit for optimization -- thus I am leaving this comment here so I can remember to come
+    // back and optmize the below.  /TODO
+    for (auto num : nums) {
+        auto hash = hashForTxNum(num).value(); // may throw, but that indicates some database inconsistency. caller catches
+        auto height = heightForTxNum(num).value(); // may throw, same deal
+        ret.emplace_back(HistoryItem{hash, int(height), {}});
+    }
+    return ret;
+}
+
+std::vector<TxNum> Storage::readHistoryTxNums_nolock(const HashX & hashX, TxNum begin, TxNum end, size_t limit, bool fromEnd) const
+{
+    TxNumVec ret;
+    if (begin >= end || !limit)
+        return ret;
+    static const QString err("Error retrieving history for a script hash");
+
+    if (p->shistLayout != ShistLayout::Chunked) {
+        // legacy layout: the entire history lives in 1 row, so we must read all of it
+        auto nums_opt = GenericDBGet<TxNumVec>(p->db.shist.get(), hashX, true, err, false, p->db.defReadOpts);
+        if (!nums_opt) return ret;
+        const auto & nums = *nums_opt;
+        auto lo = std::lower_bound(nums.begin(), nums.end(), begin), hi = std::lower_bound(lo, nums.end(), end);
+        if (size_t(hi - lo) > limit) {
+            if (fromEnd) lo = hi - limit;
+            else hi = lo + limit;
+        }
+        ret.assign(lo, hi);
+        return ret;
+    }
+
+    // chunked layout: only visit the rows for the chunks overlapping [begin, end)
+    const QByteArray lowerKey = mkShistChunkKey(hashX, shistChunkForTxNum(begin)),
+                     upperKey = mkShistChunkKey(hashX, shistChunkForTxNum(end - 1) + 1);
+    const rocksdb::Slice lower = ToSlice(lowerKey), upper = ToSlice(upperKey);
+    rocksdb::ReadOptions ropts = p->db.defReadOpts;
+    ropts.iterate_lower_bound = &lower;
+    ropts.iterate_upper_bound = &upper;
+    std::unique_ptr<rocksdb::Iterator> iter(p->db.shist->NewIterator(ropts));
+    if (!iter) throw DatabaseError(err + ": unable to obtain an iterator");
+    // returns the current row, trimmed to [begin, end)
+    const auto readRow = [&] {
+        bool ok;
+        auto row = Deserialize<TxNumVec>(FromSlice(iter->value()), &ok);
+        if (!ok) throw DatabaseSerializationError(err + ": bad TxNumVec");
+        row.erase(std::lower_bound(row.begin(), row.end(), end), row.end());
+        row.erase(row.begin(), std::lower_bound(row.begin(), row.end(), begin));
+        return row;
+    };
+    if (!fromEnd) {
+        for (iter->SeekToFirst(); iter->Valid() && ret.size() < limit; iter->Next()) {
+            const auto row = readRow();
+            ret.insert(ret.end(), row.begin(), row.begin() + std::min(row.size(), limit - ret.size()));
+        }
+    } else {
+        std::vector<TxNumVec> rows; // latest first
+        size_t total = 0;
+        for (iter->SeekToLast(); iter->Valid() && total < limit; iter->Prev()) {
+            total += rows.emplace_back(readRow()).size();
+        }
+        ret.reserve(std::min(total, limit));
+        size_t skip = total > limit ? total - limit : 0; // excess items at the beginning of the earliest row read
+        for (auto it = rows.rbegin(); it != rows.rend(); ++it) {
+            const size_t n = std::min(skip, it->size());
+            skip -= n;
+            ret.insert(ret.end(), it->begin() + n, it->end());
+        }
+    }
+    if (const auto st = iter->status(); !st.ok())
+        throw DatabaseError(err + ": " + StatusString(st));
+    return ret;
+}
+
 auto Storage::listUnspent(const HashX & hashX) const -> UnspentItems
 {
     UnspentItems ret;
@@ -3840,8 +4664,11 @@ void Storage::refreshMempoolHistogram()
     // lock exclusively to do the final swap
     ExclusiveLockGuard g(p->mempoolLock);
     p->mempoolFeeHistogram.swap(hist);
+    ++p->mempoolFeeHistogramGen;
 }
 
+quint64 Storage::mempoolHistogramGeneration() const { return p->mempoolFeeHistogramGen.load(); }
+
 auto Storage::mempoolHistogram() const -> Mempool::FeeHistogramVec
 {
     SharedLockGuard g(p->mempoolLock);
@@ -3924,15 +4751,20 @@ size_t Storage::dumpAllScriptHashes(QIODevice *outDev, unsigned int indent, unsi
     NL();
     if (progFunc) progFunc(0); // 0 = indicate operator began
     qint64 lastWriteCt = 0;
+    QByteArray prevSh; // in the chunked layout, a scripthash has 1 or more adjacent rows; we want it only once
     for (it->SeekToFirst(); it->Valid() && outDev && lastWriteCt > -1; it->Next()) {
-        const auto sh = it->key();
-        if (sh.size() == HashLen) {
+        const auto key = it->key();
+        if (key.size() == HashLen || (key.size() == size_t(kShistChunkKeyLen) && p->shistLayout == ShistLayout::Chunked)) {
+            const rocksdb::Slice sh(key.data(), HashLen);
+            if (sh == ToSlice(prevSh))
+                continue;
+            prevSh = QByteArray(sh.data(), HashLen);
             if (LIKELY(ctr)) {
                 outDev->putChar(',');
                 NL();
             }
             outDev->putChar('"');
-            lastWriteCt = outDev->write(Util::ToHexFast(FromSlice(sh)));
+            lastWriteCt = outDev->write(Util::ToHexFast(prevSh));
             outDev->putChar('"');
             if (UNLIKELY(!(++ctr % progInterval) && progFunc))
                 progFunc(ctr);
@@ -4029,7 +4861,7 @@ namespace {
     }
 
     struct UndoInfoSerHeader {
-        static constexpr uint16_t defMagic = 0xf12c, defVer = 0x2, v1Ver = 0x1;
+        static constexpr uint16_t defMagic = 0xf12c, defVer = 0x3, v2Ver = 0x2, v1Ver = 0x1;
         uint16_t magic = defMagic; ///< sanity check
         uint16_t ver = defVer; ///< sanity check
         uint32_t len = 0; ///< the length of the entire buffer, including this struct and all data to follow. A sanity check.
@@ -4063,6 +4895,11 @@ namespace {
         }
         bool isLenSane_V2() const { return size_t(len) == computeTotalSize_V2(); }
 
+
+        /* ----------- V3 format (dictionary-encoded, variable-length; see serializeUndoV3() below) */
+        /// the size of the fixed-length part of the V3 format; the dictionaries and undos follow it
+        size_t fixedSize_V3() const { return sizeof(*this) + sizeof(UndoInfo::height) + HashLen + sizeof(BlkInfo); }
+        bool isLenSane_V3() const { return size_t(len) >= fixedSize_V3(); }
     };
 
     // Deserialize a header from bytes -- no checks are done other than length check.
@@ -4077,9 +4914,11 @@ namespace {
         return ret;
     }
 
-    // UndoInfo -- serialize to V2 format (fixed 3-byte IONums)
-    template <> QByteArray Serialize(const UndoInfo &u) {
+    // UndoInfo -- serialize to V2 format (fixed 3-byte IONums). We no longer write this format unless the UndoInfo
+    // can't be represented as V3 (which never happens for the UndoInfos that addBlock() produces).
+    QByteArray serializeUndoV2(const UndoInfo &u) {
         UndoInfoSerHeader hdr;
+        hdr.ver = hdr.v2Ver;
         // fill these in now so that hdr.computeTotalSize works
         hdr.nScriptHashes = uint32_t(u.scriptHashes.size());
         hdr.nAddUndos = uint32_t(u.addUndos.size());
@@ -4127,6 +4966,205 @@ namespace {
         return ret;
     }
 
+    // UndoInfo -- serialize to V3 format. This stores each distinct hashX and txHash only once, in a dictionary, and
+    // the undos refer to them by index (as VarInts). The txHash dictionary is sorted by txNum, and each entry's
+    // txNum is stored as a VarInt delta from the previous one, so the TxNums for the TXOs (which are mostly from the
+    // same few blocks) take a byte or two each. After the header, .height, .hash, and .blkInfo (same as V2) we have:
+    //
+    //   VarInt nHashXs, nHashXs * 32-byte hashX   <-- the first hdr.nScriptHashes of these are .scriptHashes
+    //   VarInt nTxs, nTxs * (VarInt txNumDelta, 32-byte txHash)
+    //   hdr.nAddUndos * (VarInt hashXIdx, VarInt txIdx, VarInt outN)
+    //   hdr.nDelUndos * (VarInt hashXIdx, VarInt txIdx, VarInt outN, VarInt amount, VarInt confirmedHeight + 1)
+    //
+    // The TXO, CompactTXO and TXOInfo are rebuilt from the above on deserialization. Returns an empty QByteArray if
+    // `u` cannot be represented in this format (bad hash lengths, a CompactTXO whose outN differs from its TXO's, a
+    // txNum that maps to 2 different txHashes, or a negative amount).
+    QByteArray serializeUndoV3(const UndoInfo &u) {
+        UndoInfoSerHeader hdr;
+        hdr.ver = hdr.defVer;
+        hdr.nScriptHashes = uint32_t(u.scriptHashes.size());
+        hdr.nAddUndos = uint32_t(u.addUndos.size());
+        hdr.nDelUndos = uint32_t(u.delUndos.size());
+        if (u.hash.length() != HashLen) return {};
+
+        // build the hashX dictionary, .scriptHashes first
+        std::unordered_map<HashX, uint32_t, HashHasher> hashXIdxs;
+        std::vector<const HashX *> hashXs;
+        hashXIdxs.reserve(u.scriptHashes.size());
+        hashXs.reserve(u.scriptHashes.size());
+        const auto idxForHashX = [&](const HashX &hashX) -> std::optional<uint32_t> {
+            if (UNLIKELY(hashX.length() != HashLen)) return std::nullopt;
+            const auto [it, inserted] = hashXIdxs.try_emplace(hashX, uint32_t(hashXs.size()));
+            if (inserted) hashXs.push_back(&it->first); // references to unordered_map keys are stable
+            return it->second;
+        };
+        for (const auto & sh : u.scriptHashes)
+            if (UNLIKELY(!idxForHashX(sh))) return {};
+        std::vector<uint32_t> addHashXIdxs, delHashXIdxs;
+        addHashXIdxs.reserve(u.addUndos.size());
+        delHashXIdxs.reserve(u.delUndos.size());
+
+        // build the txHash dictionary, sorted by txNum
+        std::vector<std::pair<TxNum, const TxHash *>> txs;
+        txs.reserve(u.addUndos.size() + u.delUndos.size());
+        for (const auto & [txo, hashX, ctxo] : u.addUndos) {
+            const auto idx = idxForHashX(hashX);
+            if (UNLIKELY(!idx || !txo.isValid() || txo.outN != ctxo.N())) return {};
+            addHashXIdxs.push_back(*idx);
+            txs.emplace_back(ctxo.txNum(), &txo.txHash);
+        }
+        for (const auto & [txo, info] : u.delUndos) {
+            const auto idx = idxForHashX(info.hashX);
+            if (UNLIKELY(!idx || !txo.isValid() || info.amount / bitcoin::Amount::satoshi() < 0)) return {};
+            delHashXIdxs.push_back(*idx);
+            txs.emplace_back(info.txNum, &txo.txHash);
+        }
+        std::sort(txs.begin(), txs.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+        {
+            // dedupe, ensuring that each txNum maps to exactly 1 txHash
+            auto out = txs.begin();
+            for (auto it = txs.begin(); it != txs.end(); ++it) {
+                if (out != txs.begin() && std::prev(out)->first == it->first) {
+                    if (UNLIKELY(*std::prev(out)->second != *it->second)) return {};
+                    continue;
+                }
+                *out++ = *it;
+            }
+            txs.erase(out, txs.end());
+        }
+        const auto idxForTxNum = [&txs](TxNum n) {
+            return uint32_t(std::lower_bound(txs.begin(), txs.end(), n, [](const auto &a, TxNum b) { return a.first < b; })
+                            - txs.begin());
+        };
+        const auto appendVarInt = [](QByteArray &ba, auto val) {
+            const VarInt v(val);
+            ba.append(reinterpret_cast<const char *>(v.data()), int(v.size()));
+        };
+
+        QByteArray ret;
+        ret.reserve(int(hdr.fixedSize_V3() + (hashXs.size() + txs.size()) * (HashLen + 2) + u.addUndos.size() * 6
+                        + u.delUndos.size() * 16));
+        // 1. header (.len is filled in at the end)
+        ret.append(ShallowTmp(&hdr));
+        // 2. .height, 3. .hash, 4. .blkInfo
+        ret.append(SerializeScalarNoCopy(u.height));
+        ret.append(u.hash);
+        ret.append(Serialize(u.blkInfo));
+        // 5. hashX dictionary
+        appendVarInt(ret, uint64_t(hashXs.size()));
+        for (const auto *hashX : hashXs)
+            ret.append(*hashX);
+        // 6. txHash dictionary
+        appendVarInt(ret, uint64_t(txs.size()));
+        TxNum prevTxNum = 0;
+        for (const auto & [txNum, txHash] : txs) {
+            appendVarInt(ret, uint64_t(txNum - prevTxNum));
+            ret.append(*txHash);
+            prevTxNum = txNum;
+        }
+        // 7. .addUndos
+        for (size_t i = 0; i < u.addUndos.size(); ++i) {
+            const auto & [txo, hashX, ctxo] = u.addUndos[i];
+            appendVarInt(ret, addHashXIdxs[i]);
+            appendVarInt(ret, idxForTxNum(ctxo.txNum()));
+            appendVarInt(ret, uint32_t(txo.outN));
+        }
+        // 8. .delUndos
+        for (size_t i = 0; i < u.delUndos.size(); ++i) {
+            const auto & [txo, info] = u.delUndos[i];
+            appendVarInt(ret, delHashXIdxs[i]);
+            appendVarInt(ret, idxForTxNum(info.txNum));
+            appendVarInt(ret, uint32_t(txo.outN));
+            appendVarInt(ret, uint64_t(info.amount / bitcoin::Amount::satoshi()));
+            appendVarInt(ret, info.confirmedHeight ? uint64_t(*info.confirmedHeight) + 1u : uint64_t(0));
+        }
+        if (UNLIKELY(size_t(ret.size()) > std::numeric_limits<uint32_t>::max())) return {};
+        hdr.len = uint32_t(ret.size());
+        std::memcpy(ret.data(), reinterpret_cast<const char *>(&hdr), sizeof(hdr));
+        return ret;
+    }
+
+    template <> QByteArray Serialize(const UndoInfo &u) {
+        if (auto ret = serializeUndoV3(u); LIKELY(!ret.isEmpty()))
+            return ret;
+        DebugM("Undo info for height ", u.height, " cannot be represented in the V3 format, falling back to V2");
+        return serializeUndoV2(u);
+    }
+
+    // Deserialize the body of a V3 UndoInfo (see serializeUndoV3() above). `hdr` has already been checked. May throw
+    // on a malformed VarInt.
+    bool deserializeUndoV3(const QByteArray &ba, const UndoInfoSerHeader &hdr, UndoInfo &ret) {
+        const char *cur = ba.constData() + sizeof(hdr), *const end = ba.constData() + ba.length();
+        // 2. .height, 3. .hash, 4. .blkInfo (the fixed-size part was length checked by the caller)
+        bool myok;
+        ret.height = DeserializeScalar<decltype(ret.height)>(ShallowTmp(cur, sizeof(ret.height)), &myok);
+        if (!myok) return false;
+        cur += sizeof(ret.height);
+        ret.hash = DeepCpy(cur, HashLen);
+        cur += HashLen;
+        ret.blkInfo = Deserialize<BlkInfo>(ShallowTmp(cur, sizeof(BlkInfo)), &myok);
+        if (!myok) return false;
+        cur += sizeof(BlkInfo);
+
+        Span<const std::byte> span(reinterpret_cast<const std::byte *>(cur), size_t(end - cur));
+        const auto readVarInt = [&span](auto type) { return VarInt::deserialize(span).value<decltype(type)>(); }; // may throw
+        const auto readHash = [&span]() -> QByteArray {
+            if (span.size() < size_t(HashLen)) return {};
+            QByteArray h = DeepCpy(reinterpret_cast<const char *>(span.data()), HashLen);
+            span = span.subspan(size_t(HashLen));
+            return h;
+        };
+        // 5. hashX dictionary
+        const auto nHashXs = readVarInt(uint32_t{});
+        if (nHashXs < hdr.nScriptHashes || size_t(nHashXs) * HashLen > span.size()) return false;
+        std::vector<HashX> hashXs;
+        hashXs.reserve(nHashXs);
+        for (uint32_t i = 0; i < nHashXs; ++i)
+            hashXs.push_back(readHash());
+        ret.scriptHashes.reserve(hdr.nScriptHashes);
+        ret.scriptHashes.insert(hashXs.begin(), hashXs.begin() + hdr.nScriptHashes);
+        // 6. txHash dictionary
+        const auto nTxs = readVarInt(uint32_t{});
+        if (size_t(nTxs) * HashLen > span.size()) return false;
+        std::vector<std::pair<TxNum, TxHash>> txs;
+        txs.reserve(nTxs);
+        TxNum txNum = 0;
+        for (uint32_t i = 0; i < nTxs; ++i) {
+            txNum += readVarInt(TxNum{});
+            if (auto h = readHash(); LIKELY(!h.isEmpty())) txs.emplace_back(txNum, std::move(h));
+            else return false;
+        }
+        // 7. .addUndos, 8. .delUndos
+        const auto readRefs = [&](const HashX *&hashX, const std::pair<TxNum, TxHash> *&tx, IONum &outN) {
+            const auto hIdx = readVarInt(uint32_t{}), tIdx = readVarInt(uint32_t{});
+            outN = readVarInt(IONum{});
+            if (hIdx >= hashXs.size() || tIdx >= txs.size()) return false;
+            hashX = &hashXs[hIdx];
+            tx = &txs[tIdx];
+            return true;
+        };
+        const HashX *hashX;
+        const std::pair<TxNum, TxHash> *tx;
+        IONum outN;
+        ret.addUndos.reserve(hdr.nAddUndos);
+        for (uint32_t i = 0; i < hdr.nAddUndos; ++i) {
+            if (!readRefs(hashX, tx, outN)) return false;
+            ret.addUndos.emplace_back(TXO{tx->second, outN}, *hashX, CompactTXO(tx->first, outN));
+        }
+        ret.delUndos.reserve(hdr.nDelUndos);
+        for (uint32_t i = 0; i < hdr.nDelUndos; ++i) {
+            if (!readRefs(hashX, tx, outN)) return false;
+            TXOInfo info;
+            info.hashX = *hashX;
+            info.txNum = tx->first;
+            info.amount = readVarInt(int64_t{}) * bitcoin::Amount::satoshi();
+            if (const auto h = readVarInt(uint32_t{}); h > 0)
+                info.confirmedHeight = unsigned(h - 1);
+            ret.delUndos.emplace_back(TXO{tx->second, outN}, std::move(info));
+        }
+        return span.empty();
+    }
+
     // UndoInfo -- note this will fail if the byte array has extra bytes at the end
     template <> UndoInfo Deserialize(const QByteArray &ba, bool *ok) {
         UndoInfo ret;
@@ -4145,11 +5183,27 @@ namespace {
         // 1. .header
         const UndoInfoSerHeader hdr = Deserialize<UndoInfoSerHeader>(ba, &myok);;
         if (!chkAssertion(myok && int(hdr.len) == ba.size() && hdr.magic == hdr.defMagic
-                          && ( (hdr.ver == hdr.defVer && hdr.isLenSane_V2())
+                          && ( (hdr.ver == hdr.defVer && hdr.isLenSane_V3())
+                               || (hdr.ver == hdr.v2Ver && hdr.isLenSane_V2())
                                || (hdr.ver == hdr.v1Ver && hdr.isLenSane_V1()) ),
                           "Header sanity check fail"))
             return ret;
 
+        if (hdr.ver == hdr.defVer) {
+            // V3 -> dictionary-encoded
+            bool v3ok = false;
+            try {
+                v3ok = deserializeUndoV3(ba, hdr, ret);
+            } catch (const std::exception &e) {
+                // VarInt::deserialize or VarInt::value may throw on corrupt data
+                chkAssertion(false, e.what());
+                return ret;
+            }
+            if (chkAssertion(v3ok, "V3 data is malformed"))
+                setOk(true);
+            return ret;
+        }
+
         // for v1 we deserialize 2-byte fixed-size IONums, for v2 3-byte fixed-size IONums
         const bool isV1 = hdr.ver == hdr.v1Ver;
 
@@ -4272,6 +5326,12 @@ namespace {
 
 #ifdef ENABLE_TESTS
 #include "robin_hood/robin_hood.h"
+
+#include "bitcoin/script.h"
+#include "bitcoin/transaction.h"
+
+#include <QRandomGenerator>
+#include <QTemporaryDir>
 namespace {
 
     template<size_t NB>
@@ -4355,5 +5415,362 @@ namespace {
               << " elapsed: " << t0.secsStr(2) << " sec";
     }
     const auto b1 = App::registerBench("txcol", findCollisions);
+
+    /// Builds a synthetic chain in a temporary datadir, then rewinds the last few blocks via undoLatestBlock(),
+    /// reporting how long each undo took. Env vars: REORG_BLOCKS (chain length, default 200), REORG_TXS (txs per
+    /// block, default 1000), REORG_N (blocks to rewind, default 10), REORG_CHUNKED=1 (use the chunked
+    /// scripthash_history layout), REORG_UTXOCACHE=<MiB> (run with the UTXO cache enabled, as during fast-sync).
+    void benchReorg() {
+        const auto envUInt = [](const char *name, unsigned def) {
+            bool ok;
+            const unsigned val = QString(std::getenv(name)).toUInt(&ok);
+            return ok ? val : def;
+        };
+        const unsigned nBlocks = std::max(envUInt("REORG_BLOCKS", 200), 2u), nTxs = std::max(envUInt("REORG_TXS", 1000), 1u),
+                       nRewind = std::clamp(envUInt("REORG_N", 10), 1u, nBlocks - 1);
+        QTemporaryDir tmpDir;
+        if (!tmpDir.isValid()) throw Exception("Failed to create a temporary directory");
+        auto options = std::make_shared<Options>();
+        options->datadir = tmpDir.path();
+        options->maxReorg = std::max(options->maxReorg, nRewind);
+        options->db.historyChunked = envUInt("REORG_CHUNKED", 0) != 0;
+        options->utxoCache = size_t(envUInt("REORG_UTXOCACHE", 0)) * 1024u * 1024u;
+        Log() << "Chain: " << nBlocks << " blocks, " << nTxs << " txs/block, rewinding " << nRewind << " blocks, "
+              << "history layout: " << (options->db.historyChunked ? "chunked" : "legacy") << ", UTXO cache: "
+              << (options->utxoCache ? QString::number(options->utxoCache / 1024 / 1024) + " MiB" : QString("off"));
+
+        auto storage = std::make_unique<Storage>(options);
+        storage->startup();
+        std::optional<Storage::InitialSyncRAII> initialSync;
+        if (options->utxoCache) initialSync.emplace(storage->setInitialSync());
+
+        // A fixed pool of scripts, so that scripthash histories span many blocks (as they do on a real chain).
+        std::vector<bitcoin::CScript> scripts(4096);
+        for (auto & script : scripts) {
+            QByteArray h160(20, Qt::Uninitialized);
+            Util::getRandomBytes(h160.data(), h160.size());
+            script << bitcoin::OP_DUP << bitcoin::OP_HASH160 << std::vector<uint8_t>(h160.begin(), h160.end())
+                   << bitcoin::OP_EQUALVERIFY << bitcoin::OP_CHECKSIG;
+        }
+        const auto randomScript = [&scripts] { return scripts[QRandomGenerator::global()->bounded(int(scripts.size()))]; };
+        const auto amount = [](int64_t sats) { return sats * bitcoin::Amount::satoshi(); };
+
+        std::vector<bitcoin::COutPoint> spendable;
+        std::vector<std::pair<int64_t, TxNum>> sizesAfterBlock; // (utxoSetSize, txNum) for each height, to verify the undo
+        uint256 prevHash;
+        const Tic tBuild;
+        for (unsigned height = 0; height < nBlocks; ++height) {
+            bitcoin::CBlock block;
+            block.nVersion = 4;
+            block.hashPrevBlock = prevHash;
+            block.nTime = 1'600'000'000u + height * 600u;
+            block.nBits = 0x207fffff;
+            block.nNonce = height;
+            std::vector<bitcoin::COutPoint> created;
+            const auto addTx = [&](bitcoin::CMutableTransaction &&tx) {
+                auto ref = bitcoin::MakeTransactionRef(std::move(tx));
+                for (uint32_t n = 0; n < ref->vout.size(); ++n)
+                    created.emplace_back(ref->GetId(), n);
+                block.vtx.push_back(std::move(ref));
+            };
+            {   // coinbase, fanning out to many outputs so there is plenty to spend later
+                bitcoin::CMutableTransaction cb;
+                cb.nLockTime = height; // makes the txid unique
+                cb.vin.emplace_back();
+                for (unsigned i = 0; i < std::max(nTxs / 4u, 1u); ++i)
+                    cb.vout.emplace_back(amount(100'000), randomScript());
+                addTx(std::move(cb));
+            }
+            // each tx spends 1 older output and creates 2 new ones
+            for (unsigned i = 1; i < nTxs && !spendable.empty(); ++i) {
+                bitcoin::CMutableTransaction tx;
+                tx.nVersion = 2;
+                const auto idx = QRandomGenerator::global()->bounded(int(spendable.size()));
+                tx.vin.emplace_back(spendable[size_t(idx)]);
+                spendable[size_t(idx)] = spendable.back();
+                spendable.pop_back();
+                tx.vout.emplace_back(amount(40'000), randomScript());
+                tx.vout.emplace_back(amount(50'000), randomScript());
+                addTx(std::move(tx));
+            }
+            spendable.insert(spendable.end(), created.begin(), created.end());
+            prevHash = block.GetHash();
+            storage->addBlock(PreProcessedBlock::makeShared(height, size_t(BTC::Serialize(block).size()), block),
+                              height + options->maxReorg >= nBlocks /* only save undo for the blocks we may rewind */);
+            sizesAfterBlock.emplace_back(storage->utxoSetSize(), storage->getTxNum());
+        }
+        Log() << "Built chain in " << tBuild.secsStr(3) << " sec, txNum: " << storage->getTxNum()
+              << ", utxos: " << storage->utxoSetSize();
+
+        std::vector<double> msecs;
+        const Tic tUndo;
+        for (unsigned i = 0; i < nRewind; ++i) {
+            const Tic t;
+            const BlockHeight newTip = storage->undoLatestBlock();
+            msecs.push_back(t.msec<double>());
+            if (const auto & [utxos, txNum] = sizesAfterBlock[newTip]; storage->utxoSetSize() != utxos || storage->getTxNum() != txNum)
+                throw Exception(QString("Mismatch after undo to height %1: utxos %2 != %3 or txNum %4 != %5").arg(newTip)
+                                .arg(storage->utxoSetSize()).arg(utxos).arg(storage->getTxNum()).arg(txNum));
+        }
+        const double total = tUndo.msec<double>();
+        std::sort(msecs.begin(), msecs.end());
+        Log() << "Rewound " << nRewind << " blocks in " << QString::number(total, 'f', 3) << " msec; per block: avg "
+              << QString::number(total / nRewind, 'f', 3) << " msec, median " << QString::number(msecs[msecs.size() / 2], 'f', 3)
+              << " msec, max " << QString::number(msecs.back(), 'f', 3) << " msec";
+        initialSync.reset();
+        storage.reset();
+    }
+    const auto b2 = App::registerBench("reorg", benchReorg);
+
+    /// Compares the V2 and V3 (dictionary-encoded) UndoInfo formats for blob size and ser/deser speed, using a
+    /// synthetic block. Env vars: UNDO_TXS (txs in the block, default 10000; each spends 2 older outputs and creates
+    /// 2 new ones), UNDO_HASHXS (distinct scripthashes involved, default UNDO_TXS), UNDO_ITERS (default 20).
+    void benchUndoSer() {
+        const auto envUInt = [](const char *name, unsigned def) {
+            bool ok;
+            const unsigned val = QString(std::getenv(name)).toUInt(&ok);
+            return ok ? val : def;
+        };
+        const unsigned nTxs = std::max(envUInt("UNDO_TXS", 10'000), 1u), nHashXs = std::max(envUInt("UNDO_HASHXS", nTxs), 1u),
+                       nIters = std::max(envUInt("UNDO_ITERS", 20), 1u);
+        const auto randomHash = [] {
+            QByteArray ret(HashLen, Qt::Uninitialized);
+            Util::getRandomBytes(ret.data(), ret.size());
+            return ret;
+        };
+        auto *rgen = QRandomGenerator::global();
+
+        UndoInfo u;
+        u.height = 700'000;
+        u.hash = randomHash();
+        u.blkInfo = BlkInfo(1'000'000'000, nTxs);
+        std::vector<HashX> hashXs(nHashXs);
+        for (auto & h : hashXs) h = randomHash();
+        const auto randomHashX = [&] { return hashXs[rgen->bounded(nHashXs)]; };
+        // the spent prevouts come from the txs of the previous ~100 blocks
+        std::map<TxNum, TxHash> prevTxs;
+        for (unsigned i = 0; i < nTxs; ++i) {
+            const TxNum txNum = u.blkInfo.txNum0 - 1 - rgen->bounded(nTxs * 100u);
+            const TxHash & prevHash = prevTxs.try_emplace(txNum, randomHash()).first->second;
+            for (IONum n = 0; n < 2; ++n) {
+                TXOInfo info;
+                info.hashX = randomHashX();
+                info.amount = int64_t(rgen->bounded(100'000'000)) * bitcoin::Amount::satoshi();
+                info.confirmedHeight = u.height - 1 - unsigned(u.blkInfo.txNum0 - txNum) / nTxs;
+                info.txNum = txNum;
+                u.delUndos.emplace_back(TXO{prevHash, n + IONum(rgen->bounded(3))}, std::move(info));
+                u.scriptHashes.insert(u.delUndos.back().second.hashX);
+            }
+            const TxHash txHash = randomHash();
+            const TxNum txNum = u.blkInfo.txNum0 + i;
+            for (IONum n = 0; n < 2; ++n) {
+                u.addUndos.emplace_back(TXO{txHash, n}, randomHashX(), CompactTXO(txNum, n));
+                u.scriptHashes.insert(std::get<1>(u.addUndos.back()));
+            }
+        }
+        Log() << "UndoInfo: " << u.toDebugString();
+
+        const auto bench = [&](const char *name, auto && serFunc) {
+            QByteArray ba;
+            const Tic t0;
+            for (unsigned i = 0; i < nIters; ++i) ba = serFunc(u);
+            const double serMsec = t0.msec<double>() / nIters;
+            bool ok{};
+            UndoInfo u2;
+            const Tic t1;
+            for (unsigned i = 0; i < nIters; ++i) u2 = Deserialize<UndoInfo>(ba, &ok);
+            const double deserMsec = t1.msec<double>() / nIters;
+            if (!ok || !(u2 == u)) throw Exception(QString("%1: round-trip check failed").arg(name));
+            Log() << name << ": " << ba.size() << " bytes (" << QString::number(double(ba.size()) / (u.addUndos.size() + u.delUndos.size()), 'f', 1)
+                  << " bytes/undo), ser: " << QString::number(serMsec, 'f', 3) << " msec, deser: "
+                  << QString::number(deserMsec, 'f', 3) << " msec";
+            return ba.size();
+        };
+        const auto v2 = bench("V2", serializeUndoV2), v3 = bench("V3", serializeUndoV3);
+        Log() << "V3 is " << QString::number(100.0 * v3 / v2, 'f', 1) << "% the size of V2";
+    }
+    const auto b3 = App::registerBench("undoser", benchUndoSer);
+
+    /// Builds the same synthetic chain into a legacy and a chunked scripthash_history datadir, with tiny chunks so
+    /// that histories span many chunks and chunks span block boundaries, and checks that getHistory(),
+    /// getHistoryRange() and getHistoryTail() all agree. Then converts the legacy datadir to the chunked layout and
+    /// back, checking again after each conversion, and finally rewinds a few blocks in both datadirs and checks again.
+    void testShist() {
+        const unsigned savedChunkBits = shistChunkBits;
+        Defer restoreChunkBits([savedChunkBits]{ shistChunkBits = savedChunkBits; });
+        shistChunkBits = 3; // 8 TxNums per chunk
+
+        constexpr unsigned nBlocks = 60, nRewind = 5;
+        QRandomGenerator rgen(12345); // deterministic, so that a failure is reproducible
+        std::vector<bitcoin::CScript> scripts(6);
+        std::vector<HashX> hashXs;
+        for (auto & script : scripts) {
+            std::vector<uint8_t> h160(20);
+            for (auto & b : h160) b = uint8_t(rgen.bounded(256));
+            script << bitcoin::OP_DUP << bitcoin::OP_HASH160 << h160 << bitcoin::OP_EQUALVERIFY << bitcoin::OP_CHECKSIG;
+            hashXs.push_back(BTC::HashXFromCScript(script));
+        }
+        const auto amount = [](int64_t sats) { return sats * bitcoin::Amount::satoshi(); };
+
+        // Generate the chain. Blocks have between 1 and 12 txs, each of which pays to 1 or 2 random scripts and spends
+        // an older output, so each scripthash gets a history that is spread unevenly across blocks.
+        std::vector<bitcoin::CBlock> blocks;
+        std::vector<bitcoin::COutPoint> spendable;
+        uint256 prevHash;
+        for (unsigned height = 0; height < nBlocks; ++height) {
+            auto & block = blocks.emplace_back();
+            block.nVersion = 4;
+            block.hashPrevBlock = prevHash;
+            block.nTime = 1'600'000'000u + height * 600u;
+            block.nBits = 0x207fffff;
+            block.nNonce = height;
+            std::vector<bitcoin::COutPoint> created;
+            const auto addTx = [&](bitcoin::CMutableTransaction &&tx) {
+                auto ref = bitcoin::MakeTransactionRef(std::move(tx));
+                for (uint32_t n = 0; n < ref->vout.size(); ++n)
+                    created.emplace_back(ref->GetId(), n);
+                block.vtx.push_back(std::move(ref));
+            };
+            {
+                bitcoin::CMutableTransaction cb;
+                cb.nLockTime = height; // makes the txid unique
+                cb.vin.emplace_back();
+                cb.vout.emplace_back(amount(5'000'000), scripts[rgen.bounded(int(scripts.size()))]);
+                cb.vout.emplace_back(amount(5'000'000), scripts[rgen.bounded(int(scripts.size()))]);
+                addTx(std::move(cb));
+            }
+            for (int i = 1, nTxs = rgen.bounded(1, 13); i < nTxs && !spendable.empty(); ++i) {
+                bitcoin::CMutableTransaction tx;
+                tx.nVersion = 2;
+                const auto idx = size_t(rgen.bounded(int(spendable.size())));
+                tx.vin.emplace_back(spendable[idx]);
+                spendable[idx] = spendable.back();
+                spendable.pop_back();
+                for (int j = 0, nOut = rgen.bounded(1, 3); j < nOut; ++j)
+                    tx.vout.emplace_back(amount(10'000), scripts[rgen.bounded(int(scripts.size()))]);
+                addTx(std::move(tx));
+            }
+            spendable.insert(spendable.end(), created.begin(), created.end());
+            prevHash = block.GetHash();
+        }
+
+        QTemporaryDir legacyDir, chunkedDir;
+        if (!legacyDir.isValid() || !chunkedDir.isValid()) throw Exception("Failed to create a temporary directory");
+        const auto open = [nRewind = nRewind](const QString &datadir, bool chunked) {
+            auto options = std::make_shared<Options>();
+            options->datadir = datadir;
+            options->maxReorg = std::max(options->maxReorg, nRewind);
+            options->db.historyChunked = chunked;
+            auto storage = std::make_unique<Storage>(options);
+            storage->startup();
+            return storage;
+        };
+        auto legacy = open(legacyDir.path(), false), chunked = open(chunkedDir.path(), true);
+        for (unsigned height = 0; height < nBlocks; ++height) {
+            const auto size = size_t(BTC::Serialize(blocks[height]).size());
+            for (auto *storage : {legacy.get(), chunked.get()})
+                storage->addBlock(PreProcessedBlock::makeShared(height, size, blocks[height]), height + nRewind >= nBlocks);
+        }
+        Log() << "Built chain of " << nBlocks << " blocks, " << legacy->getTxNum() << " txs, in 2 datadirs";
+
+        // The reference is the legacy layout's getHistory(), which predates the chunked layout. Everything else must
+        // agree with it.
+        std::map<HashX, Storage::History> refs;
+        size_t nItems = 0;
+        for (const auto & hashX : hashXs) {
+            auto & ref = refs[hashX] = legacy->getHistory(hashX, true, false);
+            if (ref.empty()) throw Exception("Expected every test scripthash to have some history");
+            nItems += ref.size();
+        }
+        Log() << "Reference histories: " << refs.size() << " scripthashes, " << nItems << " items";
+
+        const auto check = [&refs](const Storage &storage, const char *what) {
+            const auto fail = [what](const QString &msg) { throw Exception(QString("%1: %2").arg(what).arg(msg)); };
+            const int tip = storage.latestTip().first;
+            for (const auto & [hashX, ref] : refs) {
+                const QString hex = QString(Util::ToHexFast(hashX).left(12));
+                if (storage.getHistory(hashX, true, false) != ref)
+                    fail("getHistory mismatch for " + hex);
+                // getHistoryTail: every length, including past the end
+                for (size_t n = 1; n <= ref.size() + 1; ++n) {
+                    const Storage::History expected(ref.end() - std::min(n, ref.size()), ref.end());
+                    if (storage.getHistoryTail(hashX, n) != expected)
+                        fail(QString("getHistoryTail(%1) mismatch for %2").arg(n).arg(hex));
+                }
+                // getHistoryRange: a selection of ranges, with every maxItems cut-off
+                for (const auto & [from, to] : std::vector<std::pair<int, int>>{{0, -1}, {0, tip}, {1, tip / 2},
+                                                                              {tip / 3, tip - 1}, {tip, tip}, {tip / 2, tip / 2}}) {
+                    Storage::History inRange;
+                    for (const auto & item : ref)
+                        if (item.height >= from && item.height <= (to < 0 ? tip : to))
+                            inRange.push_back(item);
+                    for (size_t maxItems = 1; maxItems <= inRange.size() + 1; ++maxItems) {
+                        const QString desc = QString("getHistoryRange(%1, %2, %3, %4)").arg(hex).arg(from).arg(to).arg(maxItems);
+                        // the expected result of 1 call, as documented in Storage.h
+                        Storage::History expected;
+                        int expectedNext = -1;
+                        if (inRange.size() <= maxItems)
+                            expected = inRange;
+                        else {
+                            const int cutHeight = inRange[maxItems].height;
+                            for (size_t i = 0; i < maxItems && inRange[i].height != cutHeight; ++i)
+                                expected.push_back(inRange[i]);
+                            if (!expected.empty())
+                                expectedNext = cutHeight;
+                            else {
+                                for (const auto & item : inRange)
+                                    if (item.height == cutHeight) expected.push_back(item);
+                                if (cutHeight < (to < 0 ? tip : to))
+                                    expectedNext = cutHeight + 1;
+                            }
+                        }
+                        int next = -2;
+                        if (storage.getHistoryRange(hashX, from, to, maxItems, &next) != expected || next != expectedNext)
+                            fail(desc + QString(" mismatch, next: %1 expected: %2").arg(next).arg(expectedNext));
+                        // paging through the range with nextFromHeight must yield all of it, exactly once
+                        Storage::History paged;
+                        for (int h = from, nCalls = 0; h >= 0; ++nCalls) {
+                            if (nCalls > tip + 1) fail(desc + " paging does not terminate");
+                            const auto page = storage.getHistoryRange(hashX, h, to, maxItems, &h);
+                            paged.insert(paged.end(), page.begin(), page.end());
+                        }
+                        if (paged != inRange)
+                            fail(desc + " paging mismatch");
+                    }
+                }
+            }
+        };
+        check(*legacy, "legacy");
+        check(*chunked, "chunked");
+        Log() << "Legacy and chunked layouts agree";
+
+        // round-trip the conversion on the legacy datadir: legacy -> chunked -> legacy
+        legacy.reset();
+        legacy = open(legacyDir.path(), true);
+        check(*legacy, "converted to chunked");
+        legacy.reset();
+        legacy = open(legacyDir.path(), false);
+        check(*legacy, "converted back to legacy");
+        Log() << "Layout conversion round-trip ok";
+
+        // rewind both, and check against the reference with the rewound blocks' items removed
+        for (unsigned i = 0; i < nRewind; ++i) {
+            legacy->undoLatestBlock();
+            chunked->undoLatestBlock();
+        }
+        const int newTip = int(nBlocks - nRewind) - 1;
+        for (auto it = refs.begin(); it != refs.end(); ) {
+            auto & ref = it->second;
+            ref.erase(std::find_if(ref.begin(), ref.end(), [newTip](const auto &item){ return item.height > newTip; }), ref.end());
+            it = ref.empty() ? refs.erase(it) : std::next(it);
+        }
+        check(*legacy, "legacy after undo");
+        check(*chunked, "chunked after undo");
+        Log() << "Rewound " << nRewind << " blocks, layouts still agree";
+
+        legacy.reset();
+        chunked.reset();
+    }
+    const auto t1 = App::registerTest("shist", testShist);
 } // end anon namespace
 #endif
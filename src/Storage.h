@@ -169,6 +169,10 @@ public:
     /// as well as modify the utxo set with spends / new outputs, and generate undo info for the block in the db if
     /// the block is accepted.  A successful return from this function without throwing indicates success.
     ///
+    /// For large blocks, the writes to the individual tables (utxoset, scripthash_unspent, scripthash_history,
+    /// txhash2txnum, undo, blkinfo and the RecordFiles) are issued concurrently and are all joined before this
+    /// returns. Per-phase timings are reported in stats() under "addBlock timings".
+    ///
     /// Note: you can only add blocks in serial sequence from 0 -> latest.
     void addBlock(PreProcessedBlockPtr ppb, bool alsoSaveUnfoInfo, unsigned num2ReserveAfter = 0, bool notifySubs = false);
 
@@ -213,6 +217,19 @@ public:
     /// Returns the known size of the utxo set in millions of bytes
     double utxoSetSizeMB() const;
 
+    /// A snapshot of some cheap counters, used by the /metrics endpoint (see Controller::metrics). Every field is read
+    /// from an atomic so this takes no locks and never contends with addBlock() or undoLatestBlock().
+    struct MetricCounters {
+        uint64_t headerCount = 0; ///< number of headers in the headers file (== latest height + 1)
+        TxNum txNum = 0; ///< same as getTxNum()
+        int64_t utxoSetSize = 0; ///< same as utxoSetSize()
+        uint64_t merges = 0, mergesTxHash2TxNum = 0; ///< rocksdb merge operator call counts
+        uint64_t num2HashHits = 0, num2HashMisses = 0; ///< LRU Cache: TxNum -> TxHash
+        uint64_t height2HashesHits = 0, height2HashesMisses = 0; ///< LRU Cache: Block Height -> TxHashes
+    };
+    /// Thread-safe, lock-free.
+    MetricCounters metricCounters() const;
+
     //-- scritphash history
     struct HistoryItem {
         TxHash hash;
@@ -228,6 +245,21 @@ public:
     /// Thread-safe. Will return an empty vector if the confirmed history size exceeds MaxHistory, or a truncated
     /// vector if the confirmed + unconfirmed history exceeds MaxHistory.
     History getHistory(const HashX &, bool includeConfirmed, bool includeMempool) const;
+    /// Thread-safe. Like getHistory(), but for many scripthashes at once. The histories are all read under a single
+    /// acquisition of the blocks lock (and of the mempool lock), so they are consistent with each other. The returned
+    /// vector is parallel to `hashXs`. Entries for invalid scripthashes are empty.
+    std::vector<History> getHistories(const std::vector<HashX> &hashXs, bool includeConfirmed, bool includeMempool) const;
+
+    /// Thread-safe. Returns at most `maxItems` items of the confirmed history of a scripthash in the block height range
+    /// [fromHeight, toHeight] (toHeight < 0 means "up to the tip"), in blockchain order. A block's items are never
+    /// split across calls: if the range holds more than `maxItems` items, the result ends at the last block that fits
+    /// entirely (or, if the first block alone has more than `maxItems` items, consists of just that block), and
+    /// *nextFromHeight is set to the height to resume from. Otherwise *nextFromHeight is set to -1.  With the chunked
+    /// history layout (db_history_chunked = true), only the db rows overlapping the requested range are read.
+    History getHistoryRange(const HashX &, int fromHeight, int toHeight, size_t maxItems, int *nextFromHeight = nullptr) const;
+    /// Thread-safe. Returns the most recent `n` items of the confirmed history of a scripthash, in blockchain order.
+    /// With the chunked history layout, only the most recent db rows are read.
+    History getHistoryTail(const HashX &, size_t n) const;
 
     struct UnspentItem : HistoryItem {
         IONum tx_pos = 0;
@@ -289,6 +321,9 @@ public:
 
     /// Takes a shared lock and returns the cached mempool histogram (calculated periodically in refreshMempoolHistogram above)
     Mempool::FeeHistogramVec mempoolHistogram() const;
+    /// Thread-safe, lock-free. Returns the number of times refreshMempoolHistogram() has been called. Used by the
+    /// servers as a cheap "the mempool has been refreshed" epoch for cached fee-related responses.
+    quint64 mempoolHistogramGeneration() const;
 
     // -- Tx Hash index based methods
     using TxHeightsResult = std::vector<std::optional<BlockHeight>>;
@@ -422,6 +457,7 @@ private:
     void loadCheckTxNumsFileAndBlkInfo(); ///< may throw -- called from startup()
     void loadCheckTxHash2TxNumMgr(); ///< may throw -- called from startup()
     void loadCheckEarliestUndo(); ///< may throw -- called from startup()
+    void loadCheckShistLayout(); ///< may throw -- called from startup()
 
     std::optional<Header> headerForHeight_nolock(BlockHeight height, QString *errMsg = nullptr) const;
     std::vector<Header> headersFromHeight_nolock_nocheck(BlockHeight height, unsigned count, QString *errMsg = nullptr) const;
@@ -435,8 +471,18 @@ private:
     /// Only does something if options->compactDBs is true (iff --compact-dbs specified on CLI)
     void compactAllDBs();
 
+    /// The file in the datadir where the SubsMgr's status cache is saved on shutdown (iff options->persistStatusCache)
+    QString statusCacheFileName() const;
+
     // Called by heightForTxNum which calls this with the blockInfo lock held
     std::optional<unsigned> heightForTxNum_nolock(TxNum) const;
+
+    /// Reads the confirmed history TxNums of a scripthash that are in the range [begin, end), at most `limit` of them:
+    /// the earliest ones if `fromEnd` is false, otherwise the latest ones. The result is in ascending order. Call this
+    /// with blocksLock held (shared). May throw on db error.
+    std::vector<TxNum> readHistoryTxNums_nolock(const HashX &, TxNum begin, TxNum end, size_t limit, bool fromEnd) const;
+    /// Resolves confirmed TxNums to HistoryItems (tx hash + height). May throw if the db is inconsistent.
+    History historyItemsForTxNums(const std::vector<TxNum> &) const;
 };
 
 Q_DECLARE_OPERATORS_FOR_FLAGS(Storage::SaveSpec)
@@ -461,6 +507,12 @@ RecordFile: "txnum2txhash"
   monotonically increasing txnum based on where it appeared on the blockchain. Block 0, tx 0 has "txnum" 0, up until
   the last tx N in block 0, which has "txnum" N. Tx 0 in block 1 then follows with "txnum" N+1, and so on.
 
+RecordFile: "blkinfo_snapshot"
+  Purpose:  A flat copy of the "blkinfo" table below (record number = block height), kept in lockstep with it by
+  addBlock and undoLatestBlock. It is loaded in 1 read on startup (after being validated against the db tip), which is
+  much faster than scanning the "blkinfo" table. If it fails validation it is simply rebuilt from the table.
+  Data layout:  Each record is a raw BlkInfo struct (txNum0, nTx) -- see Storage.cpp.
+
 RocksDB: "blkinfo"
   Purpose:  Allow for undoing on reorg and store some metadata for each block
   Key:  "num_blocks" -> value (uint32) one past the last block height saved (eg the latest valid block_height
@@ -482,6 +534,10 @@ RocksDB: "scripthash_history"
   Key: scripthash_raw_bytes (32 bytes)
   -> values: An ordered list of unique txNums: 6-byte txNums (txNum [uint48] , ... ), for all tx's spending from or to
   a scripthash.
+  Chunked layout (if db_history_chunked = true; the layout in use is recorded in "meta" under "shist_layout"):
+  Key: scripthash_raw_bytes (32 bytes) + chunk (big-endian uint32, 4 bytes), where chunk = txNum >> 20
+  -> values: same as above, but holding only the txNums that fall into that chunk. A scripthash's rows are adjacent
+  and sort in txNum order, so a height range (== txNum range) or the most recent history maps to a small key range.
 
 RocksDB: "utxoset"
   Purpose: serialize the UTXOSet structure as seen in the sources. loading this involves iterating over entire table.
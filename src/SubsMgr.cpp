@@ -20,27 +20,22 @@
 #include "Util.h"
 
 #include "bitcoin/hash.h"
+#include "bitcoin/prevector.h"
+#include "robin_hood/robin_hood.h"
 
+#include <QDataStream>
+#include <QFile>
+#include <QMetaObject>
+#include <QSaveFile>
 #include <QThread>
 
 #include <algorithm>
+#include <array>
 #include <cmath>
+#include <cstring>
 #include <mutex>
-
-/* static */ std::atomic_int64_t Subscription::nGlobalInstances = 0;
-
-Subscription::Subscription(const HashX &k)
-    : QObject(nullptr), key(k)
-{
-    ++nGlobalInstances;
-}
-
-Subscription::~Subscription()
-{
-    if (const auto n = --nGlobalInstances; UNLIKELY(n < 0))
-        // should never happen
-        Error() << "BUG! Subscription::nGlobalInstances (" << n << ") is negative! FIXME!";
-}
+#include <unordered_map>
+#include <vector>
 
 namespace {
     using LockGuard = std::lock_guard<std::mutex>;
@@ -50,32 +45,179 @@ namespace {
     constexpr const char *kRemoveZombiesTimerName = "ZombieTimer";
 
     constexpr bool debugPrint = false; ///< some of the more performance critical code in this file has its trace/debug prints compiled in or out based on this flag.
+
+    /// All subscription keys are 32-byte hashes (scripthashes or txids), so we store them inline rather than as
+    /// QByteArrays (which would cost a separate heap allocation each).
+    struct SubKey {
+        std::array<char, HashLen> bytes;
+
+        /// Returns false if `hx` is not exactly HashLen bytes
+        bool set(const HashX &hx) noexcept {
+            if (UNLIKELY(hx.size() != int(HashLen))) return false;
+            std::memcpy(bytes.data(), hx.constData(), HashLen);
+            return true;
+        }
+        HashX toHashX() const { return HashX(bytes.data(), int(HashLen)); }
+        bool operator==(const SubKey &o) const noexcept { return bytes == o.bytes; }
+    };
+    /// Keys may be chosen by clients, so we use the app-wide seeded hasher here rather than just reading the first
+    /// few bytes of the key.
+    struct SubKeyHasher {
+        std::size_t operator()(const SubKey &k) const noexcept { return Util::hashForStd(ByteView{k.bytes}); }
+    };
+
+    /// A (client, callback) pair for a subscription. `cbIdx` indexes into the client's callback table (ClientRec::cbs).
+    struct ClientRef {
+        IdMixin::Id clientId;
+        uint32_t cbIdx;
+    };
+
+    struct SubEntry {
+        /// The last status sent out as a notification. If it has_value, it's guaranteed to be the most recent one
+        /// announced to clients, so it is suitable for use in the respone to e.g. blockchain.scripthash.subscribe (iff
+        /// has_value).
+        SubStatus lastStatusNotified;
+        /// The last status that was computed as the result of a blockchain.[scripthash|dsproof].subscribe RPC call
+        /// This status is returned as the immediate result for subsequent .subscribe calls after the first client
+        /// subscribes (as a performance optimization).  This value is correctly maintained by the notification
+        /// mechanism in collaboration with Servers.cpp.  In rare cases it is not the most recent possible status since
+        /// it is a slightly delayed value -- but that's ok as a future notification to a client will rectify the
+        /// situation with the most up-to-date status in the near future anyway.
+        SubStatus cachedStatus;
+        /// The last time this sub was accessed in milliseconds (Util::getTime()). If the ts goes beyond 1 minute in the
+        /// past, and it has no clients attached, its entry may be removed.
+        int64_t tsMsec = Util::getTime();
+        /// The vast majority of subs have exactly 1 client, so that case needs no extra heap allocation. Note that
+        /// entries for clients that have since been deleted are pruned lazily (see Pvt::pruneDeadClients).
+        bitcoin::prevector<1, ClientRef> clients;
+
+        void updateTS() { tsMsec = Util::getTime(); }
+    };
+
+    using SubsTable = robin_hood::unordered_flat_map<SubKey, SubEntry, SubKeyHasher>;
 }
 
 struct SubsMgr::Pvt
 {
-    std::mutex mut;
-    std::unordered_map<HashX, SubsMgr::SubRef, HashHasher> subs;
+    std::mutex mut; ///< guards all of the below non-atomic data
+    SubsTable subs;
     std::unordered_set<HashX, HashHasher> pendingNotificatons;
 
-    static std::atomic_int64_t nGlobalClientSubsActive;
+    /// One of these per client that has (or had) at least 1 sub with us. Erased when the client is deleted.
+    struct ClientRec {
+        RPC::ConnectionBase *conn = nullptr; ///< only valid while this record exists
+        int64_t nSubs = 0;
+        QMetaObject::Connection destroyedConn;
+
+        /// The client's callback table. Identical callbacks (same StatusCallbackPtr) share 1 refcounted slot.
+        struct CBSlot { StatusCallbackPtr cb; uint32_t refs = 0; };
+        std::vector<CBSlot> cbs;
+        std::vector<uint32_t> freeSlots;
+        std::unordered_map<const StatusCallback *, uint32_t> slotByCB;
+
+        uint32_t acquireSlot(const StatusCallbackPtr &cb) {
+            if (auto it = slotByCB.find(cb.get()); it != slotByCB.end()) {
+                ++cbs[it->second].refs;
+                return it->second;
+            }
+            uint32_t idx;
+            if (!freeSlots.empty()) {
+                idx = freeSlots.back();
+                freeSlots.pop_back();
+            } else {
+                idx = uint32_t(cbs.size());
+                cbs.emplace_back();
+            }
+            cbs[idx] = CBSlot{cb, 1};
+            slotByCB.emplace(cb.get(), idx);
+            return idx;
+        }
+        void releaseSlot(uint32_t idx) {
+            auto & slot = cbs[idx];
+            if (--slot.refs == 0) {
+                slotByCB.erase(slot.cb.get());
+                slot.cb.reset();
+                freeSlots.push_back(idx);
+            }
+        }
+    };
+    std::unordered_map<IdMixin::Id, ClientRec> clients;
+
+    static std::atomic_int64_t nGlobalClientSubsActive, nGlobalSubs;
     std::atomic_int64_t nClientSubsActive{0};
     std::atomic_uint64_t cacheHits{0}, cacheMisses{0};
 
+    /// Approximate memory usage of the subs table, recomputed on each removeZombies() pass. Guarded by mut.
+    size_t lastHeapBytes = 0;
+
+    /// Statuses loaded from disk at startup (see loadPersistedStatuses). Only confirmed-only scripthash statuses are
+    /// persisted, so these are always either a 32-byte status hash or "no history". Entries are erased as soon as
+    /// their key is touched by a block or mempool change. Guarded by mut.
+    struct PersistedStatus {
+        SubKey hash{};
+        bool noHistory = false;
+        SubStatus toStatus() const { return noHistory ? QByteArray() : hash.toHashX(); }
+    };
+    robin_hood::unordered_flat_map<SubKey, PersistedStatus, SubKeyHasher> persisted;
+    std::atomic_bool hasPersisted{false}; ///< mirrors !persisted.empty(), for lock-free checks
+    std::atomic_uint64_t persistedLoaded{0}, persistedHits{0}, persistedDropped{0};
+
     static constexpr size_t kSubsReserveSize = 16384;
     Pvt() {
         subs.reserve(kSubsReserveSize);
         pendingNotificatons.reserve(kRecommendedPendingNotificationsReserveSize);
     }
+    ~Pvt() {
+        nGlobalSubs -= int64_t(subs.size());
+        for (auto & [id, rec] : clients) {
+            QObject::disconnect(rec.destroyedConn);
+            nGlobalClientSubsActive -= rec.nSubs;
+        }
+    }
     /// call this with the lock held
     inline void clearPending_nolock() {
         decltype(pendingNotificatons) emptySet;
         pendingNotificatons.swap(emptySet);
         pendingNotificatons.reserve(kRecommendedPendingNotificationsReserveSize);
     }
+    /// call this with the lock held. Returns the number of persisted statuses erased.
+    template <typename Keys>
+    size_t dropPersisted_nolock(const Keys &keys) {
+        if (persisted.empty()) return 0;
+        size_t ct = 0;
+        SubKey k;
+        for (const auto & key : keys)
+            if (k.set(key)) ct += persisted.erase(k);
+        if (persisted.empty()) {
+            hasPersisted = false;
+            persisted.compact();
+        }
+        persistedDropped += ct;
+        return ct;
+    }
+    /// call this with the lock held. Returns the record for a live client or nullptr if the client is gone.
+    ClientRec *findClient(IdMixin::Id id) {
+        if (auto it = clients.find(id); it != clients.end())
+            return &it->second;
+        return nullptr;
+    }
+    /// call this with the lock held. Drops the entries for deleted clients from `e`, returning the number dropped.
+    size_t pruneDeadClients(SubEntry &e) {
+        const auto origSize = e.clients.size();
+        e.clients.erase(std::remove_if(e.clients.begin(), e.clients.end(),
+                                       [this](const ClientRef &r){ return !clients.count(r.clientId); }),
+                        e.clients.end());
+        return origSize - e.clients.size();
+    }
+    /// call this with the lock held. Approximate bytes used by the table itself (excluding heap data it points to).
+    size_t tableBytes() const {
+        const size_t nSlots = subs.empty() ? 0 : subs.mask() + 1;
+        return nSlots * (sizeof(SubsTable::value_type) + 1);
+    }
 };
 
 /*static*/ std::atomic_int64_t SubsMgr::Pvt::nGlobalClientSubsActive{0};
+/*static*/ std::atomic_int64_t SubsMgr::Pvt::nGlobalSubs{0};
 
 SubsMgr::LimitReached::~LimitReached() {} // vtable
 
@@ -127,7 +269,7 @@ void SubsMgr::doNotifyAllPending()
     size_t ctr = 0, ctrSH = 0;
     bool emitQueueEmpty = false;
     const bool useCache = useStatusCache();
-    std::vector<SubRef> pending; // this ends up being the intersection of the sh's in p->pendingNotifications and p->subs
+    std::vector<SubKey> pending; // this ends up being the intersection of the sh's in p->pendingNotifications and p->subs
     {
         LockGuard g(p->mut);
         const bool pendingWasEmpty = p->pendingNotificatons.empty();
@@ -141,17 +283,18 @@ void SubsMgr::doNotifyAllPending()
                 // p->subs for each scripthash.
                 // Under current BCH typical network usage, this is usually the more likely branch, unless blocks are
                 // full or the network is very busy, in which case the other branch is more likely.
+                SubKey k;
                 for (const auto & sh : p->pendingNotificatons) {
-                    if (const auto it = p->subs.find(sh); it != p->subs.end()) {
-                        pending.push_back( it->second );
+                    if (k.set(sh) && p->subs.count(k)) {
+                        pending.push_back(k);
                     }
                 }
             } else {
                 // p->subs is smaller (or equal), loop over that, doing constant-time checks against the larger
                 // p->pendingNotification for each scripthash.
-                for (const auto & [sh, subref] : p->subs) {
-                    if (p->pendingNotificatons.count(sh)) {
-                        pending.push_back( subref );
+                for (const auto & [k, entry] : p->subs) {
+                    if (p->pendingNotificatons.count(k.toHashX())) {
+                        pending.push_back(k);
                     }
                 }
             }
@@ -164,45 +307,64 @@ void SubsMgr::doNotifyAllPending()
         // signal via a direct connection to a slot in this thread that then tries to take the same lock.
         emit queueEmpty();
     }
-    // at this point we got all the subrefs for the scripthashes that changed.. and the lock is released .. now run through them all and notify each
-    for (const auto & sub : pending) {
-        HashX sh; // we take a copy of this from sub in the block below with the lock held for paranoia purposes (technically we could take it now, though)
+    // at this point we got all the keys for the scripthashes that changed.. and the lock is released .. now run through them all and notify each
+    for (const auto & k : pending) {
         ++ctrSH;
         {
-            LockGuard g(sub->mut);
-            if (sub->subscribedClientIds.empty()) {
+            LockGuard g(p->mut);
+            auto it = p->subs.find(k);
+            if (it == p->subs.end())
+                continue; // was removed in the meantime
+            auto & entry = it->second;
+            p->pruneDeadClients(entry);
+            if (entry.clients.empty()) {
                 // We need to clear the "last status notified" because we have no clients now and we are skipping a
                 // notification. The "last status notified"'s primary purpose is to prevent sending existing clients
                 // dupe notifications (if status didn't change). Since we are skipping a notification, we must clear
                 // it to invalidate it.
-                sub->lastStatusNotified.reset();
-                sub->cachedStatus.reset(); // forget the cached status as it is now very definitely wrong.
+                entry.lastStatusNotified.reset();
+                entry.cachedStatus.reset(); // forget the cached status as it is now very definitely wrong.
                 continue;
-            } // else..
-            sh = sub->key;
+            }
         }
         // ^^^ We must release the above lock here temporarily because we do not want to hold it while also implicitly
         // grabbing the Storage 'blocksLock' below for getFullStatus* (storage->getHistory acquires that lock in
         // read-only mode).
+        const HashX sh = k.toHashX();
         try {
-            const auto status = getFullStatus(sh);
-            // Now, re-acquire sub lock. Temporarily having released it above should be fine for our purposes, since the
-            // above empty() check was only a performance optimization and the predicate not holding for the duration of
-            // this code block is fine. In the unlikely event that a sub lost its clients while the lock was released, the
-            // below emit sub->statusChanged(...) will just be a no-op.
-            LockGuard g(sub->mut);
-            const bool doemit = !sub->lastStatusNotified.has_value() || sub->lastStatusNotified != status;
+            // shared by all the clients we notify below, rather than copied for each of them
+            const auto status = std::make_shared<const SubStatus>(getFullStatus(sh));
+            // Now, re-acquire the lock. Temporarily having released it above should be fine for our purposes, since
+            // the above empty() check was only a performance optimization and the predicate not holding for the
+            // duration of this code block is fine. In the unlikely event that a sub lost its clients while the lock
+            // was released, the below loop will just notify nobody.
+            LockGuard g(p->mut);
+            auto it = p->subs.find(k);
+            if (it == p->subs.end())
+                continue;
+            auto & entry = it->second;
+            const bool doemit = !entry.lastStatusNotified.has_value() || entry.lastStatusNotified != *status;
             // we basically cache 2 statuses -- one for what we return immediately to new subs and one to
             // keep track of not notifying twice on the same sub.
-            sub->lastStatusNotified = status;
+            entry.lastStatusNotified = *status;
             if (useCache)
-                sub->cachedStatus = status;
+                entry.cachedStatus = *status;
             if (doemit) {
-                const auto nClients = sub->subscribedClientIds.size();
+                size_t nClients = 0;
+                for (const auto & ref : entry.clients) {
+                    auto *rec = p->findClient(ref.clientId);
+                    if (!rec) continue; // client is gone
+                    // Note: it's safe to post to rec->conn here since it cannot be deleted while we hold the lock
+                    // (its destroyed handler takes the lock). If it gets deleted before the callback runs, Qt
+                    // discards the callback.
+                    QMetaObject::invokeMethod(rec->conn, [cb = rec->cbs[ref.cbIdx].cb, sh, status]{
+                        (*cb)(sh, *status);
+                    }, Qt::QueuedConnection);
+                    ++nClients;
+                }
                 ctr += nClients;
                 DebugM("Notifying ", nClients, Util::Pluralize(" client", nClients), " of status for ", Util::ToHexFast(sh));
-                sub->updateTS();
-                emit sub->statusChanged(sh, status);
+                entry.updateTS();
             }
         } catch (const std::exception & e) {
             // Defensive programming here in case getFullStatus() or other functions throw (extremely unlikely)
@@ -219,6 +381,7 @@ void SubsMgr::enqueueNotifications(std::unordered_set<HashX, HashHasher> &&s)
 {
     if (s.empty()) return;
     LockGuard g(p->mut);
+    p->dropPersisted_nolock(s); // these keys' statuses are changing, so any status loaded from disk is now stale
     const bool wasEmpty = p->pendingNotificatons.empty();
     p->pendingNotificatons.merge(std::move(s));
     if (wasEmpty)
@@ -234,47 +397,34 @@ void SubsMgr::unsubscribeClientsForKeys(const std::unordered_set<HashX, HashHash
     }
     if (keys.empty()) return;
     const Tic t0;
-    std::vector<SubRef> matchedSubs;
-    matchedSubs.reserve(std::min(keys.size(), kRecommendedPendingNotificationsReserveSize));
-    size_t subsSize;
-    {
-        LockGuard g(p->mut);
-        subsSize = p->subs.size();
-        if (keys.size() < subsSize) {
-            // iterate over keys
-            for (const auto &key : keys)
-                if (auto it = p->subs.find(key); it != p->subs.end())
-                    matchedSubs.push_back(it->second);
-        } else {
-            // iterate over subs
-            for (const auto &[key, sub] : p->subs)
-                if (keys.count(key))
-                    matchedSubs.push_back(sub);
-        }
-    }
-    // now, emit the signal with locks not held
-    for (const auto &sub : matchedSubs) {
-        {
-            LockGuard g(sub->mut);
-            // clear cached status since this sub is going away very sooon because the associated txid is gone;
-            // as such, if a new sub comes in right after this runs, we want to return a fresh status not a cached one.
-            sub->cachedStatus.reset();
+    size_t nMatched = 0, subsSize;
+    LockGuard g(p->mut);
+    subsSize = p->subs.size();
+    SubKey k;
+    for (const auto &key : keys) {
+        if (!k.set(key)) continue;
+        auto it = p->subs.find(k);
+        if (it == p->subs.end()) continue;
+        ++nMatched;
+        auto & entry = it->second;
+        // clear cached status since this sub is going away very sooon because the associated txid is gone;
+        // as such, if a new sub comes in right after this runs, we want to return a fresh status not a cached one.
+        entry.cachedStatus.reset();
+        for (const auto & ref : entry.clients) {
+            auto *rec = p->findClient(ref.clientId);
+            if (!rec) continue;
+            // runs in the client's thread (safe to post with the lock held, see doNotifyAllPending)
+            QMetaObject::invokeMethod(rec->conn, [this, c = rec->conn, key, cb = rec->cbs[ref.cbIdx].cb] {
+                // tell client the sub is gone -- send them an empty status immediately
+                (*cb)(key, {});
+                DebugM("unsubscribe requested, proceeding to unsubscribe client ", c->id, " for key ", key.toHex(), " ...");
+                // just call unsubscribe. this will zombify this sub and it will be deleted
+                unsubscribe(c, key, false /* don't update ts */);
+            }, Qt::QueuedConnection);
         }
-        emit sub->unsubscribeRequested(); // will run in client thread(s) for subscribed client(s)
-    }
-    if (!matchedSubs.empty())
-        DebugM(__func__, ": enqueued unsubscribe for ", matchedSubs.size(), "/", subsSize, " txids in ", t0.msecStr(), " msec");
-}
-
-
-auto SubsMgr::makeSubRef(const HashX &key) -> SubRef
-{
-    static const auto Deleter = [](Subscription *s){ s->deleteLater(); };
-    SubRef ret(new Subscription(key), Deleter);
-    if (QThread::currentThread() != this->thread()) {
-        ret->moveToThread(this->thread());
     }
-    return ret;
+    if (nMatched)
+        DebugM(__func__, ": enqueued unsubscribe for ", nMatched, "/", subsSize, " txids in ", t0.msecStr(), " msec");
 }
 
 bool SubsMgr::isSubsLimitExceeded(int64_t & limit) const {
@@ -282,80 +432,83 @@ bool SubsMgr::isSubsLimitExceeded(int64_t & limit) const {
     return numGlobalSubscriptions() >= limit;
 }
 
-// may throw LimitReached
-auto SubsMgr::getOrMakeSubRef(const HashX &key) -> std::pair<SubRef, bool>
+auto SubsMgr::subscribe(RPC::ConnectionBase *c, const HashX &key, const StatusCallbackPtr &notifyCB) -> SubscribeResult
 {
+    const auto t0 = debugPrint ? Util::getTimeNS() : 0LL;
+    const bool useCache = useStatusCache();
+    if (UNLIKELY(!notifyCB || !*notifyCB))
+        throw BadArgs("SubsMgr::subscribe must be called with a valid notifyCB. FIXME!");
+    SubKey k;
+    if (UNLIKELY(!k.set(key)))
+        throw BadArgs(QString("SubsMgr::subscribe: key must be %1 bytes").arg(HashLen));
+
     if (int64_t limit; UNLIKELY(isSubsLimitExceeded(limit)))
         // Note we check the limit against all subs (including zombies) to prevent a DoS attack that circumvents
         // the limit by repeatedly creating subs, disconnecting, reconnecting, creating a different set of subs, etc.
         throw LimitReached(QString("Subs limit of %1 has been reached").arg(limit));
 
-    std::pair<SubRef, bool> ret;
-    LockGuard g(p->mut);
-
-    if (auto it = p->subs.find(key); it != p->subs.end()) {
-        ret.first = it->second;
-        ret.second = false; // was not new
-    } else {
-        ret.first = makeSubRef(key);
-        p->subs[key] = ret.first;
-        ret.second = true; // was new
+    // Persisted statuses (if any) are confirmed-only, so they cannot be used for keys that have mempool activity. We
+    // must check this before taking our lock, since the Storage locks come first in the lock order.
+    bool persistedOk = false;
+    if (useCache && p->hasPersisted) {
+        auto [mempool, lock] = storage->mempool(); // shared, read-only lock
+        persistedOk = !mempool.hashXTxs.count(key);
     }
-    return ret;
-}
-
-auto SubsMgr::findExistingSubRef(const HashX &key) const -> SubRef
-{
-    SubRef ret;
-    LockGuard g(p->mut);
-    if (auto it = p->subs.find(key); it != p->subs.end())
-        ret = it->second;
-    return ret;
-}
-
-auto SubsMgr::subscribe(RPC::ConnectionBase *c, const HashX &key, const StatusCallback &notifyCB) -> SubscribeResult
-{
-    const auto t0 = debugPrint ? Util::getTimeNS() : 0LL;
-    const bool useCache = useStatusCache();
-    if (UNLIKELY(!notifyCB))
-        throw BadArgs("SubsMgr::subscribe must be called with a valid notifyCB. FIXME!");
 
     SubscribeResult ret = { false, {} };
-    auto [sub, wasnew] = getOrMakeSubRef(key); // may throw LimitReached
     {
-        LockGuard g(sub->mut);
-        if (!wasnew && sub->subscribedClientIds.count(c->id)) {
-            // already had a sub for this client, disconnect it because we will re-add the new functor below
-            bool res = QObject::disconnect(sub.get(), &Subscription::statusChanged, c, nullptr);
-            if constexpr (debugPrint) Debug() << "Existing sub disconnected signal: " << (res ? "ok" : "not ok!");
-        } else {
-            // did not have a sub for this client, add its id and also add the destroyed signal to clean up the id
-            // upon client object destruction
-            ret.first = true;
-            sub->subscribedClientIds.insert(c->id);
-            auto conn = QObject::connect(c, &QObject::destroyed, sub.get(), [sub=sub.get(), id=c->id, this](QObject *){
-                --p->nClientSubsActive;
-                --Pvt::nGlobalClientSubsActive;
-                LockGuard g(sub->mut);
-                sub->subscribedClientIds.erase(id);
-                sub->updateTS();
-                //Debug() << "client id " << id << " destroyed, implicitly unsubbed from " << sub->key.toHex()
-                //        << ", " << sub->subscribedClientIds.size() << " sub(s) remain";
+        LockGuard g(p->mut);
+        auto recIt = p->clients.find(c->id);
+        if (recIt == p->clients.end()) {
+            // First sub for this client: add its record and a (direct) connection to its destroyed signal to clean it
+            // up. It's direct so that the record is guaranteed to be gone before the client's memory is.
+            recIt = p->clients.try_emplace(c->id).first;
+            recIt->second.conn = c;
+            recIt->second.destroyedConn = QObject::connect(c, &QObject::destroyed, [this, id=c->id](QObject *){
+                LockGuard g(p->mut);
+                if (auto it = p->clients.find(id); it != p->clients.end()) {
+                    p->nClientSubsActive -= it->second.nSubs;
+                    Pvt::nGlobalClientSubsActive -= it->second.nSubs;
+                    p->clients.erase(it);
+                }
+                // Note: this client's entries in the subs table are pruned lazily
             });
-            if (UNLIKELY(!conn))
+            if (UNLIKELY(!recIt->second.destroyedConn)) {
+                p->clients.erase(recIt);
                 throw InternalError("SubsMgr::subscribe: Failed to make the 'destroyed' connection for the client object! FIXME!");
+            }
+        }
+        auto & rec = recIt->second;
+        auto [it, wasNewSub] = p->subs.try_emplace(k);
+        if (wasNewSub)
+            ++Pvt::nGlobalSubs;
+        auto & entry = it->second;
+        auto refIt = std::find_if(entry.clients.begin(), entry.clients.end(),
+                                  [id = c->id](const ClientRef &r){ return r.clientId == id; });
+        const uint32_t cbIdx = rec.acquireSlot(notifyCB);
+        if (refIt != entry.clients.end()) {
+            // already had a sub for this client, replace its callback with the new one
+            rec.releaseSlot(refIt->cbIdx);
+            refIt->cbIdx = cbIdx;
+        } else {
+            ret.first = true;
+            entry.clients.push_back(ClientRef{c->id, cbIdx});
+            ++rec.nSubs;
             ++p->nClientSubsActive;
             ++Pvt::nGlobalClientSubsActive;
         }
         if (useCache) {
             // Copy the last known StatusHash to caller. This is guaranteed to either be a recent status since the
             // last notification sent (if known), or !has_value if not known.
-            ret.second = sub->cachedStatus;
+            ret.second = entry.cachedStatus;
+            if (!ret.second.has_value() && persistedOk && !entry.lastStatusNotified.has_value()) {
+                if (auto pit = p->persisted.find(k); pit != p->persisted.end()) {
+                    entry.cachedStatus = ret.second = pit->second.toStatus();
+                    ++p->persistedHits;
+                }
+            }
         }
-        sub->updateTS(); // our basic 'mtime'
-        auto conn = QObject::connect(sub.get(), &Subscription::statusChanged, c, notifyCB, Qt::QueuedConnection); // QueuedConnection paranoia in case client 'c' "lives" in our thread
-        if (UNLIKELY(!conn))
-            throw InternalError("SubsMgr::subscribe: Failed to make the 'statusChanged' connection to the notifyCB functor! FIXME!");
+        entry.updateTS(); // our basic 'mtime'
     }
 
     if (useCache) {
@@ -372,33 +525,6 @@ auto SubsMgr::subscribe(RPC::ConnectionBase *c, const HashX &key, const StatusCa
     return ret;
 }
 
-auto DSProofSubsMgr::subscribe(RPC::ConnectionBase *c, const HashX &key, const StatusCallback &notifyCB) -> SubscribeResult
-{
-    auto ret = SubsMgr::subscribe(c, key, notifyCB);
-    if (ret.first) { // this sub <-> client association is new, attach signal for unsubscribeAllClients() to work
-        if (SubRef sub = findExistingSubRef(key)) {
-            auto conn = QObject::connect(sub.get(), &Subscription::unsubscribeRequested, c, [this, c, key, notifyCB] {
-                if (notifyCB) {
-                    // tell client the sub is gone -- send them an empty status immediately
-                    notifyCB(key, {});
-                }
-                DebugM("unsubscribeRequested signal invoked lambda, proceeding to unsubscribe client ", c->id,
-                       " for key ", key.toHex(), " ...");
-                // just call unsubscribe. this will zombify this sub and it will be deleted
-                unsubscribe(c, key, false /* don't update ts */);
-            });
-            if (UNLIKELY(!conn)) {
-                // this should never happen
-                Error() << "INTERNAL ERROR: failed to make the connecttion to the 'unsubscribeRequested' signal for client " << c->id << ". FIXME!";
-            }
-        } else {
-            // should never happen
-            Error() << "INTERNAL ERROR: sub immediately lost its subref for " << key.toHex() << ". FIXME!";
-        }
-    }
-    return ret;
-}
-
 void SubsMgr::maybeCacheStatusResult(const HashX &sh, const SubStatus &status)
 {
     if (!status.has_value() || !useStatusCache())
@@ -410,11 +536,13 @@ void SubsMgr::maybeCacheStatusResult(const HashX &sh, const SubStatus &status)
         // we only allow empty (default constructred) DSProofs or ones that are isComplete(), otherwise reject
         return;
     // else .. we always cache status.blockHeight() ..
-    SubRef sub = findExistingSubRef(sh);
-    if (sub) {
-        LockGuard g(sub->mut);
-        if (!sub->lastStatusNotified.has_value() && !sub->cachedStatus.has_value())
-            sub->cachedStatus = status;
+    SubKey k;
+    if (!k.set(sh)) return;
+    LockGuard g(p->mut);
+    if (auto it = p->subs.find(k); it != p->subs.end()) {
+        auto & entry = it->second;
+        if (!entry.lastStatusNotified.has_value() && !entry.cachedStatus.has_value())
+            entry.cachedStatus = status;
     }
 }
 
@@ -422,19 +550,24 @@ bool SubsMgr::unsubscribe(RPC::ConnectionBase *c, const HashX &key, bool updateT
 {
     bool ret = false;
     const auto t0 = debugPrint ? Util::getTimeNS() : 0LL;
-    SubRef sub = findExistingSubRef(key);
-    if (sub) {
-        // found
-        LockGuard g(sub->mut);
-        if (auto it = sub->subscribedClientIds.find(c->id); it != sub->subscribedClientIds.end()) {
-            sub->subscribedClientIds.erase(it);
-            if (updateTS) sub->updateTS();
-            QObject::disconnect(sub.get(), &Subscription::statusChanged, c, nullptr);
-            QObject::disconnect(c, &QObject::destroyed, sub.get(), nullptr);
-            QObject::disconnect(sub.get(), &Subscription::unsubscribeRequested, c, nullptr);
-            ret = true;
-            --p->nClientSubsActive;
-            --Pvt::nGlobalClientSubsActive;
+    SubKey k;
+    if (k.set(key)) {
+        LockGuard g(p->mut);
+        auto it = p->subs.find(k);
+        auto *rec = it != p->subs.end() ? p->findClient(c->id) : nullptr;
+        if (rec) {
+            auto & entry = it->second;
+            auto refIt = std::find_if(entry.clients.begin(), entry.clients.end(),
+                                      [id = c->id](const ClientRef &r){ return r.clientId == id; });
+            if (refIt != entry.clients.end()) {
+                rec->releaseSlot(refIt->cbIdx);
+                entry.clients.erase(refIt);
+                if (updateTS) entry.updateTS();
+                --rec->nSubs;
+                ret = true;
+                --p->nClientSubsActive;
+                --Pvt::nGlobalClientSubsActive;
+            }
         }
     }
     if constexpr (debugPrint) {
@@ -450,9 +583,13 @@ int64_t SubsMgr::numScripthashesSubscribed() const {
     return int64_t(p->subs.size());
 }
 
+/*static*/
+int64_t SubsMgr::numGlobalSubscriptions() { return Pvt::nGlobalSubs.load(); }
 /*static*/
 int64_t SubsMgr::numGlobalActiveClientSubscriptions() { return Pvt::nGlobalClientSubsActive.load(); }
 
+std::pair<uint64_t, uint64_t> SubsMgr::cacheHitsAndMisses() const { return { p->cacheHits.load(), p->cacheMisses.load() }; }
+
 std::pair<bool, bool> SubsMgr::globalSubsLimitFlags() const
 {
     constexpr double factor = .8;
@@ -460,6 +597,135 @@ std::pair<bool, bool> SubsMgr::globalSubsLimitFlags() const
     return { numGlobalActiveClientSubscriptions() > thresh, numGlobalSubscriptions() > thresh };
 }
 
+namespace {
+    constexpr quint32 kPersistedMagic = 0x46534331; ///< "FSC1"
+    constexpr quint32 kPersistedVersion = 1;
+    constexpr qint64 kPersistedRecordSize = HashLen + 1 + HashLen; ///< key, noHistory flag, status hash
+}
+
+bool SubsMgr::hasPersistedStatuses() const { return p->hasPersisted; }
+
+void SubsMgr::dropPersistedStatuses(const std::unordered_set<HashX, HashHasher> &keys)
+{
+    if (keys.empty() || !p->hasPersisted) return;
+    LockGuard g(p->mut);
+    p->dropPersisted_nolock(keys);
+}
+
+void SubsMgr::loadPersistedStatuses(const QString &fileName)
+{
+    QFile f(fileName);
+    if (!f.exists()) return;
+    const Tic t0;
+    try {
+        if (!f.open(QIODevice::ReadOnly))
+            throw Exception(QString("Cannot open file: %1").arg(f.errorString()));
+        const auto [tipHeight, tipHash] = storage->latestTip();
+        QDataStream ds(&f);
+        quint32 magic{}, version{};
+        qint32 height{};
+        quint64 count{};
+        QByteArray hash(HashLen, Qt::Uninitialized);
+        ds >> magic >> version >> height;
+        ds.readRawData(hash.data(), HashLen);
+        ds >> count;
+        if (ds.status() != QDataStream::Ok || magic != kPersistedMagic || version != kPersistedVersion)
+            throw Exception("Bad file header");
+        if (height != tipHeight || hash != tipHash) {
+            Log() << objectName() << ": Ignoring persisted status cache for height " << height << " (current height: "
+                  << tipHeight << ")";
+        } else {
+            if (count > quint64(f.size() - f.pos()) / quint64(kPersistedRecordSize))
+                throw Exception("File is truncated");
+            decltype(p->persisted) loaded;
+            loaded.reserve(count);
+            SubKey k;
+            Pvt::PersistedStatus ps;
+            for (quint64 i = 0; i < count; ++i) {
+                quint8 noHistory{};
+                ds.readRawData(k.bytes.data(), HashLen);
+                ds >> noHistory;
+                ds.readRawData(ps.hash.bytes.data(), HashLen);
+                ps.noHistory = noHistory;
+                loaded.insert_or_assign(k, ps);
+            }
+            if (ds.status() != QDataStream::Ok)
+                throw Exception("Read error");
+            LockGuard g(p->mut);
+            p->persisted = std::move(loaded);
+            p->hasPersisted = !p->persisted.empty();
+            p->persistedLoaded = p->persisted.size();
+            Log() << objectName() << ": Loaded " << p->persisted.size() << " persisted "
+                  << Util::Pluralize("status", p->persisted.size()) << " in " << t0.msecStr() << " msec";
+        }
+    } catch (const std::exception &e) {
+        Warning() << objectName() << ": Failed to load persisted status cache from " << fileName << ": " << e.what();
+    }
+    f.close();
+    // This file is only valid for the tip it was written at: once we start processing blocks, it is stale.
+    if (!f.remove())
+        Warning() << objectName() << ": Failed to remove " << fileName << ": " << f.errorString();
+}
+
+void SubsMgr::savePersistedStatuses(const QString &fileName) const
+{
+    // Note: requires our thread to be stopped. While doNotifyAllPending() runs, a key may be neither pending nor have
+    // its new cachedStatus yet, and the check against pendingNotificatons below would not catch that.
+    if (_thread.isRunning()) {
+        Warning() << objectName() << ": " << __func__ << " called while the notifier thread is still running, not saving";
+        return;
+    }
+    const Tic t0;
+    const auto [tipHeight, tipHash] = storage->latestTip();
+    if (tipHeight < 0 || tipHash.size() != int(HashLen)) return;
+    std::vector<std::pair<SubKey, Pvt::PersistedStatus>> recs;
+    {
+        LockGuard g(p->mut);
+        recs.reserve(p->subs.size() + p->persisted.size());
+        for (const auto & [k, entry] : p->subs) {
+            auto *ba = entry.cachedStatus.byteArray();
+            if (!ba || (!ba->isEmpty() && ba->size() != int(HashLen)) || p->persisted.count(k))
+                continue;
+            if (p->pendingNotificatons.count(k.toHashX()))
+                continue; // status is about to change, don't save it
+            Pvt::PersistedStatus ps;
+            ps.noHistory = ba->isEmpty();
+            if (!ps.noHistory) ps.hash.set(*ba);
+            recs.emplace_back(k, ps);
+        }
+        for (const auto & [k, ps] : p->persisted)
+            recs.emplace_back(k, ps);
+    }
+    if (recs.empty()) return;
+    {
+        // statuses involving mempool txs will be stale after a restart (mempool is re-synched from scratch), skip them
+        auto [mempool, lock] = storage->mempool(); // shared, read-only lock
+        if (!mempool.hashXTxs.empty())
+            recs.erase(std::remove_if(recs.begin(), recs.end(), [&hashXTxs = mempool.hashXTxs](const auto &r){
+                           return hashXTxs.count(r.first.toHashX()); }), recs.end());
+    }
+    QSaveFile f(fileName);
+    if (!f.open(QIODevice::WriteOnly)) {
+        Warning() << objectName() << ": Failed to open " << fileName << " for writing: " << f.errorString();
+        return;
+    }
+    QDataStream ds(&f);
+    ds << kPersistedMagic << kPersistedVersion << qint32(tipHeight);
+    ds.writeRawData(tipHash.constData(), HashLen);
+    ds << quint64(recs.size());
+    for (const auto & [k, ps] : recs) {
+        ds.writeRawData(k.bytes.data(), HashLen);
+        ds << quint8(ps.noHistory);
+        ds.writeRawData(ps.hash.bytes.data(), HashLen);
+    }
+    if (ds.status() != QDataStream::Ok || !f.commit()) {
+        Warning() << objectName() << ": Failed to write persisted status cache to " << fileName << ": " << f.errorString();
+        return;
+    }
+    Log() << objectName() << ": Saved " << recs.size() << " " << Util::Pluralize("status", recs.size())
+          << " for height " << tipHeight << " in " << t0.msecStr() << " msec";
+}
+
 namespace {
 // assumption: `hist` is not empty!
 inline QByteArray optimizedStatusHashCalc(const Storage::History &hist) {
@@ -513,29 +779,58 @@ auto ScriptHashSubsMgr::getFullStatus(const HashX &sh) const -> SubStatus
     return ret;
 }
 
+std::vector<SubStatus> ScriptHashSubsMgr::getFullStatuses(const std::vector<HashX> &shs) const
+{
+    const Tic t0;
+    std::vector<SubStatus> ret;
+    ret.reserve(shs.size());
+    size_t nItems = 0;
+    for (const auto & hist : storage->getHistories(shs, true, true)) {
+        nItems += hist.size();
+        // no history -> empty QByteArray
+        ret.emplace_back(hist.empty() ? QByteArray() : optimizedStatusHashCalc(hist));
+    }
+    constexpr qint64 kTookKindaLongNS = 7'500'000LL; // 7.5mec -- if it takes longer than this, log it to debug log, otherwise don't as this can get spammy.
+    if (t0.nsec() > kTookKindaLongNS) {
+        DebugM("full statuses for ", shs.size(), " scripthashes, ", nItems, " items in ", t0.msecStr(4), " msec");
+    }
+    return ret;
+}
+
 void SubsMgr::removeZombies(bool forced)
 {
     const Tic t0;
     int ctr = 0;
     const auto now = Util::getTime();
+    size_t heapBytes = 0;
     LockGuard g(p->mut);
     const auto total = p->subs.size();
     for (auto it = p->subs.begin(); it != p->subs.end(); /* */) {
-        SubRef sub = it->second; // take a copy to increment refct so it doesn't get deleted before we unlock it (erase() below)...
-        if (UNLIKELY(!sub)) { // paranoia
-            Fatal() << "A SubRef was null in " << __func__ << ". FIXME!";
-            return;
-        }
-        LockGuard g(sub->mut);
-        if (sub->subscribedClientIds.empty() && (forced || now - sub->tsMsec > kRemoveZombiesTimerIntervalMS)) {
+        auto & entry = it->second;
+        if (p->pruneDeadClients(entry) && !forced)
+            // lost its last client(s) since we last looked: start the zombie timeout now
+            entry.updateTS();
+        if (entry.clients.empty() && (forced || now - entry.tsMsec > kRemoveZombiesTimerIntervalMS)) {
             ++ctr;
             it = p->subs.erase(it);
-        } else
+        } else {
+            // tally up heap data hanging off of this entry, for stats()
+            if (entry.clients.capacity() > entry.clients.static_capacity())
+                heapBytes += entry.clients.capacity() * sizeof(ClientRef);
+            for (const auto *st : {&entry.lastStatusNotified, &entry.cachedStatus}) {
+                if (auto *ba = st->byteArray(); ba && !ba->isNull())
+                    heapBytes += size_t(ba->capacity()) + Util::qByteArrayPvtDataSize();
+                else if (auto *dsp = st->dsproof(); dsp)
+                    heapBytes += sizeof(*dsp) + size_t(dsp->serializedProof.size());
+            }
             ++it;
+        }
     }
+    Pvt::nGlobalSubs -= ctr;
+    p->lastHeapBytes = heapBytes;
     if (ctr) {
-        if (p->subs.load_factor() <= 0.5)
-            p->subs.rehash(p->kSubsReserveSize); // shrink_to_fit down toward kSubsReserveSize (reclaim memory)
+        if (p->subs.load_factor() <= 0.25f)
+            p->subs.compact(); // shrink the table (reclaim memory)
         DebugM(objectName(), ": Removed ", ctr, " zombie ", Util::Pluralize("sub", ctr), " out of ", total,
                " in ", t0.msecStr(4), " msec");
     }
@@ -546,10 +841,12 @@ std::unordered_set<HashX, HashHasher> SubsMgr::nonZombieKeysOlderThan(const int6
     std::unordered_set<HashX, HashHasher> ret;
     const auto now = Util::getTime();
     LockGuard g(p->mut);
-    for (const auto & [key, sub] : p->subs) {
-        LockGuard g(sub->mut);
-        if (!sub->subscribedClientIds.empty() && now - sub->tsMsec > msec)
-            ret.insert(key); // it is not a zombie and it's older than msec, add to return set
+    for (auto & [key, entry] : p->subs) {
+        if (now - entry.tsMsec <= msec)
+            continue;
+        p->pruneDeadClients(entry);
+        if (!entry.clients.empty())
+            ret.insert(key.toHashX()); // it is not a zombie and it's older than msec, add to return set
     }
     return ret;
 }
@@ -560,37 +857,26 @@ auto SubsMgr::debug(const StatsParams &params) const -> Stats
     QVariant ret;
     if (params.contains("subs") || params.contains("dspsubs") || params.contains("txsubs")) {
         QVariantMap subs;
-        qulonglong collisions{}, largestBucket{}, medianBucket{}, medianNonzeroBucket{};
         {
             LockGuard g(p->mut);
-            for (const auto & [sh, sub] : p->subs) {
+            const auto now = Util::getTime();
+            for (const auto & [key, entry] : p->subs) {
                 QVariantMap m2;
-                {
-                    LockGuard g2(sub->mut);
-                    m2["count"] = qlonglong(sub->subscribedClientIds.size());
-                    m2["lastStatusNotified"] = sub->lastStatusNotified.toVariant();
-                    m2["cachedStatus"] = sub->cachedStatus.toVariant();
-                    m2["idleSecs"] = (Util::getTime() - sub->tsMsec)/1e3;
-                    const auto & clients = sub->subscribedClientIds;
-#if QT_VERSION < QT_VERSION_CHECK(5, 14, 0)
-                    // Qt < 5.14 lacks the ranged constructors for containers so we must do this.
-                    m2["clientIds"] = QVariantList::fromStdList(Util::toList<std::list<QVariant>>(clients));
-#else
-                    m2["clientIds"] = Util::toList<QVariantList>(clients);
-#endif
-                }
-                subs[QString(Util::ToHexFast(sh))] = m2;
+                QVariantList clientIds;
+                for (const auto & ref : entry.clients)
+                    if (p->clients.count(ref.clientId))
+                        clientIds.push_back(qulonglong(ref.clientId));
+                m2["count"] = qlonglong(clientIds.size());
+                m2["lastStatusNotified"] = entry.lastStatusNotified.toVariant();
+                m2["cachedStatus"] = entry.cachedStatus.toVariant();
+                m2["idleSecs"] = (now - entry.tsMsec)/1e3;
+                m2["clientIds"] = clientIds;
+                subs[QString(Util::ToHexFast(key.toHashX()))] = m2;
             }
-            std::tie(collisions, largestBucket, medianBucket, medianNonzeroBucket) = Util::bucketStats(p->subs);
         }
         QVariantMap m;
         m["subs"] = std::move(subs);
-        auto stats = this->stats().toMap();
-        stats["subscriptions bucket collisions"] = collisions;
-        stats["subscriptions largest bucket"] = largestBucket;
-        stats["subscriptions median bucket"] = medianBucket;
-        stats["subscriptions median non-zero bucket"] = medianNonzeroBucket;
-        m["stats"] = std::move(stats);
+        m["stats"] = this->stats();
         ret = std::move(m);
     }
     return ret;
@@ -602,7 +888,23 @@ auto SubsMgr::stats() const -> Stats
     {
         LockGuard g(p->mut);
         ret["subscriptions load factor"] = p->subs.load_factor();
-        ret["subscriptions bucket count"] = qulonglong(p->subs.bucket_count());
+        ret["subscriptions bucket count"] = qulonglong(p->subs.empty() ? 0 : p->subs.mask() + 1);
+        // Approximate: the table itself is exact, but the heap data hanging off of entries is as of the last
+        // zombie removal pass (at most ~1 minute old).
+        const size_t nSubs = p->subs.size(), tableBytes = p->tableBytes(), heapBytes = p->lastHeapBytes;
+        size_t clientBytes = 0;
+        for (const auto & [id, rec] : p->clients)
+            clientBytes += sizeof(std::pair<const IdMixin::Id, Pvt::ClientRec>) + rec.cbs.capacity() * sizeof(Pvt::ClientRec::CBSlot)
+                           + rec.freeSlots.capacity() * sizeof(uint32_t) + rec.slotByCB.size() * sizeof(void *) * 3;
+        const size_t totalBytes = tableBytes + heapBytes + clientBytes;
+        ret["subscriptions memory (approx. bytes)"] = QVariantMap{
+            { "table", qulonglong(tableBytes) },
+            { "statuses & client lists", qulonglong(heapBytes) },
+            { "client records", qulonglong(clientBytes) },
+            { "total", qulonglong(totalBytes) },
+        };
+        ret["subscriptions bytes per subscription"] = nSubs ? double(totalBytes) / double(nSubs) : 0.0;
+        ret["subscriptions num client records"] = qulonglong(p->clients.size());
         QVariantList l;
         for (const auto & sh : p->pendingNotificatons) {
             l.push_back(Util::ToHexFast(sh));
@@ -611,6 +913,19 @@ auto SubsMgr::stats() const -> Stats
     }
     ret["subscriptions cache hits"] = qlonglong(p->cacheHits.load()); // atomic, no lock needed
     ret["subscriptions cache misses"] = qlonglong(p->cacheMisses.load()); // atomic, no lock needed
+    if (const auto nLoaded = p->persistedLoaded.load(); nLoaded) {
+        qulonglong remaining;
+        {
+            LockGuard g(p->mut);
+            remaining = p->persisted.size();
+        }
+        ret["persisted status cache"] = QVariantMap{
+            { "loaded", qulonglong(nLoaded) },
+            { "hits", qulonglong(p->persistedHits.load()) },
+            { "invalidated", qulonglong(p->persistedDropped.load()) },
+            { "remaining", remaining },
+        };
+    }
     // these below 2 take the above lock again so we do them without the lock held
     ret["Num. active client subscriptions"] = qlonglong(numActiveClientSubscriptions());
     ret["Num. unique scripthashes subscribed (including zombies)"] = qlonglong(numScripthashesSubscribed());
@@ -32,78 +32,31 @@
 #include <atomic>
 #include <functional>
 #include <memory>
-#include <mutex>
 #include <optional>
 #include <type_traits>
 #include <unordered_set>
 #include <utility> // for pair
+#include <vector>
 
 class SubsMgr;
 
-/// A class encapsulating a single subscription to a "HashX" key. Originally this was designed to work with
-/// ElectrumX-style scripthashes but has been extended whereby a client can subscribe to any "key" that is a
-/// 32-byte hash (such as scripthash, txid, etc).
-///
-/// This class acts as a signal "fusebox" where many Clients can sign up to the `statusChanged` signal given
-/// a particular HashX key.
-class Subscription : public QObject
-{
-    Q_OBJECT
-protected:
-    friend class SubsMgr;
-
-    /// The number of global Subscription instances. This is the total across all SubsMgrs that exist (zombie + active subs)
-    static std::atomic_int64_t nGlobalInstances;
-
-    explicit Subscription(const HashX & key);
-    ~Subscription() override;
-
-    const HashX key; ///< This is typically an implicitly shared copy of the same bytes as in the map key pointing to this instance (thus it's cheap to keep around here too)
-
-    std::mutex mut; ///< this mutex guards the below data structures.
-
-    std::unordered_set<quint64> subscribedClientIds; ///< this is atomically updated as clients subscribe/unsubscribe or as they are deleted/disconnected
-    /// The last status sent out as a notification. If it has_value, it's guaranteed to be the most recent one announced
-    /// to clients, so it is suitable for use in the respone to e.g. blockchain.scripthash.subscribe (iff has_value).
-    SubStatus lastStatusNotified;
-    /// The last status that was computed as the result of a blockchain.[scripthash|dsproof].subscribe RPC call
-    /// This status is returned as the immediate result for subsequent .subscribe calls after the first client
-    /// subscribes (as a performance optimization).  This value is correctly maintained by the notification mechanism
-    /// in collaboration with Servers.cpp.  In rare cases it is not the most recent possible status since it is a
-    /// slightly delayed value -- but that's ok as a future notification to a client will rectify the situation with
-    /// the most up-to-date status in the near future anyway.
-    SubStatus cachedStatus;
-    /// The last time this sub was accessed in milliseconds (Util::getTime()). If the ts goes beyond 1 minute in the
-    /// past, and it has no clients attached, its entry may be removed.
-    int64_t tsMsec = Util::getTime();
-
-    /// Call this with the lock held.
-    void updateTS() { tsMsec = Util::getTime(); }
-
-signals:
-    /// @param key is the subscription key (ScriptHash or TxHash) (raw 32 bytes).
-    /// @param status is raw 32 bytes as well if the manager is ScriptHashSubsMgr, otherwise it is whatever is
-    ///     specified for that SubsMgr  (e.g. if DSProofSubsMgr, then it's a DSProof object).
-    void statusChanged(const HashX &key, const SubStatus &status);
-
-    /// This is a private signal. Do not emit this in code outside SubsMgr.cpp internals.
-    ///
-    /// It is connected to a lambda that will execute in the thread for all the subscribed clients for this sub.
-    /// It will automatically unsubscribe them. Used by the DSProofSubsMgr when txids get confirmed and are no longer
-    /// in the mempool.
-    void unsubscribeRequested();
-};
-
 using StatusCallback = std::function<void(const HashX &, const SubStatus &)>;
+/// Callbacks are registered by shared pointer. Registering the same StatusCallbackPtr for many subscriptions (e.g. a
+/// client's callback for all of its blockchain.scripthash.subscribe subs) stores it only once per client.
+using StatusCallbackPtr = std::shared_ptr<const StatusCallback>;
 
 /// The Subscriptions Manager. Thread-safe operations for managing subscriptions and doing notifications.
 ///
-/// This class is "owned" by the Storage instance.  Internally it takes a class-level data lock for some operations,
-/// and also a per-Subscription-level locks for others.
+/// This class is "owned" by the Storage instance.  Internally it takes a single class-level data lock.
 ///
-/// Note about deadlocking: This class's locks are *SUBSERVIENT* to the "Storage" instance that owns it! Currently
+/// Subscriptions are kept in a compact table: a flat hash map from the 32-byte key to a small struct holding the cached
+/// statuses and a small vector of (client id, callback index) pairs. There is no per-subscription QObject or signal;
+/// notifications are dispatched by posting the client's callback directly to the client's thread. Each client has
+/// just 1 record per SubsMgr (holding its callback table), no matter how many subscriptions it has.
+///
+/// Note about deadlocking: This class's lock is *SUBSERVIENT* to the "Storage" instance that owns it! Currently
 /// it takes no locks at the same time as holding a Storage lock.  However, if one must take multiple locks the order
-/// should be:  1. Storage Locks (in their defined order),  2. p->mut (Pvt::mut),  3. sub->mut (Subscription::mut).
+/// should be:  1. Storage Locks (in their defined order),  2. p->mut (Pvt::mut).
 class SubsMgr : public Mgr, public ThreadObjectMixin, public TimersByNameMixin
 {
     Q_OBJECT
@@ -144,12 +97,12 @@ public:
     /// status for the scripthash in question (but one still may exist!) -- client code should follow up with a
     /// getFullStatus() call to get the updated (non-cached) status.
     ///
-    /// Doesn't normally throw but may throw BadArgs if notifyCB is invalid, or InternalError if it failed to
-    /// make a QMetaObject::Connection for the subscription (or some other invariant failed to be satisfied).
+    /// Doesn't normally throw but may throw BadArgs if notifyCB is invalid or if `key` is not HashLen bytes, or
+    /// InternalError if it failed to make the QMetaObject::Connection that cleans up after the client is deleted.
     ///
     /// Will throw LimitReached if the subs table is full.  Calling code should catch this exception.
     /// (May also throw BadArgs).
-    virtual SubscribeResult subscribe(RPC::ConnectionBase *client, const HashX &key, const StatusCallback &notifyCB);
+    SubscribeResult subscribe(RPC::ConnectionBase *client, const HashX &key, const StatusCallbackPtr &notifyCB);
     /// Thread-safe. The inverse of subscribe. Returns true if the client was previously subscribed, false otherwise.
     /// Always call this from the client's thread otherwise undefined behavior may result.
     bool unsubscribe(RPC::ConnectionBase *client, const HashX &key, bool updateTS = true);
@@ -164,10 +117,14 @@ public:
     /// as well since it includes the aforementioned "zombies".
     int64_t numScripthashesSubscribed() const;
 
-    /// Returns the number of Subscription objects extant across all instances of SubsMgr (and its subclasses), app-wide.
-    static int64_t numGlobalSubscriptions() { return Subscription::nGlobalInstances.load(); }
+    /// Returns the number of subscriptions (zombie + active) extant across all instances of SubsMgr (and its
+    /// subclasses), app-wide.
+    static int64_t numGlobalSubscriptions();
     static int64_t numGlobalActiveClientSubscriptions();
 
+    /// Thread-safe, lock-free. Returns the lifetime number of status cache hits and misses for this instance.
+    std::pair<uint64_t, uint64_t> cacheHitsAndMisses() const;
+
     /// Returns a pair of (limitActive, limitAll)
     /// `limitActive` - is true if the number of active client subscriptions is near the global subs limit (>80% of global limit).
     /// `limitAll` - is true if the subs table (including zombies) is near the global subs limit (>80% of global limit).
@@ -191,6 +148,24 @@ public:
     /// moved-from and thus in a "valid but unspecified state".
     void enqueueNotifications(std::unordered_set<HashX, HashHasher> && s);
 
+    /// Thread-safe. Loads the on-disk status cache written by a previous savePersistedStatuses() call, if any. The
+    /// file is tagged with the chain tip it was written at, and it is ignored if that doesn't match Storage's current
+    /// tip. Loaded statuses are returned by subscribe() as cached statuses (provided the key has no mempool activity)
+    /// until they are invalidated by enqueueNotifications() or dropPersistedStatuses(). The file is deleted after it
+    /// is read, so that a stale file is never loaded twice. Does not throw.
+    void loadPersistedStatuses(const QString &fileName);
+    /// Writes all the confirmed-only statuses we know about to `fileName`, tagged with Storage's current tip. Call this
+    /// on shutdown, and only after this instance's thread has been stopped (see cleanup()): doNotifyAllPending()
+    /// updates a key's cached status some time after taking it off the pending set, and a save in between would tag
+    /// the old status with the new tip (if the thread is still running, nothing is saved). Does not throw.
+    void savePersistedStatuses(const QString &fileName) const;
+    /// Thread-safe, lock-free. Returns true if there are loaded persisted statuses that have not been invalidated.
+    bool hasPersistedStatuses() const;
+    /// Thread-safe. Invalidates the persisted statuses (if any) for `keys`. Storage calls this for blocks processed
+    /// while notifications are disabled (e.g. during the initial sync). When notifications are enabled,
+    /// enqueueNotifications() takes care of this.
+    void dropPersistedStatuses(const std::unordered_set<HashX, HashHasher> &keys);
+
 signals:
     /// Public signal.  Emitted by SrvMgr to tell us to run removeZombies() right now outside the normal timer rate limit.
     /// See SrvMgr::globalSubsLimitReached().
@@ -202,9 +177,9 @@ signals:
     void queueNoLongerEmpty();
 
 protected:
-    /// Thread-safe. Takes exclusive locks. Unsubscribes all clients currently subscribed for keys in subKeys. This
-    /// effectively iterates over all the subs matching subKeys and emits the unsubscribeRequested() private signal.
-    /// The actual unsubscribe is effectuated in the thread for each subscribed client.
+    /// Thread-safe. Takes exclusive locks. Unsubscribes all clients currently subscribed for keys in subKeys. For
+    /// each subscribed client, its callback is invoked with an empty status and then it is unsubscribed. The actual
+    /// unsubscribe is effectuated in the thread for each subscribed client.
     ///
     /// Only for use with the DSProofSubsMgr.
     void unsubscribeClientsForKeys(const std::unordered_set<HashX, HashHasher> & subKeys);
@@ -229,9 +204,6 @@ protected:
     const std::shared_ptr<const Options> options;
     Storage * const storage; ///< pointer guaranteed to be valid since Storage "owns" us and if we are alive, it is alive.
 
-    using SubRef = std::shared_ptr<Subscription>;
-    SubRef findExistingSubRef(const HashX &) const; // takes locks, returns an existing subref or empty ref.
-
     /// Used by the DSProofSubsMgr expireSubsNotInMempool() function to get a set of txids that maybe should be expired
     /// because they are subscribed but have no mempool tx.
     std::unordered_set<HashX, HashHasher> nonZombieKeysOlderThan(int64_t msec) const;
@@ -240,9 +212,6 @@ private:
     struct Pvt;
     std::unique_ptr<Pvt> p;
 
-    SubRef makeSubRef(const HashX &key);
-    std::pair<SubRef, bool> getOrMakeSubRef(const HashX &key); // takes locks, returns a new subref or an existing subref, may throw LimitReached
-
     void doNotifyAllPending();
     void removeZombies(bool forced);
 };
@@ -263,6 +232,11 @@ public:
     /// Note that this implicitly will take the Storage "blocksLock" as a shared lock -- so bear that in mind if calling
     /// this from `Storage` with that lock already held.
     SubStatus getFullStatus(const HashX &scriptHash) const override;
+
+    /// Thread-safe. Like getFullStatus(), but for many scripthashes at once. The histories are read in one pass via
+    /// Storage::getHistories(), under a single acquisition of the Storage locks. The returned vector is parallel to
+    /// `scriptHashes`.
+    std::vector<SubStatus> getFullStatuses(const std::vector<HashX> &scriptHashes) const;
 };
 
 class DSProofSubsMgr final : public SubsMgr {
@@ -282,18 +256,14 @@ public:
     /// Note that this implicitly will take the Storage "mempool lock" as a shared lock -- so bear that in mind if
     /// calling this from `Storage` with that lock already held.
     SubStatus getFullStatus(const HashX &txHash) const override;
-    /// Identical to superclass implementation but it also attaches the unsubscribeRequested() signal to a lambda
-    /// for client, so that SubsMgr::unsubscribeClientsForKeys() is not a no-op.
-    ///
-    /// Note that for the DSProofSubsMgr, we never return a cached value here -- SubscribeResult.second is always
-    /// !has_value() (empty).  Calling code can just query getFullStatus() (this is because getFullStatus() is very
-    /// cheap to call for this SubsMgr, and caching just wastes memory).
-    SubscribeResult subscribe(RPC::ConnectionBase *client, const HashX &sh, const StatusCallback &notifyCB) override;
 
 protected:
     void on_started() override;
     void on_finished() override;
 
+    /// Note that for the DSProofSubsMgr, subscribe() never returns a cached value -- SubscribeResult.second is always
+    /// !has_value() (empty).  Calling code can just query getFullStatus() (this is because getFullStatus() is very
+    /// cheap to call for this SubsMgr, and caching just wastes memory).
     bool useStatusCache() const override { return false; }
 
 private:
@@ -19,101 +19,430 @@
 #include "ThreadPool.h"
 #include "Util.h"
 
-#include <QThreadPool>
+#include <QMetaObject>
+#include <QPointer>
+#include <QThread>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 namespace {
     constexpr bool debugPrt = false;
-}
 
+    constexpr size_t kNumJobClasses = size_t(ThreadPool::JobClass::NumClasses);
+    /// Relative dequeue weights for each ThreadPool::JobClass. When all classes have work queued, for every 7 jobs
+    /// dequeued, 4 will be Cheap, 2 will be Normal and 1 will be Heavy.
+    constexpr std::array<int, kNumJobClasses> kJobClassWeights = { 4, 2, 1 };
+    constexpr std::array<const char *, kNumJobClasses> kJobClassNames = { "cheap", "normal", "heavy" };
 
-ThreadPool::ThreadPool(QObject *parent)
-    : QObject(parent), pool(std::make_unique<QThreadPool>(this))
-{
+    /// Hard upper limit on the number of worker threads per pool (setMaxThreadCount() clamps to this).
+    constexpr unsigned kMaxWorkers = 256;
+    /// Maximum number of recycled Job objects kept around per pool.
+    constexpr size_t kMaxFreeJobs = 4096;
 }
 
-ThreadPool::~ThreadPool()
+struct ThreadPool::Job
 {
-    shutdownWaitForJobs();
-}
+    VoidFunc work, completion;
+    FailFunc fail;
+    QPointer<QObject> context;
+    bool isFairRunner = false; ///< if true, this is a placeholder that runs whichever job the FairQueue picks
+};
+
+struct ThreadPool::Workers
+{
+    struct Worker {
+        const unsigned index;
+        std::mutex mut;
+        std::deque<Job *> jobs; ///< guarded by mut
+        std::thread thr;
+        explicit Worker(unsigned i) : index(i) {}
+    };
+
+    ThreadPool * const pool;
+    std::array<std::unique_ptr<Worker>, kMaxWorkers> workers; ///< slots [0, nWorkers) are valid
+    std::atomic_uint nWorkers{0}, maxThreads{std::clamp(unsigned(QThread::idealThreadCount()), 1u, kMaxWorkers)};
+    std::mutex spawnMut; ///< serializes creating/joining worker threads
+
+    std::atomic_int64_t nPending{0}; ///< number of jobs sitting in all the deques
+    std::atomic_int nIdle{0}; ///< number of workers sleeping on `cond`
+    std::atomic_bool stopping{false};
+    std::atomic_uint rr{0}; ///< round-robin cursor used to distribute jobs submitted from outside the pool
+    std::atomic_uint64_t nSteals{0};
+    std::mutex sleepMut;
+    std::condition_variable cond;
+
+    // Notified when ThreadPool::extant drops to 0
+    std::mutex doneMut;
+    std::condition_variable doneCond;
+
+    // Free list of recycled Job objects
+    std::mutex freeMut;
+    std::vector<Job *> freeJobs; ///< guarded by freeMut
+
+    /// The pool and worker (if any) that the current thread belongs to.
+    static thread_local const Workers *tlsOwner;
+    static thread_local Worker *tlsWorker;
 
+    explicit Workers(ThreadPool *p) : pool(p) { freeJobs.reserve(kMaxFreeJobs); }
+    ~Workers() {
+        stopAndJoin();
+        for (Job *j : freeJobs) delete j;
+        for (unsigned i = 0; i < nWorkers; ++i)
+            for (Job *j : workers[i]->jobs) delete j; // should normally be empty at this point
+    }
+
+    Job *allocJob() {
+        {
+            std::unique_lock g(freeMut);
+            if (!freeJobs.empty()) {
+                Job *j = freeJobs.back();
+                freeJobs.pop_back();
+                return j;
+            }
+        }
+        return new Job;
+    }
+
+    void releaseJob(Job *j) noexcept {
+        // release captured state now, outside of the lock
+        j->work = nullptr;
+        j->completion = nullptr;
+        j->fail = nullptr;
+        j->context.clear();
+        j->isFairRunner = false;
+        {
+            std::unique_lock g(freeMut);
+            if (freeJobs.size() < kMaxFreeJobs) {
+                freeJobs.push_back(j);
+                return;
+            }
+        }
+        delete j;
+    }
+
+    /// Enqueues a job, spawning a new worker thread if all current workers are busy and we are below maxThreads.
+    /// Returns false if the pool is stopped, in which case the job was not enqueued.
+    bool push(Job *job, bool front) {
+        maybeSpawnWorker();
+        const unsigned n = std::min(nWorkers.load(), maxThreads.load());
+        if (UNLIKELY(!n || stopping)) return false;
+        Worker *w = tlsOwner == this && tlsWorker->index < n ? tlsWorker // submitted from one of our own threads
+                                                             : workers[rr++ % n].get();
+        {
+            std::unique_lock g(w->mut);
+            if (front) w->jobs.push_front(job);
+            else w->jobs.push_back(job);
+        }
+        ++nPending;
+        if (nIdle > 0) {
+            { std::unique_lock g(sleepMut); } // ensures a worker that is about to sleep sees nPending > 0
+            // if the pool was shrunk, some sleepers may be ineligible to take work, so wake them all in that case
+            if (nWorkers > maxThreads) cond.notify_all();
+            else cond.notify_one();
+        }
+        return true;
+    }
+
+    Job *popFrom(Worker &w) {
+        std::unique_lock g(w.mut);
+        if (w.jobs.empty()) return nullptr;
+        Job *j = w.jobs.front();
+        w.jobs.pop_front();
+        --nPending;
+        return j;
+    }
+
+    /// Takes a job from own deque first, then tries to steal one from the other workers. Workers beyond maxThreads
+    /// (the pool was shrunk) take nothing; whatever is left in their deques gets stolen by the others.
+    Job *take(Worker &self) {
+        const unsigned n = nWorkers;
+        if (self.index >= maxThreads) return nullptr;
+        if (Job *j = popFrom(self)) return j;
+        for (unsigned i = 1; i <= n; ++i) {
+            Worker &victim = *workers[(self.index + i) % n];
+            if (&victim == &self) continue;
+            if (Job *j = popFrom(victim)) {
+                ++nSteals;
+                return j;
+            }
+        }
+        return nullptr;
+    }
 
-Job::Job(QObject *context, ThreadPool *pool, const VoidFunc & work, const VoidFunc & completion, const FailFunc &fail) noexcept
-    : QObject(nullptr), pool(pool), work(work), weakContextRef(context ? context : pool)
+    void workerLoop(Worker &self) {
+        tlsOwner = this;
+        tlsWorker = &self;
+        for (;;) {
+            if (Job *j = take(self)) {
+                pool->runJob(j);
+                continue;
+            }
+            std::unique_lock g(sleepMut);
+            ++nIdle;
+            cond.wait(g, [&]{ return stopping || (nPending > 0 && self.index < maxThreads); });
+            --nIdle;
+            if (stopping) break;
+        }
+        tlsOwner = nullptr;
+        tlsWorker = nullptr;
+    }
+
+    void maybeSpawnWorker() {
+        if (nIdle > 0 || nWorkers >= maxThreads || stopping) return;
+        std::unique_lock g(spawnMut);
+        const unsigned n = nWorkers;
+        if (n >= maxThreads || stopping) return;
+        workers[n] = std::make_unique<Worker>(n);
+        Worker &w = *workers[n];
+        w.thr = std::thread([this, &w]{ workerLoop(w); });
+        nWorkers = n + 1; // publish only after the slot is fully constructed
+    }
+
+    /// Removes all queued (not yet running) jobs from all deques and returns them.
+    std::vector<Job *> takeAllQueued() {
+        std::vector<Job *> ret;
+        std::unique_lock g(spawnMut);
+        for (unsigned i = 0; i < nWorkers; ++i) {
+            auto & w = *workers[i];
+            std::unique_lock g2(w.mut);
+            ret.insert(ret.end(), w.jobs.begin(), w.jobs.end());
+            nPending -= int64_t(w.jobs.size());
+            w.jobs.clear();
+        }
+        return ret;
+    }
+
+    void stopAndJoin() {
+        {
+            std::unique_lock g(sleepMut);
+            stopping = true;
+        }
+        cond.notify_all();
+        std::unique_lock g(spawnMut);
+        for (unsigned i = 0; i < nWorkers; ++i)
+            if (auto & w = *workers[i]; w.thr.joinable())
+                w.thr.join();
+    }
+};
+
+/* static */ thread_local const ThreadPool::Workers *ThreadPool::Workers::tlsOwner = nullptr;
+/* static */ thread_local ThreadPool::Workers::Worker *ThreadPool::Workers::tlsWorker = nullptr;
+
+struct ThreadPool::FairQueue
 {
-    if (!context && (completion || fail))
-        Debug(Log::Magenta) << "Warning: use of ThreadPool jobs without a context is not recommended, FIXME!";
-    if (completion)
-        connect(this, &Job::completed, context ? context : pool, [completion]{ completion(); });
-    if (fail)
-        connect(this, &Job::failed, context ? context : pool, [fail](const QString &err){ fail(err); });
-}
-Job::~Job() {}
+    struct Item {
+        Job *job;
+        qint64 tsEnqueued; ///< from Util::getTimeNS()
+    };
+    struct Class {
+        std::unordered_map<const void *, std::deque<Item>> queues; ///< fairness key -> queued jobs (never empty)
+        std::deque<const void *> ring; ///< keys in `queues`, in round-robin order
+        size_t size = 0; ///< total number of queued jobs for this class
+        int current = 0; ///< "current weight" for the smooth weighted round-robin in pop()
+    };
+    std::mutex mut;
+    std::array<Class, kNumJobClasses> classes; ///< guarded by mut
 
-void Job::run() {
-    emit started();
-    if (UNLIKELY(pool->isShuttingDown())) {
-        Debug() << objectName() << ": blockNewWork = true, exiting early without doing any work";
-        return;
+    struct ClassStats {
+        std::atomic_int queued{0};
+        std::atomic_uint64_t nJobs{0}, waitTotalNS{0}, waitMaxNS{0};
+    };
+    std::array<ClassStats, kNumJobClasses> stats;
 
-    } else if (UNLIKELY(!weakContextRef)) {
-        // this is here so we avoid doing any work in case work is costly when we know for a fact the
-        // interested/subscribed context object is already deleted.
-        DebugM(objectName(), ": context already deleted, exiting early without doing any work");
-        return;
+    void push(const void *key, JobClass cls, Job *job) {
+        const auto idx = size_t(cls);
+        {
+            std::unique_lock g(mut);
+            auto & c = classes[idx];
+            auto & q = c.queues[key];
+            if (q.empty()) c.ring.push_back(key);
+            q.push_back({job, Util::getTimeNS()});
+            ++c.size;
+        }
+        ++stats[idx].queued;
     }
-    if (LIKELY(work)) {
-        try {
-            work();
-        } catch (const std::exception &e) {
-            emit failed(e.what());
-            return;
-        } catch (...) {
-            emit failed("Unknown exception");
-            return;
+
+    /// Returns nullptr if there are no jobs queued.
+    Job *pop() {
+        Item item{};
+        size_t idx = 0;
+        {
+            std::unique_lock g(mut);
+            // Smooth weighted round-robin across the non-empty classes (same algorithm as nginx's upstream balancer).
+            Class *best = nullptr;
+            int totalWeight = 0;
+            for (size_t i = 0; i < kNumJobClasses; ++i) {
+                auto & c = classes[i];
+                if (!c.size) continue;
+                c.current += kJobClassWeights[i];
+                totalWeight += kJobClassWeights[i];
+                if (!best || c.current > best->current) {
+                    best = &c;
+                    idx = i;
+                }
+            }
+            if (!best) return nullptr;
+            best->current -= totalWeight;
+            // Plain round-robin across the fairness keys within the class
+            const void *key = best->ring.front();
+            best->ring.pop_front();
+            auto it = best->queues.find(key);
+            auto & q = it->second;
+            item = q.front();
+            q.pop_front();
+            if (q.empty()) best->queues.erase(it);
+            else best->ring.push_back(key);
+            if (!--best->size) best->current = 0;
+        }
+        auto & st = stats[idx];
+        --st.queued;
+        ++st.nJobs;
+        const auto waited = uint64_t(std::max(Util::getTimeNS() - item.tsEnqueued, qint64(0)));
+        st.waitTotalNS += waited;
+        if (waited > st.waitMaxNS) st.waitMaxNS = waited; // not strictly atomic, but this is just for stats
+        return item.job;
+    }
+
+    /// Removes and returns all queued jobs. Used on shutdown.
+    std::vector<Job *> takeAll() {
+        std::vector<Job *> ret;
+        std::unique_lock g(mut);
+        for (size_t i = 0; i < kNumJobClasses; ++i) {
+            auto & c = classes[i];
+            for (auto & [key, q] : c.queues)
+                for (const auto & item : q)
+                    ret.push_back(item.job);
+            stats[i].queued -= int(c.size);
+            c = Class{};
         }
+        return ret;
     }
-    emit completed();
+};
+
+ThreadPool::ThreadPool(QObject *parent)
+    : QObject(parent), workers(std::make_unique<Workers>(this)), fq(std::make_unique<FairQueue>())
+{
 }
 
-void ThreadPool::submitWork(QObject *context, const VoidFunc & work, const VoidFunc & completion, const FailFunc & fail, int priority)
+ThreadPool::~ThreadPool()
+{
+    shutdownWaitForJobs();
+}
+
+auto ThreadPool::newJob(QObject *context, const VoidFunc & work, const VoidFunc & completion, const FailFunc & fail) -> Job *
 {
     if (blockNewWork) {
         Debug() << __func__ << ": Ignoring new work submitted because blockNewWork = true";
-        return;
+        return nullptr;
     }
     static const FailFunc defaultFail = [](const QString &msg) {
             Warning() << "A ThreadPool job failed with the error message: " << msg;
     };
     const FailFunc & failFuncToUse (fail ? fail : defaultFail);
-    Job *job = new Job(context, this, work, completion, failFuncToUse);
-    QObject::connect(job, &QObject::destroyed, this, [this](QObject *){ --extant;}, Qt::DirectConnection);
+    if (!context && (completion || fail))
+        Debug(Log::Magenta) << "Warning: use of ThreadPool jobs without a context is not recommended, FIXME!";
     if (const auto njobs = ++extant; njobs > extantLimit) {
         ++noverflows;
-        delete job; // will decrement extant on delete
+        --extant;
         const auto msg = QString("Job limit exceeded (%1)").arg(njobs);
         failFuncToUse(msg);
-        return;
+        return nullptr;
     } else if (UNLIKELY(njobs < 0)) {
         // should absolutely never happen.
         Error() << "FIXME: njobs " << njobs << " < 0!";
     } else if (njobs > extantMaxSeen)
         // FIXME: this isn't entirely atomic but this value is for diagnostic purposes and doesn't need to be strictly correct
         extantMaxSeen = njobs;
-    job->setAutoDelete(true);
-    const auto num = ++ctr;
-    job->setObjectName(QStringLiteral("Job %1 for '%2'").arg(num).arg( context ? context->objectName() : QStringLiteral("<no context>")));
-    if constexpr (debugPrt) {
-        QObject::connect(job, &Job::started, this, [n=job->objectName()]{
-            Debug() << n << " -- started";
-        }, Qt::DirectConnection);
-        QObject::connect(job, &Job::completed, this, [n=job->objectName()]{
-            Debug() << n << " -- completed";
-        }, Qt::DirectConnection);
-        QObject::connect(job, &Job::failed, this, [n=job->objectName()](const QString &msg){
-            Debug() << n << " -- failed: " << msg;
-        }, Qt::DirectConnection);
-    }
-    pool->start(job, priority);
+    ++ctr;
+    Job *job = workers->allocJob();
+    job->work = work;
+    job->completion = completion;
+    job->fail = failFuncToUse;
+    job->context = context ? context : this;
+    return job;
+}
+
+void ThreadPool::freeJob(Job *job) noexcept
+{
+    const bool wasRealJob = !job->isFairRunner;
+    workers->releaseJob(job);
+    if (wasRealJob && --extant <= 0) {
+        { std::unique_lock g(workers->doneMut); }
+        workers->doneCond.notify_all();
+    }
+}
+
+void ThreadPool::runJob(Job *job) noexcept
+{
+    if (job->isFairRunner) {
+        freeJob(job);
+        runNextFairJob();
+        return;
+    }
+    if (UNLIKELY(isShuttingDown())) {
+        DebugM("ThreadPool: blockNewWork = true, exiting early without doing any work");
+    } else if (UNLIKELY(!job->context)) {
+        // this is here so we avoid doing any work in case work is costly when we know for a fact the
+        // interested/subscribed context object is already deleted.
+        DebugM("ThreadPool: context already deleted, exiting early without doing any work");
+    } else {
+        QString errMsg;
+        bool ok = false;
+        try {
+            if (LIKELY(job->work)) job->work();
+            ok = true;
+        } catch (const std::exception &e) {
+            errMsg = e.what();
+        } catch (...) {
+            errMsg = "Unknown exception";
+        }
+        // Post the result to the context's thread. If the context is deleted before it gets there, Qt discards the
+        // posted call, so in that case neither completion nor fail will run.
+        if (QObject *ctx = job->context.data()) {
+            if (ok) {
+                if (job->completion)
+                    QMetaObject::invokeMethod(ctx, std::move(job->completion), Qt::QueuedConnection);
+            } else if (job->fail) {
+                QMetaObject::invokeMethod(ctx, [fail = std::move(job->fail), errMsg]{ fail(errMsg); }, Qt::QueuedConnection);
+            }
+        }
+    }
+    freeJob(job);
+}
+
+void ThreadPool::submitWork(QObject *context, const VoidFunc & work, const VoidFunc & completion, const FailFunc & fail, int priority)
+{
+    if (Job *job = newJob(context, work, completion, fail); job && !workers->push(job, priority > 0))
+        freeJob(job); // pool was stopped
+}
+
+void ThreadPool::submitFairWork(const void *fairnessKey, JobClass cls, QObject *context, const VoidFunc & work,
+                                const VoidFunc & completion, const FailFunc & fail)
+{
+    if (UNLIKELY(cls >= JobClass::NumClasses)) cls = JobClass::Heavy; // paranoia
+    if (Job *job = newJob(context, work, completion, fail)) {
+        fq->push(fairnessKey, cls, job);
+        Job *runner = workers->allocJob();
+        runner->isFairRunner = true;
+        if (!workers->push(runner, false)) {
+            freeJob(runner); // pool was stopped; the queued job will be freed by shutdownWaitForJobs()
+        }
+    }
+}
+
+void ThreadPool::runNextFairJob() noexcept
+{
+    // Note: We may end up running a job other than the one whose submission enqueued this runner -- that's the point.
+    if (Job *job = fq->pop())
+        runJob(job);
 }
 
 bool ThreadPool::shutdownWaitForJobs(int timeout_ms)
@@ -122,8 +451,25 @@ bool ThreadPool::shutdownWaitForJobs(int timeout_ms)
     if constexpr (debugPrt) {
         Debug() << __func__ << ": waiting for jobs ...";
     }
-    pool->clear();
-    return pool->waitForDone(timeout_ms);
+    // drop all queued jobs -- they will never run now
+    for (Job *job : workers->takeAllQueued())
+        freeJob(job);
+    for (Job *job : fq->takeAll())
+        freeJob(job);
+    // wait for the running jobs to finish
+    bool done;
+    {
+        std::unique_lock g(workers->doneMut);
+        const auto pred = [this]{ return extant.load() <= 0; };
+        if (timeout_ms < 0) {
+            workers->doneCond.wait(g, pred);
+            done = true;
+        } else
+            done = workers->doneCond.wait_for(g, std::chrono::milliseconds(timeout_ms), pred);
+    }
+    if (done)
+        workers->stopAndJoin();
+    return done;
 }
 
 int ThreadPool::extantJobs() const noexcept { return extant.load(); }
@@ -137,12 +483,17 @@ bool ThreadPool::setExtantJobLimit(int limit)  noexcept {
 }
 uint64_t ThreadPool::numJobsSubmitted() const noexcept { return ctr.load(); }
 uint64_t ThreadPool::overflows() const noexcept { return noverflows.load(); }
-int ThreadPool::maxThreadCount() const noexcept { return pool->maxThreadCount(); }
+int ThreadPool::maxThreadCount() const noexcept { return int(workers->maxThreads.load()); }
 bool ThreadPool::setMaxThreadCount(int max) {
     if (max < 1)
         return false;
-    pool->setMaxThreadCount(max);
-    return pool->maxThreadCount() == max;
+    const unsigned val = std::min(unsigned(max), kMaxWorkers);
+    {
+        std::unique_lock g(workers->sleepMut);
+        workers->maxThreads = val;
+    }
+    workers->cond.notify_all(); // wake up any sleepers that may now be eligible (or ineligible) to take work
+    return maxThreadCount() == max;
 }
 
 QVariantMap ThreadPool::stats() const noexcept
@@ -154,5 +505,98 @@ QVariantMap ThreadPool::stats() const noexcept
     m["job count (lifetime)"] = qulonglong(numJobsSubmitted());
     m["job queue overflows (lifetime)"] = qulonglong(overflows());
     m["thread count (max)"] = maxThreadCount();
+    m["thread count (current)"] = workers->nWorkers.load();
+    m["job steals (lifetime)"] = qulonglong(workers->nSteals.load());
+    QVariantMap fair;
+    for (size_t i = 0; i < kNumJobClasses; ++i) {
+        const auto & st = fq->stats[i];
+        const auto n = st.nJobs.load();
+        fair[kJobClassNames[i]] = QVariantMap{
+            { "queued", st.queued.load() },
+            { "jobs (lifetime)", qulonglong(n) },
+            { "wait avg (msec)", n ? double(st.waitTotalNS.load()) / double(n) / 1e6 : 0.0 },
+            { "wait max (msec)", double(st.waitMaxNS.load()) / 1e6 },
+        };
+    }
+    m["fair queue"] = fair;
     return m;
 }
+
+#ifdef ENABLE_TESTS
+#include "App.h"
+
+#include <QEventLoop>
+#include <QRunnable>
+#include <QThreadPool>
+
+namespace {
+    /// Approximates the previous ThreadPool implementation: a heap-allocated QRunnable per job handed to a
+    /// QThreadPool, with the completion posted back to the context object.
+    class QtJob : public QRunnable {
+        QPointer<QObject> context;
+        ThreadPool::VoidFunc work, completion;
+    public:
+        QtJob(QObject *ctx, const ThreadPool::VoidFunc &w, const ThreadPool::VoidFunc &c)
+            : context(ctx), work(w), completion(c) { setAutoDelete(true); }
+        void run() override {
+            if (!context) return;
+            work();
+            if (QObject *ctx = context.data())
+                QMetaObject::invokeMethod(ctx, completion, Qt::QueuedConnection);
+        }
+    };
+
+    void bench() {
+        constexpr int N = 200'000;
+        const int nThreads = std::max(QThread::idealThreadCount(), 1);
+        Log() << "Running " << N << " trivial jobs through each pool using " << nThreads << " threads ...";
+
+        using SubmitFunc = std::function<void(QObject *, const ThreadPool::VoidFunc &, const ThreadPool::VoidFunc &)>;
+        const auto runOne = [&](const QString &name, const SubmitFunc &submit) {
+            QObject ctx;
+            QEventLoop loop;
+            std::vector<qint64> latencies(size_t(N), 0);
+            std::atomic_uint64_t sink{0};
+            int ndone = 0;
+            const Tic t0;
+            for (int i = 0; i < N; ++i) {
+                const qint64 ts = Util::getTimeNS();
+                submit(&ctx, [&sink, i]{ sink += uint64_t(i); }, [&, i, ts]{
+                    latencies[size_t(i)] = Util::getTimeNS() - ts;
+                    if (++ndone == N) loop.quit();
+                });
+            }
+            if (ndone < N) loop.exec();
+            const double secs = t0.secs<double>();
+            std::sort(latencies.begin(), latencies.end());
+            double sum = 0.;
+            for (const auto l : latencies) sum += double(l);
+            Log() << name << ": " << QString::number(N / secs, 'f', 0) << " jobs/sec, submit-to-completion latency"
+                  << " avg: " << QString::number(sum / N / 1e3, 'f', 1) << " usec,"
+                  << " p50: " << QString::number(latencies[N / 2] / 1e3, 'f', 1) << " usec,"
+                  << " p99: " << QString::number(latencies[size_t(N * 0.99)] / 1e3, 'f', 1) << " usec"
+                  << " (took: " << t0.msecStr(4) << " msec)";
+        };
+
+        {
+            QThreadPool qpool;
+            qpool.setMaxThreadCount(nThreads);
+            runOne("QThreadPool", [&qpool](QObject *ctx, const auto &work, const auto &completion) {
+                qpool.start(new QtJob(ctx, work, completion));
+            });
+            qpool.waitForDone();
+        }
+        {
+            ThreadPool pool;
+            pool.setMaxThreadCount(nThreads);
+            pool.setExtantJobLimit(N + 1);
+            runOne("ThreadPool", [&pool](QObject *ctx, const auto &work, const auto &completion) {
+                pool.submitWork(ctx, work, completion);
+            });
+            pool.shutdownWaitForJobs();
+        }
+    }
+
+    static const auto bench_ = App::registerBench("threadpool", &bench);
+}
+#endif // ENABLE_TESTS
@@ -19,21 +19,24 @@
 #pragma once
 
 #include <QObject>
-#include <QPointer>
-#include <QRunnable>
+#include <QVariantMap>
 
 #include <atomic>
+#include <cstdint>
 #include <functional>
 #include <memory>
 
-class QThreadPool;
-
-/// A wrapper around QThreadPool, whereby all work is submitted via lambdas.  It also keeps some stats and
-/// provides some limits on number of jobs that can be enqueued.  Currently, there is one of these globally
-/// owned by the 'App' object and accessible via ::AppThreadPool() (declared in App.h).
+/// A thread pool whereby all work is submitted via lambdas.  It also keeps some stats and provides some limits on
+/// number of jobs that can be enqueued.  Currently, there is one of these globally owned by the 'App' object and
+/// accessible via ::AppThreadPool() (declared in App.h).
+///
+/// Internally this is a work-stealing pool: each worker thread has its own job deque, submitted work is spread
+/// round-robin across the deques, and a worker whose deque is empty steals from the others. Job objects are recycled
+/// via a free list, and completion/failure callbacks are posted straight to the `context` object's event queue
+/// (no per-job QObject is created).
 ///
-/// Each instance of this class internally creates its own QThreadPool instance, thus each instance never conflicts with
-/// other thread pools such as the Qt-provided QThreadPool::globalInstance().
+/// Each instance of this class has its own worker threads, thus each instance never conflicts with other thread pools
+/// such as the Qt-provided QThreadPool::globalInstance().
 ///
 /// All of the public methods of this class are thread-safe.  None of the methods of this class throw.
 class ThreadPool : public QObject
@@ -51,7 +54,7 @@ public:
 
     /// Submit work to be performed asynchronously from a thread pool thread.
     ///
-    /// `work` is called in the context of one of this instance's QThreadPool threads (it should lambda-capture all
+    /// `work` is called in the context of one of this instance's worker threads (it should lambda-capture all
     /// data it needs to compute its results). It may throw, in which case `fail` (if specified) is invoked with the
     /// exception.what() message.
     ///
@@ -71,9 +74,31 @@ public:
     ///
     /// Using shared_ptr to share data between `work` and `completion` (via lambda-capture) is thus the intended
     /// way to use this mechanism.
+    ///
+    /// If `priority` is > 0, the job is placed at the front of the queue rather than at the back.
     void submitWork(QObject *context, const VoidFunc & work, const VoidFunc & completion = VoidFunc(),
                     const FailFunc & fail = FailFunc(), int priority = 0);
 
+    /// Scheduling classes for submitFairWork(). Cheaper classes are dequeued more often than more expensive ones
+    /// (see kJobClassWeights in ThreadPool.cpp), but no class is ever starved.
+    enum class JobClass : uint8_t {
+        Cheap = 0, ///< O(1)-ish work such as returning a single header
+        Normal,    ///< moderately expensive work such as computing a merkle branch
+        Heavy,     ///< work that scales with user-supplied input, such as get_history on a large address
+        NumClasses
+    };
+
+    /// Like submitWork(), except that jobs are not run in FIFO order. Instead, each job is queued under its
+    /// `fairnessKey` (an opaque pointer that is never dereferenced, e.g. a client's per-IP data), and whenever a pool
+    /// thread becomes free, it picks the next job via weighted round-robin across the JobClasses, and then via
+    /// round-robin across the fairness keys that have work queued in that class. This way a single key submitting
+    /// thousands of expensive jobs cannot starve other keys of CPU time, and cheap jobs don't wait behind heavy ones.
+    ///
+    /// The semantics of `context`, `work`, `completion` and `fail` are identical to submitWork(). The time each job
+    /// spends waiting in the queue is recorded per-class and reported in stats().
+    void submitFairWork(const void *fairnessKey, JobClass cls, QObject *context, const VoidFunc & work,
+                        const VoidFunc & completion = VoidFunc(), const FailFunc & fail = FailFunc());
+
     /// Call this on app or pool shutdown to wait for extant jobs that may be running to complete. This prevents jobs
     /// that are currently running from referencing data that may go away during shutdown (a situation that would cause
     /// a segfault).
@@ -122,40 +147,25 @@ public:
     QVariantMap stats() const noexcept;
 
 private:
-    const std::unique_ptr<QThreadPool> pool;
+    struct Job;
+    struct Workers;
+    struct FairQueue;
+
+    /// Creates a new job, enforcing extantLimit. Returns nullptr (after calling the fail func) if the job was rejected.
+    Job *newJob(QObject *context, const VoidFunc & work, const VoidFunc & completion, const FailFunc & fail);
+    /// Returns `job` to the free list, decrementing `extant` if it was a real job (and not a fair queue runner).
+    void freeJob(Job *job) noexcept;
+    /// Called in a worker thread: runs the job, posts its completion or failure to its context, and frees it.
+    void runJob(Job *job) noexcept;
+    /// Called when a fair queue runner job runs: dequeues the next job according to the fair scheduling policy and
+    /// runs it. There is exactly 1 runner enqueued per job submitted via submitFairWork().
+    void runNextFairJob() noexcept;
+
+    const std::unique_ptr<Workers> workers;
+    const std::unique_ptr<FairQueue> fq;
     std::atomic_uint64_t ctr = 0, noverflows = 0;
     std::atomic_int extant = 0, extantMaxSeen = 0;
     std::atomic_bool blockNewWork = false;
     /// maximum number of extant jobs we allow before failing and not enqueuing more.
     std::atomic_int extantLimit = 15'000;
 };
-
-/// Semi-private class not intended to be constructed by client code, but used inside ThreadPool::SubmitWork.
-/// We put it here because the meta object compiler needs to see it for signal/slot glue code generation.
-class Job : public QObject, public QRunnable {
-    Q_OBJECT
-
-    friend class ::ThreadPool;
-    using VoidFunc = ThreadPool::VoidFunc;
-    using FailFunc = ThreadPool::FailFunc;
-
-    const ThreadPool * const pool; ///< since the ThreadPool object owns us, this pointer is always valid if we exist.
-    const VoidFunc work;
-    QPointer<QObject> weakContextRef;
-
-
-    Job(QObject *context, ThreadPool *pool,
-        const VoidFunc & work,
-        const VoidFunc & completion = VoidFunc(),
-        const FailFunc & = FailFunc()) noexcept;
-
-public:
-    void run() override;
-    ~Job() override;
-
-signals:
-    void started(); ///< emitted inside run() on job start
-    void completed(); ///< calls completion in QObject context via a signal emit
-    void failed(const QString &); ///< called if work() throws.
-};
-
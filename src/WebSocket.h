@@ -151,6 +151,13 @@ namespace WebSocket
         /// - the resuling data would exceed the maximum size of a QByteArray (currently INT_MAX)
         QByteArray wrapPayload(const QByteArray &data, FrameType type, bool isMasked, std::size_t fragmentSize = DefaultFragmentSize);
 
+        /// Identical to wrapPayload(), except that the framed data is appended to `out` rather than returned as a new
+        /// buffer. This allows callers to build up several frames in one buffer without any intermediate copies (which
+        /// is what Wrapper does to coalesce outgoing messages into a single socket write). Throws the same exceptions
+        /// as wrapPayload(), in which case `out` is left unmodified.
+        void appendPayload(QByteArray &out, const char *data, std::size_t len, FrameType type, bool isMasked,
+                           std::size_t fragmentSize = DefaultFragmentSize);
+
         /// Convenience function that wraps 'data' using the 'Text' data frame opcode. Note that 'data' must be Utf8 encoded
         /// text or else the other side may terminate the connection.
         inline QByteArray wrapText(const QByteArray &data, bool isMasked, std::size_t fragmentSize = DefaultFragmentSize) {
@@ -477,12 +484,13 @@ namespace WebSocket
 
         // From QIODevice
         qint64 bytesAvailable() const override { return dataFrameByteCount + readDataPartialBuf.size(); }
-        qint64 bytesToWrite() const override { return socket->bytesToWrite(); }
+        /// Includes frames that are queued in this instance but not yet handed to the underlying socket.
+        qint64 bytesToWrite() const override { return socket->bytesToWrite() + pendingOut.size(); }
         bool canReadLine() const override; ///< do not use this
         void close() override { if (socket && socket->isOpen()) { emit aboutToClose(); } abort();  setOpenMode(NotOpen); }
         bool atEnd() const override { return socket->atEnd(); }
-        bool flush() { return socket->flush(); } // ### Qt6: remove me (implementation moved to private flush())
-        void abort() { socket->abort(); }
+        bool flush() { flushPendingOut(); return socket->flush(); } // ### Qt6: remove me (implementation moved to private flush())
+        void abort() { pendingOut.clear(); socket->abort(); }
 
         // From QAbstractSocket:
         void setReadBufferSize(qint64 size) override { QTcpSocket::setReadBufferSize(size); socket->setReadBufferSize(size); }
@@ -561,6 +569,17 @@ namespace WebSocket
         bool autopingreply = true;
         bool sentclose = false, gotclose = false;
         int autopinginterval = 20'000;
+        /// Outgoing frames that have been generated but not yet written to `socket`. All sends append here, and the
+        /// buffer is written out with a single socket->write() call the next time we return to the event loop (or
+        /// immediately for control frames), so that a burst of messages (e.g. notifications) costs just 1 write.
+        QByteArray pendingOut;
+        bool pendingOutFlushScheduled = false;
+
+        /// Appends a frame for `data` to pendingOut, and schedules a flush if one is not already scheduled.
+        /// Returns `len` on success, or -1 if the socket is not writable or the frame could not be generated.
+        qint64 queueFrame(const char *data, qint64 len, FrameType type);
+        /// Writes all of pendingOut to the socket now. Returns the number of bytes written, or -1 on error.
+        qint64 flushPendingOut();
 
         void on_readyRead();
         inline bool isMasked() const { return _mode == ClientMode; }
@@ -909,6 +909,55 @@ void SHA256D64(uint8_t *out, const uint8_t *in, size_t blocks) {
     }
 }
 
+bool SHA256D64Kernel(unsigned ways, uint8_t *out, const uint8_t *in, size_t blocks) {
+    TransformD64Type kernel = nullptr;
+    switch (ways) {
+    case 1: kernel = TransformD64; break;
+    case 2: kernel = TransformD64_2way; break;
+    case 4: kernel = TransformD64_4way; break;
+    case 8: kernel = TransformD64_8way; break;
+    default: break;
+    }
+    if (!kernel) return false;
+    while (blocks >= ways) {
+        kernel(out, in);
+        out += 32 * ways;
+        in += 64 * ways;
+        blocks -= ways;
+    }
+    while (blocks) {
+        TransformD64(out, in);
+        out += 32;
+        in += 64;
+        --blocks;
+    }
+    return true;
+}
+
+void SHA256Batch(uint8_t *out, const uint8_t *const *msgs, const size_t *lens, size_t n) {
+    uint8_t block[128];
+    uint32_t s[8];
+    for (size_t i = 0; i < n; ++i, out += CSHA256::OUTPUT_SIZE) {
+        const size_t len = lens[i];
+        if (len > sizeof(block) - 9) {
+            // long message, take the normal (buffered) path
+            CSHA256().Write(msgs[i], len).Finalize(out);
+            continue;
+        }
+        // short message: pad it ourselves into 1 (len <= 55) or 2 blocks and run them through the selected Transform
+        const size_t nblocks = len + 9 > 64 ? 2 : 1;
+        const size_t padded = nblocks * 64;
+        if (len) std::memcpy(block, msgs[i], len);
+        block[len] = 0x80;
+        std::memset(block + len + 1, 0, padded - len - 9);
+        WriteBE64(block + padded - 8, uint64_t(len) << 3);
+        sha256::Initialize(s);
+        Transform(s, block, nblocks);
+        for (int j = 0; j < 8; ++j)
+            WriteBE32(out + 4*j, s[j]);
+    }
+}
+
 } // end namespace bitcoin
 
 #ifdef __clang__
@@ -42,4 +42,20 @@ std::string SHA256AutoDetect();
  */
 void SHA256D64(uint8_t *output, const uint8_t *input, size_t blocks);
 
+/**
+ * Like SHA256D64, but uses only the `ways`-way kernel (1, 2, 4, or 8) for as
+ * many of the hashes as it can, computing the remainder with the 1-way kernel.
+ * Returns false without computing anything if that kernel is not available in
+ * this build / on this CPU. Added by Calin, for benchmarking the kernels.
+ */
+bool SHA256D64Kernel(unsigned ways, uint8_t *output, const uint8_t *input, size_t blocks);
+
+/**
+ * Compute the (single) SHA256 of each of `n` messages, writing n*32 bytes to
+ * `output`. Messages of up to 119 bytes (such as nearly all scriptPubKeys) are
+ * padded in place and fed straight to the runtime-selected transform, avoiding
+ * the CSHA256 buffering overhead. Added by Calin, for batch hashX computation.
+ */
+void SHA256Batch(uint8_t *output, const uint8_t *const *msgs, const size_t *lens, size_t n);
+
 }